@@ -0,0 +1,218 @@
+#include <zephyr/kernel.h>
+#include <errno.h>
+#include <string.h>
+
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include <zephyr/net/coap.h>
+#include <zephyr/net/socket.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(coap_proto, CONFIG_APP_LOG_LEVEL);
+
+#include "coap_proto.h"
+
+/* Enough to tell apart the requests of one device. */
+#define COAP_PROTO_TOKEN_LEN 4
+/* How long to wait for a separate response once the request was acknowledged,
+ * as for the whole run of retransmissions.
+ */
+#define COAP_PROTO_SEPARATE_MS \
+	(CONFIG_COAP_INIT_ACK_TIMEOUT_MS * ((1 << (CONFIG_APP_COAP_MAX_RETRANSMIT + 1)) - 1))
+
+/* Requests are made one at a time, from the thread that sends to the backend. */
+static uint8_t tx_buf_[CONFIG_APP_COAP_MAX_DATAGRAM];
+static uint8_t rx_buf_[CONFIG_APP_COAP_MAX_DATAGRAM];
+
+static int coap_proto_encode(struct coap_packet *pkt, const char *path, const uint8_t *token,
+			     const pb_msgdesc_t *fields, const void *message, size_t *payload_len)
+{
+	pb_ostream_t stream;
+	size_t size;
+	int ret;
+
+	ret = coap_packet_init(pkt, tx_buf_, sizeof(tx_buf_), COAP_VERSION_1, COAP_TYPE_CON,
+			       COAP_PROTO_TOKEN_LEN, token, COAP_METHOD_POST, coap_next_id());
+	if (ret == 0) {
+		ret = coap_packet_append_option(pkt, COAP_OPTION_URI_PATH, path, strlen(path));
+	}
+	if (ret == 0) {
+		ret = coap_append_option_int(pkt, COAP_OPTION_CONTENT_FORMAT,
+					     COAP_CONTENT_FORMAT_APP_OCTET_STREAM);
+	}
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (!pb_get_encoded_size(&size, fields, message)) {
+		return -EINVAL;
+	}
+	*payload_len = size;
+	if (size == 0) {
+		return 0;
+	}
+	// One byte for the payload marker.
+	if (pkt->offset + 1 + size > pkt->max_len) {
+		return -EMSGSIZE;
+	}
+	ret = coap_packet_append_payload_marker(pkt);
+	if (ret < 0) {
+		return ret;
+	}
+	stream = pb_ostream_from_buffer(pkt->data + pkt->offset, pkt->max_len - pkt->offset);
+	if (!pb_encode(&stream, fields, message)) {
+		LOG_ERR("Encoding failed: %s", PB_GET_ERROR(&stream));
+		return -EINVAL;
+	}
+	pkt->offset += stream.bytes_written;
+	return 0;
+}
+
+static void coap_proto_send_ack(int sock, uint16_t id)
+{
+	uint8_t buf[4];
+	struct coap_packet ack;
+
+	if (coap_packet_init(&ack, buf, sizeof(buf), COAP_VERSION_1, COAP_TYPE_ACK, 0, NULL,
+			     COAP_CODE_EMPTY, id) == 0) {
+		(void)send(sock, ack.data, ack.offset, 0);
+	}
+}
+
+/* Wait until @p deadline for the response to the request with @p id and
+ * @p token. An empty ACK moves the deadline out to wait for the separate
+ * response. Returns 1 with the response in @p rsp, 0 at the deadline or a
+ * negative errno.
+ */
+static int coap_proto_wait(int sock, uint16_t id, const uint8_t *token, int64_t *deadline,
+			   bool *acked, struct coap_packet *rsp)
+{
+	struct pollfd pfd = {
+		.fd = sock,
+		.events = POLLIN,
+	};
+	uint8_t rsp_token[COAP_TOKEN_MAX_LEN];
+	int64_t remaining;
+
+	while ((remaining = *deadline - k_uptime_get()) > 0) {
+		bool same_id, same_token;
+		ssize_t len;
+		uint8_t type;
+
+		if (poll(&pfd, 1, (int)remaining) < 0) {
+			return -errno;
+		}
+		len = recv(sock, rx_buf_, sizeof(rx_buf_), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN) {
+				continue;
+			}
+			return -errno;
+		}
+		if (coap_packet_parse(rsp, rx_buf_, len, NULL, 0) < 0) {
+			LOG_WRN("Dropped a malformed datagram of %zd bytes", len);
+			continue;
+		}
+
+		type = coap_header_get_type(rsp);
+		same_id = coap_header_get_id(rsp) == id;
+		same_token = coap_header_get_token(rsp, rsp_token) == COAP_PROTO_TOKEN_LEN &&
+			     memcmp(rsp_token, token, COAP_PROTO_TOKEN_LEN) == 0;
+
+		if (type == COAP_TYPE_RESET && same_id) {
+			return -ECONNREFUSED;
+		}
+		if (type == COAP_TYPE_ACK && same_id) {
+			if (coap_header_get_code(rsp) != COAP_CODE_EMPTY) {
+				return 1;
+			}
+			LOG_DBG("Request acknowledged, waiting for the response");
+			*acked = true;
+			*deadline = k_uptime_get() + COAP_PROTO_SEPARATE_MS;
+			continue;
+		}
+		if ((type == COAP_TYPE_CON || type == COAP_TYPE_NON_CON) && same_token) {
+			if (type == COAP_TYPE_CON) {
+				coap_proto_send_ack(sock, coap_header_get_id(rsp));
+			}
+			return 1;
+		}
+		LOG_DBG("Ignored a datagram of type %u", type);
+	}
+	return 0;
+}
+
+int coap_proto_request(int sock, const char *path, const pb_msgdesc_t *request_fields,
+		       const void *request, const pb_msgdesc_t *response_fields, void *response,
+		       struct req_trace *trace, struct coap_proto_stats *stats)
+{
+	struct coap_packet pkt;
+	struct coap_packet rsp;
+	struct coap_pending pending;
+	/* The socket is connected and responses are matched here, so the
+	 * pending exchange only needs an address to be initialized.
+	 */
+	struct sockaddr peer = { .sa_family = AF_INET };
+	uint8_t token[COAP_PROTO_TOKEN_LEN];
+	const uint8_t *payload;
+	uint16_t payload_len;
+	int64_t deadline = 0;
+	bool acked = false;
+	pb_istream_t stream;
+	uint8_t code;
+	uint16_t id;
+	int ret;
+
+	memset(stats, 0, sizeof(*stats));
+	memcpy(token, coap_next_token(), sizeof(token));
+	ret = coap_proto_encode(&pkt, path, token, request_fields, request, &stats->tx_payload);
+	if (ret < 0) {
+		return ret;
+	}
+	id = coap_header_get_id(&pkt);
+	ret = coap_pending_init(&pending, &pkt, &peer, CONFIG_APP_COAP_MAX_RETRANSMIT);
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (;;) {
+		if (send(sock, pkt.data, pkt.offset, 0) < 0) {
+			return -errno;
+		}
+		if (stats->transmissions++ == 0) {
+			req_trace_mark(trace, REQ_PHASE_SENT);
+		} else {
+			LOG_INF("Retransmitted %s (%u)", path, stats->transmissions - 1);
+		}
+		deadline = k_uptime_get() + pending.timeout;
+
+		ret = coap_proto_wait(sock, id, token, &deadline, &acked, &rsp);
+		if (ret != 0) {
+			break;
+		}
+		// Doubles the timeout, until the retransmissions run out.
+		if (acked || !coap_pending_cycle(&pending)) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+	}
+	if (ret < 0) {
+		LOG_ERR("%s failed after %u transmissions: %d", path, stats->transmissions, ret);
+		return ret;
+	}
+	req_trace_mark(trace, REQ_PHASE_FIRST_BYTE);
+
+	code = coap_header_get_code(&rsp);
+	payload = coap_packet_get_payload(&rsp, &payload_len);
+	stats->rx_payload = payload_len;
+	if ((code >> 5) != 2) {
+		LOG_ERR("%s: response %u.%02u", path, code >> 5, code & 0x1f);
+		return -EBADMSG;
+	}
+	stream = pb_istream_from_buffer(payload, payload_len);
+	if (!pb_decode(&stream, response_fields, response)) {
+		LOG_ERR("Decoding failed: %s", PB_GET_ERROR(&stream));
+		return -EBADMSG;
+	}
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Protobuf request/response exchanges over CoAP.
+ *
+ * The request message is encoded straight into one confirmable CoAP POST
+ * and sent on a connected UDP socket. It is retransmitted with exponential
+ * back-off (RFC 7252 section 4.2) until the server acknowledges it. The
+ * response is either piggybacked on the ACK or sent separately, in which case
+ * it is acknowledged in turn.
+ *
+ * There is no block-wise transfer, so a request has to fit in one datagram
+ * of CONFIG_APP_COAP_MAX_DATAGRAM bytes. When it does not, nothing is sent
+ * and the caller can fall back to HTTP.
+ *
+ * Usage:
+ *
+ *	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+ *	connect(sock, addr, addrlen);
+ *	ret = coap_proto_request(sock, "check_in", CheckInRequest_fields, &request,
+ *				 CheckInResponse_fields, &response, &trace, &stats);
+ */
+
+#ifndef APP_COAP_PROTO_H
+#define APP_COAP_PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pb.h>
+
+#include "req_trace.h"
+
+struct coap_proto_stats {
+	/* Protobuf bytes of the request and of the response. */
+	size_t tx_payload;
+	size_t rx_payload;
+	/* Datagrams sent for the request, retransmissions included. */
+	uint8_t transmissions;
+};
+
+/**
+ * @brief POST @p request to @p path and decode the response into @p response.
+ *
+ * @param trace Marked when the request is first sent and when the response
+ * arrives.
+ * @retval 0 on a 2.xx response that decoded.
+ * @retval -EMSGSIZE if the request does not fit in a datagram; nothing was sent.
+ * @retval -ETIMEDOUT if no response came after the last retransmission.
+ * @retval -ECONNREFUSED if the server reset the exchange.
+ * @retval -EBADMSG on an error response or one that did not decode.
+ */
+int coap_proto_request(int sock, const char *path, const pb_msgdesc_t *request_fields,
+		       const void *request, const pb_msgdesc_t *response_fields, void *response,
+		       struct req_trace *trace, struct coap_proto_stats *stats);
+
+#endif /* APP_COAP_PROTO_H */
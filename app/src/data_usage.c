@@ -0,0 +1,250 @@
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <modem/quectel_bg96.h>
+
+#if defined(CONFIG_MCUMGR_GRP_OS_RESET_HOOK)
+#include <zephyr/mgmt/mcumgr/mgmt/callbacks.h>
+#endif
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(data_usage, CONFIG_APP_LOG_LEVEL);
+
+#include "data_usage.h"
+
+/* Stored in settings as-is, so only append fields. */
+struct data_usage_counters {
+	uint32_t requests;
+	uint32_t tx_payload_bytes;
+	uint32_t rx_payload_bytes;
+	uint32_t tx_http_bytes;
+	uint32_t rx_http_bytes;
+	uint32_t tx_at_bytes;
+	uint32_t rx_at_bytes;
+	uint32_t tx_packets;
+	uint32_t rx_packets;
+};
+
+static struct data_usage_counters usage_[_RequestEndpoint_ARRAYSIZE];
+/* Endpoints counted since they were last saved, and their requests. */
+static uint32_t unsaved_mask_;
+static uint32_t unsaved_requests_;
+/* Requests for different endpoints may finish on different threads. */
+static K_MUTEX_DEFINE(usage_lock_);
+
+BUILD_ASSERT(_RequestEndpoint_ARRAYSIZE <= 32, "unsaved_mask_ has a bit per endpoint");
+
+static void data_usage_save_work(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(save_work_, data_usage_save_work);
+
+static int data_usage_set(const char *name, size_t len, settings_read_cb read_cb,
+			  void *cb_arg) {
+	int endpoint = atoi(name);
+	int rc;
+
+	if (endpoint < 0 || endpoint >= ARRAY_SIZE(usage_)) {
+		return -ENOENT;
+	}
+	if (len != sizeof(usage_[endpoint])) {
+		// Stale layout; start counting again.
+		return 0;
+	}
+
+	rc = read_cb(cb_arg, &usage_[endpoint], sizeof(usage_[endpoint]));
+	return rc < 0 ? rc : 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(data_usage, "data_usage", NULL, data_usage_set, NULL, NULL);
+
+static void data_usage_save(RequestEndpoint endpoint, const struct data_usage_counters *counters) {
+	char key[sizeof("data_usage/##")];
+	int rc;
+
+	snprintk(key, sizeof(key), "data_usage/%d", (int)endpoint);
+	rc = settings_save_one(key, counters, sizeof(*counters));
+	if (rc != 0) {
+		LOG_WRN("Saving %s failed: %d", key, rc);
+	}
+}
+
+void data_usage_flush(void) {
+	struct data_usage_counters copy[ARRAY_SIZE(usage_)];
+	uint32_t mask;
+
+	k_work_cancel_delayable(&save_work_);
+
+	k_mutex_lock(&usage_lock_, K_FOREVER);
+	mask = unsaved_mask_;
+	memcpy(copy, usage_, sizeof(copy));
+	unsaved_mask_ = 0;
+	unsaved_requests_ = 0;
+	k_mutex_unlock(&usage_lock_);
+
+	// Flash is written outside the lock, so counting is never held up by it.
+	for (int i = 0; i < ARRAY_SIZE(copy); i++) {
+		if (mask & BIT(i)) {
+			data_usage_save((RequestEndpoint)i, &copy[i]);
+		}
+	}
+}
+
+static void data_usage_save_work(struct k_work *work) {
+	data_usage_flush();
+}
+
+static void data_usage_add(RequestEndpoint endpoint,
+			   const struct quectel_bg96_data_usage *sock_usage,
+			   size_t tx_body, size_t rx_body) {
+	struct data_usage_counters *counters;
+	bool save_now;
+
+	k_mutex_lock(&usage_lock_, K_FOREVER);
+	counters = &usage_[endpoint];
+	counters->requests++;
+	counters->tx_payload_bytes += tx_body;
+	counters->rx_payload_bytes += rx_body;
+	// Whatever else went over the socket is HTTP framing.
+	counters->tx_http_bytes += sock_usage->tx_bytes - MIN(tx_body, sock_usage->tx_bytes);
+	counters->rx_http_bytes += sock_usage->rx_bytes - MIN(rx_body, sock_usage->rx_bytes);
+	counters->tx_at_bytes += sock_usage->tx_at_bytes;
+	counters->rx_at_bytes += sock_usage->rx_at_bytes;
+	counters->tx_packets += sock_usage->tx_packets;
+	counters->rx_packets += sock_usage->rx_packets;
+	unsaved_mask_ |= BIT(endpoint);
+	save_now = ++unsaved_requests_ >= CONFIG_APP_DATA_USAGE_SAVE_REQUESTS;
+	k_mutex_unlock(&usage_lock_);
+
+	if (save_now) {
+		data_usage_flush();
+	} else {
+		// Only starts the timer if it is not already running.
+		k_work_schedule(&save_work_, K_SECONDS(CONFIG_APP_DATA_USAGE_SAVE_INTERVAL_S));
+	}
+}
+
+void data_usage_record(RequestEndpoint endpoint, int sock, size_t tx_body, size_t rx_body) {
+	struct quectel_bg96_data_usage sock_usage = { 0 };
+
+	if (endpoint >= ARRAY_SIZE(usage_)) {
+		return;
+	}
+#if defined(CONFIG_MODEM_QUECTEL_BG96)
+	if (quectel_bg96_socket_usage(sock, &sock_usage) != 0) {
+		LOG_WRN("No modem usage for socket %d", sock);
+	}
+#endif
+	data_usage_add(endpoint, &sock_usage, tx_body, rx_body);
+}
+
+void data_usage_record_since(RequestEndpoint endpoint, int sock,
+			     struct quectel_bg96_data_usage *mark,
+			     size_t tx_body, size_t rx_body) {
+	struct quectel_bg96_data_usage now = *mark;
+	struct quectel_bg96_data_usage delta;
+
+	if (endpoint >= ARRAY_SIZE(usage_)) {
+		return;
+	}
+#if defined(CONFIG_MODEM_QUECTEL_BG96)
+	if (quectel_bg96_socket_usage(sock, &now) != 0) {
+		LOG_WRN("No modem usage for socket %d", sock);
+	}
+#endif
+	delta.tx_bytes = now.tx_bytes - mark->tx_bytes;
+	delta.rx_bytes = now.rx_bytes - mark->rx_bytes;
+	delta.tx_packets = now.tx_packets - mark->tx_packets;
+	delta.rx_packets = now.rx_packets - mark->rx_packets;
+	delta.tx_at_bytes = now.tx_at_bytes - mark->tx_at_bytes;
+	delta.rx_at_bytes = now.rx_at_bytes - mark->rx_at_bytes;
+	*mark = now;
+	data_usage_add(endpoint, &delta, tx_body, rx_body);
+}
+
+pb_size_t data_usage_fill(DataUsage *usage, pb_size_t max) {
+	pb_size_t count = 0;
+
+	k_mutex_lock(&usage_lock_, K_FOREVER);
+	for (int i = 0; i < ARRAY_SIZE(usage_) && count < max; i++) {
+		const struct data_usage_counters *counters = &usage_[i];
+		DataUsage *out;
+
+		if (counters->requests == 0) {
+			continue;
+		}
+		out = &usage[count++];
+		out->endpoint = (RequestEndpoint)i;
+		out->requests = counters->requests;
+		out->tx_payload_bytes = counters->tx_payload_bytes;
+		out->rx_payload_bytes = counters->rx_payload_bytes;
+		out->tx_http_bytes = counters->tx_http_bytes;
+		out->rx_http_bytes = counters->rx_http_bytes;
+		out->tx_at_bytes = counters->tx_at_bytes;
+		out->rx_at_bytes = counters->rx_at_bytes;
+		out->tx_packets = counters->tx_packets;
+		out->rx_packets = counters->rx_packets;
+	}
+	k_mutex_unlock(&usage_lock_);
+
+	return count;
+}
+
+#if defined(CONFIG_MCUMGR_GRP_OS_RESET_HOOK)
+/* Save what is pending before an MCUmgr reset, such as after an update. */
+static enum mgmt_cb_return data_usage_reset_hook(uint32_t event, enum mgmt_cb_return prev_status,
+						 int32_t *rc, uint16_t *group, bool *abort_more,
+						 void *data, size_t data_size) {
+	data_usage_flush();
+	return MGMT_CB_OK;
+}
+
+static struct mgmt_callback reset_hook_ = {
+	.callback = data_usage_reset_hook,
+	.event_id = MGMT_EVT_OP_OS_MGMT_RESET,
+};
+
+static int data_usage_hooks_init(void) {
+	mgmt_callback_register(&reset_hook_);
+	return 0;
+}
+
+SYS_INIT(data_usage_hooks_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#endif /* defined(CONFIG_MCUMGR_GRP_OS_RESET_HOOK) */
+
+#if defined(CONFIG_SHELL)
+static int cmd_data_usage(const struct shell *sh, size_t argc, char **argv) {
+	DataUsage usage[_RequestEndpoint_ARRAYSIZE];
+	pb_size_t count = data_usage_fill(usage, ARRAY_SIZE(usage));
+
+	shell_print(sh, "%-9s %6s %19s %19s %19s %13s", "endpoint", "reqs",
+		    "payload tx/rx", "http tx/rx", "at tx/rx", "packets tx/rx");
+	for (pb_size_t i = 0; i < count; i++) {
+		shell_print(sh, "%-9d %6u %9u/%-9u %9u/%-9u %9u/%-9u %6u/%-6u",
+			    usage[i].endpoint, usage[i].requests,
+			    usage[i].tx_payload_bytes, usage[i].rx_payload_bytes,
+			    usage[i].tx_http_bytes, usage[i].rx_http_bytes,
+			    usage[i].tx_at_bytes, usage[i].rx_at_bytes,
+			    usage[i].tx_packets, usage[i].rx_packets);
+	}
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96)
+	struct quectel_bg96_data_usage cid;
+
+	shell_print(sh, "\n%-9s %19s %19s %13s", "connect", "socket tx/rx", "at tx/rx",
+		    "packets tx/rx");
+	for (int id = 0; quectel_bg96_connect_id_usage(id, &cid) == 0; id++) {
+		shell_print(sh, "%-9d %9u/%-9u %9u/%-9u %6u/%-6u", id,
+			    cid.tx_bytes, cid.rx_bytes, cid.tx_at_bytes, cid.rx_at_bytes,
+			    cid.tx_packets, cid.rx_packets);
+	}
+#endif
+	return 0;
+}
+
+SHELL_CMD_REGISTER(data_usage, NULL, "Show cellular data usage per endpoint and connect ID",
+		   cmd_data_usage);
+#endif /* defined(CONFIG_SHELL) */
@@ -0,0 +1,66 @@
+/*
+ * Cellular data accounting per endpoint.
+ *
+ * After each request, the bytes the modem exchanged on its socket are
+ * attributed to the request's endpoint and split into:
+ *
+ *  - payload: the HTTP bodies;
+ *  - http: the rest of the socket data (request line, headers, chunking,
+ *    or the CoAP and MQTT framing);
+ *  - at: the AT command framing around the socket data on the modem UART.
+ *
+ * The counters are cumulative, persisted in settings under "data_usage/",
+ * and sent with every full status report. They are saved every
+ * CONFIG_APP_DATA_USAGE_SAVE_REQUESTS requests or
+ * CONFIG_APP_DATA_USAGE_SAVE_INTERVAL_S, whichever comes first, and by
+ * data_usage_flush() before a clean shutdown.
+ */
+
+#ifndef APP_DATA_USAGE_H
+#define APP_DATA_USAGE_H
+
+#include <stddef.h>
+
+#include <modem/quectel_bg96.h>
+
+#include "api/api.pb.h"
+
+/**
+ * @brief Attribute a request's socket usage to @p endpoint.
+ *
+ * Must be called before @p sock is closed.
+ *
+ * @param tx_body Bytes of HTTP body sent.
+ * @param rx_body Bytes of HTTP body received.
+ */
+void data_usage_record(RequestEndpoint endpoint, int sock, size_t tx_body, size_t rx_body);
+
+/**
+ * @brief Attribute the usage of a socket that stays open across requests.
+ *
+ * Only what the socket exchanged since the previous call is counted, which
+ * includes any keepalives and pushes in between.
+ *
+ * @param mark The socket usage at the previous call, updated to now. Zero
+ * it when the socket is connected.
+ */
+void data_usage_record_since(RequestEndpoint endpoint, int sock,
+			     struct quectel_bg96_data_usage *mark,
+			     size_t tx_body, size_t rx_body);
+
+/**
+ * @brief Save the counters that changed since they were last saved.
+ *
+ * Call before a clean shutdown; MCUmgr resets do it with
+ * CONFIG_MCUMGR_GRP_OS_RESET_HOOK.
+ */
+void data_usage_flush(void);
+
+/**
+ * @brief Fill @p usage with the counters of every endpoint that has any.
+ *
+ * @returns The number of entries filled in.
+ */
+pb_size_t data_usage_fill(DataUsage *usage, pb_size_t max);
+
+#endif /* APP_DATA_USAGE_H */
@@ -0,0 +1,229 @@
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(joystick, CONFIG_APP_LOG_LEVEL);
+
+#include "joystick.h"
+
+/* Edges waiting for the work item; a power of two. */
+#define JOYSTICK_QUEUE_LEN 16
+
+STATS_SECT_START(joystick)
+STATS_SECT_ENTRY(presses)
+STATS_SECT_ENTRY(long_presses)
+STATS_SECT_ENTRY(repeats)
+/* Edges that came within the debounce time of another. */
+STATS_SECT_ENTRY(bounces)
+/* Edges lost because the queue was full. */
+STATS_SECT_ENTRY(queue_drops)
+STATS_SECT_ENTRY(isr_last_us)
+STATS_SECT_ENTRY(isr_max_us)
+/* From the interrupt to the edge being taken off the queue. */
+STATS_SECT_ENTRY(defer_max_us)
+STATS_SECT_END;
+
+STATS_NAME_START(joystick)
+STATS_NAME(joystick, presses)
+STATS_NAME(joystick, long_presses)
+STATS_NAME(joystick, repeats)
+STATS_NAME(joystick, bounces)
+STATS_NAME(joystick, queue_drops)
+STATS_NAME(joystick, isr_last_us)
+STATS_NAME(joystick, isr_max_us)
+STATS_NAME(joystick, defer_max_us)
+STATS_NAME_END(joystick);
+
+static STATS_SECT_DECL(joystick) joystick_stats_;
+
+struct joystick_line {
+	struct gpio_dt_spec spec;
+	struct gpio_callback cb;
+	struct k_work_delayable debounce;
+	struct k_work_delayable hold;
+	/* Debounced state, only touched on the system work queue. */
+	bool pressed;
+	bool long_pressed;
+};
+
+#define JOYSTICK_LINE(alias) { .spec = GPIO_DT_SPEC_GET_OR(DT_ALIAS(alias), gpios, {0}) }
+
+static struct joystick_line lines_[JOYSTICK_KEY_COUNT] = {
+	[JOYSTICK_SELECT] = JOYSTICK_LINE(sw0),
+	[JOYSTICK_DOWN] = JOYSTICK_LINE(sw1),
+	[JOYSTICK_RIGHT] = JOYSTICK_LINE(sw2),
+	[JOYSTICK_UP] = JOYSTICK_LINE(sw3),
+	[JOYSTICK_LEFT] = JOYSTICK_LINE(sw4),
+};
+
+static joystick_handler_t handler_;
+
+/* Single producer, single consumer ring of edges. The GPIO interrupts all
+ * run at one priority, so they do not preempt each other and only one
+ * writes at a time; only the work item reads. Each side owns one index.
+ */
+struct joystick_edge {
+	uint8_t key;
+	uint32_t cycles;
+};
+
+static struct joystick_edge queue_[JOYSTICK_QUEUE_LEN];
+static atomic_t head_;
+static atomic_t tail_;
+
+static void edge_work_handler(struct k_work *work);
+static K_WORK_DEFINE(edge_work_, edge_work_handler);
+
+static uint32_t cycles_us(uint32_t cycles) {
+	return (uint32_t)k_cyc_to_us_floor64(cycles);
+}
+
+static void joystick_isr(const struct device *port, struct gpio_callback *cb, uint32_t pins) {
+	uint32_t start = k_cycle_get_32();
+	struct joystick_line *line = CONTAINER_OF(cb, struct joystick_line, cb);
+	atomic_val_t head = atomic_get(&head_);
+	uint32_t us;
+
+	if (head - atomic_get(&tail_) >= JOYSTICK_QUEUE_LEN) {
+		STATS_INC(joystick_stats_, queue_drops);
+	} else {
+		queue_[head % JOYSTICK_QUEUE_LEN] = (struct joystick_edge){
+			.key = line - lines_,
+			.cycles = start,
+		};
+		atomic_set(&head_, head + 1);
+	}
+	k_work_submit(&edge_work_);
+
+	us = cycles_us(k_cycle_get_32() - start);
+	STATS_SET(joystick_stats_, isr_last_us, us);
+	if (us > joystick_stats_.isr_max_us) {
+		STATS_SET(joystick_stats_, isr_max_us, us);
+	}
+}
+
+static void report(struct joystick_line *line, enum joystick_event event) {
+	if (handler_ != NULL) {
+		handler_(line - lines_, event);
+	}
+}
+
+static void edge_work_handler(struct k_work *work) {
+	atomic_val_t tail = atomic_get(&tail_);
+
+	while (tail != atomic_get(&head_)) {
+		const struct joystick_edge *edge = &queue_[tail % JOYSTICK_QUEUE_LEN];
+		struct joystick_line *line = &lines_[edge->key];
+		uint32_t us = cycles_us(k_cycle_get_32() - edge->cycles);
+
+		if (us > joystick_stats_.defer_max_us) {
+			STATS_SET(joystick_stats_, defer_max_us, us);
+		}
+		if (k_work_delayable_is_pending(&line->debounce)) {
+			STATS_INC(joystick_stats_, bounces);
+		}
+		// Every edge starts the debounce time over.
+		k_work_reschedule(&line->debounce, K_MSEC(CONFIG_APP_JOYSTICK_DEBOUNCE_MS));
+
+		tail++;
+		atomic_set(&tail_, tail);
+	}
+}
+
+static void debounce_handler(struct k_work *work) {
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct joystick_line *line = CONTAINER_OF(dwork, struct joystick_line, debounce);
+	bool pressed = gpio_pin_get_dt(&line->spec) > 0;
+
+	// Bounces that settled back to where they started are no event.
+	if (pressed == line->pressed) {
+		return;
+	}
+
+	line->pressed = pressed;
+	if (pressed) {
+		line->long_pressed = false;
+		STATS_INC(joystick_stats_, presses);
+		k_work_schedule(&line->hold, K_MSEC(CONFIG_APP_JOYSTICK_LONG_PRESS_MS));
+		report(line, JOYSTICK_PRESS);
+	} else {
+		k_work_cancel_delayable(&line->hold);
+		report(line, JOYSTICK_RELEASE);
+	}
+}
+
+static void hold_handler(struct k_work *work) {
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct joystick_line *line = CONTAINER_OF(dwork, struct joystick_line, hold);
+
+	if (!line->pressed) {
+		return;
+	}
+
+	if (!line->long_pressed) {
+		line->long_pressed = true;
+		STATS_INC(joystick_stats_, long_presses);
+		report(line, JOYSTICK_LONG_PRESS);
+	} else {
+		STATS_INC(joystick_stats_, repeats);
+		report(line, JOYSTICK_REPEAT);
+	}
+
+	if (CONFIG_APP_JOYSTICK_REPEAT_MS > 0) {
+		k_work_schedule(&line->hold, K_MSEC(CONFIG_APP_JOYSTICK_REPEAT_MS));
+	}
+}
+
+static int line_init(struct joystick_line *line) {
+	int ret;
+
+	k_work_init_delayable(&line->debounce, debounce_handler);
+	k_work_init_delayable(&line->hold, hold_handler);
+
+	if (!gpio_is_ready_dt(&line->spec)) {
+		LOG_ERR("Button device %s is not ready",
+			line->spec.port != NULL ? line->spec.port->name : "(none)");
+		return -ENODEV;
+	}
+
+	ret = gpio_pin_configure_dt(&line->spec, GPIO_INPUT);
+	if (ret != 0) {
+		LOG_ERR("Error %d: failed to configure %s pin %d", ret, line->spec.port->name,
+			line->spec.pin);
+		return ret;
+	}
+
+	// Both edges, so releases are seen and bounces in either direction
+	// restart the debounce time.
+	ret = gpio_pin_interrupt_configure_dt(&line->spec, GPIO_INT_EDGE_BOTH);
+	if (ret != 0) {
+		LOG_ERR("Error %d: failed to configure interrupt on %s pin %d", ret,
+			line->spec.port->name, line->spec.pin);
+		return ret;
+	}
+
+	gpio_init_callback(&line->cb, joystick_isr, BIT(line->spec.pin));
+	return gpio_add_callback(line->spec.port, &line->cb);
+}
+
+int joystick_init(joystick_handler_t handler) {
+	int first_err = 0;
+	int ret;
+
+	handler_ = handler;
+	ret = STATS_INIT_AND_REG(joystick_stats_, STATS_SIZE_32, "joystick");
+	if (ret < 0) {
+		LOG_ERR("Registering joystick stats failed: %d", ret);
+	}
+
+	for (int i = 0; i < JOYSTICK_KEY_COUNT; i++) {
+		ret = line_init(&lines_[i]);
+		if (ret != 0 && first_err == 0) {
+			first_err = ret;
+		}
+	}
+	return first_err;
+}
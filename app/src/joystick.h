@@ -0,0 +1,60 @@
+/*
+ * Debounced joystick input.
+ *
+ * The GPIO interrupt of each of the five lines (sw0 to sw4) only
+ * timestamps the edge, puts it on a lock-free queue and submits a work
+ * item, so it stays short and never blocks. The work item drains the queue
+ * on the system work queue and starts a debounce timer per line; once the
+ * line has been stable for CONFIG_APP_JOYSTICK_DEBOUNCE_MS its level is
+ * read and a press or release reported. A key held for
+ * CONFIG_APP_JOYSTICK_LONG_PRESS_MS is reported as a long press, and then
+ * repeated every CONFIG_APP_JOYSTICK_REPEAT_MS until it is released.
+ *
+ * The "joystick" stats group counts the events, the edges that were bounce
+ * and the queue overflows, with the last and longest interrupt time and the
+ * longest delay from an edge to its handling. The interrupt time bounds the
+ * latency the joystick adds to the modem UART RX interrupt, which cannot
+ * preempt it at the same priority.
+ *
+ * Usage:
+ *
+ *	static void on_key(enum joystick_key key, enum joystick_event event)
+ *	{
+ *		...
+ *	}
+ *
+ *	joystick_init(on_key);
+ */
+
+#ifndef APP_JOYSTICK_H
+#define APP_JOYSTICK_H
+
+enum joystick_key {
+	JOYSTICK_SELECT = 0,
+	JOYSTICK_DOWN,
+	JOYSTICK_RIGHT,
+	JOYSTICK_UP,
+	JOYSTICK_LEFT,
+	JOYSTICK_KEY_COUNT,
+};
+
+enum joystick_event {
+	JOYSTICK_PRESS,
+	JOYSTICK_RELEASE,
+	JOYSTICK_LONG_PRESS,
+	JOYSTICK_REPEAT,
+};
+
+/* Called from the system work queue. */
+typedef void (*joystick_handler_t)(enum joystick_key key, enum joystick_event event);
+
+/**
+ * @brief Configure the joystick lines and their interrupts, and register
+ * the "joystick" stats group.
+ *
+ * @returns 0, or the error of the first line that could not be set up.
+ * The other lines are still set up.
+ */
+int joystick_init(joystick_handler_t handler);
+
+#endif /* APP_JOYSTICK_H */
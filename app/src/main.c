@@ -9,22 +9,41 @@
 LOG_MODULE_REGISTER(main, CONFIG_APP_LOG_LEVEL);
 
 /* IOTEMBSYS: Add required iheadersmport shell and/or others */
-//#include <zephyr/shell/shell.h>
+#include <zephyr/shell/shell.h>
 
 /* IOTEMBSYS: Add required headers for settings */
 #include <zephyr/settings/settings.h>
 #include <zephyr/storage/flash_map.h>
+#include <zephyr/storage/stream_flash.h>
 
 /* IOTEMBSYS: Add required headers for protobufs */
 #include <pb_encode.h>
 #include <pb_decode.h>
 #include "api/api.pb.h"
+#include "proto_stream.h"
+#include "req_trace.h"
+#include "data_usage.h"
+#include "thread_prof.h"
+#include "power_stats.h"
+#include "joystick.h"
+#include "stats_export.h"
+#include "metric_report.h"
+#include "coap_proto.h"
+#include "mqtt_session.h"
+#include "tls_session.h"
+#include <modem/quectel_bg96.h>
+#include <evtrace/evtrace.h>
+#include <bootprof/bootprof.h>
+#include <adcmon/adcmon.h>
+#include <metricagg/metricagg.h>
 
 /* IOTEMBSYS: Add header for stats */
 #include <zephyr/stats/stats.h>
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include "app_version.h"
 
 // Helper for converting macros into strings
@@ -32,7 +51,7 @@ LOG_MODULE_REGISTER(main, CONFIG_APP_LOG_LEVEL);
 #define xstr(s) str(s)
 
 /* IOTEMBSYS: Stats sections and entries declarations. */
-/* Define an example stats group; approximates seconds since boot. */
+/* Define an example stats group; ticks are seconds since boot. */
 STATS_SECT_START(app_stats)
 STATS_SECT_ENTRY(ticks)
 STATS_SECT_ENTRY(button_press_count)
@@ -53,28 +72,6 @@ STATS_SECT_DECL(app_stats) app_stats;
 /* The devicetree node identifier for the "led0" alias. */
 #define LED0_NODE DT_ALIAS(led0)
 
-/* IOTEMBSYS: Add joystick key declarations. */
-#define SW0_NODE	DT_ALIAS(sw0)
-#define SW1_NODE	DT_ALIAS(sw1)
-#define SW2_NODE	DT_ALIAS(sw2)
-#define SW3_NODE	DT_ALIAS(sw3)
-#define SW4_NODE	DT_ALIAS(sw4)
-static const struct gpio_dt_spec sw0 = GPIO_DT_SPEC_GET_OR(SW0_NODE, gpios,
-							      {0});
-static const struct gpio_dt_spec sw1 = GPIO_DT_SPEC_GET_OR(SW1_NODE, gpios,
-							      {0});
-static const struct gpio_dt_spec sw2 = GPIO_DT_SPEC_GET_OR(SW2_NODE, gpios,
-							      {0});
-static const struct gpio_dt_spec sw3 = GPIO_DT_SPEC_GET_OR(SW3_NODE, gpios,
-							      {0});								  								  								  
-static const struct gpio_dt_spec sw4 = GPIO_DT_SPEC_GET_OR(SW4_NODE, gpios,
-							      {0});								  
-static struct gpio_callback button_cb_data_0;
-static struct gpio_callback button_cb_data_1;
-static struct gpio_callback button_cb_data_2;
-static struct gpio_callback button_cb_data_3;
-static struct gpio_callback button_cb_data_4;
-
 /* IOTEMBSYS: Define/declare partitions here */
 #define SLOT1_PARTITION slot1_partition
 #define SLOT1_PARTITION_ID FIXED_PARTITION_ID(SLOT1_PARTITION)
@@ -88,9 +85,27 @@ static struct gpio_callback button_cb_data_4;
  */
 static const struct gpio_dt_spec led = GPIO_DT_SPEC_GET(LED0_NODE, gpios);
 
+#if defined(CONFIG_ADCMON) && DT_NODE_HAS_PROP(DT_PATH(zephyr_user), io_channels)
+#define ADC_SPEC_AND_COMMA(node_id, prop, idx) ADC_DT_SPEC_GET_BY_IDX(node_id, idx),
+
+/* Channels sampled continuously, from adcmon.overlay. */
+static const struct adc_dt_spec adc_channels_[] = {
+	DT_FOREACH_PROP_ELEM(DT_PATH(zephyr_user), io_channels, ADC_SPEC_AND_COMMA)
+};
+#endif
+
 /* The amount of time between GPIO blinking. */
 static uint32_t blink_interval_ = DEFAULT_SLEEP_TIME_MS;
 
+/* Blinks the LED from the system timer interrupt, so no thread has to wake
+ * up for it, and the CPU sleeps between toggles.
+ */
+static void led_timer_expiry(struct k_timer *timer) {
+	gpio_pin_toggle_dt(&led);
+}
+
+static K_TIMER_DEFINE(led_timer_, led_timer_expiry, NULL);
+
 /* IOTEMBSYS: Add synchronization to unblock the sender task */
 static struct k_event unblock_sender_;
 typedef enum {
@@ -99,6 +114,9 @@ typedef enum {
 	BUTTON_ACTION_OTA_DOWNLOAD,
 	BUTTON_ACTION_PROTO_REQ,
 	BUTTON_ACTION_GET_OTA_PATH,
+	BUTTON_ACTION_OTA_DOWNLOAD_MODEM,
+	// Not a button: the backend pushed an update over MQTT.
+	BUTTON_ACTION_OTA_PUSH,
 } button_action_e;
 
 /* IOTEMBSYS: Add synchronization to pass the socket to the receiver task */
@@ -112,11 +130,25 @@ static uint8_t recv_buf_[MAX_RECV_BUF_LEN];
 // TODO(mskobov): this should not be static!
 static char ota_path_[128] = "/does_not_exist/zephyr.signed.bin";
 
+/* The path of an update pushed over MQTT, handed from the MQTT session
+ * thread to the HTTP client thread, which owns ota_path_.
+ */
+static char ota_push_path_[sizeof(ota_path_)];
+static K_MUTEX_DEFINE(ota_push_lock_);
+
+/* Phase timing of the request in progress. Requests are made one at a time
+ * by the HTTP client thread; the OTA range threads only add marks.
+ */
+static struct req_trace trace_;
+
 /* IOTEMBSYS: Consider provisioning a device ID. */
 static const char kDeviceId[] = "12345";
 
 static void change_blink_interval(uint32_t new_interval_ms) {
 	blink_interval_ = new_interval_ms;
+	if (IS_ENABLED(CONFIG_APP_LED_BLINK)) {
+		k_timer_start(&led_timer_, K_MSEC(new_interval_ms), K_MSEC(new_interval_ms));
+	}
 }
 
 /* IOTEMBSYS: Define a default settings val and configuration access */
@@ -161,72 +193,80 @@ struct settings_handler my_conf = {
     .h_export = foo_settings_export
 };
 
-/* IOTEMBSYS: Add joystick press handler. Metaphorical bonus points for debouncing. */
-static void button_pressed(const struct device *dev, struct gpio_callback *cb,
-		    uint32_t pins) {
-	printk("Button %d pressed at %" PRIu32 "\n", pins, k_cycle_get_32());
-	k_msleep(100);
+/* A window summary or a rule event was queued; the network is only woken
+ * up for these, not for every sample.
+ */
+static void metrics_queued(void) {
+	k_event_post(&unblock_sender_, (1 << BUTTON_ACTION_PROTO_REQ));
+}
 
-	STATS_INC(app_stats, button_press_count);
+#if defined(CONFIG_ADCMON) && DT_NODE_HAS_PROP(DT_PATH(zephyr_user), io_channels)
+static void adc_window(size_t channel, const struct adcmon_window *window, void *user_data) {
+	metricagg_add(channel, window->mean_mv);
+}
+#endif
 
-	uint32_t interval_ms = 0;
-	if (pins == BIT(sw0.pin)) {
-		interval_ms = 100;
-	} else if (pins == BIT(sw1.pin)) {
-		// Down
-		interval_ms = 200;
-		k_event_set(&unblock_sender_, (1 << BUTTON_ACTION_OTA_DOWNLOAD));
-	} else if (pins == BIT(sw2.pin)) {
-		// Right
-		interval_ms = 500;
-		k_event_set(&unblock_sender_, (1 << BUTTON_ACTION_GENERIC_HTTP));
-	} else if (pins == BIT(sw3.pin)) {
-		// Up
-		interval_ms = 1000;
-		k_event_set(&unblock_sender_, (1 << BUTTON_ACTION_PROTO_REQ));
-	} else if (pins == BIT(sw4.pin)) {
-		// Left
-		k_event_set(&unblock_sender_, (1 << BUTTON_ACTION_GET_OTA_PATH));
-		interval_ms = 2000;
-	} else {
-		printk("Unrecognized pin");
-	}
+/* IOTEMBSYS: Joystick presses set the blink interval and start a request.
+ * Debouncing is done in joystick.c; this runs on the system work queue.
+ */
+static void joystick_event(enum joystick_key key, enum joystick_event event) {
+	static const struct {
+		uint32_t interval_ms;
+		button_action_e action;
+	} actions[JOYSTICK_KEY_COUNT] = {
+		[JOYSTICK_SELECT] = { 100, BUTTON_ACTION_NONE },
+		[JOYSTICK_DOWN] = { 200, BUTTON_ACTION_OTA_DOWNLOAD },
+		[JOYSTICK_RIGHT] = { 500, BUTTON_ACTION_GENERIC_HTTP },
+		[JOYSTICK_UP] = { 1000, BUTTON_ACTION_PROTO_REQ },
+		[JOYSTICK_LEFT] = { 2000, BUTTON_ACTION_GET_OTA_PATH },
+	};
 
-	if (interval_ms != 0) {
-		printk("Setting interval to %d", interval_ms);
-		change_blink_interval(interval_ms);
+	if (event != JOYSTICK_PRESS) {
+		return;
 	}
-}
 
-static int init_joystick_gpio(const struct gpio_dt_spec* button, struct gpio_callback* data) {
-	int ret = -1;
+	LOG_INF("Button %d pressed", key);
+	STATS_INC(app_stats, button_press_count);
 
-	if (!gpio_is_ready_dt(button)) {
-		printk("Error: button device %s is not ready\n",
-		       button->port->name);
-		return ret;
+	if (actions[key].action != BUTTON_ACTION_NONE) {
+		k_event_set(&unblock_sender_, (1 << actions[key].action));
 	}
+	LOG_INF("Setting interval to %u", actions[key].interval_ms);
+	change_blink_interval(actions[key].interval_ms);
+}
 
-	ret = gpio_pin_configure_dt(button, GPIO_INPUT);
-	if (ret != 0) {
-		printk("Error %d: failed to configure %s pin %d\n",
-		       ret, button->port->name, button->pin);
-		return ret;
-	}
+#if defined(CONFIG_SHELL)
+/* Makes the same requests as the joystick, for runs without one. */
+static int cmd_app_request(const struct shell *sh, size_t argc, char **argv) {
+	static const struct {
+		const char *name;
+		button_action_e action;
+	} requests[] = {
+		{ "http", BUTTON_ACTION_GENERIC_HTTP },
+		{ "ota", BUTTON_ACTION_OTA_DOWNLOAD },
+		{ "backend", BUTTON_ACTION_PROTO_REQ },
+		{ "ota_path", BUTTON_ACTION_GET_OTA_PATH },
+#if defined(CONFIG_APP_OTA_MODEM_HTTP)
+		{ "ota_modem", BUTTON_ACTION_OTA_DOWNLOAD_MODEM },
+#endif
+	};
 
-	ret = gpio_pin_interrupt_configure_dt(button,
-					      GPIO_INT_EDGE_TO_ACTIVE);
-	if (ret != 0) {
-		printk("Error %d: failed to configure interrupt on %s pin %d\n",
-			ret, button->port->name, button->pin);
-		return ret;
+	for (size_t i = 0; i < ARRAY_SIZE(requests); i++) {
+		if (strcmp(argv[1], requests[i].name) == 0) {
+			k_event_set(&unblock_sender_, (1 << requests[i].action));
+			return 0;
+		}
 	}
-
-	gpio_init_callback(data, button_pressed, BIT(button->pin));
-	gpio_add_callback(button->port, data);
-	return ret;
+	shell_error(sh, "Unknown request %s", argv[1]);
+	return -EINVAL;
 }
 
+SHELL_CMD_ARG_REGISTER(app_request, NULL,
+		       "Make a request: http, ota, backend (check-in or status), ota_path "
+		       "or ota_modem",
+		       cmd_app_request, 2, 0);
+#endif /* defined(CONFIG_SHELL) */
+
 //
 // Networking/sockets helpers
 //
@@ -238,23 +278,40 @@ static void dump_addrinfo(const struct addrinfo *ai) {
 	       ((struct sockaddr_in *)ai->ai_addr)->sin_port);
 }
 
-static int get_addr_if_needed(struct addrinfo **ai, const char* host, const char* port) {
-	if (*ai != NULL) {
+/* A resolved address owned by one endpoint. The modem driver hands every
+ * lookup the same static result, so it is copied out rather than kept.
+ */
+struct endpoint_addr {
+	struct sockaddr_storage addr;
+	socklen_t addrlen; // 0 until resolved
+};
+
+static int get_addr_if_needed(struct endpoint_addr *ep, const char* host, const char* port) {
+	if (ep->addrlen != 0) {
 		// We already have the address.
 		return 0;
 	}
 	struct addrinfo hints;
+	struct addrinfo *ai;
 	int st;
 
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_INET;
 	hints.ai_socktype = SOCK_STREAM;
-	st = getaddrinfo(host, port, &hints, ai);
+	st = getaddrinfo(host, port, &hints, &ai);
 	LOG_INF("getaddrinfo status: %d\n", st);
-	if (st == 0) {
-		dump_addrinfo(*ai);
+	if (st != 0) {
+		return st;
+	}
+	dump_addrinfo(ai);
+	if (ai->ai_addrlen > sizeof(ep->addr)) {
+		freeaddrinfo(ai);
+		return -EAFNOSUPPORT;
 	}
-	return st;
+	memcpy(&ep->addr, ai->ai_addr, ai->ai_addrlen);
+	ep->addrlen = ai->ai_addrlen;
+	freeaddrinfo(ai);
+	return 0;
 }
 
 //
@@ -269,15 +326,19 @@ static int get_addr_if_needed(struct addrinfo **ai, const char* host, const char
 #define IS_POST_REQ 1
 #define USE_PROTO 1
 
-#define HTTPBIN_PORT 80
-#define HTTPBIN_HOST "httpbin.org"
-static struct addrinfo* httpbin_addr_;
+#define HTTPBIN_PORT CONFIG_APP_HTTPBIN_PORT
+#define HTTPBIN_HOST CONFIG_APP_HTTPBIN_HOST
+static struct endpoint_addr httpbin_addr_;
+
+/* HTTP body bytes received for the current generic request. */
+static size_t generic_rx_body_;
 
 /* IOTEMBSYS: Create a HTTP response handler/callback. */
 void http_response_cb(struct http_response *rsp,
 			enum http_final_call final_data,
 			void *user_data)
 {
+	evtrace_record(EVTRACE_HTTP_RESPONSE, final_data, rsp->body_frag_len);
 	if (final_data == HTTP_DATA_MORE) {
 		LOG_INF("Partial data received (%zd bytes)", rsp->data_len);
 	} else if (final_data == HTTP_DATA_FINAL) {
@@ -286,6 +347,8 @@ void http_response_cb(struct http_response *rsp,
 		// This assumes the response fits in a single buffer.
 		recv_buf_[rsp->data_len] = '\0';
 	}
+	req_trace_mark(&trace_, REQ_PHASE_FIRST_BYTE);
+	generic_rx_body_ += rsp->body_frag_len;
 
 	LOG_INF("Response to %s", (const char *)user_data);
 	LOG_INF("Response status %s", rsp->http_status);
@@ -310,31 +373,50 @@ int http_payload_cb(int sock, struct http_request *req, void *user_data) {
 	pos += snprintk(tmp + pos, sizeof(tmp) - pos, "0\r\n\r\n");
 
 	(void)send(sock, tmp, pos, 0);
+	evtrace_record(EVTRACE_HTTP_PAYLOAD, 0, pos);
+	req_trace_mark(&trace_, REQ_PHASE_SENT);
 
 	return pos;
 }
 
+/* Payload callback of requests without a body. The HTTP client calls it
+ * once the headers are flushed, so it marks the request as sent.
+ */
+static int http_no_payload_cb(int sock, struct http_request *req, void *user_data) {
+	req_trace_mark(&trace_, REQ_PHASE_SENT);
+	return 0;
+}
+
 /* IOTEMBSYS: Implement the HTTP client functionality */
 static void generic_http_request(void) {
 	int sock;
 	const int32_t timeout = 5 * MSEC_PER_SEC;
 
+	req_trace_begin(&trace_, RequestEndpoint_REQUEST_ENDPOINT_GENERIC);
+
 	// Get the IP address of the domain
 	if (get_addr_if_needed(&httpbin_addr_, HTTPBIN_HOST, xstr(HTTPBIN_PORT)) != 0) {
 		LOG_ERR("DNS lookup failed");
+		req_trace_end(&trace_, -EHOSTUNREACH);
 		return;
 	}
+	req_trace_mark(&trace_, REQ_PHASE_DNS);
 
 	// Create a socket using parameters that the modem allows.
 	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (sock < 0) {
 		LOG_ERR("Creating socket failed");
+		req_trace_end(&trace_, -errno);
 		return;
 	}
-	if (connect(sock, httpbin_addr_->ai_addr, httpbin_addr_->ai_addrlen) < 0) {
+	req_trace_mark(&trace_, REQ_PHASE_SOCKET);
+	if (connect(sock, (struct sockaddr *)&httpbin_addr_.addr, httpbin_addr_.addrlen) < 0) {
 		LOG_ERR("Connecting to socket failed");
+		req_trace_end(&trace_, -errno);
+		close(sock);
 		return;
 	}
+	req_trace_mark(&trace_, REQ_PHASE_CONNECT);
 
 	struct http_request req;
 
@@ -344,6 +426,7 @@ static void generic_http_request(void) {
 #if !IS_POST_REQ
 	req.method = HTTP_GET;
 	req.url = "/get";
+	req.payload_cb = http_no_payload_cb;
 #else
 	req.method = HTTP_POST;
 	req.url = "/post";
@@ -359,6 +442,7 @@ static void generic_http_request(void) {
 
 	// This request is synchronous and blocks the thread.
 	LOG_INF("Sending HTTP request");
+	generic_rx_body_ = 0;
 	int ret = http_client_req(sock, &req, timeout, "IPv4 GET");
 	if (ret > 0) {
 		LOG_INF("HTTP request sent %d bytes", ret);
@@ -366,142 +450,195 @@ static void generic_http_request(void) {
 		LOG_ERR("HTTP request failed: %d", ret);
 	}
 
+	data_usage_record(RequestEndpoint_REQUEST_ENDPOINT_GENERIC, sock, req.payload_len,
+			  generic_rx_body_);
 	LOG_INF("Closing the socket");
 	close(sock);
+	req_trace_end(&trace_, MIN(ret, 0));
 }
 
 //
 // Backend Request Section
 //
 
-// You will need to change this to match your host
-// WARNING: This will change with each new EC2 instance!
-#define EC2_HOST "ec2-34-224-91-168.compute-1.amazonaws.com"
-#define BACKEND_PORT 8080
-#define BACKEND_HOST EC2_HOST ":8080"
-static struct addrinfo* backend_addr_;
+// Set CONFIG_APP_BACKEND_HOST to match your host
+// WARNING: The EC2 host will change with each new instance!
+#define EC2_HOST CONFIG_APP_BACKEND_HOST
+#if defined(CONFIG_APP_BACKEND_TLS_NONE)
+#define BACKEND_PORT CONFIG_APP_BACKEND_PORT
+#else
+#define BACKEND_PORT CONFIG_APP_BACKEND_TLS_PORT
+#endif
+// The modem does the handshake in connect() for these.
+#if defined(CONFIG_APP_BACKEND_TLS_MODEM)
+#define BACKEND_PROTO IPPROTO_TLS_1_2
+#else
+#define BACKEND_PROTO IPPROTO_TCP
+#endif
+#define BACKEND_HOST EC2_HOST ":" xstr(BACKEND_PORT)
+static struct endpoint_addr backend_addr_;
 
 /* IOTEMBSYS: Add protobuf encoding and decoding. */
-static bool encode_status_update_request(uint8_t *buffer, size_t buffer_size, size_t *message_length)
+/* The message is encoded straight into the socket by proto_payload_cb(). */
+/* Set once the boot profile has been delivered; it is only sent once. */
+static bool boot_reported_;
+
+static pb_size_t fill_boot_marks(BootMark *out, pb_size_t max, bool previous)
 {
-	bool status;
+	const struct bootprof_mark *marks;
+	size_t count = bootprof_get(previous, &marks, NULL);
 
-	/* Allocate space on the stack to store the message data.
-	 *
-	 * Nanopb generates simple struct definitions for all the messages.
-	 * - check out the contents of api.pb.h!
-	 * It is a good idea to always initialize your structures
-	 * so that you do not have garbage data from RAM in there.
-	 */
-	StatusUpdateRequest message = StatusUpdateRequest_init_zero;
+	count = MIN(count, max);
+	for (size_t i = 0; i < count; i++) {
+		out[i].us = marks[i].us;
+		strncpy(out[i].name, marks[i].name, sizeof(out[i].name) - 1);
+	}
+	return count;
+}
+
+/* Returns false until the boot is complete, or if there is nothing to send. */
+static bool fill_boot_profile(BootProfile *message)
+{
+	const struct bootprof_mark *marks;
+	bool complete = false;
+	bool previous_complete = true;
 
-	/* Create a stream that will write to our buffer. */
-	pb_ostream_t stream = pb_ostream_from_buffer(buffer, buffer_size);
+	if (boot_reported_ || bootprof_get(false, &marks, &complete) == 0 || !complete) {
+		return false;
+	}
+	message->marks_count = fill_boot_marks(message->marks, ARRAY_SIZE(message->marks), false);
+	// A previous boot that never completed shows where it got stuck.
+	if (bootprof_get(true, &marks, &previous_complete) > 0 && !previous_complete) {
+		message->previous_count = fill_boot_marks(message->previous,
+							  ARRAY_SIZE(message->previous), true);
+	}
+	return true;
+}
 
+static void fill_status_update_request(StatusUpdateRequest *message)
+{
 	/* Fill in the reboot count */
-	message.boot_count = boot_count;
+	message->boot_count = boot_count;
 
 	/* IOTEMBSYS: Fill out app stats. */
-	message.uptime_ticks = k_uptime_get();
-	strncpy(message.device_id, kDeviceId, sizeof(message.device_id));
+	message->uptime_ticks = k_uptime_get();
+	strncpy(message->device_id, kDeviceId, sizeof(message->device_id));
 
 	// TODO(mskobov): Get RTC value
-	message.has_app_stats = true;
-	message.app_stats.ticks = app_stats.ticks;
-	message.app_stats.button_press_count = app_stats.button_press_count;
+	STATS_SET(app_stats, ticks, k_uptime_get() / MSEC_PER_SEC);
+	message->has_app_stats = true;
+	message->app_stats.ticks = app_stats.ticks;
+	message->app_stats.button_press_count = app_stats.button_press_count;
 
-	/* Now we are ready to encode the message! */
-	status = pb_encode(&stream, StatusUpdateRequest_fields, &message);
-	*message_length = stream.bytes_written;
+	message->data_usage_count = data_usage_fill(message->data_usage,
+						    ARRAY_SIZE(message->data_usage));
+	message->threads_count = thread_prof_fill(message->threads,
+						  ARRAY_SIZE(message->threads));
 
-	if (!status) {
-		printk("Encoding failed: %s\n", PB_GET_ERROR(&stream));
-	}
+	message->has_stats = IS_ENABLED(CONFIG_APP_STATS_EXPORT);
+	stats_export_fill(&message->stats);
 
-	return status;
+	message->has_boot = fill_boot_profile(&message->boot);
 }
 
-static bool decode_status_update_response(uint8_t *buffer, size_t message_length)
+static void handle_status_update_response(const StatusUpdateResponse *message)
 {
-	bool status = false;
-	if (message_length == 0) {
-		LOG_WRN("Message length is 0");
-		return status;
-	}
-
-	/* Allocate space for the decoded message. */
-	StatusUpdateResponse message = StatusUpdateResponse_init_zero;
-
-	/* Create a stream that reads from the buffer. */
-	pb_istream_t stream = pb_istream_from_buffer(buffer, message_length);
+	/* Print the data contained in the message. */
+	printk("Response message: %s\n", message->message);
 
-	/* Now we are ready to decode the message. */
-	status = pb_decode(&stream, StatusUpdateResponse_fields, &message);
-
-	/* Check for errors... */
-	if (status) {
-		/* Print the data contained in the message. */
-		printk("Response message: %s\n", message.message);
-	} else {
-		printk("Decoding failed: %s\n", PB_GET_ERROR(&stream));
+	if (message->has_metrics) {
+		metric_report_config(&message->metrics);
 	}
-
-	return status;
 }
 
-int http_proto_payload_gen(uint8_t* buffer, size_t buf_size) {
-	size_t message_length;
-
-	/* Encode our message */
-	if (!encode_status_update_request(buffer, buf_size, &message_length)) {
-		LOG_ERR("Encoding request failed");
-		return 0;
-	} else {
-		LOG_INF("Sending proto to server. Length: %d", (int)message_length);
-	}
-
-	return (int)message_length;
-}
+/* Bytes received for the current backend exchange, headers included,
+ * and those of them that were body.
+ */
+static size_t backend_rx_bytes_;
+static size_t backend_rx_body_;
 
 void http_proto_response_cb(struct http_response *rsp,
 			enum http_final_call final_data,
 			void *user_data)
 {
+	evtrace_record(EVTRACE_HTTP_RESPONSE, final_data, rsp->body_frag_len);
 	if (final_data == HTTP_DATA_MORE) {
 		LOG_INF("Partial data received (%zd bytes)", rsp->data_len);
 	} else if (final_data == HTTP_DATA_FINAL) {
 		LOG_INF("All the data received (%zd bytes)", rsp->data_len);
-
-		// Decode the protobuf response.
-		decode_status_update_response(rsp->body_frag_start, rsp->body_frag_len);
 	}
+	backend_rx_bytes_ += rsp->data_len;
+	backend_rx_body_ += rsp->body_frag_len;
+	req_trace_mark(&trace_, REQ_PHASE_FIRST_BYTE);
+
+	// The body may span several fragments; each is decoded as it arrives.
+	proto_decode_feed(rsp->body_frag_start, rsp->body_frag_len);
 
-	LOG_INF("Response to %s", (const char *)user_data);
 	LOG_INF("Response status %s", rsp->http_status);
 }
 
+static int backend_payload_cb(int sock, struct http_request *req, void *user_data) {
+	int ret = proto_payload_cb(sock, req, user_data);
+
+	evtrace_record(EVTRACE_HTTP_PAYLOAD, 0, ret);
+	req_trace_mark(&trace_, REQ_PHASE_SENT);
+	return ret;
+}
 
 /* IOTEMBSYS: Implement the HTTP client functionality */
-static void backend_http_request(void) {
+/* Run one protobuf request/response exchange with the backend over a new
+ * connection, with TLS if enabled. Returns true if a response was decoded
+ * into @p response.
+ */
+static bool backend_proto_request(const char *url, RequestEndpoint endpoint,
+				  const pb_msgdesc_t *request_fields, const void *request,
+				  const pb_msgdesc_t *response_fields, void *response) {
 	int sock;
+	// The socket HTTP goes over; sock itself unless mbedTLS wraps it.
+	int http_sock;
 	const int32_t timeout = 5 * MSEC_PER_SEC;
+	struct proto_payload payload = { request_fields, request };
+	int64_t start_ms = k_uptime_get();
+	bool decoded;
+
+	req_trace_begin(&trace_, endpoint);
 
 	// Get the IP address of the domain
 	if (get_addr_if_needed(&backend_addr_, EC2_HOST, xstr(BACKEND_PORT)) != 0) {
 		LOG_ERR("DNS lookup failed");
-		return;
+		req_trace_end(&trace_, -EHOSTUNREACH);
+		return false;
 	}
+	req_trace_mark(&trace_, REQ_PHASE_DNS);
 
 	// Create a socket using parameters that the modem allows.
-	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sock = socket(AF_INET, SOCK_STREAM, BACKEND_PROTO);
 	if (sock < 0) {
 		LOG_ERR("Creating socket failed");
-		return;
+		req_trace_end(&trace_, -errno);
+		return false;
 	}
-	if (connect(sock, backend_addr_->ai_addr, backend_addr_->ai_addrlen) < 0) {
+	req_trace_mark(&trace_, REQ_PHASE_SOCKET);
+	if (connect(sock, (struct sockaddr *)&backend_addr_.addr, backend_addr_.addrlen) < 0) {
 		LOG_ERR("Connecting to socket failed");
-		return;
+		req_trace_end(&trace_, -errno);
+		close(sock);
+		return false;
 	}
+	req_trace_mark(&trace_, REQ_PHASE_CONNECT);
+	http_sock = sock;
+#if defined(CONFIG_APP_BACKEND_TLS_MBEDTLS)
+	struct tls_session_stats tls_stats;
+
+	http_sock = tls_session_wrap(sock, EC2_HOST, &tls_stats);
+	if (http_sock < 0) {
+		LOG_ERR("TLS handshake failed");
+		req_trace_end(&trace_, http_sock);
+		close(sock);
+		return false;
+	}
+	req_trace_mark(&trace_, REQ_PHASE_TLS);
+#endif
 
 	struct http_request req;
 
@@ -509,33 +646,48 @@ static void backend_http_request(void) {
 	memset(recv_buf_, 0, sizeof(recv_buf_));
 
 	req.method = HTTP_POST;
-	req.url = "/status_update";
+	req.url = url;
 	req.host = BACKEND_HOST;
 	req.protocol = "HTTP/1.1";
-	req.payload_len = http_proto_payload_gen(recv_buf_, sizeof(recv_buf_));
-	req.payload = req.payload_len ? recv_buf_ : NULL;
+	if (proto_payload_setup(&req, &payload) < 0) {
+		LOG_ERR("Encoding request failed");
+		req_trace_end(&trace_, -EINVAL);
+		close(http_sock);
+		return false;
+	}
+	req.payload_cb = backend_payload_cb;
 	req.response = http_proto_response_cb;
 	req.recv_buf = recv_buf_;
 	req.recv_buf_len = sizeof(recv_buf_);
 
+	backend_rx_bytes_ = 0;
+	backend_rx_body_ = 0;
+	proto_decode_begin(response_fields, response);
+
 	// This request is synchronous and blocks the thread.
-	LOG_INF("Sending HTTP request");
-	int ret = http_client_req(sock, &req, timeout, "IPv4 GET");
+	LOG_INF("Sending HTTP request to %s", url);
+	int ret = http_client_req(http_sock, &req, timeout, &payload);
 	if (ret > 0) {
 		LOG_INF("HTTP request sent %d bytes", ret);
 	} else {
 		LOG_ERR("HTTP request failed: %d", ret);
 	}
 
+	decoded = proto_decode_end();
+
+	// Counted on the modem socket, so TLS records and handshake are included.
+	data_usage_record(endpoint, sock, payload.bytes, backend_rx_body_);
 	LOG_INF("Closing the socket");
-	close(sock);
-}
+	close(http_sock);
+	req_trace_end(&trace_, ret < 0 ? ret : (decoded ? 0 : -EBADMSG));
 
-/* IOTEMBSYS: Create a HTTP request and response with protobuf. */
-static bool encode_ota_update_request(uint8_t *buffer, size_t buffer_size, size_t *message_length)
-{
-	bool status;
+	// Connection setup and teardown are included, as they dominate on cellular.
+	LOG_INF("%s: %d bytes sent, %zu bytes received in %lld ms", url,
+		MAX(ret, 0), backend_rx_bytes_, k_uptime_get() - start_ms);
+	return decoded;
+}
 
+static void backend_http_request(void) {
 	/* Allocate space on the stack to store the message data.
 	 *
 	 * Nanopb generates simple struct definitions for all the messages.
@@ -543,282 +695,769 @@ static bool encode_ota_update_request(uint8_t *buffer, size_t buffer_size, size_
 	 * It is a good idea to always initialize your structures
 	 * so that you do not have garbage data from RAM in there.
 	 */
-	OTAUpdateRequest message = OTAUpdateRequest_init_zero;
-
-	/* Create a stream that will write to our buffer. */
-	pb_ostream_t stream = pb_ostream_from_buffer(buffer, buffer_size);
-	
-	/* TODO: fill out the actual state. */
-	message.state = OTAState_OTA_STATE_NONE;
-	strncpy(message.version, APP_VERSION_STR, sizeof(message.version));
-	strncpy(message.device_id, kDeviceId, sizeof(message.device_id));
-
-	/* Now we are ready to encode the message! */
-	status = pb_encode(&stream, OTAUpdateRequest_fields, &message);
-	*message_length = stream.bytes_written;
-
-	if (!status) {
-		printk("Encoding failed: %s\n", PB_GET_ERROR(&stream));
+	StatusUpdateRequest request = StatusUpdateRequest_init_zero;
+	/* Allocate space for the decoded message. */
+	StatusUpdateResponse response = StatusUpdateResponse_init_zero;
+
+	uint32_t traces_seq;
+
+	fill_status_update_request(&request);
+	request.traces_count = req_trace_fill(request.traces, ARRAY_SIZE(request.traces),
+					      &traces_seq);
+	metric_report_fill(&request.summaries, &request.events, &request.metric_config_id);
+	if (backend_proto_request("/status_update",
+				  RequestEndpoint_REQUEST_ENDPOINT_STATUS_UPDATE,
+				  StatusUpdateRequest_fields, &request,
+				  StatusUpdateResponse_fields, &response)) {
+		req_trace_ack(traces_seq);
+		metric_report_ack();
+		stats_export_ack(response.stats_dict_id);
+		boot_reported_ |= request.has_boot;
+		handle_status_update_response(&response);
 	}
+}
 
-	return status;
+/* IOTEMBSYS: Create a HTTP request and response with protobuf. */
+/* The state of the most recent OTA download, reported to the backend. */
+static OTAState ota_state_ = OTAState_OTA_STATE_NONE;
+
+static void fill_ota_update_request(OTAUpdateRequest *message)
+{
+	message->state = ota_state_;
+	strncpy(message->version, APP_VERSION_STR, sizeof(message->version));
+	strncpy(message->device_id, kDeviceId, sizeof(message->device_id));
 }
 
-static bool decode_ota_update_response(uint8_t *buffer, size_t message_length)
+static void handle_ota_update_response(const OTAUpdateResponse *message)
 {
-	bool status = false;
-	if (message_length == 0) {
-		LOG_WRN("Message length is 0");
-		return status;
+	/* Print the data contained in the message. */
+	printk("OTA path: %s\n", message->path);
+	strncpy(ota_path_, message->path, sizeof(ota_path_));
+}
+
+static void backend_ota_http_request(void) {
+	OTAUpdateRequest request = OTAUpdateRequest_init_zero;
+	OTAUpdateResponse response = OTAUpdateResponse_init_zero;
+
+	fill_ota_update_request(&request);
+	if (backend_proto_request("/ota", RequestEndpoint_REQUEST_ENDPOINT_OTA_CHECK,
+				  OTAUpdateRequest_fields, &request,
+				  OTAUpdateResponse_fields, &response)) {
+		handle_ota_update_response(&response);
 	}
+}
 
-	/* Allocate space for the decoded message. */
-	OTAUpdateResponse message = OTAUpdateResponse_init_zero;
+/* IOTEMBSYS: Combine the status update and OTA check into one round trip. */
 
-	/* Create a stream that reads from the buffer. */
-	pb_istream_t stream = pb_istream_from_buffer(buffer, message_length);
+/* The status fields that are sent as deltas. */
+struct status_snapshot {
+	int32_t boot_count;
+	int64_t uptime_ticks;
+	int32_t ticks;
+	int32_t button_press_count;
+};
 
-	/* Now we are ready to decode the message. */
-	status = pb_decode(&stream, OTAUpdateResponse_fields, &message);
+/* Status sync state. Deltas are taken against the last snapshot the
+ * backend acknowledged, so a lost check-in is folded into the next one.
+ */
+static struct {
+	/* Assigned by the backend on a full snapshot; 0 when there is none. */
+	uint32_t session_token;
+	/* Sequence number of the last check-in sent. */
+	uint32_t seq;
+	uint32_t acked_seq;
+	struct status_snapshot acked;
+	struct status_snapshot sent;
+	/* Check-ins sent since the last full snapshot. */
+	uint32_t since_full;
+} status_sync_;
+
+static void status_snapshot_get(struct status_snapshot *snap, const StatusUpdateRequest *status)
+{
+	snap->boot_count = status->boot_count;
+	snap->uptime_ticks = status->uptime_ticks;
+	snap->ticks = status->app_stats.ticks;
+	snap->button_press_count = status->app_stats.button_press_count;
+}
 
-	/* Check for errors... */
-	if (status) {
-		/* Print the data contained in the message. */
-		printk("OTA path: %s\n", message.path);
-		strncpy(ota_path_, message.path, sizeof(ota_path_));
-	} else {
-		printk("Decoding failed: %s\n", PB_GET_ERROR(&stream));
-	}
+/* The same values as fill_status_update_request() puts in the snapshot,
+ * without the stats, thread and data usage reports a delta does not carry.
+ */
+static void status_snapshot_now(struct status_snapshot *snap)
+{
+	int64_t uptime_ms = k_uptime_get();
 
-	return status;
+	STATS_SET(app_stats, ticks, uptime_ms / MSEC_PER_SEC);
+	snap->boot_count = boot_count;
+	snap->uptime_ticks = uptime_ms;
+	snap->ticks = app_stats.ticks;
+	snap->button_press_count = app_stats.button_press_count;
 }
 
-/* IOTEMBSYS: Implement the HTTP client functionality */
-static int http_ota_proto_payload_get(uint8_t* buffer, size_t buf_size) {
-	size_t message_length;
-
-	/* Encode our message */
-	if (!encode_ota_update_request(buffer, buf_size, &message_length)) {
-		LOG_ERR("Encoding request failed");
-		return 0;
+static void fill_check_in_request(CheckInRequest *message)
+{
+	bool full = !IS_ENABLED(CONFIG_APP_STATUS_DELTA) ||
+		    status_sync_.session_token == 0 ||
+		    status_sync_.since_full >= CONFIG_APP_STATUS_FULL_INTERVAL;
+
+	message->seq = ++status_sync_.seq;
+	message->ota_state = ota_state_;
+
+	if (full) {
+		fill_status_update_request(&message->status);
+		status_snapshot_get(&status_sync_.sent, &message->status);
+		message->has_status = true;
+		strncpy(message->version, APP_VERSION_STR, sizeof(message->version));
+		status_sync_.since_full = 0;
 	} else {
-		LOG_INF("Sending proto to server. Length: %d", (int)message_length);
+		const struct status_snapshot *base = &status_sync_.acked;
+		const struct status_snapshot *cur = &status_sync_.sent;
+
+		status_snapshot_now(&status_sync_.sent);
+		// Unchanged fields are zero and so are left out of the encoding.
+		message->session_token = status_sync_.session_token;
+		message->base_seq = status_sync_.acked_seq;
+		message->has_delta = true;
+		message->delta.boot_count = cur->boot_count - base->boot_count;
+		message->delta.uptime_ticks = cur->uptime_ticks - base->uptime_ticks;
+		message->delta.ticks = cur->ticks - base->ticks;
+		message->delta.button_press_count =
+			cur->button_press_count - base->button_press_count;
 	}
-	return (int)message_length;
+	status_sync_.since_full++;
 }
 
-static void http_ota_proto_response_cb(struct http_response *rsp,
-			enum http_final_call final_data,
-			void *user_data)
+static void handle_check_in_sync(const CheckInResponse *message)
 {
-	if (final_data == HTTP_DATA_MORE) {
-		LOG_INF("Partial data received (%zd bytes)", rsp->data_len);
-	} else if (final_data == HTTP_DATA_FINAL) {
-		LOG_INF("All the data received (%zd bytes)", rsp->data_len);
-
-		// Decode the protobuf response.
-		decode_ota_update_response(rsp->body_frag_start, rsp->body_frag_len);
+	if (message->ack_seq != 0 && message->ack_seq == status_sync_.seq) {
+		status_sync_.acked = status_sync_.sent;
+		status_sync_.acked_seq = message->ack_seq;
 	}
+	// A zero token means the backend lost the session and wants a full snapshot.
+	if (message->session_token != status_sync_.session_token) {
+		LOG_INF("Status session token %u", message->session_token);
+	}
+	status_sync_.session_token = message->session_token;
+}
 
-	LOG_INF("Response to %s", (const char *)user_data);
-	LOG_INF("Response status %s", rsp->http_status);
+/* Returns true if the backend asked for an update to be downloaded. */
+static bool handle_check_in_response(const CheckInResponse *message)
+{
+	handle_check_in_sync(message);
+	if (message->has_status) {
+		handle_status_update_response(&message->status);
+	}
+	if (message->has_config && message->config.blink_interval_ms != 0) {
+		LOG_INF("Blink interval set to %u ms by the backend",
+			message->config.blink_interval_ms);
+		change_blink_interval(message->config.blink_interval_ms);
+	}
+	if (message->has_ota && message->ota.do_update) {
+		handle_ota_update_response(&message->ota);
+		return true;
+	}
+	return false;
 }
 
-static void backend_ota_http_request(void) {
+#if defined(CONFIG_APP_BACKEND_COAP)
+static struct endpoint_addr backend_coap_addr_;
+
+/* Run one protobuf exchange with the backend as a CoAP POST over UDP. There is
+ * no connection to set up or tear down and no HTTP headers, which is what a
+ * small periodic message pays for the most on cellular.
+ * Returns 0 if a response was decoded into @p response, or a negative errno;
+ * -EMSGSIZE means nothing was sent as the request does not fit in a datagram.
+ */
+static int backend_coap_request(const char *path, RequestEndpoint endpoint,
+				const pb_msgdesc_t *request_fields, const void *request,
+				const pb_msgdesc_t *response_fields, void *response) {
+	struct coap_proto_stats stats;
+	int64_t start_ms = k_uptime_get();
 	int sock;
-	const int32_t timeout = 5 * MSEC_PER_SEC;
+	int ret;
 
-	// Get the IP address of the domain
-	if (get_addr_if_needed(&backend_addr_, EC2_HOST, xstr(BACKEND_PORT)) != 0) {
+	req_trace_begin(&trace_, endpoint);
+
+	if (get_addr_if_needed(&backend_coap_addr_, EC2_HOST,
+			       xstr(CONFIG_APP_BACKEND_COAP_PORT)) != 0) {
 		LOG_ERR("DNS lookup failed");
-		return;
+		req_trace_end(&trace_, -EHOSTUNREACH);
+		return -EHOSTUNREACH;
 	}
+	req_trace_mark(&trace_, REQ_PHASE_DNS);
 
-	// Create a socket using parameters that the modem allows.
-	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	if (sock < 0) {
 		LOG_ERR("Creating socket failed");
-		return;
+		ret = -errno;
+		req_trace_end(&trace_, ret);
+		return ret;
 	}
-	if (connect(sock, backend_addr_->ai_addr, backend_addr_->ai_addrlen) < 0) {
+	req_trace_mark(&trace_, REQ_PHASE_SOCKET);
+	// Only fixes the peer; nothing is sent until the request.
+	if (connect(sock, (struct sockaddr *)&backend_coap_addr_.addr,
+		    backend_coap_addr_.addrlen) < 0) {
 		LOG_ERR("Connecting to socket failed");
-		return;
+		ret = -errno;
+		req_trace_end(&trace_, ret);
+		close(sock);
+		return ret;
 	}
+	req_trace_mark(&trace_, REQ_PHASE_CONNECT);
 
-	struct http_request req;
+	ret = coap_proto_request(sock, path, request_fields, request, response_fields, response,
+				 &trace_, &stats);
 
-	memset(&req, 0, sizeof(req));
-	memset(recv_buf_, 0, sizeof(recv_buf_));
+	if (stats.transmissions > 0) {
+		data_usage_record(endpoint, sock, stats.tx_payload, stats.rx_payload);
+	}
+	close(sock);
+	req_trace_end(&trace_, ret);
 
-	req.host = BACKEND_HOST;
-	req.protocol = "HTTP/1.1";
-	req.method = HTTP_POST;
-	req.url = "/ota";
-	req.payload = recv_buf_;
-	req.payload_len = http_ota_proto_payload_get(recv_buf_, sizeof(recv_buf_));
-	req.payload = req.payload_len ? recv_buf_ : NULL;
-	req.response = http_ota_proto_response_cb;
-	req.recv_buf = recv_buf_;
-	req.recv_buf_len = sizeof(recv_buf_);
+	LOG_INF("coap %s: %zu bytes sent in %u datagrams, %zu bytes received in %lld ms",
+		path, stats.tx_payload, stats.transmissions, stats.rx_payload,
+		k_uptime_get() - start_ms);
+	return ret;
+}
+#endif /* defined(CONFIG_APP_BACKEND_COAP) */
 
-	// This request is synchronous and blocks the thread.
-	LOG_INF("Sending OTA HTTP request");
-	int ret = http_client_req(sock, &req, timeout, "IPv4 GET");
-	if (ret > 0) {
-		LOG_INF("HTTP request sent %d bytes", ret);
-	} else {
-		LOG_ERR("HTTP request failed: %d", ret);
+/* Send a check-in on the MQTT session while it is up, else over CoAP when it
+ * is enabled, or over HTTP. Returns true if
+ * a response was decoded into @p response.
+ */
+static bool backend_check_in_exchange(const CheckInRequest *request,
+				      CheckInResponse *response) {
+	int ret;
+
+	if (mqtt_session_connected()) {
+		ret = mqtt_session_request(RequestEndpoint_REQUEST_ENDPOINT_CHECK_IN_MQTT, "check_in",
+					   CheckInRequest_fields, request,
+					   CheckInResponse_fields, response, &trace_);
+		if (ret != -EMSGSIZE && ret != -ENOTCONN) {
+			return ret == 0;
+		}
+		LOG_INF("Check-in not sent over MQTT (%d)", ret);
 	}
+#if defined(CONFIG_APP_BACKEND_COAP)
+	ret = backend_coap_request("check_in", RequestEndpoint_REQUEST_ENDPOINT_CHECK_IN_COAP,
+				       CheckInRequest_fields, request,
+				       CheckInResponse_fields, response);
+
+	// Full snapshots with traces can outgrow a datagram; those still go over HTTP.
+	if (ret != -EMSGSIZE) {
+		return ret == 0;
+	}
+	LOG_INF("Check-in too large for CoAP, sending over HTTP");
+#endif
+	return backend_proto_request("/check_in", RequestEndpoint_REQUEST_ENDPOINT_CHECK_IN,
+				     CheckInRequest_fields, request,
+				     CheckInResponse_fields, response);
+}
 
-	LOG_INF("Closing the socket");
-	close(sock);
+/* Returns true if an OTA download should follow. */
+static bool backend_check_in_request(void) {
+	CheckInRequest request = CheckInRequest_init_zero;
+	CheckInResponse response = CheckInResponse_init_zero;
+	uint32_t traces_seq;
+
+	fill_check_in_request(&request);
+	// Attached at the top level, so they also go with delta check-ins.
+	request.traces_count = req_trace_fill(request.traces, ARRAY_SIZE(request.traces),
+					      &traces_seq);
+	metric_report_fill(&request.summaries, &request.events, &request.metric_config_id);
+	if (!backend_check_in_exchange(&request, &response)) {
+		return false;
+	}
+	req_trace_ack(traces_seq);
+	metric_report_ack();
+	// Only full check-ins carry the stats.
+	if (request.has_status && response.has_status) {
+		stats_export_ack(response.status.stats_dict_id);
+	}
+	boot_reported_ |= request.has_status && request.status.has_boot;
+	return handle_check_in_response(&response);
+}
+
+/* Called from the MQTT session thread when the backend pushes an update.
+ * The download runs on the HTTP client thread, see apply_ota_push().
+ */
+static void handle_ota_push(const OTAUpdateResponse *message)
+{
+	if (!message->do_update) {
+		return;
+	}
+	k_mutex_lock(&ota_push_lock_, K_FOREVER);
+	strncpy(ota_push_path_, message->path, sizeof(ota_push_path_) - 1);
+	k_mutex_unlock(&ota_push_lock_);
+	k_event_post(&unblock_sender_, (1 << BUTTON_ACTION_OTA_PUSH));
 }
 
+/* Takes the path of the last pushed update, on the HTTP client thread. */
+static void apply_ota_push(void)
+{
+	k_mutex_lock(&ota_push_lock_, K_FOREVER);
+	printk("OTA path: %s\n", ota_push_path_);
+	strncpy(ota_path_, ota_push_path_, sizeof(ota_path_));
+	k_mutex_unlock(&ota_push_lock_);
+}
+
+static void handle_config_push(const DeviceConfig *message)
+{
+	if (message->blink_interval_ms != 0) {
+		LOG_INF("Blink interval set to %u ms by the backend", message->blink_interval_ms);
+		change_blink_interval(message->blink_interval_ms);
+	}
+}
+
+static const struct mqtt_session_handlers mqtt_handlers_ = {
+	.ota = handle_ota_push,
+	.config = handle_config_push,
+};
+
 //
 // OTA Download Section
 //
-#define OTA_HTTP_PORT 80
-#define OTA_HOST "iotemb-firmware-releases.s3.amazonaws.com"
-static int total_read_size;
-static int total_write_size;
+#define OTA_HTTP_PORT CONFIG_APP_OTA_PORT
+#define OTA_HOST CONFIG_APP_OTA_HOST
+#define OTA_RANGE_STACK_SIZE 2048
+// Must be a multiple of the flash write block size (8 bytes on STM32L4).
+#define OTA_FLASH_BUF_LEN 512
+// Ranges start on page boundaries so that no two writers share a block.
+#define OTA_RANGE_ALIGN 2048
 static int content_length_;
-static struct flash_area *image_area;
-static struct addrinfo* ota_addr_;
+static const struct flash_area *image_area;
+static struct endpoint_addr ota_addr_;
+
+/* IOTEMBSYS: A single byte range of the OTA image and the state needed to
+ * write it to flash. The single-stream download uses one range that covers
+ * the whole image.
+ */
+struct ota_range {
+	bool ranged;
+	bool failed;
+	size_t start;
+	size_t end;
+	size_t total_read_size;
+	int ret;
+	char range_hdr[sizeof("Range: bytes=4294967295-4294967295\r\n")];
+	struct stream_flash_ctx flash;
+	uint8_t flash_buf[OTA_FLASH_BUF_LEN];
+	uint8_t recv_buf[MAX_RECV_BUF_LEN];
+};
+
+static struct ota_range ota_ranges_[CONFIG_APP_OTA_RANGE_CONNECTIONS];
+static struct k_thread ota_range_threads_[CONFIG_APP_OTA_RANGE_CONNECTIONS];
+static K_THREAD_STACK_ARRAY_DEFINE(ota_range_stacks_, CONFIG_APP_OTA_RANGE_CONNECTIONS,
+				   OTA_RANGE_STACK_SIZE);
 
 /* IOTEMBSYS: Implement the OTA HTTP download. */
 void http_ota_response_cb(struct http_response *rsp,
 			enum http_final_call final_data,
 			void *user_data)
 {
-	static uint8_t overflow_[8];
-	static uint8_t overflow_count_;
-	uint8_t overflow_inverse = 0;
-	size_t bytes_to_write = rsp->body_frag_len;
+	struct ota_range *range = user_data;
+	bool flush = (final_data == HTTP_DATA_FINAL);
+	int err;
 
-	if (total_read_size == 0) {
-		overflow_count_ = 0;
+	evtrace_record(EVTRACE_HTTP_RESPONSE, final_data, rsp->body_frag_len);
+	if (range->failed) {
+		return;
 	}
 
-	if (overflow_count_ != 0) {
-		overflow_inverse = sizeof(overflow_) - overflow_count_;
-		
-		if (overflow_inverse > rsp->body_frag_len) {
-			LOG_INF("Not enough data; copy all to overflow");
-			memcpy(overflow_ + overflow_count_, rsp->body_frag_start, rsp->body_frag_len);
-			overflow_count_ += rsp->body_frag_len;
-			bytes_to_write -= rsp->body_frag_len;
-		} else {
-			memcpy(overflow_ + overflow_count_, rsp->body_frag_start, overflow_inverse);
-			bytes_to_write -= overflow_inverse;
-			int err = flash_area_write(image_area, total_read_size - overflow_count_, overflow_, sizeof(overflow_));
-			if (err != 0) {
-				LOG_ERR("Flash area write failed");
-			} else {
-				total_write_size += sizeof(overflow_);
-			}
-		}
+	// A server that ignores the Range header sends the whole image,
+	// which must not be written at this range's offset.
+	if (range->ranged && rsp->http_status_code != 206) {
+		LOG_ERR("Range %zu-%zu not honored (status %d)", range->start, range->end,
+			rsp->http_status_code);
+		range->failed = true;
+		return;
 	}
 
-	if (bytes_to_write != 0) {
-		// This is specific to STM32 flash
-		// TODO(mskobov): don't write if < 8 bytes to write
-		overflow_count_ = bytes_to_write % 8;
-		int err = flash_area_write(image_area, total_read_size + overflow_inverse, rsp->body_frag_start + overflow_inverse, bytes_to_write - overflow_count_);
+	// The stream flash context keeps the partial write block between
+	// fragments, so fragments of any length can be written as they arrive.
+	if (rsp->body_frag_len != 0 || flush) {
+		err = stream_flash_buffered_write(&range->flash, rsp->body_frag_start,
+						  rsp->body_frag_len, flush);
 		if (err != 0) {
-			LOG_ERR("Flash area write failed");
-		} else {
-			total_write_size += bytes_to_write - overflow_count_;
-		}
-		if (overflow_count_ != 0) {
-			memset(overflow_, 0, sizeof(overflow_));
-			memcpy(overflow_, rsp->body_frag_start + overflow_inverse + bytes_to_write - overflow_count_, overflow_count_);
-			if (final_data == HTTP_DATA_FINAL) {
-				err = flash_area_write(image_area, total_read_size + overflow_inverse + bytes_to_write - overflow_count_, overflow_, sizeof(overflow_));
-				if (err != 0) {
-					LOG_ERR("Flash area write failed");
-				} else {
-					// Technically, we could have written more, but we don't care about the alignment bytes.
-					total_write_size += overflow_count_;
-				}
-			}
+			LOG_ERR("Flash area write failed: %d", err);
+			range->failed = true;
+			return;
 		}
 	}
 
+	if (rsp->body_frag_len != 0) {
+		req_trace_mark(&trace_, REQ_PHASE_FIRST_BYTE);
+	}
+
 	// Count the read size to make sure it matches the content length header at the end.
-	total_read_size += rsp->body_frag_len;
-	content_length_ = rsp->content_length;
+	range->total_read_size += rsp->body_frag_len;
+	if (!range->ranged) {
+		content_length_ = rsp->content_length;
+	}
 }
 
-/* IOTEMBSYS: Implement the HTTP OTA task */
-static void http_ota_request() {
-	int sock;
-	const int32_t timeout = 120 * MSEC_PER_SEC;
-
-	LOG_INF("Starting OTA...");
-
-	total_read_size = 0;
-	total_write_size = 0;
-
-	// Erase a flash area if previously written to.
-	int err = flash_area_open(SLOT1_PARTITION_ID, (const struct flash_area **)&image_area);
-	if (err != 0) {
-		LOG_ERR("Flash area open failed");
-		return;
-	}
-	err = flash_area_erase(image_area, 0, image_area->fa_size);
-	if (err != 0) {
-		LOG_ERR("Flash area erase failed");
-		return;
+static void http_ota_head_response_cb(struct http_response *rsp,
+			enum http_final_call final_data,
+			void *user_data)
+{
+	if (final_data == HTTP_DATA_FINAL) {
+		content_length_ = rsp->content_length;
 	}
+}
 
-	// Get the IP address of the domain
-	if (get_addr_if_needed(&ota_addr_, OTA_HOST, xstr(OTA_HTTP_PORT)) != 0) {
-		LOG_ERR("DNS lookup failed");
-		return;
-	}
+static int ota_connect(void) {
+	int sock;
 
 	// Create a socket using parameters that the modem allows.
 	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (sock < 0) {
 		LOG_ERR("Creating socket failed");
-		return;
+		return -1;
 	}
-	if (connect(sock, ota_addr_->ai_addr, ota_addr_->ai_addrlen) < 0) {
+	req_trace_mark(&trace_, REQ_PHASE_SOCKET);
+	if (connect(sock, (struct sockaddr *)&ota_addr_.addr, ota_addr_.addrlen) < 0) {
 		LOG_ERR("Connecting to socket failed");
-		return;
+		close(sock);
+		return -1;
 	}
+	req_trace_mark(&trace_, REQ_PHASE_CONNECT);
+	return sock;
+}
 
+/* Fetch the image size with a HEAD request, so it can be split into ranges. */
+static int ota_get_image_size(void) {
+	const int32_t timeout = 10 * MSEC_PER_SEC;
 	struct http_request req;
+	int sock;
+	int ret;
+
+	sock = ota_connect();
+	if (sock < 0) {
+		return -1;
+	}
 
 	memset(&req, 0, sizeof(req));
-	memset(recv_buf_, 0, sizeof(recv_buf_));
+	req.method = HTTP_HEAD;
+	req.url = ota_path_;
+	req.host = OTA_HOST;
+	req.protocol = "HTTP/1.1";
+	req.response = http_ota_head_response_cb;
+	req.recv_buf = recv_buf_;
+	req.recv_buf_len = sizeof(recv_buf_);
+
+	content_length_ = 0;
+	ret = http_client_req(sock, &req, timeout, NULL);
+	data_usage_record(RequestEndpoint_REQUEST_ENDPOINT_OTA_DOWNLOAD, sock, 0, 0);
+	close(sock);
+	if (ret < 0) {
+		LOG_ERR("HEAD request failed: %d", ret);
+		return ret;
+	}
+	return content_length_;
+}
+
+static int ota_fetch_range(struct ota_range *range) {
+	const int32_t timeout = 120 * MSEC_PER_SEC;
+	const char *headers[] = { range->range_hdr, NULL };
+	struct http_request req;
+	int sock;
+	int ret;
+
+	ret = stream_flash_init(&range->flash, flash_area_get_device(image_area),
+				range->flash_buf, sizeof(range->flash_buf),
+				image_area->fa_off + range->start,
+				image_area->fa_size - range->start, NULL);
+	if (ret != 0) {
+		LOG_ERR("Stream flash init failed: %d", ret);
+		return ret;
+	}
+
+	sock = ota_connect();
+	if (sock < 0) {
+		return -1;
+	}
 
+	memset(&req, 0, sizeof(req));
 	req.method = HTTP_GET;
 	req.url = ota_path_;
 	req.host = OTA_HOST;
 	req.protocol = "HTTP/1.1";
 	req.payload_len = 0;
-	req.payload_cb = NULL;
+	req.payload_cb = http_no_payload_cb;
+	if (range->ranged) {
+		snprintk(range->range_hdr, sizeof(range->range_hdr), "Range: bytes=%zu-%zu\r\n",
+			 range->start, range->end);
+		req.header_fields = headers;
+	}
 	req.response = http_ota_response_cb;
-	req.recv_buf = recv_buf_;
-	req.recv_buf_len = sizeof(recv_buf_);
+	req.recv_buf = range->recv_buf;
+	req.recv_buf_len = sizeof(range->recv_buf);
 
 	// This request is synchronous and blocks the thread.
-	int ret = http_client_req(sock, &req, timeout, "IPv4 GET");
+	ret = http_client_req(sock, &req, timeout, range);
 	if (ret > 0) {
 		LOG_INF("HTTP request sent %d bytes", ret);
-		LOG_INF("Received: %d", total_read_size);
-		if (content_length_ != total_read_size || total_write_size != total_read_size) {
-			LOG_ERR("Content length mismatch. Read: %d\tWrote: %d\tExpected: %d", total_read_size, total_write_size, content_length_);
-		}
-		k_msleep(1000);
 	} else {
 		LOG_ERR("HTTP request failed: %d", ret);
-		k_msleep(1000);
 	}
 
+	data_usage_record(RequestEndpoint_REQUEST_ENDPOINT_OTA_DOWNLOAD, sock, 0,
+			  range->total_read_size);
 	LOG_INF("Closing the socket");
 	close(sock);
+	return ret;
+}
+
+static void ota_range_thread(void *p1, void *p2, void *p3) {
+	struct ota_range *range = p1;
+
+	range->ret = ota_fetch_range(range);
+}
+
+/* Download the image over several connections at once. Each range is fetched
+ * by its own thread and written directly at its offset in slot1, so ranges may
+ * complete in any order.
+ */
+static int ota_download_ranges(size_t image_size, int connections) {
+	size_t range_len = ROUND_UP(DIV_ROUND_UP(image_size, connections), OTA_RANGE_ALIGN);
+	size_t total = 0;
+	int count = 0;
+	int ret = 0;
+
+	for (int i = 0; i < connections && i * range_len < image_size; i++) {
+		struct ota_range *range = &ota_ranges_[i];
+
+		memset(range, 0, offsetof(struct ota_range, flash));
+		range->ranged = true;
+		range->start = i * range_len;
+		range->end = MIN(range->start + range_len, image_size) - 1;
+
+		k_thread_create(&ota_range_threads_[i], ota_range_stacks_[i],
+				K_THREAD_STACK_SIZEOF(ota_range_stacks_[i]),
+				ota_range_thread, range, NULL, NULL,
+				K_PRIO_PREEMPT(5), 0, K_NO_WAIT);
+		char name[sizeof("ota_range99")];
+
+		snprintk(name, sizeof(name), "ota_range%d", i);
+		k_thread_name_set(&ota_range_threads_[i], name);
+		count++;
+	}
+
+	for (int i = 0; i < count; i++) {
+		struct ota_range *range = &ota_ranges_[i];
+
+		k_thread_join(&ota_range_threads_[i], K_FOREVER);
+		if (range->ret <= 0 || range->failed ||
+		    range->total_read_size != range->end - range->start + 1) {
+			LOG_ERR("Range %zu-%zu failed. Read: %zu", range->start, range->end,
+				range->total_read_size);
+			ret = -EIO;
+		}
+		total += range->total_read_size;
+	}
+
+	return ret == 0 ? (int)total : ret;
+}
+
+static int ota_download_single(void) {
+	struct ota_range *range = &ota_ranges_[0];
+	int ret;
+
+	memset(range, 0, offsetof(struct ota_range, flash));
+	content_length_ = 0;
+
+	ret = ota_fetch_range(range);
+	if (ret <= 0) {
+		return -EIO;
+	}
+	if (range->failed || content_length_ != range->total_read_size) {
+		LOG_ERR("Content length mismatch. Read: %zu\tWrote: %zu\tExpected: %d",
+			range->total_read_size, stream_flash_bytes_written(&range->flash),
+			content_length_);
+		return -EIO;
+	}
+	return (int)range->total_read_size;
+}
+
+/* Download the image over the modem's sockets, with the HTTP client running
+ * on the MCU. Sets @p connections to the number of connections used.
+ */
+static int ota_download_sockets(int *connections) {
+	int image_size = 0;
+
+	// Get the IP address of the domain
+	if (get_addr_if_needed(&ota_addr_, OTA_HOST, xstr(OTA_HTTP_PORT)) != 0) {
+		LOG_ERR("DNS lookup failed");
+		return -EHOSTUNREACH;
+	}
+	req_trace_mark(&trace_, REQ_PHASE_DNS);
+
+	ota_state_ = OTAState_OTA_STATE_IN_PROGRESS;
+	if (*connections > 1) {
+		image_size = ota_get_image_size();
+		if (image_size <= 0 || (size_t)image_size > image_area->fa_size) {
+			LOG_WRN("Image size unknown (%d); using a single connection", image_size);
+			*connections = 1;
+		} else if (image_size < *connections * OTA_RANGE_ALIGN) {
+			*connections = 1;
+		}
+	}
+
+	if (*connections > 1) {
+		return ota_download_ranges(image_size, *connections);
+	}
+	return ota_download_single();
+}
+
+#if defined(CONFIG_APP_OTA_MODEM_HTTP)
+// Name of the image in the modem's file system until it is in slot1.
+#define OTA_MODEM_FILE "ota.bin"
+#define OTA_MODEM_TIMEOUT_S 600
+static uint8_t ota_modem_block_[CONFIG_APP_OTA_MODEM_BLOCK_SIZE];
+
+static int ota_modem_write_block(const uint8_t *data, size_t len, void *user_data) {
+	struct ota_range *range = user_data;
+	int err;
+
+	err = stream_flash_buffered_write(&range->flash, data, len, false);
+	if (err != 0) {
+		LOG_ERR("Flash area write failed: %d", err);
+		return err;
+	}
+	range->total_read_size += len;
+	return 0;
+}
+
+/* Have the modem download the image into its own file system, then copy the
+ * file to slot1. While the image comes over the air, the MCU only waits for
+ * the modem to report the result, with nothing on the UART.
+ */
+static int ota_download_modem(void) {
+	struct ota_range *range = &ota_ranges_[0];
+	struct quectel_bg96_http_response rsp;
+	char url[sizeof("http://:65535") + sizeof(OTA_HOST) + sizeof(ota_path_)];
+	int64_t start_ms = k_uptime_get();
+	int64_t fetched_ms;
+	int size;
+	int ret;
+
+	memset(range, 0, offsetof(struct ota_range, flash));
+	ret = stream_flash_init(&range->flash, flash_area_get_device(image_area),
+				range->flash_buf, sizeof(range->flash_buf),
+				image_area->fa_off, image_area->fa_size, NULL);
+	if (ret != 0) {
+		LOG_ERR("Stream flash init failed: %d", ret);
+		goto exit;
+	}
+
+	ota_state_ = OTAState_OTA_STATE_IN_PROGRESS;
+	snprintk(url, sizeof(url), "http://%s:%d%s", OTA_HOST, OTA_HTTP_PORT, ota_path_);
+	ret = quectel_bg96_http_get(url, OTA_MODEM_TIMEOUT_S, &rsp);
+	if (ret < 0) {
+		goto exit;
+	}
+	req_trace_mark(&trace_, REQ_PHASE_FIRST_BYTE);
+	if (rsp.status != 200) {
+		LOG_ERR("Image request failed (status %d)", rsp.status);
+		ret = -EIO;
+		goto exit;
+	}
+
+	size = quectel_bg96_http_read_file(OTA_MODEM_FILE, OTA_MODEM_TIMEOUT_S);
+	if (size < 0) {
+		ret = size;
+		goto exit;
+	}
+	fetched_ms = k_uptime_get() - start_ms;
+	if ((rsp.content_length >= 0 && size != rsp.content_length) ||
+	    (size_t)size > image_area->fa_size) {
+		LOG_ERR("Image size %d does not fit (content length %d)", size,
+			rsp.content_length);
+		ret = -EIO;
+		goto exit;
+	}
+
+	ret = quectel_bg96_file_read(OTA_MODEM_FILE, ota_modem_block_, sizeof(ota_modem_block_),
+				     ota_modem_write_block, range);
+	if (ret >= 0) {
+		ret = stream_flash_buffered_write(&range->flash, NULL, 0, true);
+	}
+	if (ret == 0 && range->total_read_size != (size_t)size) {
+		LOG_ERR("Copied %zu of %d bytes", range->total_read_size, size);
+		ret = -EIO;
+	}
+	if (ret == 0) {
+		LOG_INF("Modem fetched %d bytes in %lld ms; copied to slot1 in %lld ms", size,
+			fetched_ms, k_uptime_get() - start_ms - fetched_ms);
+	} else {
+		LOG_ERR("Copy to slot1 failed: %d", ret);
+	}
+
+exit:
+	(void)quectel_bg96_file_delete(OTA_MODEM_FILE);
+	return ret < 0 ? ret : size;
+}
+#else
+static int ota_download_modem(void) {
+	return -ENOTSUP;
+}
+#endif /* defined(CONFIG_APP_OTA_MODEM_HTTP) */
+
+/* IOTEMBSYS: Implement the HTTP OTA task. The image is fetched by the
+ * modem's HTTP client when @p modem is set, else over sockets.
+ */
+static void http_ota_request(bool modem) {
+	int connections = CONFIG_APP_OTA_RANGE_CONNECTIONS;
+	int64_t start_ms;
+	int64_t elapsed_ms;
+	int64_t rate;
+	int ret;
+
+	LOG_INF("Starting OTA...");
+
+	// Erase a flash area if previously written to.
+	int err = flash_area_open(SLOT1_PARTITION_ID, &image_area);
+	if (err != 0) {
+		LOG_ERR("Flash area open failed");
+		return;
+	}
+	err = flash_area_erase(image_area, 0, image_area->fa_size);
+	if (err != 0) {
+		LOG_ERR("Flash area erase failed");
+		flash_area_close(image_area);
+		return;
+	}
+
+	// The erase is left out of the trace, which covers the network phases.
+	// The two transports are traced as separate endpoints to compare them.
+	req_trace_begin(&trace_, modem ? RequestEndpoint_REQUEST_ENDPOINT_OTA_DOWNLOAD_MODEM :
+					 RequestEndpoint_REQUEST_ENDPOINT_OTA_DOWNLOAD);
+
+	start_ms = k_uptime_get();
+	if (modem) {
+		ret = ota_download_modem();
+	} else {
+		ret = ota_download_sockets(&connections);
+	}
+	elapsed_ms = k_uptime_get() - start_ms;
+	req_trace_end(&trace_, MIN(ret, 0));
+
+	if (ret > 0) {
+		rate = elapsed_ms ? ((int64_t)ret * MSEC_PER_SEC) / elapsed_ms : 0;
+		if (modem) {
+			LOG_INF("OTA received %d bytes in %lld ms through the modem (%lld B/s)",
+				ret, elapsed_ms, rate);
+		} else {
+			LOG_INF("OTA received %d bytes in %lld ms over %d connection(s) (%lld B/s)",
+				ret, elapsed_ms, connections, rate);
+		}
+		ota_state_ = OTAState_OTA_STATE_DOWNLOADED;
+	} else {
+		LOG_ERR("OTA download failed: %d", ret);
+		ota_state_ = OTAState_OTA_STATE_FAILED;
+	}
+	k_msleep(1000);
+
 	LOG_INF("Close image area");
 	flash_area_close(image_area);
 }
@@ -838,23 +1477,39 @@ void http_client_thread(void* p1, void* p2, void* p3) {
 			continue;
 		}
 
+		// Start waking the modem if it sleeps, while the request is prepared.
+		quectel_bg96_wake();
+
 		// Multiple button events are possible, so handle all without exclusion.
 		if (events & (1 << BUTTON_ACTION_GENERIC_HTTP)) {
 			generic_http_request();
 		}
 		if (events & (1 << BUTTON_ACTION_OTA_DOWNLOAD)) {
-			http_ota_request();
+			http_ota_request(false);
+		}
+		if (events & (1 << BUTTON_ACTION_OTA_DOWNLOAD_MODEM)) {
+			http_ota_request(true);
 		}
 		if (events & (1 << BUTTON_ACTION_PROTO_REQ)) {
-			backend_http_request();
+			if (IS_ENABLED(CONFIG_APP_BACKEND_CHECK_IN)) {
+				if (backend_check_in_request()) {
+					http_ota_request(IS_ENABLED(CONFIG_APP_OTA_MODEM_HTTP));
+				}
+			} else {
+				backend_http_request();
+			}
 		}
 		if (events & (1 << BUTTON_ACTION_GET_OTA_PATH)) {
 			backend_ota_http_request();
 		}
+		if (events & (1 << BUTTON_ACTION_OTA_PUSH)) {
+			apply_ota_push();
+			http_ota_request(IS_ENABLED(CONFIG_APP_OTA_MODEM_HTTP));
+		}
 	}
 }
 
-K_THREAD_DEFINE(http_client_tid, 4000 /*stack size*/,
+K_THREAD_DEFINE(http_client_tid, CONFIG_APP_HTTP_CLIENT_STACK_SIZE,
                 http_client_thread, NULL, NULL, NULL,
                 5 /*priority*/, 0, 0);
 
@@ -863,11 +1518,13 @@ void main(void)
 	int ret;
 	const struct device *modem;
 
+	bootprof_mark("main");
 	if (!gpio_is_ready_dt(&led)) {
 		return;
 	}
 
-	ret = gpio_pin_configure_dt(&led, GPIO_OUTPUT_ACTIVE);
+	ret = gpio_pin_configure_dt(&led, IS_ENABLED(CONFIG_APP_LED_BLINK) ?
+				    GPIO_OUTPUT_ACTIVE : GPIO_OUTPUT_INACTIVE);
 	if (ret < 0) {
 		return;
 	}
@@ -890,6 +1547,7 @@ void main(void)
 	settings_subsys_init();
     settings_register(&my_conf);
     settings_load();
+	bootprof_mark("settings");
 
 	/* IOTEMBSYS: Initialize stats subsystem. */
 	ret = STATS_INIT_AND_REG(app_stats, STATS_SIZE_32,
@@ -897,6 +1555,21 @@ void main(void)
 	if (ret < 0) {
 		return;
 	}
+	thread_prof_init();
+	power_stats_init();
+	metricagg_init(metrics_queued);
+#if defined(CONFIG_ADCMON) && DT_NODE_HAS_PROP(DT_PATH(zephyr_user), io_channels)
+	/* Windows of the channels go out as the adcmon<N> stats groups, and
+	 * their means are aggregated as metric <N>.
+	 */
+	if (adcmon_start(adc_channels_, ARRAY_SIZE(adc_channels_), adc_window, NULL) < 0) {
+		LOG_ERR("ADC monitor setup failed");
+	}
+#endif
+	if (tls_session_init() < 0) {
+		LOG_ERR("TLS setup failed");
+	}
+	bootprof_mark("stats");
 
 	/* IOTEMBSYS: Increment boot count. */
 	boot_count++;
@@ -905,27 +1578,24 @@ void main(void)
     LOG_INF("boot_count: %d\n", boot_count);
 
 	/* IOTEMBSYS: Configure joystick GPIOs. */
-	init_joystick_gpio(&sw0, &button_cb_data_0);
-	init_joystick_gpio(&sw1, &button_cb_data_1);
-	init_joystick_gpio(&sw2, &button_cb_data_2);
-	init_joystick_gpio(&sw3, &button_cb_data_3);
-	init_joystick_gpio(&sw4, &button_cb_data_4);
+	if (joystick_init(joystick_event) < 0) {
+		LOG_ERR("Joystick setup failed");
+	}
+	bootprof_mark("joystick");
+	stats_export_init();
 
 	modem = DEVICE_DT_GET(DT_NODELABEL(quectel_bg96));
 	if (!device_is_ready(modem)) {
 		LOG_ERR("Modem is not ready");
 		return;
 	}
+	mqtt_session_start(kDeviceId, &mqtt_handlers_);
+	bootprof_done();
 
+	/* Everything else runs from threads, timers and interrupts, so main
+	 * returns and the CPU idles until one of them has work.
+	 */
 	LOG_INF("Running blinky");
-	while (1) {
-		ret = gpio_pin_toggle_dt(&led);
-		/* IOTEMBSYS: Print GPIO state to console. */
-		if (ret < 0) {
-			return;
-		}
-		STATS_INC(app_stats, ticks);
-		k_msleep(blink_interval_);
-	}
+	change_blink_interval(blink_interval_);
 }
 
@@ -0,0 +1,113 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include <pb_encode.h>
+#include <metricagg/metricagg.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(metric_report, CONFIG_APP_LOG_LEVEL);
+
+#include "metric_report.h"
+
+/* The snapshot taken by the last metric_report_fill(). Only the HTTP
+ * client thread reports, so this is not locked.
+ */
+static struct metricagg_summary summaries_[CONFIG_APP_METRIC_REPORT_MAX];
+static size_t summary_count_;
+static struct metricagg_event events_[CONFIG_APP_METRIC_REPORT_MAX];
+static size_t event_count_;
+static struct metricagg_cursor cursor_;
+static int64_t fill_ms_;
+
+static uint32_t age_ms(int64_t uptime_ms) {
+	return (uint32_t)MAX(fill_ms_ - uptime_ms, 0);
+}
+
+static bool encode_summaries(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+	for (size_t i = 0; i < summary_count_; i++) {
+		const struct metricagg_summary *s = &summaries_[i];
+		MetricSummary entry = {
+			.metric = s->metric,
+			.age_ms = age_ms(s->end_ms),
+			.duration_ms = s->duration_ms,
+			.count = s->count,
+			.min = s->min,
+			.max = s->max,
+			.mean = s->mean,
+			.stddev = s->stddev,
+			.p50 = s->p50,
+			.p90 = s->p90,
+			.p99 = s->p99,
+		};
+
+		if (!pb_encode_tag_for_field(stream, field) ||
+		    !pb_encode_submessage(stream, MetricSummary_fields, &entry)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool encode_events(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+	for (size_t i = 0; i < event_count_; i++) {
+		const struct metricagg_event *e = &events_[i];
+		MetricEvent entry = {
+			.metric = e->metric,
+			.rule = e->rule,
+			.cleared = e->cleared,
+			.value = e->value,
+			.age_ms = age_ms(e->uptime_ms),
+		};
+
+		if (!pb_encode_tag_for_field(stream, field) ||
+		    !pb_encode_submessage(stream, MetricEvent_fields, &entry)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void metric_report_fill(pb_callback_t *summaries, pb_callback_t *events,
+			uint32_t *config_id) {
+	cursor_ = (struct metricagg_cursor){ 0 };
+	fill_ms_ = k_uptime_get();
+	// Windows of metrics that stopped being sampled go out too.
+	metricagg_flush(fill_ms_);
+	summary_count_ = metricagg_summaries_get(summaries_, ARRAY_SIZE(summaries_), &cursor_);
+	event_count_ = metricagg_events_get(events_, ARRAY_SIZE(events_), &cursor_);
+
+	summaries->funcs.encode = summary_count_ > 0 ? encode_summaries : NULL;
+	events->funcs.encode = event_count_ > 0 ? encode_events : NULL;
+	*config_id = metricagg_config_id();
+}
+
+void metric_report_ack(void) {
+	metricagg_ack(&cursor_);
+}
+
+int metric_report_config(const MetricConfig *config) {
+	struct metricagg_rule rules[ARRAY_SIZE(config->rules)];
+	int ret;
+
+	for (pb_size_t i = 0; i < config->rules_count; i++) {
+		const MetricRule *rule = &config->rules[i];
+
+		// Out of range values are left for metricagg_configure() to reject.
+		rules[i] = (struct metricagg_rule){
+			.metric = MIN(rule->metric, UINT8_MAX),
+			.type = MIN((uint32_t)rule->type, UINT8_MAX),
+			.threshold = rule->threshold,
+			.hysteresis = rule->hysteresis,
+		};
+	}
+	ret = metricagg_configure(config->id,
+				  MIN(config->window_s, UINT32_MAX / MSEC_PER_SEC) * MSEC_PER_SEC,
+				  rules, config->rules_count);
+	if (ret < 0) {
+		LOG_WRN("Metric config %08x rejected (%d)", config->id, ret);
+		return ret;
+	}
+	LOG_INF("Metric config %08x: %u s windows, %u rules", config->id, config->window_s,
+		config->rules_count);
+	return 0;
+}
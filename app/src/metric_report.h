@@ -0,0 +1,57 @@
+/*
+ * Reporting of the metric aggregator to the backend.
+ *
+ * The summaries and events queued by the metricagg library are copied
+ * into the request by metric_report_fill() and dropped from the queues by
+ * metric_report_ack() once the backend has them; a failed request leaves
+ * them queued for the next one. The request also carries the ID of the
+ * configuration the device runs, and the backend answers with a
+ * MetricConfig when it wants another one.
+ *
+ * Usage:
+ *
+ *	metric_report_fill(&request.summaries, &request.events,
+ *			   &request.metric_config_id);
+ *	...send the request...
+ *	metric_report_ack();
+ *	if (response.has_metrics) {
+ *		metric_report_config(&response.metrics);
+ *	}
+ */
+
+#ifndef APP_METRIC_REPORT_H
+#define APP_METRIC_REPORT_H
+
+#include <stdint.h>
+
+#include "api/api.pb.h"
+
+#if defined(CONFIG_APP_METRIC_REPORT)
+/**
+ * @brief Snapshot up to CONFIG_APP_METRIC_REPORT_MAX summaries and events
+ * and set up the fields to encode them.
+ *
+ * The fields are only valid until the next call.
+ */
+void metric_report_fill(pb_callback_t *summaries, pb_callback_t *events,
+			uint32_t *config_id);
+
+/**
+ * @brief Drop what the last metric_report_fill() reported from the queues.
+ */
+void metric_report_ack(void);
+
+/**
+ * @brief Apply a configuration sent by the backend.
+ *
+ * @returns 0, or -EINVAL if the aggregator rejected it.
+ */
+int metric_report_config(const MetricConfig *config);
+#else
+static inline void metric_report_fill(pb_callback_t *summaries, pb_callback_t *events,
+				      uint32_t *config_id) {}
+static inline void metric_report_ack(void) {}
+static inline int metric_report_config(const MetricConfig *config) { return 0; }
+#endif /* defined(CONFIG_APP_METRIC_REPORT) */
+
+#endif /* APP_METRIC_REPORT_H */
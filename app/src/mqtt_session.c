@@ -0,0 +1,442 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <errno.h>
+#include <string.h>
+
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include <zephyr/net/mqtt.h>
+#include <zephyr/net/socket.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(mqtt_session, CONFIG_APP_LOG_LEVEL);
+
+#include "data_usage.h"
+#include "mqtt_session.h"
+
+#define MQTT_SESSION_STACK_SIZE 2048
+/* Below the HTTP client thread, which makes the requests. */
+#define MQTT_SESSION_PRIORITY 6
+#define MQTT_SESSION_CONNACK_TIMEOUT_MS (10 * MSEC_PER_SEC)
+#define MQTT_SESSION_RSP_TIMEOUT K_SECONDS(10)
+#define MQTT_TOPIC_ROOT "embsys/"
+#define MQTT_TOPIC_LEN 96
+
+static struct k_thread thread_;
+static K_THREAD_STACK_DEFINE(stack_, MQTT_SESSION_STACK_SIZE);
+
+static struct mqtt_client client_;
+static struct sockaddr_storage broker_;
+/* Only packet headers go through these; payloads are read and written separately. */
+static uint8_t client_rx_buf_[256];
+static uint8_t client_tx_buf_[256];
+static uint8_t payload_rx_[CONFIG_APP_MQTT_PAYLOAD_SIZE];
+static uint8_t payload_tx_[CONFIG_APP_MQTT_PAYLOAD_SIZE];
+
+static char client_id_[sizeof("embsys-") + 64];
+/* "embsys/<device id>/" */
+static char topic_prefix_[sizeof(MQTT_TOPIC_ROOT) + 64 + 1];
+static const struct mqtt_session_handlers *handlers_;
+
+static atomic_t connected_;
+static atomic_t message_id_;
+static bool connack_received_;
+static int connack_result_;
+static bool session_present_;
+
+/* Socket usage at the last request, for the data usage of the connection. */
+static struct quectel_bg96_data_usage usage_mark_;
+
+/* The request waiting for its response. */
+static struct {
+	char topic[MQTT_TOPIC_LEN];
+	const pb_msgdesc_t *fields;
+	void *message;
+	size_t rx_len;
+	int result;
+} pending_;
+static K_MUTEX_DEFINE(pending_lock_);
+static K_SEM_DEFINE(pending_sem_, 0, 1);
+
+static uint16_t mqtt_session_next_id(void)
+{
+	// 0 is not a valid packet identifier.
+	return (uint16_t)(atomic_inc(&message_id_) % UINT16_MAX) + 1;
+}
+
+static bool topic_is(const struct mqtt_utf8 *topic, const char *name)
+{
+	size_t prefix_len = strlen(topic_prefix_);
+	size_t name_len = strlen(name);
+
+	return topic->size == prefix_len + name_len &&
+	       memcmp(topic->utf8, topic_prefix_, prefix_len) == 0 &&
+	       memcmp(topic->utf8 + prefix_len, name, name_len) == 0;
+}
+
+static void mqtt_session_end_pending(int result)
+{
+	k_mutex_lock(&pending_lock_, K_FOREVER);
+	if (pending_.fields != NULL) {
+		pending_.result = result;
+		pending_.fields = NULL;
+		k_sem_give(&pending_sem_);
+	}
+	k_mutex_unlock(&pending_lock_);
+}
+
+static void mqtt_session_on_response(const struct mqtt_utf8 *topic, size_t len)
+{
+	pb_istream_t stream;
+
+	k_mutex_lock(&pending_lock_, K_FOREVER);
+	if (pending_.fields == NULL || topic->size != strlen(pending_.topic) ||
+	    memcmp(topic->utf8, pending_.topic, topic->size) != 0) {
+		k_mutex_unlock(&pending_lock_);
+		LOG_WRN("Dropped a response with no request waiting");
+		return;
+	}
+	stream = pb_istream_from_buffer(payload_rx_, len);
+	pending_.result = pb_decode(&stream, pending_.fields, pending_.message) ? 0 : -EBADMSG;
+	pending_.rx_len = len;
+	pending_.fields = NULL;
+	k_sem_give(&pending_sem_);
+	k_mutex_unlock(&pending_lock_);
+}
+
+static void mqtt_session_dispatch(const struct mqtt_utf8 *topic, size_t len)
+{
+	pb_istream_t stream = pb_istream_from_buffer(payload_rx_, len);
+
+	if (topic_is(topic, "ota")) {
+		OTAUpdateResponse message = OTAUpdateResponse_init_zero;
+
+		if (!pb_decode(&stream, OTAUpdateResponse_fields, &message)) {
+			LOG_ERR("Bad OTA push: %s", PB_GET_ERROR(&stream));
+			return;
+		}
+		LOG_INF("OTA push: do_update %d, path %s", message.do_update, message.path);
+		handlers_->ota(&message);
+	} else if (topic_is(topic, "config")) {
+		DeviceConfig message = DeviceConfig_init_zero;
+
+		if (!pb_decode(&stream, DeviceConfig_fields, &message)) {
+			LOG_ERR("Bad config push: %s", PB_GET_ERROR(&stream));
+			return;
+		}
+		handlers_->config(&message);
+	} else {
+		mqtt_session_on_response(topic, len);
+	}
+}
+
+static int mqtt_session_on_publish(struct mqtt_client *client,
+				   const struct mqtt_publish_param *publish)
+{
+	size_t len = publish->message.payload.len;
+	size_t left = len;
+	int ret;
+
+	// The payload has to be read off the socket even if it is not wanted.
+	while (left > 0) {
+		size_t chunk = MIN(left, sizeof(payload_rx_));
+
+		ret = mqtt_readall_publish_payload(client, payload_rx_, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		left -= chunk;
+	}
+
+	if (len > sizeof(payload_rx_)) {
+		LOG_ERR("Dropped a publish of %zu bytes", len);
+	} else {
+		mqtt_session_dispatch(&publish->message.topic.topic, len);
+	}
+
+	// Acknowledged once handled, so a push is not lost if the device resets first.
+	if (publish->message.topic.qos == MQTT_QOS_1_AT_LEAST_ONCE) {
+		struct mqtt_puback_param ack = {
+			.message_id = publish->message_id,
+		};
+
+		return mqtt_publish_qos1_ack(client, &ack);
+	}
+	return 0;
+}
+
+static void mqtt_session_evt(struct mqtt_client *client, const struct mqtt_evt *evt)
+{
+	switch (evt->type) {
+	case MQTT_EVT_CONNACK:
+		connack_received_ = true;
+		connack_result_ = evt->result;
+		if (evt->result == 0) {
+			session_present_ = evt->param.connack.session_present_flag;
+			atomic_set(&connected_, 1);
+		}
+		break;
+	case MQTT_EVT_DISCONNECT:
+		atomic_set(&connected_, 0);
+		break;
+	case MQTT_EVT_PUBLISH:
+		if (mqtt_session_on_publish(client, &evt->param.publish) < 0) {
+			LOG_ERR("Reading a publish failed");
+		}
+		break;
+	case MQTT_EVT_SUBACK:
+		LOG_INF("Subscribed");
+		break;
+	default:
+		break;
+	}
+}
+
+static int mqtt_session_subscribe(void)
+{
+	char ota[MQTT_TOPIC_LEN];
+	char config[MQTT_TOPIC_LEN];
+	char rsp[MQTT_TOPIC_LEN];
+	struct mqtt_topic topics[] = {
+		{ .topic = { .utf8 = (uint8_t *)ota }, .qos = MQTT_QOS_1_AT_LEAST_ONCE },
+		{ .topic = { .utf8 = (uint8_t *)config }, .qos = MQTT_QOS_1_AT_LEAST_ONCE },
+		{ .topic = { .utf8 = (uint8_t *)rsp }, .qos = MQTT_QOS_1_AT_LEAST_ONCE },
+	};
+	struct mqtt_subscription_list list = {
+		.list = topics,
+		.list_count = ARRAY_SIZE(topics),
+		.message_id = mqtt_session_next_id(),
+	};
+
+	topics[0].topic.size = snprintk(ota, sizeof(ota), "%sota", topic_prefix_);
+	topics[1].topic.size = snprintk(config, sizeof(config), "%sconfig", topic_prefix_);
+	topics[2].topic.size = snprintk(rsp, sizeof(rsp), "%s+/rsp", topic_prefix_);
+	return mqtt_subscribe(&client_, &list);
+}
+
+static int mqtt_session_connect(void)
+{
+	struct zsock_addrinfo hints = {
+		.ai_family = AF_INET,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct zsock_addrinfo *res;
+	struct pollfd pfd = {
+		.events = POLLIN,
+	};
+	int64_t start_ms = k_uptime_get();
+	int ret;
+
+	// Looked up on every connect, as the broker address may have changed.
+	ret = getaddrinfo(CONFIG_APP_BACKEND_HOST, STRINGIFY(CONFIG_APP_MQTT_PORT), &hints, &res);
+	if (ret != 0) {
+		LOG_ERR("DNS lookup failed: %d", ret);
+		return -EHOSTUNREACH;
+	}
+	memcpy(&broker_, res->ai_addr, MIN(res->ai_addrlen, sizeof(broker_)));
+	freeaddrinfo(res);
+
+	mqtt_client_init(&client_);
+	client_.broker = &broker_;
+	client_.evt_cb = mqtt_session_evt;
+	client_.client_id.utf8 = (uint8_t *)client_id_;
+	client_.client_id.size = strlen(client_id_);
+	client_.protocol_version = MQTT_VERSION_3_1_1;
+	client_.rx_buf = client_rx_buf_;
+	client_.rx_buf_size = sizeof(client_rx_buf_);
+	client_.tx_buf = client_tx_buf_;
+	client_.tx_buf_size = sizeof(client_tx_buf_);
+	client_.keepalive = CONFIG_APP_MQTT_KEEPALIVE_S;
+	client_.clean_session = 0;
+	client_.transport.type = MQTT_TRANSPORT_NON_SECURE;
+
+	connack_received_ = false;
+	ret = mqtt_connect(&client_);
+	if (ret < 0) {
+		LOG_ERR("Connecting to the broker failed: %d", ret);
+		return ret;
+	}
+	memset(&usage_mark_, 0, sizeof(usage_mark_));
+
+	pfd.fd = client_.transport.tcp.sock;
+	while (!connack_received_) {
+		ret = poll(&pfd, 1, MQTT_SESSION_CONNACK_TIMEOUT_MS);
+		if (ret <= 0) {
+			ret = ret < 0 ? -errno : -ETIMEDOUT;
+			break;
+		}
+		ret = mqtt_input(&client_);
+		if (ret < 0) {
+			break;
+		}
+	}
+	if (ret == 0 && connack_result_ != 0) {
+		LOG_ERR("The broker refused the connection: %d", connack_result_);
+		ret = -ECONNREFUSED;
+	}
+	// The broker kept the subscriptions of a resumed session.
+	if (ret == 0 && !session_present_) {
+		ret = mqtt_session_subscribe();
+	}
+	if (ret < 0) {
+		mqtt_abort(&client_);
+		return ret;
+	}
+
+	LOG_INF("MQTT connected in %lld ms, %s session, keepalive %u s",
+		k_uptime_get() - start_ms, session_present_ ? "resumed" : "new",
+		CONFIG_APP_MQTT_KEEPALIVE_S);
+	return 0;
+}
+
+/* Service the connection until it fails. */
+static int mqtt_session_run(void)
+{
+	struct pollfd pfd = {
+		.fd = client_.transport.tcp.sock,
+		.events = POLLIN,
+	};
+	int ret = 0;
+
+	while (atomic_get(&connected_)) {
+		ret = poll(&pfd, 1, mqtt_keepalive_time_left(&client_));
+		if (ret < 0) {
+			ret = -errno;
+			break;
+		}
+		if (ret > 0) {
+			if (pfd.revents & (POLLHUP | POLLERR)) {
+				ret = -ENOTCONN;
+				break;
+			}
+			ret = mqtt_input(&client_);
+			if (ret < 0) {
+				break;
+			}
+		}
+		// A ping still unanswered at the next one means the NAT or the
+		// broker dropped the connection.
+		if (client_.unacked_ping > 1) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+		ret = mqtt_live(&client_);
+		if (ret < 0 && ret != -EAGAIN) {
+			break;
+		}
+		ret = 0;
+	}
+	mqtt_abort(&client_);
+	return ret;
+}
+
+static void mqtt_session_thread(void *p1, void *p2, void *p3)
+{
+	uint32_t backoff_s = 1;
+
+	while (true) {
+		int ret = mqtt_session_connect();
+
+		if (ret == 0) {
+			backoff_s = 1;
+			ret = mqtt_session_run();
+		}
+		atomic_set(&connected_, 0);
+		mqtt_session_end_pending(-ENOTCONN);
+
+		LOG_WRN("MQTT session down (%d), reconnecting in %u s", ret, backoff_s);
+		k_sleep(K_SECONDS(backoff_s));
+		backoff_s = MIN(backoff_s * 2, CONFIG_APP_MQTT_RECONNECT_MAX_S);
+	}
+}
+
+void mqtt_session_start(const char *device_id, const struct mqtt_session_handlers *handlers)
+{
+	handlers_ = handlers;
+	snprintk(client_id_, sizeof(client_id_), "embsys-%s", device_id);
+	snprintk(topic_prefix_, sizeof(topic_prefix_), MQTT_TOPIC_ROOT "%s/", device_id);
+
+	k_thread_create(&thread_, stack_, K_THREAD_STACK_SIZEOF(stack_),
+			mqtt_session_thread, NULL, NULL, NULL,
+			MQTT_SESSION_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&thread_, "mqtt_session");
+}
+
+bool mqtt_session_connected(void)
+{
+	return atomic_get(&connected_);
+}
+
+int mqtt_session_request(RequestEndpoint endpoint, const char *name,
+			 const pb_msgdesc_t *request_fields, const void *request,
+			 const pb_msgdesc_t *response_fields, void *response,
+			 struct req_trace *trace)
+{
+	char topic[MQTT_TOPIC_LEN];
+	struct mqtt_publish_param param = { 0 };
+	pb_ostream_t stream;
+	int64_t start_ms = k_uptime_get();
+	size_t rx_len;
+	size_t size;
+	int ret;
+
+	if (!atomic_get(&connected_)) {
+		return -ENOTCONN;
+	}
+	if (!pb_get_encoded_size(&size, request_fields, request)) {
+		return -EINVAL;
+	}
+	if (size > sizeof(payload_tx_)) {
+		return -EMSGSIZE;
+	}
+	stream = pb_ostream_from_buffer(payload_tx_, sizeof(payload_tx_));
+	if (!pb_encode(&stream, request_fields, request)) {
+		LOG_ERR("Encoding failed: %s", PB_GET_ERROR(&stream));
+		return -EINVAL;
+	}
+
+	// The connection is already up, so the DNS, socket and connect phases are skipped.
+	req_trace_begin(trace, endpoint);
+	snprintk(topic, sizeof(topic), "%s%s", topic_prefix_, name);
+
+	k_mutex_lock(&pending_lock_, K_FOREVER);
+	snprintk(pending_.topic, sizeof(pending_.topic), "%s/rsp", topic);
+	pending_.fields = response_fields;
+	pending_.message = response;
+	pending_.rx_len = 0;
+	pending_.result = -ETIMEDOUT;
+	k_sem_reset(&pending_sem_);
+	k_mutex_unlock(&pending_lock_);
+
+	param.message.topic.topic.utf8 = (uint8_t *)topic;
+	param.message.topic.topic.size = strlen(topic);
+	param.message.topic.qos = MQTT_QOS_1_AT_LEAST_ONCE;
+	param.message.payload.data = payload_tx_;
+	param.message.payload.len = stream.bytes_written;
+	param.message_id = mqtt_session_next_id();
+
+	ret = mqtt_publish(&client_, &param);
+	if (ret == 0) {
+		req_trace_mark(trace, REQ_PHASE_SENT);
+		(void)k_sem_take(&pending_sem_, MQTT_SESSION_RSP_TIMEOUT);
+	}
+
+	k_mutex_lock(&pending_lock_, K_FOREVER);
+	pending_.fields = NULL;
+	ret = ret < 0 ? ret : pending_.result;
+	rx_len = pending_.rx_len;
+	k_mutex_unlock(&pending_lock_);
+
+	if (ret == 0) {
+		req_trace_mark(trace, REQ_PHASE_FIRST_BYTE);
+	}
+	if (atomic_get(&connected_)) {
+		data_usage_record_since(endpoint, client_.transport.tcp.sock, &usage_mark_,
+					stream.bytes_written, rx_len);
+	}
+	req_trace_end(trace, ret);
+
+	LOG_INF("mqtt %s: %zu bytes sent, %zu bytes received in %lld ms", name,
+		stream.bytes_written, rx_len, k_uptime_get() - start_ms);
+	return ret;
+}
@@ -0,0 +1,82 @@
+/*
+ * A persistent MQTT session with the backend.
+ *
+ * One long-lived connection to the broker replaces polling for updates. The
+ * backend pushes OTA notifications and config changes to per-device topics
+ * as they happen, and check-ins are published on the same connection. The
+ * session is not clean, so the broker keeps the subscriptions and queues
+ * QoS 1 pushes while the device is offline, and delivers them when it
+ * reconnects. The keepalive is kept below the idle timeout of the carrier
+ * NAT so the connection is not dropped silently while it is idle.
+ *
+ * Topics, under embsys/<device id>/:
+ *
+ *  ota             OTAUpdateResponse pushed by the backend
+ *  config          DeviceConfig pushed by the backend
+ *  <name>          a request published by mqtt_session_request()
+ *  <name>/rsp      the response of the backend to it
+ *
+ * Usage:
+ *
+ *	mqtt_session_start(device_id, &handlers);
+ *	...
+ *	if (mqtt_session_connected()) {
+ *		ret = mqtt_session_request(RequestEndpoint_REQUEST_ENDPOINT_CHECK_IN_MQTT,
+ *					   "check_in", CheckInRequest_fields, &request,
+ *					   CheckInResponse_fields, &response, &trace);
+ *	}
+ */
+
+#ifndef APP_MQTT_SESSION_H
+#define APP_MQTT_SESSION_H
+
+#include <errno.h>
+#include <stdbool.h>
+
+#include "api/api.pb.h"
+#include "req_trace.h"
+
+/* Called from the session thread for each push. */
+struct mqtt_session_handlers {
+	void (*ota)(const OTAUpdateResponse *message);
+	void (*config)(const DeviceConfig *message);
+};
+
+#if defined(CONFIG_APP_MQTT)
+/** @brief Start the thread that holds the session, reconnecting as needed. */
+void mqtt_session_start(const char *device_id, const struct mqtt_session_handlers *handlers);
+
+bool mqtt_session_connected(void);
+
+/**
+ * @brief Publish @p request on the topic @p name and wait for the response
+ * on <name>/rsp. Requests are made one at a time.
+ *
+ * @retval 0 if a response was decoded into @p response.
+ * @retval -ENOTCONN if the session is down, or went down before the response.
+ * @retval -EMSGSIZE if the request is larger than CONFIG_APP_MQTT_PAYLOAD_SIZE;
+ * nothing was sent.
+ * @retval -ETIMEDOUT if no response came.
+ * @retval -EBADMSG if the response did not decode.
+ */
+int mqtt_session_request(RequestEndpoint endpoint, const char *name,
+			 const pb_msgdesc_t *request_fields, const void *request,
+			 const pb_msgdesc_t *response_fields, void *response,
+			 struct req_trace *trace);
+#else
+static inline void mqtt_session_start(const char *device_id,
+				      const struct mqtt_session_handlers *handlers) {}
+static inline bool mqtt_session_connected(void)
+{
+	return false;
+}
+static inline int mqtt_session_request(RequestEndpoint endpoint, const char *name,
+				       const pb_msgdesc_t *request_fields, const void *request,
+				       const pb_msgdesc_t *response_fields, void *response,
+				       struct req_trace *trace)
+{
+	return -ENOTCONN;
+}
+#endif /* defined(CONFIG_APP_MQTT) */
+
+#endif /* APP_MQTT_SESSION_H */
@@ -0,0 +1,174 @@
+#include <zephyr/kernel.h>
+#include <zephyr/pm/pm.h>
+#include <zephyr/pm/state.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(power_stats, CONFIG_APP_LOG_LEVEL);
+
+#include "power_stats.h"
+
+/* STOP0 to STOP2 are substates 1 to 3 of PM_STATE_SUSPEND_TO_IDLE. */
+#define POWER_STATS_STOP_MODES 3
+
+STATS_SECT_START(power)
+STATS_SECT_ENTRY(wakeups)
+/* Wakeups in the last second of uptime that had any, and the most in one. */
+STATS_SECT_ENTRY(wakeups_last_s)
+STATS_SECT_ENTRY(wakeups_max_s)
+/* Uptime not spent in a power state, WFI idle included. */
+STATS_SECT_ENTRY(run_ms)
+STATS_SECT_ENTRY(stop0_ms)
+STATS_SECT_ENTRY(stop1_ms)
+STATS_SECT_ENTRY(stop2_ms)
+/* Any other power state. */
+STATS_SECT_ENTRY(other_ms)
+STATS_SECT_END;
+
+STATS_NAME_START(power)
+STATS_NAME(power, wakeups)
+STATS_NAME(power, wakeups_last_s)
+STATS_NAME(power, wakeups_max_s)
+STATS_NAME(power, run_ms)
+STATS_NAME(power, stop0_ms)
+STATS_NAME(power, stop1_ms)
+STATS_NAME(power, stop2_ms)
+STATS_NAME(power, other_ms)
+STATS_NAME_END(power);
+
+static STATS_SECT_DECL(power) power_stats_;
+
+/* Entries into each stop mode, and into other states. */
+static uint32_t stop_entries_[POWER_STATS_STOP_MODES];
+static uint32_t other_entries_;
+
+/* State being entered, as an index into stop_entries_, or -1 for others. */
+static int cur_stop_;
+static int64_t entry_ticks_;
+/* Time in power states in ticks, which stop the ms values drifting. */
+static int64_t stop_ticks_[POWER_STATS_STOP_MODES];
+static int64_t other_ticks_;
+
+static int64_t cur_second_;
+static uint32_t cur_second_wakeups_;
+
+static struct k_spinlock lock_;
+
+static uint32_t ticks_ms(int64_t ticks) {
+	return (uint32_t)k_ticks_to_ms_floor64(ticks);
+}
+
+static void update_run(int64_t now) {
+	int64_t idle = other_ticks_;
+
+	for (int i = 0; i < POWER_STATS_STOP_MODES; i++) {
+		idle += stop_ticks_[i];
+	}
+	STATS_SET(power_stats_, run_ms, ticks_ms(now - idle));
+}
+
+// Called from the idle thread with interrupts locked, right before the SoC
+// enters the state.
+static void state_entry(enum pm_state state) {
+	const struct pm_state_info *info = pm_state_next_get(0);
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+
+	cur_stop_ = -1;
+	if (state == PM_STATE_SUSPEND_TO_IDLE && info != NULL &&
+	    info->substate_id >= 1 && info->substate_id <= POWER_STATS_STOP_MODES) {
+		cur_stop_ = info->substate_id - 1;
+		stop_entries_[cur_stop_]++;
+	} else {
+		other_entries_++;
+	}
+	entry_ticks_ = k_uptime_ticks();
+	k_spin_unlock(&lock_, key);
+}
+
+// Called once the SoC is back, before the interrupt that woke it is served.
+static void state_exit(enum pm_state state) {
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+	int64_t now = k_uptime_ticks();
+	int64_t second = k_ticks_to_ms_floor64(now) / MSEC_PER_SEC;
+
+	if (cur_stop_ >= 0) {
+		stop_ticks_[cur_stop_] += now - entry_ticks_;
+	} else {
+		other_ticks_ += now - entry_ticks_;
+	}
+
+	if (second != cur_second_) {
+		if (cur_second_wakeups_ > 0) {
+			STATS_SET(power_stats_, wakeups_last_s, cur_second_wakeups_);
+		}
+		cur_second_ = second;
+		cur_second_wakeups_ = 0;
+	}
+	cur_second_wakeups_++;
+	if (cur_second_wakeups_ > power_stats_.wakeups_max_s) {
+		STATS_SET(power_stats_, wakeups_max_s, cur_second_wakeups_);
+	}
+	STATS_INC(power_stats_, wakeups);
+
+	STATS_SET(power_stats_, stop0_ms, ticks_ms(stop_ticks_[0]));
+	STATS_SET(power_stats_, stop1_ms, ticks_ms(stop_ticks_[1]));
+	STATS_SET(power_stats_, stop2_ms, ticks_ms(stop_ticks_[2]));
+	STATS_SET(power_stats_, other_ms, ticks_ms(other_ticks_));
+	update_run(now);
+	k_spin_unlock(&lock_, key);
+}
+
+static struct pm_notifier notifier_ = {
+	.state_entry = state_entry,
+	.state_exit = state_exit,
+};
+
+void power_stats_init(void) {
+	int ret = STATS_INIT_AND_REG(power_stats_, STATS_SIZE_32, "power");
+
+	if (ret < 0) {
+		LOG_ERR("Registering power stats failed: %d", ret);
+		return;
+	}
+	pm_notifier_register(&notifier_);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_power_stats(const struct shell *sh, size_t argc, char **argv) {
+	static const char *const names[POWER_STATS_STOP_MODES] = { "stop0", "stop1", "stop2" };
+	uint32_t stop_ms[POWER_STATS_STOP_MODES];
+	uint32_t stop_entries[POWER_STATS_STOP_MODES];
+	uint32_t other_ms, other_entries, uptime_s;
+	STATS_SECT_DECL(power) stats;
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+	int64_t now = k_uptime_ticks();
+
+	update_run(now);
+	stats = power_stats_;
+	for (int i = 0; i < POWER_STATS_STOP_MODES; i++) {
+		stop_ms[i] = ticks_ms(stop_ticks_[i]);
+		stop_entries[i] = stop_entries_[i];
+	}
+	other_ms = ticks_ms(other_ticks_);
+	other_entries = other_entries_;
+	k_spin_unlock(&lock_, key);
+
+	uptime_s = MAX(ticks_ms(now) / MSEC_PER_SEC, 1);
+	shell_print(sh, "wakeups: %u (%u.%02u/s since boot, last %u/s, max %u/s)",
+		    stats.wakeups, stats.wakeups / uptime_s,
+		    stats.wakeups * 100 / uptime_s % 100,
+		    stats.wakeups_last_s, stats.wakeups_max_s);
+	shell_print(sh, "%-6s %10s %8s", "state", "ms", "entries");
+	shell_print(sh, "%-6s %10u %8s", "run", stats.run_ms, "-");
+	for (int i = 0; i < POWER_STATS_STOP_MODES; i++) {
+		shell_print(sh, "%-6s %10u %8u", names[i], stop_ms[i], stop_entries[i]);
+	}
+	shell_print(sh, "%-6s %10u %8u", "other", other_ms, other_entries);
+	return 0;
+}
+
+SHELL_CMD_REGISTER(power_stats, NULL, "Show time in each power state and wakeups",
+		   cmd_power_stats);
+#endif /* defined(CONFIG_SHELL) */
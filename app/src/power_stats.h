@@ -0,0 +1,30 @@
+/*
+ * Time spent in each system power state, and wakeups from them.
+ *
+ * A PM notifier sees every entry into and exit from a power state. The
+ * STM32L4 stop modes are all PM_STATE_SUSPEND_TO_IDLE, told apart by their
+ * substate: 1 to 3 for STOP0 to STOP2. Each exit is a wakeup, and wakeups
+ * are also counted per second of uptime, so a busy wake source shows up as
+ * a high per-second count even when the total looks small. Idle time spent
+ * in plain WFI, when the PM policy keeps the stop modes out, is not seen
+ * and counts as run time.
+ *
+ * The counters are the "power" stats group, which goes out with the status
+ * update, and the "power_stats" shell command prints them.
+ *
+ * Usage:
+ *
+ *	power_stats_init();
+ */
+
+#ifndef APP_POWER_STATS_H
+#define APP_POWER_STATS_H
+
+#if defined(CONFIG_APP_POWER_STATS)
+/** @brief Register the "power" stats group and the PM notifier. */
+void power_stats_init(void);
+#else
+static inline void power_stats_init(void) {}
+#endif /* defined(CONFIG_APP_POWER_STATS) */
+
+#endif /* APP_POWER_STATS_H */
@@ -0,0 +1,297 @@
+#include <zephyr/kernel.h>
+#include <errno.h>
+#include <string.h>
+
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include <zephyr/net/socket.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(proto_stream, CONFIG_APP_LOG_LEVEL);
+
+#include "proto_stream.h"
+
+#define PROTO_DECODER_STACK_SIZE 1536
+
+/* Every socket write is an AT+QISEND round trip on the modem, so encoder
+ * output is coalesced into sends of up to this many bytes.
+ */
+#define PROTO_SEND_LEN 256
+/* Room for a "%04x\r\n" chunk header before the data. */
+#define PROTO_CHUNK_HDR_LEN 6
+#define PROTO_CHUNK_END "\r\n"
+#define PROTO_LAST_CHUNK "0\r\n\r\n"
+
+struct proto_frag {
+	const uint8_t *data;
+	size_t len;
+};
+
+/* A fragment with no data marks the end of the body. */
+K_MSGQ_DEFINE(decoder_frags_, sizeof(struct proto_frag), 1, 4);
+/* Given when the decoder is done with the fragment it was handed. */
+static K_SEM_DEFINE(decoder_consumed_, 0, 1);
+static K_MUTEX_DEFINE(decoder_lock_);
+static K_THREAD_STACK_DEFINE(decoder_stack_, PROTO_DECODER_STACK_SIZE);
+static struct k_thread decoder_thread_;
+
+static struct {
+	const pb_msgdesc_t *fields;
+	void *dest;
+	bool active;
+	bool eof;
+	bool status;
+	size_t bytes;
+	/* The fragment currently being read; NULL when none is held. */
+	const uint8_t *cur;
+	size_t cur_len;
+} decoder_;
+
+static void release_fragment(void) {
+	if (decoder_.cur != NULL) {
+		decoder_.cur = NULL;
+		decoder_.cur_len = 0;
+		k_sem_give(&decoder_consumed_);
+	}
+}
+
+/* nanopb input callback; blocks until the HTTP client has more body data. */
+static bool fragment_read(pb_istream_t *stream, pb_byte_t *buf, size_t count) {
+	while (count > 0) {
+		if (decoder_.cur_len == 0) {
+			struct proto_frag frag;
+
+			release_fragment();
+			k_msgq_get(&decoder_frags_, &frag, K_FOREVER);
+			if (frag.len == 0) {
+				/* Tell nanopb this is the end of the stream, not an error. */
+				decoder_.eof = true;
+				stream->bytes_left = 0;
+				return false;
+			}
+			decoder_.cur = frag.data;
+			decoder_.cur_len = frag.len;
+		}
+
+		size_t n = MIN(count, decoder_.cur_len);
+
+		memcpy(buf, decoder_.cur, n);
+		decoder_.cur += n;
+		decoder_.cur_len -= n;
+		buf += n;
+		count -= n;
+	}
+	return true;
+}
+
+static void decoder_thread(void *p1, void *p2, void *p3) {
+	pb_istream_t stream = {
+		.callback = fragment_read,
+		.state = NULL,
+		.bytes_left = SIZE_MAX,
+	};
+
+	decoder_.status = pb_decode(&stream, decoder_.fields, decoder_.dest);
+	if (!decoder_.status) {
+		LOG_ERR("Decoding failed: %s", PB_GET_ERROR(&stream));
+	}
+
+	/* Discard whatever follows the message so the HTTP client never blocks. */
+	release_fragment();
+	while (!decoder_.eof) {
+		struct proto_frag frag;
+
+		k_msgq_get(&decoder_frags_, &frag, K_FOREVER);
+		if (frag.len == 0) {
+			decoder_.eof = true;
+		} else {
+			k_sem_give(&decoder_consumed_);
+		}
+	}
+}
+
+void proto_decode_begin(const pb_msgdesc_t *fields, void *dest) {
+	k_mutex_lock(&decoder_lock_, K_FOREVER);
+
+	memset(&decoder_, 0, sizeof(decoder_));
+	decoder_.fields = fields;
+	decoder_.dest = dest;
+	decoder_.active = true;
+	k_msgq_purge(&decoder_frags_);
+	k_sem_reset(&decoder_consumed_);
+
+	k_thread_create(&decoder_thread_, decoder_stack_,
+			K_THREAD_STACK_SIZEOF(decoder_stack_),
+			decoder_thread, NULL, NULL, NULL,
+			k_thread_priority_get(k_current_get()), 0, K_NO_WAIT);
+	k_thread_name_set(&decoder_thread_, "proto_decoder");
+}
+
+void proto_decode_feed(const uint8_t *data, size_t len) {
+	struct proto_frag frag = { .data = data, .len = len };
+
+	if (!decoder_.active || data == NULL || len == 0) {
+		return;
+	}
+
+	decoder_.bytes += len;
+	k_msgq_put(&decoder_frags_, &frag, K_FOREVER);
+	k_sem_take(&decoder_consumed_, K_FOREVER);
+}
+
+bool proto_decode_end(void) {
+	struct proto_frag end = { .data = NULL, .len = 0 };
+	bool status;
+
+	if (!decoder_.active) {
+		return false;
+	}
+
+	k_msgq_put(&decoder_frags_, &end, K_FOREVER);
+	k_thread_join(&decoder_thread_, K_FOREVER);
+
+	decoder_.active = false;
+	status = decoder_.status;
+	if (decoder_.bytes == 0) {
+		LOG_WRN("Message length is 0");
+		status = false;
+	} else {
+		LOG_INF("Decoded %zu byte message", decoder_.bytes);
+	}
+
+	k_mutex_unlock(&decoder_lock_);
+	return status;
+}
+
+struct socket_ostream {
+	int sock;
+	bool chunked;
+	int sent;
+	size_t len;
+	uint8_t buf[PROTO_CHUNK_HDR_LEN + PROTO_SEND_LEN + sizeof(PROTO_CHUNK_END) - 1 +
+		    sizeof(PROTO_LAST_CHUNK) - 1];
+};
+
+static int sendall(int sock, const uint8_t *buf, size_t len) {
+	while (len > 0) {
+		ssize_t out = send(sock, buf, len, 0);
+
+		if (out < 0) {
+			return -errno;
+		}
+		buf += out;
+		len -= out;
+	}
+	return 0;
+}
+
+/* Write out the buffered data, framed as a chunk when chunked encoding is
+ * used. The last chunk also carries the terminating zero-length chunk so
+ * the body ends with no extra send.
+ */
+static int socket_ostream_flush(struct socket_ostream *out, bool last) {
+	uint8_t *start = out->buf + PROTO_CHUNK_HDR_LEN;
+	size_t len = out->len;
+	int ret;
+
+	if (out->chunked) {
+		if (len > 0) {
+			char hdr[PROTO_CHUNK_HDR_LEN + 1];
+
+			snprintk(hdr, sizeof(hdr), "%04x\r\n", (unsigned int)len);
+			start = out->buf;
+			memcpy(start, hdr, PROTO_CHUNK_HDR_LEN);
+			len += PROTO_CHUNK_HDR_LEN;
+			memcpy(start + len, PROTO_CHUNK_END, sizeof(PROTO_CHUNK_END) - 1);
+			len += sizeof(PROTO_CHUNK_END) - 1;
+		}
+		if (last) {
+			memcpy(start + len, PROTO_LAST_CHUNK, sizeof(PROTO_LAST_CHUNK) - 1);
+			len += sizeof(PROTO_LAST_CHUNK) - 1;
+		}
+	}
+
+	ret = sendall(out->sock, start, len);
+	if (ret < 0) {
+		return ret;
+	}
+	out->sent += len;
+	out->len = 0;
+	return 0;
+}
+
+static bool socket_ostream_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count) {
+	struct socket_ostream *out = stream->state;
+
+	while (count > 0) {
+		size_t n = MIN(count, PROTO_SEND_LEN - out->len);
+
+		memcpy(out->buf + PROTO_CHUNK_HDR_LEN + out->len, buf, n);
+		out->len += n;
+		buf += n;
+		count -= n;
+
+		if (out->len == PROTO_SEND_LEN && socket_ostream_flush(out, false) < 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int proto_payload_cb(int sock, struct http_request *req, void *user_data) {
+	struct proto_payload *payload = user_data;
+	struct socket_ostream out = {
+		.sock = sock,
+		.chunked = IS_ENABLED(CONFIG_APP_PROTO_CHUNKED_PAYLOAD),
+	};
+	pb_ostream_t stream = {
+		.callback = socket_ostream_write,
+		.state = &out,
+		.max_size = SIZE_MAX,
+	};
+	int ret;
+
+	if (!pb_encode(&stream, payload->fields, payload->message)) {
+		LOG_ERR("Encoding failed: %s", PB_GET_ERROR(&stream));
+		return -EIO;
+	}
+
+	ret = socket_ostream_flush(&out, true);
+	if (ret < 0) {
+		LOG_ERR("Sending payload failed: %d", ret);
+		return ret;
+	}
+
+	payload->bytes = stream.bytes_written;
+	LOG_INF("Sent %zu byte proto (%d bytes on the wire)", stream.bytes_written, out.sent);
+	return out.sent;
+}
+
+int proto_payload_setup(struct http_request *req, struct proto_payload *payload) {
+	req->payload_cb = proto_payload_cb;
+	payload->bytes = 0;
+
+	if (IS_ENABLED(CONFIG_APP_PROTO_CHUNKED_PAYLOAD)) {
+		size_t count = 0;
+
+		for (const char **hdr = req->header_fields; hdr != NULL && *hdr != NULL; hdr++) {
+			if (count == PROTO_PAYLOAD_MAX_HEADERS) {
+				LOG_ERR("Too many request headers");
+				return -ENOMEM;
+			}
+			payload->headers[count++] = *hdr;
+		}
+		payload->headers[count++] = "Transfer-Encoding: chunked\r\n";
+		payload->headers[count] = NULL;
+		req->header_fields = payload->headers;
+		req->payload_len = 0;
+		return 0;
+	}
+
+	if (!pb_get_encoded_size(&payload->bytes, payload->fields, payload->message)) {
+		LOG_ERR("Sizing request failed");
+		return -EINVAL;
+	}
+	req->payload_len = payload->bytes;
+	return 0;
+}
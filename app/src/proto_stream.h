@@ -0,0 +1,101 @@
+/*
+ * Streaming nanopb helpers for HTTP bodies.
+ *
+ * The HTTP client hands the response body over in fragments, each only
+ * valid for the duration of one response callback. Rather than reassembling
+ * the body, the message is decoded on a helper thread whose input stream
+ * pulls directly from those fragments, so the decoder state carries over
+ * from one callback to the next.
+ *
+ * Usage, from the thread making the request:
+ *
+ *	proto_decode_begin(MyMessage_fields, &message);
+ *	http_client_req(...);          // response cb calls proto_decode_feed()
+ *	if (proto_decode_end()) { ...use message... }
+ *
+ * Only one decode can be in progress at a time; proto_decode_begin() blocks
+ * until the previous one has ended.
+ *
+ * Requests are encoded the same way in the other direction: the HTTP
+ * client's payload callback runs pb_encode with an output stream that
+ * writes to the socket, so the request body is never staged in RAM.
+ *
+ *	struct proto_payload payload = { MyRequest_fields, &request };
+ *	proto_payload_setup(&req, &payload);
+ *	http_client_req(sock, &req, timeout, &payload);
+ */
+
+#ifndef APP_PROTO_STREAM_H
+#define APP_PROTO_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pb.h>
+#include <zephyr/net/http/client.h>
+
+/* Headers a caller may set on a request with a proto_payload body. */
+#define PROTO_PAYLOAD_MAX_HEADERS 4
+
+/* A request message to be encoded into an HTTP request body. */
+struct proto_payload {
+	const pb_msgdesc_t *fields;
+	const void *message;
+	/* Encoded size of the message. Set by proto_payload_setup() unless the
+	 * body is chunked, and by proto_payload_cb() once it is sent.
+	 */
+	size_t bytes;
+	/* The caller's headers followed by the Transfer-Encoding header. */
+	const char *headers[PROTO_PAYLOAD_MAX_HEADERS + 2];
+};
+
+/**
+ * @brief Start decoding a message that will arrive in fragments.
+ *
+ * @param fields Message descriptor, e.g. StatusUpdateResponse_fields.
+ * @param dest Message to decode into. Must stay valid until proto_decode_end().
+ */
+void proto_decode_begin(const pb_msgdesc_t *fields, void *dest);
+
+/**
+ * @brief Pass the next body fragment to the decoder.
+ *
+ * Blocks until the decoder has consumed the fragment, so @p data only needs
+ * to be valid for the duration of the call. Does nothing if no decode is in
+ * progress or @p len is 0.
+ */
+void proto_decode_feed(const uint8_t *data, size_t len);
+
+/**
+ * @brief Mark the end of the body and wait for the decode to complete.
+ *
+ * @returns true if a non-empty message was decoded successfully.
+ */
+bool proto_decode_end(void);
+
+/**
+ * @brief Configure an HTTP request to send @p payload as its body.
+ *
+ * Sets the payload callback, and either the Content-Length (from
+ * pb_get_encoded_size()) or, with CONFIG_APP_PROTO_CHUNKED_PAYLOAD, a
+ * chunked Transfer-Encoding header after any headers already set on
+ * @p req; the message is then not sized. @p payload must be passed as the
+ * user_data of http_client_req().
+ *
+ * @returns 0, or a negative errno.
+ */
+int proto_payload_setup(struct http_request *req, struct proto_payload *payload);
+
+/**
+ * @brief HTTP payload callback that encodes the message into the socket.
+ *
+ * Installed by proto_payload_setup().
+ *
+ * Sets the encoded size in the proto_payload.
+ *
+ * @returns The number of bytes written to the socket, or a negative errno.
+ */
+int proto_payload_cb(int sock, struct http_request *req, void *user_data);
+
+#endif /* APP_PROTO_STREAM_H */
@@ -0,0 +1,233 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include <zephyr/shell/shell.h>
+#include <evtrace/evtrace.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(req_trace, CONFIG_APP_LOG_LEVEL);
+
+#include "req_trace.h"
+
+/* Marks the phase durations of a window slot that were not reached. */
+#define PHASE_MS_NONE UINT16_MAX
+
+static const char *const phase_names[REQ_PHASE_COUNT] = {
+	[REQ_PHASE_DNS] = "dns",
+	[REQ_PHASE_SOCKET] = "socket",
+	[REQ_PHASE_CONNECT] = "connect",
+	[REQ_PHASE_TLS] = "tls",
+	[REQ_PHASE_SENT] = "sent",
+	[REQ_PHASE_FIRST_BYTE] = "first_byte",
+	[REQ_PHASE_DONE] = "done",
+};
+
+static const char *const endpoint_names[_RequestEndpoint_ARRAYSIZE] = {
+	[RequestEndpoint_REQUEST_ENDPOINT_UNKNOWN] = "unknown",
+	[RequestEndpoint_REQUEST_ENDPOINT_GENERIC] = "generic",
+	[RequestEndpoint_REQUEST_ENDPOINT_STATUS_UPDATE] = "status_update",
+	[RequestEndpoint_REQUEST_ENDPOINT_OTA_CHECK] = "ota_check",
+	[RequestEndpoint_REQUEST_ENDPOINT_CHECK_IN] = "check_in",
+	[RequestEndpoint_REQUEST_ENDPOINT_OTA_DOWNLOAD] = "ota_download",
+	[RequestEndpoint_REQUEST_ENDPOINT_CHECK_IN_COAP] = "check_in_coap",
+	[RequestEndpoint_REQUEST_ENDPOINT_CHECK_IN_MQTT] = "check_in_mqtt",
+	[RequestEndpoint_REQUEST_ENDPOINT_OTA_DOWNLOAD_MODEM] = "ota_download_modem",
+};
+
+static struct k_spinlock lock_;
+
+/* The most recent traces, indexed by seq. */
+static struct req_trace history_[CONFIG_APP_REQ_TRACE_HISTORY];
+static uint32_t next_seq_ = 1;
+static uint32_t acked_seq_;
+
+/* Per-endpoint window of recent phase durations, for percentiles. */
+struct req_window {
+	uint16_t phase_ms[CONFIG_APP_REQ_TRACE_WINDOW][REQ_PHASE_COUNT];
+	uint32_t total;
+	uint16_t next;
+};
+
+static struct req_window windows_[_RequestEndpoint_ARRAYSIZE];
+
+void req_trace_begin(struct req_trace *trace, RequestEndpoint endpoint) {
+	memset(trace, 0, sizeof(*trace));
+	trace->endpoint = endpoint;
+	trace->start_ms = k_uptime_get();
+	trace->start_cycles = k_cycle_get_32();
+	evtrace_record(EVTRACE_HTTP_BEGIN, endpoint, 0);
+}
+
+void req_trace_mark(struct req_trace *trace, enum req_phase phase) {
+	uint32_t cycles = k_cycle_get_32();
+	int64_t elapsed_ms = k_uptime_get() - trace->start_ms;
+	/* Half the time it takes the 32-bit cycle counter to wrap. */
+	int64_t cycles_valid_ms = ((int64_t)UINT32_MAX * MSEC_PER_SEC) /
+				  sys_clock_hw_cycles_per_sec() / 2;
+	uint32_t us;
+
+	if (elapsed_ms < cycles_valid_ms) {
+		us = k_cyc_to_us_floor32(cycles - trace->start_cycles);
+	} else {
+		// Long requests, such as OTA downloads, use the uptime clock instead.
+		us = (uint32_t)MIN(elapsed_ms * USEC_PER_MSEC, UINT32_MAX);
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+	bool first = trace->mark_us[phase] == 0;
+
+	if (first) {
+		// 0 means not reached, so round a mark at the very start up.
+		trace->mark_us[phase] = MAX(us, 1);
+	}
+	k_spin_unlock(&lock_, key);
+
+	if (first && phase != REQ_PHASE_DONE) {
+		evtrace_record(EVTRACE_HTTP_PHASE, phase, us);
+	}
+}
+
+static void window_add(const struct req_trace *trace) {
+	struct req_window *window = &windows_[trace->endpoint];
+	uint16_t *slot = window->phase_ms[window->next];
+	uint32_t prev_us = 0;
+
+	for (int i = 0; i < REQ_PHASE_COUNT; i++) {
+		if (trace->mark_us[i] == 0) {
+			slot[i] = PHASE_MS_NONE;
+			continue;
+		}
+		slot[i] = MIN((trace->mark_us[i] - MIN(prev_us, trace->mark_us[i])) /
+			      USEC_PER_MSEC, PHASE_MS_NONE - 1);
+		prev_us = trace->mark_us[i];
+	}
+	window->next = (window->next + 1) % CONFIG_APP_REQ_TRACE_WINDOW;
+	window->total++;
+}
+
+void req_trace_end(struct req_trace *trace, int result) {
+	req_trace_mark(trace, REQ_PHASE_DONE);
+	trace->result = result;
+	evtrace_record(EVTRACE_HTTP_END, trace->endpoint, result);
+
+	if (trace->endpoint >= _RequestEndpoint_ARRAYSIZE) {
+		return;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+
+	trace->seq = next_seq_++;
+	history_[trace->seq % ARRAY_SIZE(history_)] = *trace;
+	window_add(trace);
+	k_spin_unlock(&lock_, key);
+
+	LOG_DBG("%s: %d after %u ms", endpoint_names[trace->endpoint], result,
+		trace->mark_us[REQ_PHASE_DONE] / USEC_PER_MSEC);
+}
+
+static uint32_t to_ms(uint32_t us) {
+	// Round up so that a phase that was reached is never reported as 0.
+	return us ? DIV_ROUND_UP(us, USEC_PER_MSEC) : 0;
+}
+
+pb_size_t req_trace_fill(RequestTrace *traces, pb_size_t max, uint32_t *seq) {
+	int64_t now = k_uptime_get();
+	pb_size_t count = 0;
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+	uint32_t oldest = MAX(acked_seq_ + 1,
+			      next_seq_ > ARRAY_SIZE(history_) ? next_seq_ - ARRAY_SIZE(history_) : 1);
+
+	*seq = next_seq_ - 1;
+	// Newest first, so the most recent traces are kept when there are too many.
+	for (uint32_t s = next_seq_ - 1; s >= oldest && count < max; s--) {
+		const struct req_trace *trace = &history_[s % ARRAY_SIZE(history_)];
+		RequestTrace *out = &traces[count++];
+
+		out->endpoint = trace->endpoint;
+		out->result = trace->result;
+		out->dns_ms = to_ms(trace->mark_us[REQ_PHASE_DNS]);
+		out->socket_ms = to_ms(trace->mark_us[REQ_PHASE_SOCKET]);
+		out->connect_ms = to_ms(trace->mark_us[REQ_PHASE_CONNECT]);
+		out->tls_ms = to_ms(trace->mark_us[REQ_PHASE_TLS]);
+		out->sent_ms = to_ms(trace->mark_us[REQ_PHASE_SENT]);
+		out->first_byte_ms = to_ms(trace->mark_us[REQ_PHASE_FIRST_BYTE]);
+		out->done_ms = to_ms(trace->mark_us[REQ_PHASE_DONE]);
+		out->age_ms = (uint32_t)MIN(now - trace->start_ms, UINT32_MAX);
+	}
+	k_spin_unlock(&lock_, key);
+
+	return count;
+}
+
+void req_trace_ack(uint32_t seq) {
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+
+	acked_seq_ = MAX(acked_seq_, seq);
+	k_spin_unlock(&lock_, key);
+}
+
+#if defined(CONFIG_SHELL)
+static void sort_u16(uint16_t *values, size_t n) {
+	for (size_t i = 1; i < n; i++) {
+		uint16_t v = values[i];
+		size_t j = i;
+
+		for (; j > 0 && values[j - 1] > v; j--) {
+			values[j] = values[j - 1];
+		}
+		values[j] = v;
+	}
+}
+
+/* Nearest-rank percentile of sorted values. */
+static uint16_t percentile(const uint16_t *sorted, size_t n, int pct) {
+	size_t rank = DIV_ROUND_UP(n * pct, 100);
+
+	return sorted[MAX(rank, 1) - 1];
+}
+
+static int cmd_req_trace(const struct shell *sh, size_t argc, char **argv) {
+	/* One phase of one window at a time; static, as it can be too large
+	 * for the shell stack, and only the shell thread runs this.
+	 */
+	static uint16_t values[CONFIG_APP_REQ_TRACE_WINDOW];
+
+	for (int ep = 0; ep < _RequestEndpoint_ARRAYSIZE; ep++) {
+		const struct req_window *window = &windows_[ep];
+		k_spinlock_key_t key = k_spin_lock(&lock_);
+		uint32_t total = window->total;
+
+		k_spin_unlock(&lock_, key);
+
+		if (total == 0) {
+			continue;
+		}
+
+		size_t slots = MIN(total, CONFIG_APP_REQ_TRACE_WINDOW);
+
+		shell_print(sh, "%s: %u requests, last %zu:", endpoint_names[ep], total, slots);
+		shell_print(sh, "  %-10s %6s %6s %6s %6s", "phase (ms)", "p50", "p90", "p99", "max");
+		for (int phase = 0; phase < REQ_PHASE_COUNT; phase++) {
+			size_t n = 0;
+
+			key = k_spin_lock(&lock_);
+			for (size_t i = 0; i < slots; i++) {
+				if (window->phase_ms[i][phase] != PHASE_MS_NONE) {
+					values[n++] = window->phase_ms[i][phase];
+				}
+			}
+			k_spin_unlock(&lock_, key);
+			if (n == 0) {
+				continue;
+			}
+			sort_u16(values, n);
+			shell_print(sh, "  %-10s %6u %6u %6u %6u", phase_names[phase],
+				    percentile(values, n, 50), percentile(values, n, 90),
+				    percentile(values, n, 99), values[n - 1]);
+		}
+	}
+	return 0;
+}
+
+SHELL_CMD_REGISTER(req_trace, NULL, "Show request phase latency percentiles", cmd_req_trace);
+#endif /* defined(CONFIG_SHELL) */
@@ -0,0 +1,80 @@
+/*
+ * Request phase tracing.
+ *
+ * Every HTTP request the app makes goes through the same phases. A trace
+ * records when each phase ended, relative to the start of the request.
+ * Finished traces are kept for two purposes:
+ *
+ *  - the most recent ones are attached to the next status update, so the
+ *    backend sees device-side latency broken down by phase;
+ *  - a window of recent traces per endpoint is kept for percentiles, shown
+ *    by the "req_trace" shell command.
+ */
+
+#ifndef APP_REQ_TRACE_H
+#define APP_REQ_TRACE_H
+
+#include <stdint.h>
+
+#include "api/api.pb.h"
+
+enum req_phase {
+	REQ_PHASE_DNS = 0,
+	REQ_PHASE_SOCKET,
+	REQ_PHASE_CONNECT,
+	/* Handshake done, when TLS is run on the MCU. */
+	REQ_PHASE_TLS,
+	/* Request headers and body written. */
+	REQ_PHASE_SENT,
+	REQ_PHASE_FIRST_BYTE,
+	REQ_PHASE_DONE,
+	REQ_PHASE_COUNT,
+};
+
+struct req_trace {
+	RequestEndpoint endpoint;
+	int result;
+	uint32_t start_cycles;
+	int64_t start_ms;
+	/* Time from the start to the end of each phase; 0 if not reached. */
+	uint32_t mark_us[REQ_PHASE_COUNT];
+	/* Set when the trace is stored, to track what has been reported. */
+	uint32_t seq;
+};
+
+#if defined(CONFIG_APP_REQ_TRACE)
+void req_trace_begin(struct req_trace *trace, RequestEndpoint endpoint);
+
+/**
+ * @brief Mark the end of @p phase. Only the first mark of a phase counts,
+ * so marks may be made from every place a phase can end.
+ */
+void req_trace_mark(struct req_trace *trace, enum req_phase phase);
+
+/** @brief Mark the request done and store the trace. */
+void req_trace_end(struct req_trace *trace, int result);
+
+/**
+ * @brief Fill @p traces with the most recent traces not yet reported.
+ *
+ * @param seq Set to the sequence number to pass to req_trace_ack() once
+ * the traces have been delivered.
+ * @returns The number of traces filled in.
+ */
+pb_size_t req_trace_fill(RequestTrace *traces, pb_size_t max, uint32_t *seq);
+
+/** @brief Mark the traces up to @p seq as reported. */
+void req_trace_ack(uint32_t seq);
+#else
+static inline void req_trace_begin(struct req_trace *trace, RequestEndpoint endpoint) {}
+static inline void req_trace_mark(struct req_trace *trace, enum req_phase phase) {}
+static inline void req_trace_end(struct req_trace *trace, int result) {}
+static inline pb_size_t req_trace_fill(RequestTrace *traces, pb_size_t max, uint32_t *seq)
+{
+	*seq = 0;
+	return 0;
+}
+static inline void req_trace_ack(uint32_t seq) {}
+#endif /* defined(CONFIG_APP_REQ_TRACE) */
+
+#endif /* APP_REQ_TRACE_H */
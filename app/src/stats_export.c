@@ -0,0 +1,208 @@
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/util.h>
+
+#include <pb_encode.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(stats_export, CONFIG_APP_LOG_LEVEL);
+
+#include "stats_export.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+/* A group in the snapshot, and how many of its entries have values. */
+struct export_group {
+	struct stats_hdr *hdr;
+	uint16_t count;
+};
+
+/* The snapshot taken by the last stats_export_fill(), indexed by ID. Only
+ * the HTTP client thread exports stats, so this is not locked.
+ */
+static uint64_t values_[CONFIG_APP_STATS_EXPORT_MAX];
+static uint32_t count_;
+static struct export_group groups_[CONFIG_APP_STATS_EXPORT_MAX_GROUPS];
+static uint32_t groups_count_;
+static uint32_t dict_id_;
+static uint32_t acked_dict_id_;
+/* Stats registered at the last warning that they did not all fit. */
+static uint32_t warned_total_;
+
+struct snapshot_ctx {
+	uint32_t count;
+	uint32_t groups;
+	/* The group being walked, or NULL if it is left out. */
+	struct export_group *group;
+	uint32_t hash;
+	/* Every registered stat, including those past the cap. */
+	uint32_t total;
+};
+
+static uint32_t fnv1a(uint32_t hash, const char *str) {
+	// The terminator is hashed too, so "ab" "c" differs from "a" "bc".
+	do {
+		hash ^= (uint8_t)*str;
+		hash *= FNV_PRIME;
+	} while (*str++ != '\0');
+	return hash;
+}
+
+static uint64_t stat_value(const struct stats_hdr *hdr, uint16_t off) {
+	const uint8_t *ptr = (const uint8_t *)hdr + off;
+
+	switch (hdr->s_size) {
+	case sizeof(uint16_t):
+		return *(const uint16_t *)ptr;
+	case sizeof(uint32_t):
+		return *(const uint32_t *)ptr;
+	case sizeof(uint64_t):
+		return *(const uint64_t *)ptr;
+	default:
+		return 0;
+	}
+}
+
+static int snapshot_entry(struct stats_hdr *hdr, void *arg, const char *name, uint16_t off) {
+	struct snapshot_ctx *ctx = arg;
+
+	ctx->total++;
+	if (ctx->group == NULL || ctx->count == ARRAY_SIZE(values_)) {
+		// Counted, but left out until the limit is raised.
+		return 0;
+	}
+	values_[ctx->count++] = stat_value(hdr, off);
+	ctx->group->count++;
+	ctx->hash = fnv1a(fnv1a(ctx->hash, hdr->s_name), name);
+	return 0;
+}
+
+static int snapshot_group(struct stats_hdr *hdr, void *arg) {
+	struct snapshot_ctx *ctx = arg;
+
+	ctx->group = NULL;
+	if (ctx->groups < ARRAY_SIZE(groups_) && ctx->count < ARRAY_SIZE(values_)) {
+		ctx->group = &groups_[ctx->groups++];
+		ctx->group->hdr = hdr;
+		ctx->group->count = 0;
+	}
+	return stats_walk(hdr, snapshot_entry, arg);
+}
+
+static bool encode_values(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+	pb_ostream_t sizing = PB_OSTREAM_SIZING;
+
+	if (count_ == 0) {
+		return true;
+	}
+
+	// Packed: one length-delimited field holding all the varints.
+	for (uint32_t i = 0; i < count_; i++) {
+		pb_encode_varint(&sizing, values_[i]);
+	}
+	if (!pb_encode_tag(stream, PB_WT_STRING, field->tag) ||
+	    !pb_encode_varint(stream, sizing.bytes_written)) {
+		return false;
+	}
+	for (uint32_t i = 0; i < count_; i++) {
+		if (!pb_encode_varint(stream, values_[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct names_ctx {
+	pb_ostream_t *stream;
+	const pb_field_t *field;
+	uint32_t id;
+	/* Entries of the current group still to encode. */
+	uint32_t left;
+	bool ok;
+};
+
+static int encode_name(struct stats_hdr *hdr, void *arg, const char *name, uint16_t off) {
+	struct names_ctx *ctx = arg;
+	StatName entry = StatName_init_zero;
+
+	// The rest of the group did not fit in the snapshot.
+	if (ctx->left == 0) {
+		return 1;
+	}
+	ctx->left--;
+
+	entry.id = ctx->id++;
+	snprintk(entry.name, sizeof(entry.name), "%s.%s", hdr->s_name, name);
+	if (!pb_encode_tag_for_field(ctx->stream, ctx->field) ||
+	    !pb_encode_submessage(ctx->stream, StatName_fields, &entry)) {
+		ctx->ok = false;
+		return 1;
+	}
+	return 0;
+}
+
+/* Walks the snapshotted groups rather than the registered ones, so that
+ * the names match the values and the sizing and sending passes encode the
+ * same bytes.
+ */
+static bool encode_names(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+	struct names_ctx ctx = {
+		.stream = stream,
+		.field = field,
+		.ok = true,
+	};
+
+	for (uint32_t i = 0; i < groups_count_ && ctx.ok; i++) {
+		ctx.left = groups_[i].count;
+		stats_walk(groups_[i].hdr, encode_name, &ctx);
+	}
+	return ctx.ok;
+}
+
+/* Warn once per growth of the registered stats past the cap, rather than
+ * on every report.
+ */
+static void check_total(uint32_t total, uint32_t exported) {
+	if (exported < total && total != warned_total_) {
+		LOG_WRN("%u stats registered, only the first %u are exported; raise "
+			"CONFIG_APP_STATS_EXPORT_MAX or CONFIG_APP_STATS_EXPORT_MAX_GROUPS",
+			total, exported);
+		warned_total_ = total;
+	}
+}
+
+void stats_export_init(void) {
+	struct snapshot_ctx ctx = {
+		.hash = FNV_OFFSET_BASIS,
+	};
+
+	stats_group_walk(snapshot_group, &ctx);
+	LOG_INF("%u stats registered, up to %u exported", ctx.total,
+		(uint32_t)ARRAY_SIZE(values_));
+	check_total(ctx.total, ctx.count);
+}
+
+void stats_export_fill(StatsReport *report) {
+	struct snapshot_ctx ctx = {
+		.hash = FNV_OFFSET_BASIS,
+	};
+
+	stats_group_walk(snapshot_group, &ctx);
+	// Groups such as those of newly seen threads are registered later.
+	check_total(ctx.total, ctx.count);
+	count_ = ctx.count;
+	groups_count_ = ctx.groups;
+	dict_id_ = ctx.hash;
+
+	report->dict_id = dict_id_;
+	report->values.funcs.encode = encode_values;
+	report->names.funcs.encode = (dict_id_ == acked_dict_id_) ? NULL : encode_names;
+}
+
+void stats_export_ack(uint32_t dict_id) {
+	if (dict_id != acked_dict_id_) {
+		LOG_INF("Backend has stats dictionary %08x (current %08x)", dict_id, dict_id_);
+	}
+	acked_dict_id_ = dict_id;
+}
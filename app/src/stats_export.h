@@ -0,0 +1,60 @@
+/*
+ * Export of every registered stats group into a StatsReport.
+ *
+ * Each stat is interned to a small ID: its position when walking the
+ * groups, which Zephyr keeps sorted by name. The report carries the values
+ * indexed by ID as one packed array. The dictionary of the "group.name" of
+ * each ID is only sent until the backend echoes its dictionary ID back.
+ * A group registered later, such as that of a newly seen thread, can move
+ * the IDs of the groups after it; that changes the dictionary ID, so the
+ * names go out again. Both are encoded from the groups snapshotted with the
+ * values, so a group registered in between does not shift them.
+ *
+ * Usage:
+ *
+ *	stats_export_init();
+ *	...
+ *	stats_export_fill(&request.stats);
+ *	...send the request...
+ *	stats_export_ack(response.stats_dict_id);
+ */
+
+#ifndef APP_STATS_EXPORT_H
+#define APP_STATS_EXPORT_H
+
+#include <stdint.h>
+
+#include "api/api.pb.h"
+
+#if defined(CONFIG_APP_STATS_EXPORT)
+/**
+ * @brief Count the stats registered so far, and warn if they do not all
+ * fit in CONFIG_APP_STATS_EXPORT_MAX.
+ *
+ * Call once the groups registered at boot are.
+ */
+void stats_export_init(void);
+
+/**
+ * @brief Snapshot all stats and set up @p report to encode them.
+ *
+ * The values are copied, so the encoded size does not change between
+ * sizing and sending the message. @p report is only valid until the next
+ * call.
+ */
+void stats_export_fill(StatsReport *report);
+
+/**
+ * @brief Record the dictionary the backend has.
+ *
+ * @param dict_id The dictionary ID echoed by the backend, or 0 if it has
+ * none; the names are sent again unless it is the current one.
+ */
+void stats_export_ack(uint32_t dict_id);
+#else
+static inline void stats_export_init(void) {}
+static inline void stats_export_fill(StatsReport *report) {}
+static inline void stats_export_ack(uint32_t dict_id) {}
+#endif /* defined(CONFIG_APP_STATS_EXPORT) */
+
+#endif /* APP_STATS_EXPORT_H */
@@ -0,0 +1,242 @@
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/util.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(thread_prof, CONFIG_APP_LOG_LEVEL);
+
+#include "thread_prof.h"
+
+/* Fits "thr_" and the name, truncated to what ThreadStats.name holds. */
+#define THREAD_PROF_NAME_LEN 20
+
+STATS_SECT_START(thread_prof)
+/* Share of the last window, in tenths of a percent. */
+STATS_SECT_ENTRY(cpu_permille)
+STATS_SECT_ENTRY(cpu_max_permille)
+STATS_SECT_ENTRY(stack_used)
+STATS_SECT_ENTRY(stack_size)
+STATS_SECT_ENTRY(stack_pct)
+/* Samples in which the stack was over the threshold. */
+STATS_SECT_ENTRY(stack_over)
+STATS_SECT_END;
+
+STATS_NAME_START(thread_prof)
+STATS_NAME(thread_prof, cpu_permille)
+STATS_NAME(thread_prof, cpu_max_permille)
+STATS_NAME(thread_prof, stack_used)
+STATS_NAME(thread_prof, stack_size)
+STATS_NAME(thread_prof, stack_pct)
+STATS_NAME(thread_prof, stack_over)
+STATS_NAME_END(thread_prof);
+
+/* A thread seen by the sampler. Slots are kept for threads that exit, and
+ * reused if the same k_thread is started again, as the proto decoder and
+ * OTA range threads are.
+ */
+struct thread_slot {
+	const struct k_thread *thread;
+	char stats_name[THREAD_PROF_NAME_LEN];
+	uint64_t last_cycles;
+	bool alive;
+	bool over;
+	STATS_SECT_DECL(thread_prof) stats;
+};
+
+static struct thread_slot slots_[CONFIG_APP_THREAD_PROF_MAX_THREADS];
+static int slot_count_;
+/* Guards the slots against the status update and shell readers. */
+static K_MUTEX_DEFINE(slots_lock_);
+
+static uint64_t last_total_cycles_;
+static uint64_t window_cycles_;
+
+static void thread_prof_work(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(sample_work_, thread_prof_work);
+
+static const char *slot_name(const struct thread_slot *slot) {
+	return slot->stats_name + sizeof("thr_") - 1;
+}
+
+static int slot_register(struct thread_slot *slot) {
+	return stats_init_and_reg(&slot->stats.s_hdr, STATS_SIZE_32,
+				  (sizeof(slot->stats) - sizeof(struct stats_hdr)) / STATS_SIZE_32,
+				  STATS_NAME_INIT_PARMS(thread_prof), slot->stats_name);
+}
+
+static struct thread_slot *slot_get(const struct k_thread *thread) {
+	struct thread_slot *slot;
+	const char *name;
+	int ret;
+
+	for (int i = 0; i < slot_count_; i++) {
+		if (slots_[i].thread == thread) {
+			return &slots_[i];
+		}
+	}
+	if (slot_count_ == ARRAY_SIZE(slots_)) {
+		return NULL;
+	}
+
+	slot = &slots_[slot_count_++];
+	slot->thread = thread;
+	name = k_thread_name_get((k_tid_t)thread);
+	if (name != NULL && name[0] != '\0') {
+		snprintf(slot->stats_name, sizeof(slot->stats_name), "thr_%s", name);
+	} else {
+		snprintf(slot->stats_name, sizeof(slot->stats_name), "thr_%p", thread);
+	}
+	ret = slot_register(slot);
+	if (ret == -EALREADY) {
+		// Another thread has the name; tell them apart by the slot.
+		char suffix[sizeof("_99")];
+		size_t len;
+
+		snprintf(suffix, sizeof(suffix), "_%d", (int)(slot - slots_));
+		len = MIN(strlen(slot->stats_name), sizeof(slot->stats_name) - sizeof(suffix));
+		strcpy(slot->stats_name + len, suffix);
+		ret = slot_register(slot);
+	}
+	if (ret != 0) {
+		// Still sampled for the shell, but not exported.
+		LOG_WRN("Registering stats %s failed: %d", slot->stats_name, ret);
+	}
+	return slot;
+}
+
+static void sample_thread(const struct k_thread *thread, void *user_data) {
+	struct thread_slot *slot = slot_get(thread);
+	k_thread_runtime_stats_t rt;
+	size_t size = thread->stack_info.size;
+	size_t unused = 0;
+	uint32_t used;
+	uint32_t pct;
+	uint64_t cycles;
+
+	if (slot == NULL) {
+		return;
+	}
+
+	k_thread_runtime_stats_get((k_tid_t)thread, &rt);
+	cycles = rt.execution_cycles - MIN(slot->last_cycles, rt.execution_cycles);
+	slot->last_cycles = rt.execution_cycles;
+	slot->alive = true;
+	if (window_cycles_ > 0) {
+		STATS_SET(slot->stats, cpu_permille, (uint32_t)(cycles * 1000 / window_cycles_));
+		if (slot->stats.cpu_permille > slot->stats.cpu_max_permille) {
+			STATS_SET(slot->stats, cpu_max_permille, slot->stats.cpu_permille);
+		}
+	}
+
+	if (k_thread_stack_space_get(thread, &unused) != 0 || size == 0) {
+		return;
+	}
+	used = size - unused;
+	pct = used * 100 / size;
+	STATS_SET(slot->stats, stack_used, used);
+	STATS_SET(slot->stats, stack_size, size);
+	STATS_SET(slot->stats, stack_pct, pct);
+
+	if (pct >= CONFIG_APP_THREAD_PROF_STACK_PCT) {
+		STATS_INC(slot->stats, stack_over);
+		if (!slot->over) {
+			LOG_WRN("%s stack at %u%% (%u of %zu bytes)", slot_name(slot), pct, used,
+				size);
+		}
+		slot->over = true;
+	}
+}
+
+static void thread_prof_sample(void) {
+	k_thread_runtime_stats_t all;
+
+	k_mutex_lock(&slots_lock_, K_FOREVER);
+
+	k_thread_runtime_stats_all_get(&all);
+	window_cycles_ = all.execution_cycles - MIN(last_total_cycles_, all.execution_cycles);
+	last_total_cycles_ = all.execution_cycles;
+
+	for (int i = 0; i < slot_count_; i++) {
+		slots_[i].alive = false;
+	}
+	// Stack scans are slow, so don't hold the scheduler lock for them.
+	k_thread_foreach_unlocked(sample_thread, NULL);
+
+	k_mutex_unlock(&slots_lock_);
+}
+
+static void thread_prof_work(struct k_work *work) {
+	thread_prof_sample();
+	k_work_schedule(&sample_work_, K_MSEC(CONFIG_APP_THREAD_PROF_WINDOW_MS));
+}
+
+void thread_prof_init(void) {
+	// The first sample only sets the baseline for the first window.
+	thread_prof_sample();
+	k_work_schedule(&sample_work_, K_MSEC(CONFIG_APP_THREAD_PROF_WINDOW_MS));
+}
+
+pb_size_t thread_prof_fill(ThreadStats *threads, pb_size_t max) {
+	pb_size_t count = 0;
+
+	k_mutex_lock(&slots_lock_, K_FOREVER);
+	for (int i = 0; i < slot_count_; i++) {
+		const struct thread_slot *slot = &slots_[i];
+		pb_size_t pos;
+
+		if (!slot->alive) {
+			continue;
+		}
+		// Insertion sort by CPU usage, keeping the busiest max threads.
+		for (pos = count; pos > 0; pos--) {
+			if (threads[pos - 1].cpu_permille >= slot->stats.cpu_permille) {
+				break;
+			}
+			if (pos < max) {
+				threads[pos] = threads[pos - 1];
+			}
+		}
+		if (pos >= max) {
+			continue;
+		}
+
+		threads[pos] = (ThreadStats)ThreadStats_init_zero;
+		strncpy(threads[pos].name, slot_name(slot), sizeof(threads[pos].name) - 1);
+		threads[pos].cpu_permille = slot->stats.cpu_permille;
+		threads[pos].stack_used = slot->stats.stack_used;
+		threads[pos].stack_size = slot->stats.stack_size;
+		threads[pos].stack_over_threshold = slot->over;
+		count = MIN(count + 1, max);
+	}
+	k_mutex_unlock(&slots_lock_);
+
+	return count;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_thread_prof(const struct shell *sh, size_t argc, char **argv) {
+	k_mutex_lock(&slots_lock_, K_FOREVER);
+	shell_print(sh, "window: %u ms", CONFIG_APP_THREAD_PROF_WINDOW_MS);
+	shell_print(sh, "%-16s %7s %7s %13s %5s", "thread", "cpu%", "max%", "stack", "use%");
+	for (int i = 0; i < slot_count_; i++) {
+		const struct thread_slot *slot = &slots_[i];
+
+		if (!slot->alive) {
+			continue;
+		}
+		shell_print(sh, "%-16s %3u.%u%% %3u.%u%% %6u/%-6u %4u%%%s", slot_name(slot),
+			    slot->stats.cpu_permille / 10, slot->stats.cpu_permille % 10,
+			    slot->stats.cpu_max_permille / 10, slot->stats.cpu_max_permille % 10,
+			    slot->stats.stack_used, slot->stats.stack_size, slot->stats.stack_pct,
+			    slot->over ? " !" : "");
+	}
+	k_mutex_unlock(&slots_lock_);
+	return 0;
+}
+
+SHELL_CMD_REGISTER(thread_prof, NULL, "Show per-thread CPU and stack usage", cmd_thread_prof);
+#endif /* defined(CONFIG_SHELL) */
@@ -0,0 +1,39 @@
+/*
+ * Thread CPU and stack profiling.
+ *
+ * Every CONFIG_APP_THREAD_PROF_WINDOW_MS the runtime and stack usage of
+ * every thread is sampled. CPU usage is the share of the cycles in the
+ * window that the thread ran for; stack usage is the high-water mark since
+ * the thread started, found by scanning for the fill pattern the kernel
+ * writes into stacks with CONFIG_INIT_STACKS.
+ *
+ * Each thread gets a "thr_<name>" stats group, the latest sample is sent
+ * with the next status update, and the "thread_prof" shell command prints
+ * it. Threads whose stack usage reaches CONFIG_APP_THREAD_PROF_STACK_PCT
+ * percent are logged and flagged.
+ */
+
+#ifndef APP_THREAD_PROF_H
+#define APP_THREAD_PROF_H
+
+#include "api/api.pb.h"
+
+#if defined(CONFIG_APP_THREAD_PROF)
+/** @brief Take a first sample and start sampling periodically. */
+void thread_prof_init(void);
+
+/**
+ * @brief Fill @p threads with the latest sample, busiest threads first.
+ *
+ * @returns The number of threads filled in.
+ */
+pb_size_t thread_prof_fill(ThreadStats *threads, pb_size_t max);
+#else
+static inline void thread_prof_init(void) {}
+static inline pb_size_t thread_prof_fill(ThreadStats *threads, pb_size_t max)
+{
+	return 0;
+}
+#endif /* defined(CONFIG_APP_THREAD_PROF) */
+
+#endif /* APP_THREAD_PROF_H */
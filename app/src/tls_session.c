@@ -0,0 +1,505 @@
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/fdtable.h>
+#include <errno.h>
+#include <string.h>
+
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/ssl_ciphersuites.h>
+#include <mbedtls/x509_crt.h>
+#if defined(CONFIG_MBEDTLS_MEMORY_DEBUG)
+#include <mbedtls/memory_buffer_alloc.h>
+#endif
+
+/* For struct socket_op_vtable. */
+#include "sockets_internal.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(tls_session, CONFIG_APP_LOG_LEVEL);
+
+#include "tls_session.h"
+
+/* A serialized session: the ID or ticket, the master secret and a digest of
+ * the server certificate, with room for a ticket of a few hundred bytes.
+ */
+#define TLS_SESSION_SAVED_MAX 512
+/* Covers the certificate exchange over a slow link. */
+#define TLS_HANDSHAKE_TIMEOUT_MS (30 * MSEC_PER_SEC)
+
+STATS_SECT_START(tls_stats)
+STATS_SECT_ENTRY(full)
+STATS_SECT_ENTRY(resumed)
+STATS_SECT_ENTRY(failed)
+/* Of the most recent full and resumed handshake. */
+STATS_SECT_ENTRY(full_ms)
+STATS_SECT_ENTRY(full_bytes)
+STATS_SECT_ENTRY(full_heap)
+STATS_SECT_ENTRY(resumed_ms)
+STATS_SECT_ENTRY(resumed_bytes)
+STATS_SECT_ENTRY(resumed_heap)
+STATS_SECT_END;
+
+STATS_NAME_START(tls_stats)
+STATS_NAME(tls_stats, full)
+STATS_NAME(tls_stats, resumed)
+STATS_NAME(tls_stats, failed)
+STATS_NAME(tls_stats, full_ms)
+STATS_NAME(tls_stats, full_bytes)
+STATS_NAME(tls_stats, full_heap)
+STATS_NAME(tls_stats, resumed_ms)
+STATS_NAME(tls_stats, resumed_bytes)
+STATS_NAME(tls_stats, resumed_heap)
+STATS_NAME_END(tls_stats);
+
+static STATS_SECT_DECL(tls_stats) tls_stats;
+
+/* The wrapped socket. Backend requests are made one at a time, so there is
+ * only ever one.
+ */
+struct tls_sock {
+	mbedtls_ssl_context ssl;
+	/* The connected TCP socket underneath. */
+	int sock;
+	/* Passed on to the TCP socket by the receive callback. */
+	int recv_flags;
+	int timeout_ms;
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	/* Set by POLL_PREPARE when decrypted data is already buffered. */
+	bool poll_ready;
+	bool open;
+};
+
+static struct tls_sock tls_;
+static mbedtls_ssl_config conf_;
+static const struct socket_op_vtable tls_sock_vtable_;
+
+static const int ciphersuites_[] = {
+	MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+	0,
+};
+
+static const uint16_t groups_[] = {
+	MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1,
+	MBEDTLS_SSL_IANA_TLS_GROUP_NONE,
+};
+
+#if defined(CONFIG_APP_BACKEND_TLS_VERIFY)
+static const unsigned char ca_cert_[] = {
+#include "backend_ca.pem.inc"
+	/* mbedtls_x509_crt_parse() wants PEM NUL terminated. */
+	0x00
+};
+static mbedtls_x509_crt ca_;
+#endif
+
+/* The session offered on the next handshake, as saved in settings. */
+static uint8_t saved_[TLS_SESSION_SAVED_MAX];
+static size_t saved_len_;
+
+static int tls_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+			    void *cb_arg)
+{
+	const char *next;
+	int rc;
+
+	if (!settings_name_steq(name, "session", &next) || next) {
+		return -ENOENT;
+	}
+	if (len > sizeof(saved_)) {
+		// Not from this build; a full handshake replaces it.
+		return 0;
+	}
+
+	rc = read_cb(cb_arg, saved_, len);
+	if (rc < 0) {
+		return rc;
+	}
+	saved_len_ = rc;
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(tls, "tls", NULL, tls_settings_set, NULL, NULL);
+
+static int tls_random(void *ctx, unsigned char *buf, size_t len)
+{
+	return sys_csrand_get(buf, len) == 0 ? 0 : MBEDTLS_ERR_ENTROPY_SOURCE_FAILED;
+}
+
+static int tls_bio_send(void *ctx, const unsigned char *buf, size_t len)
+{
+	struct tls_sock *tls = ctx;
+	ssize_t ret = send(tls->sock, buf, len, 0);
+
+	if (ret < 0) {
+		return errno == EAGAIN ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+	}
+	tls->tx_bytes += ret;
+	return ret;
+}
+
+static int tls_bio_recv(void *ctx, unsigned char *buf, size_t len)
+{
+	struct tls_sock *tls = ctx;
+	struct pollfd pfd = {
+		.fd = tls->sock,
+		.events = POLLIN,
+	};
+	ssize_t ret;
+
+	if (!(tls->recv_flags & MSG_DONTWAIT) && tls->timeout_ms != SYS_FOREVER_MS) {
+		ret = poll(&pfd, 1, tls->timeout_ms);
+		if (ret == 0) {
+			return MBEDTLS_ERR_SSL_TIMEOUT;
+		}
+		if (ret < 0) {
+			return MBEDTLS_ERR_NET_RECV_FAILED;
+		}
+	}
+	ret = recv(tls->sock, buf, len, tls->recv_flags);
+	if (ret < 0) {
+		return errno == EAGAIN ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+	}
+	tls->rx_bytes += ret;
+	return ret;
+}
+
+/* Offer the saved session. Returns true if it was set on @p ssl, with its
+ * master secret in @p master, which is the same after the handshake if and
+ * only if the server resumed it. This holds for session IDs and tickets.
+ */
+static bool tls_session_offer(mbedtls_ssl_context *ssl, uint8_t *master)
+{
+	mbedtls_ssl_session session;
+	bool offered = false;
+
+	if (saved_len_ == 0) {
+		return false;
+	}
+
+	mbedtls_ssl_session_init(&session);
+	if (mbedtls_ssl_session_load(&session, saved_, saved_len_) == 0 &&
+	    mbedtls_ssl_set_session(ssl, &session) == 0) {
+		memcpy(master, session.MBEDTLS_PRIVATE(master), sizeof(session.MBEDTLS_PRIVATE(master)));
+		offered = true;
+	} else {
+		LOG_WRN("Saved session not usable; doing a full handshake");
+		saved_len_ = 0;
+	}
+	mbedtls_ssl_session_free(&session);
+	return offered;
+}
+
+/* Save the session of the handshake just done if it is not the one saved,
+ * as when the server sent a new ticket. Returns true if it was resumed.
+ */
+static bool tls_session_update(mbedtls_ssl_context *ssl, bool offered, const uint8_t *master)
+{
+	static uint8_t buf[TLS_SESSION_SAVED_MAX];
+	mbedtls_ssl_session session;
+	bool resumed = false;
+	size_t len;
+	int rc;
+
+	mbedtls_ssl_session_init(&session);
+	if (mbedtls_ssl_get_session(ssl, &session) != 0) {
+		goto exit;
+	}
+	resumed = offered && memcmp(master, session.MBEDTLS_PRIVATE(master),
+				    sizeof(session.MBEDTLS_PRIVATE(master))) == 0;
+
+	rc = mbedtls_ssl_session_save(&session, buf, sizeof(buf), &len);
+	if (rc != 0) {
+		LOG_WRN("Session not saved: -0x%04x", -rc);
+		goto exit;
+	}
+	if (len == saved_len_ && memcmp(buf, saved_, len) == 0) {
+		goto exit;
+	}
+	memcpy(saved_, buf, len);
+	saved_len_ = len;
+	rc = settings_save_one("tls/session", saved_, saved_len_);
+	if (rc != 0) {
+		LOG_WRN("Saving the session failed: %d", rc);
+	}
+
+exit:
+	mbedtls_ssl_session_free(&session);
+	return resumed;
+}
+
+static void tls_stats_record(const struct tls_session_stats *stats)
+{
+	uint32_t bytes = stats->handshake_tx + stats->handshake_rx;
+
+	if (stats->resumed) {
+		STATS_INC(tls_stats, resumed);
+		STATS_SET(tls_stats, resumed_ms, stats->handshake_ms);
+		STATS_SET(tls_stats, resumed_bytes, bytes);
+		STATS_SET(tls_stats, resumed_heap, stats->heap_peak);
+	} else {
+		STATS_INC(tls_stats, full);
+		STATS_SET(tls_stats, full_ms, stats->handshake_ms);
+		STATS_SET(tls_stats, full_bytes, bytes);
+		STATS_SET(tls_stats, full_heap, stats->heap_peak);
+	}
+}
+
+int tls_session_init(void)
+{
+	int ret;
+
+	mbedtls_ssl_config_init(&conf_);
+	ret = mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT,
+					  MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+	if (ret != 0) {
+		LOG_ERR("TLS config failed: -0x%04x", -ret);
+		return -EINVAL;
+	}
+	mbedtls_ssl_conf_min_tls_version(&conf_, MBEDTLS_SSL_VERSION_TLS1_2);
+	mbedtls_ssl_conf_max_tls_version(&conf_, MBEDTLS_SSL_VERSION_TLS1_2);
+	mbedtls_ssl_conf_ciphersuites(&conf_, ciphersuites_);
+	mbedtls_ssl_conf_groups(&conf_, groups_);
+	mbedtls_ssl_conf_rng(&conf_, tls_random, NULL);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+	mbedtls_ssl_conf_session_tickets(&conf_, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+#if defined(CONFIG_APP_BACKEND_TLS_VERIFY)
+	mbedtls_x509_crt_init(&ca_);
+	ret = mbedtls_x509_crt_parse(&ca_, ca_cert_, sizeof(ca_cert_));
+	if (ret != 0) {
+		LOG_ERR("CA certificate not parsed: -0x%04x", -ret);
+		return -EINVAL;
+	}
+	mbedtls_ssl_conf_ca_chain(&conf_, &ca_, NULL);
+	mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_REQUIRED);
+#else
+	LOG_WRN("The backend certificate is not verified");
+	mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_NONE);
+#endif
+
+	return STATS_INIT_AND_REG(tls_stats, STATS_SIZE_32, "tls");
+}
+
+int tls_session_wrap(int sock, const char *hostname, struct tls_session_stats *stats)
+{
+	uint8_t master[48];
+	int64_t start_ms = k_uptime_get();
+	bool offered;
+	int fd;
+	int ret;
+
+	memset(stats, 0, sizeof(*stats));
+	if (tls_.open) {
+		return -EBUSY;
+	}
+
+	fd = z_reserve_fd();
+	if (fd < 0) {
+		return -errno;
+	}
+
+	tls_.sock = sock;
+	tls_.recv_flags = 0;
+	tls_.timeout_ms = TLS_HANDSHAKE_TIMEOUT_MS;
+	tls_.tx_bytes = 0;
+	tls_.rx_bytes = 0;
+	tls_.poll_ready = false;
+
+#if defined(CONFIG_MBEDTLS_MEMORY_DEBUG)
+	mbedtls_memory_buffer_alloc_max_reset();
+#endif
+	mbedtls_ssl_init(&tls_.ssl);
+	ret = mbedtls_ssl_setup(&tls_.ssl, &conf_);
+	if (ret == 0) {
+		ret = mbedtls_ssl_set_hostname(&tls_.ssl, hostname);
+	}
+	if (ret != 0) {
+		LOG_ERR("TLS setup failed: -0x%04x", -ret);
+		mbedtls_ssl_free(&tls_.ssl);
+		z_free_fd(fd);
+		return -ENOMEM;
+	}
+	offered = tls_session_offer(&tls_.ssl, master);
+	mbedtls_ssl_set_bio(&tls_.ssl, &tls_, tls_bio_send, tls_bio_recv, NULL);
+
+	do {
+		ret = mbedtls_ssl_handshake(&tls_.ssl);
+	} while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+	stats->handshake_ms = k_uptime_get() - start_ms;
+	stats->handshake_tx = tls_.tx_bytes;
+	stats->handshake_rx = tls_.rx_bytes;
+#if defined(CONFIG_MBEDTLS_MEMORY_DEBUG)
+	size_t max_used, max_blocks;
+
+	mbedtls_memory_buffer_alloc_max_get(&max_used, &max_blocks);
+	stats->heap_peak = max_used;
+#endif
+
+	if (ret != 0) {
+		LOG_ERR("Handshake failed after %u ms: -0x%04x", stats->handshake_ms, -ret);
+		STATS_INC(tls_stats, failed);
+		if (offered) {
+			// The server may have rejected it in a way that fails every time.
+			saved_len_ = 0;
+		}
+		mbedtls_ssl_free(&tls_.ssl);
+		z_free_fd(fd);
+		return -ECONNABORTED;
+	}
+
+	stats->resumed = tls_session_update(&tls_.ssl, offered, master);
+	tls_stats_record(stats);
+	LOG_INF("%s handshake in %u ms: %u bytes sent, %u received, heap peak %u",
+		stats->resumed ? "Resumed" : "Full", stats->handshake_ms, stats->handshake_tx,
+		stats->handshake_rx, stats->heap_peak);
+
+	tls_.timeout_ms = SYS_FOREVER_MS;
+	tls_.open = true;
+	z_finalize_fd(fd, &tls_, (const struct fd_op_vtable *)&tls_sock_vtable_);
+	return fd;
+}
+
+static ssize_t tls_sock_error(int ret)
+{
+	switch (ret) {
+	case MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY:
+	case MBEDTLS_ERR_SSL_CONN_EOF:
+		return 0;
+	case MBEDTLS_ERR_SSL_WANT_READ:
+	case MBEDTLS_ERR_SSL_WANT_WRITE:
+		errno = EAGAIN;
+		return -1;
+	default:
+		LOG_ERR("TLS error -0x%04x", -ret);
+		errno = EIO;
+		return -1;
+	}
+}
+
+static ssize_t tls_sock_recvfrom(void *obj, void *buf, size_t len, int flags,
+				 struct sockaddr *from, socklen_t *fromlen)
+{
+	struct tls_sock *tls = obj;
+	int ret;
+
+	if (flags & MSG_PEEK) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	tls->recv_flags = flags & MSG_DONTWAIT;
+	ret = mbedtls_ssl_read(&tls->ssl, buf, len);
+	tls->recv_flags = 0;
+	return ret >= 0 ? ret : tls_sock_error(ret);
+}
+
+static ssize_t tls_sock_sendto(void *obj, const void *buf, size_t len, int flags,
+			       const struct sockaddr *to, socklen_t tolen)
+{
+	struct tls_sock *tls = obj;
+	int ret = mbedtls_ssl_write(&tls->ssl, buf, len);
+
+	// A close notify from the server is not a successful send.
+	if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY || ret == MBEDTLS_ERR_SSL_CONN_EOF) {
+		errno = ECONNRESET;
+		return -1;
+	}
+	return ret >= 0 ? ret : tls_sock_error(ret);
+}
+
+static ssize_t tls_sock_read(void *obj, void *buf, size_t len)
+{
+	return tls_sock_recvfrom(obj, buf, len, 0, NULL, NULL);
+}
+
+static ssize_t tls_sock_write(void *obj, const void *buf, size_t len)
+{
+	return tls_sock_sendto(obj, buf, len, 0, NULL, 0);
+}
+
+static int tls_sock_close(void *obj)
+{
+	struct tls_sock *tls = obj;
+
+	// Best effort; the server may already have closed the connection.
+	(void)mbedtls_ssl_close_notify(&tls->ssl);
+	mbedtls_ssl_free(&tls->ssl);
+	tls->open = false;
+	return close(tls->sock);
+}
+
+/* Poll is passed on to the TCP socket, except when a record was already
+ * decrypted and not all of it read, which the TCP socket knows nothing of.
+ */
+static int tls_sock_ioctl(void *obj, unsigned int request, va_list args)
+{
+	struct tls_sock *tls = obj;
+	const struct fd_op_vtable *vtable;
+	struct k_mutex *lock;
+	void *inner;
+
+	switch (request) {
+	case ZFD_IOCTL_POLL_PREPARE: {
+		struct zsock_pollfd *pfd;
+		struct k_poll_event **pev;
+		struct k_poll_event *pev_end;
+
+		pfd = va_arg(args, struct zsock_pollfd *);
+		pev = va_arg(args, struct k_poll_event **);
+		pev_end = va_arg(args, struct k_poll_event *);
+
+		tls->poll_ready = (pfd->events & ZSOCK_POLLIN) &&
+				  mbedtls_ssl_get_bytes_avail(&tls->ssl) > 0;
+		if (tls->poll_ready) {
+			return -EALREADY;
+		}
+		inner = z_get_fd_obj_and_vtable(tls->sock, &vtable, &lock);
+		if (!inner) {
+			return -EBADF;
+		}
+		return z_fdtable_call_ioctl(vtable, inner, request, pfd, pev, pev_end);
+	}
+	case ZFD_IOCTL_POLL_UPDATE: {
+		struct zsock_pollfd *pfd;
+		struct k_poll_event **pev;
+
+		pfd = va_arg(args, struct zsock_pollfd *);
+		pev = va_arg(args, struct k_poll_event **);
+
+		if (tls->poll_ready) {
+			// No event was added for it, so there is none to consume.
+			tls->poll_ready = false;
+			pfd->revents |= ZSOCK_POLLIN;
+			return 0;
+		}
+		inner = z_get_fd_obj_and_vtable(tls->sock, &vtable, &lock);
+		if (!inner) {
+			return -EBADF;
+		}
+		return z_fdtable_call_ioctl(vtable, inner, request, pfd, pev);
+	}
+
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+static const struct socket_op_vtable tls_sock_vtable_ = {
+	.fd_vtable = {
+		.read = tls_sock_read,
+		.write = tls_sock_write,
+		.close = tls_sock_close,
+		.ioctl = tls_sock_ioctl,
+	},
+	.sendto = tls_sock_sendto,
+	.recvfrom = tls_sock_recvfrom,
+};
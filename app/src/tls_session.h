@@ -0,0 +1,77 @@
+/*
+ * TLS 1.2 with mbedTLS over an offloaded modem socket.
+ *
+ * A connected TCP socket is wrapped in a new socket descriptor that runs
+ * mbedTLS on top of it, so the HTTP client and everything else that takes a
+ * socket work unchanged. Only ECDHE-ECDSA with AES-128-GCM on P-256 is
+ * offered, which keeps the handshake to one curve and one signature check.
+ *
+ * The session of the last handshake is saved in settings under
+ * "tls/session" and offered on the next connection, also after a reboot, as
+ * a session ticket or session ID. A resumed handshake skips the certificate
+ * and the key exchange, which saves one round trip, most of the handshake
+ * bytes and the ECC work on every connection after the first.
+ *
+ * Handshakes are counted in the "tls" stats group, split into full and
+ * resumed, with the time, bytes and heap peak of the last one of each.
+ *
+ * Usage:
+ *
+ *	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+ *	connect(sock, addr, addrlen);
+ *	tls_sock = tls_session_wrap(sock, CONFIG_APP_BACKEND_HOST, &stats);
+ *	http_client_req(tls_sock, ...);
+ *	close(tls_sock);
+ */
+
+#ifndef APP_TLS_SESSION_H
+#define APP_TLS_SESSION_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct tls_session_stats {
+	uint32_t handshake_ms;
+	/* TLS bytes exchanged during the handshake. */
+	uint32_t handshake_tx;
+	uint32_t handshake_rx;
+	/* Peak mbedTLS heap use up to the end of the handshake; 0 when not
+	 * measured.
+	 */
+	uint32_t heap_peak;
+	bool resumed;
+};
+
+#if defined(CONFIG_APP_BACKEND_TLS_MBEDTLS)
+/** @brief Set up the TLS configuration and register the "tls" stats group. */
+int tls_session_init(void);
+
+/**
+ * @brief Run a TLS handshake over the connected socket @p sock.
+ *
+ * One wrapped socket can be open at a time.
+ *
+ * @param hostname Name checked against the server certificate, also sent
+ * as SNI.
+ * @param stats Filled in once the handshake is done.
+ * @returns A socket descriptor for the TLS connection, which also closes
+ * @p sock when it is closed. @p sock stays usable for the data usage of the
+ * connection. On error, a negative errno and @p sock is left open.
+ * @retval -EBUSY if a wrapped socket is already open.
+ * @retval -ECONNABORTED if the handshake failed.
+ */
+int tls_session_wrap(int sock, const char *hostname, struct tls_session_stats *stats);
+#else
+static inline int tls_session_init(void)
+{
+	return 0;
+}
+static inline int tls_session_wrap(int sock, const char *hostname,
+				   struct tls_session_stats *stats)
+{
+	return -ENOTSUP;
+}
+#endif /* defined(CONFIG_APP_BACKEND_TLS_MBEDTLS) */
+
+#endif /* APP_TLS_SESSION_H */
@@ -0,0 +1,17 @@
+/*
+ * Additions to the mbedTLS configuration Zephyr generates, for the backend
+ * TLS client. See src/tls_session.h.
+ */
+
+#ifndef APP_MBEDTLS_USER_CONFIG_H
+#define APP_MBEDTLS_USER_CONFIG_H
+
+/* Resume with a ticket when the server issues one, else with the session ID. */
+#define MBEDTLS_SSL_SESSION_TICKETS
+
+/* Keep only a digest of the server certificate in the session, so a saved
+ * session is a few hundred bytes rather than the size of the certificate.
+ */
+#undef MBEDTLS_SSL_KEEP_PEER_CERTIFICATE
+
+#endif /* APP_MBEDTLS_USER_CONFIG_H */
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2020 Analog Life LLC
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Response parsing helpers of the driver. They are kept apart from the
+ * driver so that tests/benchmarks/hot_paths can time them; the includer
+ * must have registered a log module.
+ */
+
+#ifndef QUECTEL_BG96_PARSE_H
+#define QUECTEL_BG96_PARSE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <zephyr/logging/log.h>
+
+static inline int digits(int n)
+{
+	int count = 0;
+
+	while (n != 0) {
+		n /= 10;
+		++count;
+	}
+
+	return count;
+}
+
+static inline uint32_t hash32(char *str, int len)
+{
+#define HASH_MULTIPLIER		37
+
+	uint32_t h = 0;
+	int i;
+
+	for (i = 0; i < len; ++i) {
+		h = (h * HASH_MULTIPLIER) + str[i];
+	}
+
+	return h;
+}
+
+/* Func: modem_atoi
+ * Desc: Convert string to long integer, but handle errors
+ */
+static inline int modem_atoi(const char *s, const int err_value,
+			     const char *desc, const char *func)
+{
+	int   ret;
+	char  *endptr;
+
+	ret = (int)strtol(s, &endptr, 10);
+	if (!endptr || *endptr != '\0') {
+		LOG_ERR("bad %s '%s' in %s", s, desc,
+			func);
+		return err_value;
+	}
+
+	return ret;
+}
+
+/* Func: find_len
+ * Desc: Parse the length that starts a +QIRD data response, up to "\r",
+ * or up to the "," before the remote address of a UDP service.
+ */
+static inline int find_len(char *data)
+{
+	char buf[10] = {0};
+	int  i;
+
+	for (i = 0; i < 10; i++) {
+		if (data[i] == '\r' || data[i] == ',') {
+			break;
+		}
+
+		buf[i] = data[i];
+	}
+
+	return modem_atoi(buf, 0, "rx_buf", __func__);
+}
+
+#endif /* QUECTEL_BG96_PARSE_H */
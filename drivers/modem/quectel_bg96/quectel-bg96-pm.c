@@ -0,0 +1,160 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Time-in-state and wake latency accounting for the BG96 power saving.
+ * With stats enabled the counters are also registered as the "bg96_pm"
+ * stats group.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+
+#include "quectel-bg96.h"
+
+#if defined(CONFIG_STATS)
+STATS_SECT_START(bg96_pm)
+STATS_SECT_ENTRY(awake_ms)
+STATS_SECT_ENTRY(sleep_ms)
+STATS_SECT_ENTRY(psm_ms)
+STATS_SECT_ENTRY(wakes)
+STATS_SECT_ENTRY(psm_wakes)
+STATS_SECT_ENTRY(wake_ms_last)
+STATS_SECT_ENTRY(wake_ms_max)
+STATS_SECT_ENTRY(first_byte_ms_last)
+STATS_SECT_ENTRY(first_byte_ms_max)
+STATS_SECT_END;
+
+STATS_NAME_START(bg96_pm)
+STATS_NAME(bg96_pm, awake_ms)
+STATS_NAME(bg96_pm, sleep_ms)
+STATS_NAME(bg96_pm, psm_ms)
+STATS_NAME(bg96_pm, wakes)
+STATS_NAME(bg96_pm, psm_wakes)
+STATS_NAME(bg96_pm, wake_ms_last)
+STATS_NAME(bg96_pm, wake_ms_max)
+STATS_NAME(bg96_pm, first_byte_ms_last)
+STATS_NAME(bg96_pm, first_byte_ms_max)
+STATS_NAME_END(bg96_pm);
+
+static STATS_SECT_DECL(bg96_pm) pm_stats_group;
+#endif /* defined(CONFIG_STATS) */
+
+static struct quectel_bg96_pm_stats pm_stats;
+static bool pm_asleep;
+/* Uptime of the last state change. */
+static int64_t pm_since;
+/* Uptime of the last wake while its first byte is still to come, or -1. */
+static int64_t pm_wake_start = -1;
+static uint32_t pm_psm_after_ms;
+static struct k_spinlock pm_lock;
+
+/* Add the time spent in the current state up to @p now to @p stats. */
+static void pm_add_interval(struct quectel_bg96_pm_stats *stats, int64_t now)
+{
+	uint32_t ms = (uint32_t)(now - pm_since);
+
+	if (!pm_asleep) {
+		stats->awake_ms += ms;
+		return;
+	}
+
+	stats->sleep_ms += ms;
+	if (pm_psm_after_ms && ms > pm_psm_after_ms) {
+		stats->psm_ms += ms - pm_psm_after_ms;
+	}
+}
+
+static void pm_publish(void)
+{
+#if defined(CONFIG_STATS)
+	STATS_SET(pm_stats_group, awake_ms, pm_stats.awake_ms);
+	STATS_SET(pm_stats_group, sleep_ms, pm_stats.sleep_ms);
+	STATS_SET(pm_stats_group, psm_ms, pm_stats.psm_ms);
+	STATS_SET(pm_stats_group, wakes, pm_stats.wakes);
+	STATS_SET(pm_stats_group, psm_wakes, pm_stats.psm_wakes);
+	STATS_SET(pm_stats_group, wake_ms_last, pm_stats.wake_ms_last);
+	STATS_SET(pm_stats_group, wake_ms_max, pm_stats.wake_ms_max);
+	STATS_SET(pm_stats_group, first_byte_ms_last, pm_stats.first_byte_ms_last);
+	STATS_SET(pm_stats_group, first_byte_ms_max, pm_stats.first_byte_ms_max);
+#endif
+}
+
+void mdm_pm_stats_init(void)
+{
+	pm_since = k_uptime_get();
+#if defined(CONFIG_STATS)
+	stats_init_and_reg(&pm_stats_group.s_hdr, STATS_SIZE_32,
+			   (sizeof(pm_stats_group) - sizeof(struct stats_hdr)) / STATS_SIZE_32,
+			   STATS_NAME_INIT_PARMS(bg96_pm), "bg96_pm");
+#endif
+}
+
+void mdm_pm_stats_sleep(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&pm_lock);
+
+	pm_add_interval(&pm_stats, k_uptime_get());
+	pm_since = k_uptime_get();
+	pm_asleep = true;
+	/* Data read before the modem went back to sleep was not woken for. */
+	pm_wake_start = -1;
+	pm_publish();
+	k_spin_unlock(&pm_lock, key);
+}
+
+void mdm_pm_stats_wake(uint32_t wake_ms, bool psm)
+{
+	k_spinlock_key_t key = k_spin_lock(&pm_lock);
+	int64_t now = k_uptime_get();
+
+	/* The wake itself is counted as sleep, up to when it started. */
+	pm_add_interval(&pm_stats, now - wake_ms);
+	pm_stats.awake_ms += wake_ms;
+	pm_since = now;
+	pm_asleep = false;
+	pm_wake_start = now - wake_ms;
+
+	pm_stats.wakes++;
+	if (psm) {
+		pm_stats.psm_wakes++;
+	}
+	pm_stats.wake_ms_last = wake_ms;
+	pm_stats.wake_ms_max = MAX(pm_stats.wake_ms_max, wake_ms);
+	pm_publish();
+	k_spin_unlock(&pm_lock, key);
+}
+
+void mdm_pm_stats_rx(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&pm_lock);
+	uint32_t ms;
+
+	if (pm_wake_start >= 0) {
+		ms = (uint32_t)(k_uptime_get() - pm_wake_start);
+		pm_wake_start = -1;
+		pm_stats.first_byte_ms_last = ms;
+		pm_stats.first_byte_ms_max = MAX(pm_stats.first_byte_ms_max, ms);
+		pm_publish();
+	}
+	k_spin_unlock(&pm_lock, key);
+}
+
+void mdm_pm_stats_psm_active(uint32_t active_s)
+{
+	k_spinlock_key_t key = k_spin_lock(&pm_lock);
+
+	pm_psm_after_ms = active_s * MSEC_PER_SEC;
+	k_spin_unlock(&pm_lock, key);
+}
+
+int quectel_bg96_pm_stats(struct quectel_bg96_pm_stats *stats)
+{
+	k_spinlock_key_t key = k_spin_lock(&pm_lock);
+
+	*stats = pm_stats;
+	/* Include the state the modem is in now. */
+	pm_add_interval(stats, k_uptime_get());
+	k_spin_unlock(&pm_lock, key);
+	return 0;
+}
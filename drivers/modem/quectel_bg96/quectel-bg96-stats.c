@@ -0,0 +1,131 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Per-command-class latency statistics for the BG96 driver. Each class is
+ * registered as its own stats group, so they can be read with the
+ * "stats show" shell command or the mcumgr stat group.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/util.h>
+
+#include "quectel-bg96.h"
+
+STATS_SECT_START(bg96_cmd)
+STATS_SECT_ENTRY(count)
+STATS_SECT_ENTRY(timeouts)
+STATS_SECT_ENTRY(errors)
+STATS_SECT_ENTRY(min_us)
+STATS_SECT_ENTRY(max_us)
+STATS_SECT_ENTRY(total_ms)
+/* Log-scaled latency buckets, each 4x the previous. */
+STATS_SECT_ENTRY(lt1ms)
+STATS_SECT_ENTRY(lt4ms)
+STATS_SECT_ENTRY(lt16ms)
+STATS_SECT_ENTRY(lt64ms)
+STATS_SECT_ENTRY(lt256ms)
+STATS_SECT_ENTRY(lt1s)
+STATS_SECT_ENTRY(lt4s)
+STATS_SECT_ENTRY(ge4s)
+STATS_SECT_END;
+
+STATS_NAME_START(bg96_cmd)
+STATS_NAME(bg96_cmd, count)
+STATS_NAME(bg96_cmd, timeouts)
+STATS_NAME(bg96_cmd, errors)
+STATS_NAME(bg96_cmd, min_us)
+STATS_NAME(bg96_cmd, max_us)
+STATS_NAME(bg96_cmd, total_ms)
+STATS_NAME(bg96_cmd, lt1ms)
+STATS_NAME(bg96_cmd, lt4ms)
+STATS_NAME(bg96_cmd, lt16ms)
+STATS_NAME(bg96_cmd, lt64ms)
+STATS_NAME(bg96_cmd, lt256ms)
+STATS_NAME(bg96_cmd, lt1s)
+STATS_NAME(bg96_cmd, lt4s)
+STATS_NAME(bg96_cmd, ge4s)
+STATS_NAME_END(bg96_cmd);
+
+#define MDM_CMD_STATS_BUCKETS 8
+#define MDM_CMD_STATS_FIRST_BUCKET_US 1000
+
+static STATS_SECT_DECL(bg96_cmd) cmd_stats[MDM_CMD_CLASS_COUNT];
+
+static const char *const cmd_stats_names[MDM_CMD_CLASS_COUNT] = {
+	[MDM_CMD_CLASS_TX_LOCK] = "bg96_tx_lock",
+	[MDM_CMD_CLASS_QIOPEN] = "bg96_qiopen",
+#if defined(CONFIG_MODEM_QUECTEL_BG96_SSL)
+	[MDM_CMD_CLASS_QSSLOPEN] = "bg96_qsslopen",
+#endif
+	[MDM_CMD_CLASS_QISEND_PROMPT] = "bg96_qisend_prompt",
+	[MDM_CMD_CLASS_SEND_OK] = "bg96_send_ok",
+	[MDM_CMD_CLASS_QIRD] = "bg96_qird",
+	[MDM_CMD_CLASS_QIDNSGIP] = "bg96_qidnsgip",
+	[MDM_CMD_CLASS_QFREAD] = "bg96_qfread",
+	[MDM_CMD_CLASS_OTHER] = "bg96_other",
+};
+
+/* Records are made by the sending threads, which may run concurrently. */
+static struct k_spinlock cmd_stats_lock;
+
+void mdm_cmd_stats_init(void)
+{
+	for (int i = 0; i < MDM_CMD_CLASS_COUNT; i++) {
+		stats_init_and_reg(&cmd_stats[i].s_hdr, STATS_SIZE_32,
+				   (sizeof(cmd_stats[i]) - sizeof(struct stats_hdr)) /
+				   STATS_SIZE_32,
+				   STATS_NAME_INIT_PARMS(bg96_cmd), cmd_stats_names[i]);
+	}
+}
+
+/* Cycles are precise but wrap within a minute at the usual clock rates,
+ * so they are only used while the uptime says they have not.
+ */
+static uint32_t elapsed_us(struct mdm_cmd_start start)
+{
+	uint64_t us = k_ticks_to_us_floor64(k_uptime_ticks() - start.ticks);
+
+	if (us < USEC_PER_SEC) {
+		return k_cyc_to_us_floor32(k_cycle_get_32() - start.cycles);
+	}
+	return (uint32_t)MIN(us, UINT32_MAX);
+}
+
+void mdm_cmd_stats_record(enum mdm_cmd_class cls, struct mdm_cmd_start start, int ret)
+{
+	uint32_t us = elapsed_us(start);
+	uint32_t limit = MDM_CMD_STATS_FIRST_BUCKET_US;
+	uint32_t *buckets;
+	k_spinlock_key_t key;
+	int bucket = 0;
+
+	if (cls >= MDM_CMD_CLASS_COUNT) {
+		return;
+	}
+	/* The buckets are consecutive 32-bit entries starting at lt1ms. */
+	buckets = &cmd_stats[cls].lt1ms;
+
+	while (bucket < MDM_CMD_STATS_BUCKETS - 1 && us >= limit) {
+		limit *= 4;
+		bucket++;
+	}
+
+	key = k_spin_lock(&cmd_stats_lock);
+	if (cmd_stats[cls].count == 0 || us < cmd_stats[cls].min_us) {
+		STATS_SET(cmd_stats[cls], min_us, us);
+	}
+	if (us > cmd_stats[cls].max_us) {
+		STATS_SET(cmd_stats[cls], max_us, us);
+	}
+	STATS_INC(cmd_stats[cls], count);
+	STATS_INCN(cmd_stats[cls], total_ms, us / USEC_PER_MSEC);
+	if (ret == -ETIMEDOUT || ret == -EAGAIN) {
+		STATS_INC(cmd_stats[cls], timeouts);
+	} else if (ret < 0) {
+		STATS_INC(cmd_stats[cls], errors);
+	}
+	buckets[bucket]++;
+	k_spin_unlock(&cmd_stats_lock, key);
+}
@@ -10,6 +10,7 @@
 LOG_MODULE_REGISTER(modem_quectel_bg96, CONFIG_MODEM_LOG_LEVEL);
 
 #include "quectel-bg96.h"
+#include "quectel-bg96-parse.h"
 
 static struct k_thread	       modem_rx_thread;
 static struct k_work_q	       modem_workq;
@@ -22,11 +23,24 @@ static struct zsock_addrinfo result;
 static struct sockaddr result_addr;
 static char result_canonname[DNS_MAX_NAME_SIZE + 1];
 #define MDM_DNS_TIMEOUT			K_SECONDS(60)
+
+/* Each lookup hands out a copy of the result, freed by freeaddrinfo(). */
+#define MDM_DNS_RESULTS			4
+struct mdm_dns_result {
+	struct zsock_addrinfo ai;
+	struct sockaddr addr;
+};
+K_MEM_SLAB_DEFINE_STATIC(dns_results, sizeof(struct mdm_dns_result), MDM_DNS_RESULTS, 4);
 #endif
 
 static K_KERNEL_STACK_DEFINE(modem_rx_stack, CONFIG_MODEM_QUECTEL_BG96_RX_STACK_SIZE);
 static K_KERNEL_STACK_DEFINE(modem_workq_stack, CONFIG_MODEM_QUECTEL_BG96_RX_WORKQ_STACK_SIZE);
+static const struct k_work_queue_config modem_workq_cfg = {
+	.name = "modem_workq",
+};
 NET_BUF_POOL_DEFINE(mdm_recv_pool, MDM_RECV_MAX_BUF, MDM_RECV_BUF_SIZE, 0, NULL);
+BUILD_ASSERT(MDM_FILE_READ_MAX <= MDM_RECV_MAX_BUF * MDM_RECV_BUF_SIZE / 2,
+	     "A file block must fit in the receive buffers");
 
 static const struct gpio_dt_spec power_gpio = GPIO_DT_SPEC_INST_GET(0, mdm_power_gpios);
 static const struct gpio_dt_spec reset_gpio = GPIO_DT_SPEC_INST_GET(0, mdm_reset_gpios);
@@ -41,32 +55,6 @@ static const struct gpio_dt_spec sim_select0_gpio = GPIO_DT_SPEC_INST_GET_BY_IDX
 static const struct gpio_dt_spec sim_select1_gpio = GPIO_DT_SPEC_INST_GET_BY_IDX(0, mdm_sim_select_gpios, 1);
 #endif
 
-static inline int digits(int n)
-{
-	int count = 0;
-
-	while (n != 0) {
-		n /= 10;
-		++count;
-	}
-
-	return count;
-}
-
-static inline uint32_t hash32(char *str, int len)
-{
-#define HASH_MULTIPLIER		37
-
-	uint32_t h = 0;
-	int i;
-
-	for (i = 0; i < len; ++i) {
-		h = (h * HASH_MULTIPLIER) + str[i];
-	}
-
-	return h;
-}
-
 static inline uint8_t *modem_get_mac(const struct device *dev)
 {
 	struct modem_data *data = dev->data;
@@ -83,43 +71,136 @@ static inline uint8_t *modem_get_mac(const struct device *dev)
 	return data->mac_addr;
 }
 
-/* Func: modem_atoi
- * Desc: Convert string to long integer, but handle errors
+/* Func: sock_is_tls
+ * Desc: Whether the socket runs over the modem's SSL stack, which has its
+ * own open, send, read and close commands for the same connect IDs.
+ */
+static inline bool sock_is_tls(const struct modem_socket *sock)
+{
+	return IS_ENABLED(CONFIG_MODEM_QUECTEL_BG96_SSL) && sock &&
+	       sock->ip_proto == IPPROTO_TLS_1_2;
+}
+
+/* Func: sock_usage_add
+ * Desc: Add to the data usage counters of the socket's connect ID.
  */
-static int modem_atoi(const char *s, const int err_value,
-		      const char *desc, const char *func)
+static void sock_usage_add(struct modem_socket *sock,
+			   const struct quectel_bg96_data_usage *delta)
+{
+	struct quectel_bg96_data_usage *usage;
+	k_spinlock_key_t key;
+
+	if (!sock || sock->id < MDM_BASE_SOCKET_NUM ||
+	    sock->id >= MDM_BASE_SOCKET_NUM + MDM_MAX_SOCKETS) {
+		return;
+	}
+
+	usage = &mdata.usage[sock->id - MDM_BASE_SOCKET_NUM];
+	key = k_spin_lock(&mdata.usage_lock);
+	usage->tx_bytes += delta->tx_bytes;
+	usage->rx_bytes += delta->rx_bytes;
+	usage->tx_packets += delta->tx_packets;
+	usage->rx_packets += delta->rx_packets;
+	usage->tx_at_bytes += delta->tx_at_bytes;
+	usage->rx_at_bytes += delta->rx_at_bytes;
+	k_spin_unlock(&mdata.usage_lock, key);
+}
+
+/* Func: sock_usage_at
+ * Desc: Count an AT command sent for the socket and its response framing.
+ * The command is followed by a CR on the UART.
+ */
+static void sock_usage_at(struct modem_socket *sock, const char *cmd, size_t rx_len)
+{
+	struct quectel_bg96_data_usage delta = {
+		.tx_at_bytes = strlen(cmd) + 1,
+		.rx_at_bytes = rx_len,
+	};
+
+	sock_usage_add(sock, &delta);
+}
+
+int quectel_bg96_connect_id_usage(int connect_id, struct quectel_bg96_data_usage *usage)
 {
-	int   ret;
-	char  *endptr;
+	k_spinlock_key_t key;
 
-	ret = (int)strtol(s, &endptr, 10);
-	if (!endptr || *endptr != '\0') {
-		LOG_ERR("bad %s '%s' in %s", s, desc,
-			func);
-		return err_value;
+	if (connect_id < MDM_BASE_SOCKET_NUM ||
+	    connect_id >= MDM_BASE_SOCKET_NUM + MDM_MAX_SOCKETS) {
+		return -EINVAL;
 	}
 
-	return ret;
+	key = k_spin_lock(&mdata.usage_lock);
+	*usage = mdata.usage[connect_id - MDM_BASE_SOCKET_NUM];
+	k_spin_unlock(&mdata.usage_lock, key);
+	return 0;
 }
 
-static inline int find_len(char *data)
+int quectel_bg96_socket_usage(int fd, struct quectel_bg96_data_usage *usage)
 {
-	char buf[10] = {0};
-	int  i;
+	struct modem_socket *sock = modem_socket_from_fd(&mdata.socket_config, fd);
+	const struct quectel_bg96_data_usage *now, *start;
+	k_spinlock_key_t key;
 
-	for (i = 0; i < 10; i++) {
-		if (data[i] == '\r') {
-			break;
-		}
+	if (!sock || sock->id < MDM_BASE_SOCKET_NUM ||
+	    sock->id >= MDM_BASE_SOCKET_NUM + MDM_MAX_SOCKETS) {
+		return -EINVAL;
+	}
 
-		buf[i] = data[i];
+	now = &mdata.usage[sock->id - MDM_BASE_SOCKET_NUM];
+	start = &mdata.usage_at_connect[sock->id - MDM_BASE_SOCKET_NUM];
+	key = k_spin_lock(&mdata.usage_lock);
+	usage->tx_bytes = now->tx_bytes - start->tx_bytes;
+	usage->rx_bytes = now->rx_bytes - start->rx_bytes;
+	usage->tx_packets = now->tx_packets - start->tx_packets;
+	usage->rx_packets = now->rx_packets - start->rx_packets;
+	usage->tx_at_bytes = now->tx_at_bytes - start->tx_at_bytes;
+	usage->rx_at_bytes = now->rx_at_bytes - start->rx_at_bytes;
+	k_spin_unlock(&mdata.usage_lock, key);
+	return 0;
+}
+
+/* Func: sockread_parse_from
+ * Desc: Parse the remote address that follows the length in the +QIRD
+ * header of a UDP service, "<len>,"<ip>",<port>".
+ */
+static int sockread_parse_from(char *header, struct sockaddr *from)
+{
+	char *ip = strchr(header, ',');
+	char *port;
+
+	if (!ip) {
+		return -ENOENT;
+	}
+	ip++;
+	port = strchr(ip, ',');
+	if (!port) {
+		return -EINVAL;
+	}
+	*port++ = '\0';
+
+	/* The address may or may not be quoted. */
+	if (*ip == '"') {
+		ip++;
+	}
+	if (port - ip >= 2 && port[-2] == '"') {
+		port[-2] = '\0';
 	}
 
-	return ATOI(buf, 0, "rx_buf");
+	memset(from, 0, sizeof(*from));
+	if (strchr(ip, ':')) {
+		from->sa_family = AF_INET6;
+		net_sin6(from)->sin6_port = htons(ATOI(port, 0, "remote_port"));
+		return net_addr_pton(AF_INET6, ip, &net_sin6(from)->sin6_addr);
+	}
+	from->sa_family = AF_INET;
+	net_sin(from)->sin_port = htons(ATOI(port, 0, "remote_port"));
+	return net_addr_pton(AF_INET, ip, &net_sin(from)->sin_addr);
 }
 
 /* Func: on_cmd_sockread_common
  * Desc: Function to successfully read data from the modem on a given socket.
+ * The data follows a header line, "<len>" for TCP and UDP clients and
+ * "<len>,"<ip>",<port>" for UDP services.
  */
 static int on_cmd_sockread_common(int socket_fd,
 				  struct modem_cmd_handler_data *data,
@@ -129,7 +210,11 @@ static int on_cmd_sockread_common(int socket_fd,
 	struct socket_read_data	 *sock_data;
 	int ret, i;
 	int socket_data_length;
-	int bytes_to_skip;
+	bool dgram, tls;
+	size_t rsp_len;
+	char header[sizeof("####,\"\",#####\r") + NET_IPV6_ADDR_LEN];
+	size_t header_len;
+	char *header_end;
 
 	if (!len) {
 		LOG_ERR("Invalid length, Aborting!");
@@ -142,11 +227,46 @@ static int on_cmd_sockread_common(int socket_fd,
 		return -EINVAL;
 	}
 
-	socket_data_length = find_len(data->rx_buf->data);
+	header_len = net_buf_linearize(header, sizeof(header) - 1, data->rx_buf, 0,
+				       sizeof(header) - 1);
+	header[header_len] = '\0';
+	header_end = strchr(header, '\r');
+	if (!header_end) {
+		return header_len == sizeof(header) - 1 ? -EINVAL : -EAGAIN;
+	}
+	*header_end = '\0';
+	/* The header line and its CRLF. */
+	header_len = header_end - header + 2;
+
+	socket_data_length = find_len(header);
+
+	sock = modem_socket_from_fd(&mdata.socket_config, socket_fd);
+	dgram = sock && sock->type == SOCK_DGRAM;
+	tls = sock_is_tls(sock);
+	rsp_len = tls ? sizeof(MDM_QSSLRECV_RSP) - 1 : sizeof(MDM_QIRD_RSP) - 1;
 
 	/* No (or not enough) data available on the socket. */
-	bytes_to_skip = digits(socket_data_length) + 2 + 4;
 	if (socket_data_length <= 0) {
+		if ((dgram || tls) && socket_data_length == 0) {
+			struct quectel_bg96_data_usage delta = {
+				.rx_at_bytes = rsp_len + header_len - 2,
+			};
+
+			/* Nothing queued; recvfrom() will wait for the next URC.
+			 * The socket stops polling readable until then. This runs
+			 * on the RX thread in order with the URC handler, so a
+			 * "recv" URC behind this response is not cleared.
+			 */
+			for (i = 0; i < header_len; i++) {
+				net_buf_pull_u8(data->rx_buf);
+			}
+			if (!data->rx_buf->len) {
+				data->rx_buf = net_buf_frag_del(NULL, data->rx_buf);
+			}
+			sock_usage_add(sock, &delta);
+			modem_socket_packet_size_update(&mdata.socket_config, sock, 0);
+			return 0;
+		}
 		// TODO(mskobov): This is an annoying bug in the driver that should be fixed.
 		// LOG_ERR("Length problem (%d).  Aborting!", socket_data_length);
 		return -EAGAIN;
@@ -154,14 +274,14 @@ static int on_cmd_sockread_common(int socket_fd,
 
 	/* check to make sure we have all of the data. */
 	int frag_len = net_buf_frags_len(data->rx_buf);
-	if (frag_len < (socket_data_length + bytes_to_skip)) {
-		LOG_DBG("Not enough data. Want: %d + %d, have %d", socket_data_length, bytes_to_skip, frag_len);
+	if (frag_len < (socket_data_length + header_len + 4)) {
+		LOG_DBG("Not enough data. Want: %d + %d, have %d", socket_data_length,
+			header_len + 4, frag_len);
 		return -EAGAIN;
 	}
 
-	/* Skip "len" and CRLF */
-	bytes_to_skip = digits(socket_data_length) + 2;
-	for (i = 0; i < bytes_to_skip; i++) {
+	/* Skip the header line and CRLF */
+	for (i = 0; i < header_len; i++) {
 		net_buf_pull_u8(data->rx_buf);
 	}
 
@@ -169,7 +289,6 @@ static int on_cmd_sockread_common(int socket_fd,
 		data->rx_buf = net_buf_frag_del(NULL, data->rx_buf);
 	}
 
-	sock = modem_socket_from_fd(&mdata.socket_config, socket_fd);
 	if (!sock) {
 		LOG_ERR("Socket not found! (%d)", socket_fd);
 		ret = -EINVAL;
@@ -183,12 +302,25 @@ static int on_cmd_sockread_common(int socket_fd,
 		goto exit;
 	}
 
+	sock_data->has_recv_from = sockread_parse_from(header, &sock_data->recv_from) == 0;
+
 	LOG_DBG("Reading socket data");
 	ret = net_buf_linearize(sock_data->recv_buf, sock_data->recv_buf_len,
 				data->rx_buf, 0, (uint16_t)socket_data_length);
-	data->rx_buf = net_buf_skip(data->rx_buf, ret);
+	/* A datagram is read whole, and truncated to the buffer like recv(). */
+	data->rx_buf = net_buf_skip(data->rx_buf, dgram ? socket_data_length : ret);
 	sock_data->recv_read_len = ret;
-	if (ret != socket_data_length) {
+
+	struct quectel_bg96_data_usage delta = {
+		.rx_bytes = ret,
+		.rx_packets = 1,
+		/* "+QIRD: <header>\r\n" or "+QSSLRECV: <header>\r\n" before the data */
+		.rx_at_bytes = rsp_len + header_len - 2,
+	};
+
+	sock_usage_add(sock, &delta);
+	mdm_pm_stats_rx();
+	if (ret != socket_data_length && !dgram) {
 		LOG_ERR("Total copied data is different then received data!"
 			" copied:%d vs. received:%d", ret, socket_data_length);
 		ret = -EINVAL;
@@ -207,9 +339,10 @@ exit:
 // Added by instructors for checking received data size.
 static int on_cmd_handle_check_data(int socket_fd,
 				  struct modem_cmd_handler_data *data,
-				  int unread)
+				  int unread, size_t rsp_len)
 {
 	struct modem_socket	 *sock = NULL;
+	struct quectel_bg96_data_usage delta = { 0 };
 
 	sock = modem_socket_from_fd(&mdata.socket_config, socket_fd);
 	if (!sock) {
@@ -217,30 +350,279 @@ static int on_cmd_handle_check_data(int socket_fd,
 		return -EINVAL;
 	}
 
+	delta.rx_at_bytes = rsp_len;
+	sock_usage_add(sock, &delta);
+
 	if (unread) {
 		(void)modem_socket_packet_size_update(&mdata.socket_config, sock, unread);
 	}
 	return 0;
 }
 
+/* Func: mdm_sem_give
+ * Desc: k_sem_give, recorded in the event trace.
+ */
+static inline void mdm_sem_give(struct k_sem *sem, enum evtrace_sem id)
+{
+	evtrace_record(EVTRACE_SEM_GIVE, id, 0);
+	k_sem_give(sem);
+}
+
+/* Func: mdm_sem_take
+ * Desc: k_sem_take, recording the wait in the event trace.
+ */
+static inline int mdm_sem_take(struct k_sem *sem, enum evtrace_sem id, k_timeout_t timeout)
+{
+	int ret;
+
+	evtrace_record(EVTRACE_SEM_TAKE_BEGIN, id, 0);
+	ret = k_sem_take(sem, timeout);
+	evtrace_record(EVTRACE_SEM_TAKE_END, id, ret);
+	return ret;
+}
+
+/* Func: mdm_uart_active
+ * Desc: Keep the SoC out of its stop modes while the modem may send on the
+ * UART, as they lose UART input. Does nothing without CONFIG_PM.
+ */
+static void mdm_uart_active(bool active)
+{
+	if (active) {
+		pm_policy_state_lock_get(PM_STATE_SUSPEND_TO_IDLE, PM_ALL_SUBSTATES);
+	} else {
+		pm_policy_state_lock_put(PM_STATE_SUSPEND_TO_IDLE, PM_ALL_SUBSTATES);
+	}
+}
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PM)
+/* Func: mdm_pm_probe
+ * Desc: Send AT to find out whether the modem is awake. Called with the
+ * TX lock held.
+ */
+static int mdm_pm_probe(void)
+{
+	return modem_cmd_send_nolock(&mctx.iface, &mctx.cmd_handler, NULL, 0U, "AT",
+				     &mdata.sem_response, MDM_PM_PROBE_TIMEOUT);
+}
+
+/* Func: mdm_pm_wake_locked
+ * Desc: Wake the modem if it was let sleep: drive DTR to bring its UART up,
+ * and pulse PWRKEY if it still does not answer because it is in PSM.
+ * Called with the TX lock held.
+ */
+static void mdm_pm_wake_locked(void)
+{
+	int64_t start;
+	bool psm = false;
+	int ret;
+
+	if (!mdata.pm_asleep) {
+		return;
+	}
+
+	start = k_uptime_get();
+	mdm_uart_active(true);
+#if DT_INST_NODE_HAS_PROP(0, mdm_dtr_gpios)
+	/* DTR is active low; asserted keeps the UART up. */
+	gpio_pin_set_dt(&dtr_gpio, 1);
+	k_sleep(K_MSEC(CONFIG_MODEM_QUECTEL_BG96_PM_WAKE_MS));
+#endif
+	ret = mdm_pm_probe();
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PSM)
+	if (ret < 0) {
+		/* Only PWRKEY brings the modem out of PSM. It keeps its
+		 * registration and PDP context there, so nothing is set up
+		 * again.
+		 */
+		psm = true;
+		gpio_pin_set_dt(&power_gpio, 1);
+		k_sleep(MDM_PSM_PWRKEY_TIME);
+		gpio_pin_set_dt(&power_gpio, 0);
+		for (int i = 0; i < MDM_PSM_WAKE_PROBES && ret < 0; i++) {
+			ret = mdm_pm_probe();
+		}
+	}
+#endif
+
+	if (ret < 0) {
+		/* Stay marked asleep, so the next command tries again. */
+		LOG_ERR("Modem did not wake: %d", ret);
+		mdm_uart_active(false);
+		return;
+	}
+
+	mdata.pm_asleep = false;
+	mdm_pm_stats_wake((uint32_t)(k_uptime_get() - start), psm);
+}
+
+/* Func: mdm_pm_busy
+ * Desc: Whether a response may come while no command is in flight. The
+ * modem holds URCs while its UART sleeps, and there is no RI line to
+ * learn of them, so it is kept awake while a socket is open or an HTTP
+ * result is awaited.
+ */
+static bool mdm_pm_busy(void)
+{
+	if (atomic_get(&mdata.pm_holds) > 0) {
+		return true;
+	}
+
+	for (int i = 0; i < MDM_MAX_SOCKETS; i++) {
+		if (modem_socket_is_allocated(&mdata.socket_config, &mdata.sockets[i])) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Func: mdm_pm_idle_work
+ * Desc: Let the modem sleep once it has been idle for the idle time.
+ */
+static void mdm_pm_idle_work(struct k_work *work)
+{
+	/* A command in flight restarts the idle time when it is done. */
+	if (k_sem_take(&mdata.cmd_handler_data.sem_tx_lock, K_NO_WAIT) < 0) {
+		return;
+	}
+
+	if (mdm_pm_busy()) {
+		k_work_reschedule_for_queue(&modem_workq, &mdata.pm_idle_work,
+					    K_MSEC(CONFIG_MODEM_QUECTEL_BG96_PM_IDLE_MS));
+	} else if (!mdata.pm_asleep) {
+#if DT_INST_NODE_HAS_PROP(0, mdm_dtr_gpios)
+		gpio_pin_set_dt(&dtr_gpio, 0);
+#endif
+		mdata.pm_asleep = true;
+		mdm_pm_stats_sleep();
+		mdm_uart_active(false);
+	}
+
+	k_sem_give(&mdata.cmd_handler_data.sem_tx_lock);
+}
+
+/* Func: mdm_pm_idle_restart
+ * Desc: Start the idle time over, after a command.
+ */
+static void mdm_pm_idle_restart(void)
+{
+	if (mdata.pm_started) {
+		k_work_reschedule_for_queue(&modem_workq, &mdata.pm_idle_work,
+					    K_MSEC(CONFIG_MODEM_QUECTEL_BG96_PM_IDLE_MS));
+	}
+}
+
+/* Keep the modem awake while waiting for a URC outside of a command. */
+static inline void mdm_pm_hold(void)
+{
+	atomic_inc(&mdata.pm_holds);
+}
+
+static inline void mdm_pm_release(void)
+{
+	atomic_dec(&mdata.pm_holds);
+	mdm_pm_idle_restart();
+}
+#else
+static inline void mdm_pm_wake_locked(void) {}
+static inline void mdm_pm_idle_restart(void) {}
+static inline void mdm_pm_hold(void) {}
+static inline void mdm_pm_release(void) {}
+#endif /* defined(CONFIG_MODEM_QUECTEL_BG96_PM) */
+
+/* Func: mdm_tx_lock
+ * Desc: Take the command handler TX lock, recording the time spent waiting,
+ * and wake the modem if it was let sleep.
+ */
+static void mdm_tx_lock(void)
+{
+	struct mdm_cmd_start start = mdm_cmd_stats_start();
+
+	mdm_sem_take(&mdata.cmd_handler_data.sem_tx_lock, EVTRACE_SEM_MDM_TX_LOCK, K_FOREVER);
+	mdm_cmd_stats_record(MDM_CMD_CLASS_TX_LOCK, start, 0);
+	mdm_pm_wake_locked();
+}
+
+static void mdm_tx_unlock(void)
+{
+	mdm_pm_idle_restart();
+	mdm_sem_give(&mdata.cmd_handler_data.sem_tx_lock, EVTRACE_SEM_MDM_TX_LOCK);
+}
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PM)
+/* Func: mdm_pm_wake_work
+ * Desc: Wake the modem ahead of a command, see quectel_bg96_wake().
+ */
+static void mdm_pm_wake_work(struct k_work *work)
+{
+	mdm_tx_lock();
+	mdm_tx_unlock();
+}
+
+void quectel_bg96_wake(void)
+{
+	if (mdata.pm_started && mdata.pm_asleep) {
+		k_work_submit_to_queue(&modem_workq, &mdata.pm_wake_work);
+	}
+}
+#else
+void quectel_bg96_wake(void) {}
+
+int quectel_bg96_pm_stats(struct quectel_bg96_pm_stats *stats)
+{
+	return -ENOTSUP;
+}
+#endif /* defined(CONFIG_MODEM_QUECTEL_BG96_PM) */
+
+/* Func: mdm_cmd_send
+ * Desc: Same as modem_cmd_send, but records the lock wait and the command
+ * latency under the given class.
+ */
+static int mdm_cmd_send(enum mdm_cmd_class cls,
+			const struct modem_cmd *handler_cmds,
+			size_t handler_cmds_len, const uint8_t *buf,
+			struct k_sem *sem, k_timeout_t timeout)
+{
+	struct mdm_cmd_start start;
+	int ret;
+
+	mdm_tx_lock();
+	start = mdm_cmd_stats_start();
+	evtrace_record(EVTRACE_MDM_CMD_BEGIN, 0, evtrace_tag(buf));
+	ret = modem_cmd_send_nolock(&mctx.iface, &mctx.cmd_handler,
+				    handler_cmds, handler_cmds_len, buf,
+				    sem, timeout);
+	evtrace_record(EVTRACE_MDM_CMD_END, (uint16_t)ret, 0);
+	if (cls != MDM_CMD_CLASS_NONE) {
+		mdm_cmd_stats_record(cls, start, ret);
+	}
+	mdm_tx_unlock();
+
+	return ret;
+}
+
 /* Func: socket_close
  * Desc: Function to close the given socket descriptor.
  */
 static void socket_close(struct modem_socket *sock)
 {
-	char buf[sizeof("AT+QICLOSE=##")] = {0};
+	char buf[sizeof("AT+QSSLCLOSE=##")] = {0};
 	int  ret;
 
-	snprintk(buf, sizeof(buf), "AT+QICLOSE=%d", sock->id);
+	snprintk(buf, sizeof(buf), sock_is_tls(sock) ? "AT+QSSLCLOSE=%d" : "AT+QICLOSE=%d",
+		 sock->id);
 
 	/* Tell the modem to close the socket. */
-	ret = modem_cmd_send(&mctx.iface, &mctx.cmd_handler,
-			     NULL, 0U, buf,
-			     &mdata.sem_response, MDM_CMD_TIMEOUT);
+	ret = mdm_cmd_send(MDM_CMD_CLASS_OTHER, NULL, 0U, buf,
+			   &mdata.sem_response, MDM_CMD_TIMEOUT);
+	sock_usage_at(sock, buf, sizeof(MDM_OK_RSP) - 1);
 	if (ret < 0) {
 		LOG_ERR("%s ret:%d", buf, ret);
 	}
 
+	evtrace_record(EVTRACE_SOCK_STATE, sock->id, EVTRACE_SOCK_CLOSED);
+	mdata.udp_service[sock->id - MDM_BASE_SOCKET_NUM] = false;
 	modem_socket_put(&mdata.socket_config, sock->sock_fd);
 }
 
@@ -252,30 +634,34 @@ static void socket_close_async(struct modem_socket *sock)
 {
 	// Put the socket so that it is no longer connected
 	// and no other commands to close it are sent.
+	mdata.udp_service[sock->id - MDM_BASE_SOCKET_NUM] = false;
 	modem_socket_put(&mdata.socket_config, sock->sock_fd);
 }
 
 /* Handler: OK */
 MODEM_CMD_DEFINE(on_cmd_ok)
 {
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag("OK"));
 	modem_cmd_handler_set_error(data, 0);
-	k_sem_give(&mdata.sem_response);
+	mdm_sem_give(&mdata.sem_response, EVTRACE_SEM_MDM_RESPONSE);
 	return 0;
 }
 
 /* Handler: ERROR */
 MODEM_CMD_DEFINE(on_cmd_error)
 {
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag("ERR"));
 	modem_cmd_handler_set_error(data, -EIO);
-	k_sem_give(&mdata.sem_response);
+	mdm_sem_give(&mdata.sem_response, EVTRACE_SEM_MDM_RESPONSE);
 	return 0;
 }
 
 /* Handler: +CME Error: <err>[0] */
 MODEM_CMD_DEFINE(on_cmd_exterror)
 {
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag("CME"));
 	modem_cmd_handler_set_error(data, -EIO);
-	k_sem_give(&mdata.sem_response);
+	mdm_sem_give(&mdata.sem_response, EVTRACE_SEM_MDM_RESPONSE);
 	return 0;
 }
 
@@ -301,14 +687,20 @@ MODEM_CMD_DEFINE(on_cmd_atcmdinfo_rssi_csq)
 	return 0;
 }
 
-/* Handler: +QIOPEN: <connect_id>[0], <err>[1] */
+/* Handler: +QIOPEN: <connect_id>[0], <err>[1]
+ * Also +QSSLOPEN, which has the same arguments. This arrives as a URC, so
+ * it is registered with the unsolicited commands.
+ * Setting the handler error here would clobber the result of whichever
+ * command another thread has in flight, so the result is kept separately.
+ */
 MODEM_CMD_DEFINE(on_cmd_atcmdinfo_sockopen)
 {
 	int err = ATOI(argv[1], 0, "sock_err");
 
+	evtrace_record(EVTRACE_MDM_RSP, ATOI(argv[0], 0, "sock_id"), evtrace_tag("QIOP"));
 	LOG_INF("AT+QIOPEN: %d", err);
-	modem_cmd_handler_set_error(data, err);
-	k_sem_give(&mdata.sem_sock_conn);
+	mdata.sock_conn_err = err;
+	mdm_sem_give(&mdata.sem_sock_conn, EVTRACE_SEM_MDM_SOCK_CONN);
 
 	return 0;
 }
@@ -427,22 +819,24 @@ MODEM_CMD_DEFINE(on_cmd_registration_status)
 	LOG_INF("AT+CEREG: %d", status);
 
 	registered_ = (status == BG9X_CEREG_STATUS_REGISTERED_HOME || status == BG9X_CEREG_STATUS_REGISTERED_ROAMING);
-	k_sem_give(&mdata.sem_sock_conn);
+	mdm_sem_give(&mdata.sem_sock_conn, EVTRACE_SEM_MDM_SOCK_CONN);
 	return 0;
 }
 
 /* Handler: TX Ready */
 MODEM_CMD_DIRECT_DEFINE(on_cmd_tx_ready)
 {
-	k_sem_give(&mdata.sem_tx_ready);
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag(">"));
+	mdm_sem_give(&mdata.sem_tx_ready, EVTRACE_SEM_MDM_TX_READY);
 	return len;
 }
 
 /* Handler: SEND OK */
 MODEM_CMD_DEFINE(on_cmd_send_ok)
 {
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag("SOK"));
 	modem_cmd_handler_set_error(data, 0);
-	k_sem_give(&mdata.sem_response);
+	mdm_sem_give(&mdata.sem_response, EVTRACE_SEM_MDM_RESPONSE);
 
 	return 0;
 }
@@ -450,9 +844,10 @@ MODEM_CMD_DEFINE(on_cmd_send_ok)
 /* Handler: SEND FAIL */
 MODEM_CMD_DEFINE(on_cmd_send_fail)
 {
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag("SFAI"));
 	mdata.sock_written = 0;
 	modem_cmd_handler_set_error(data, -EIO);
-	k_sem_give(&mdata.sem_response);
+	mdm_sem_give(&mdata.sem_response, EVTRACE_SEM_MDM_RESPONSE);
 
 	return 0;
 }
@@ -469,9 +864,12 @@ MODEM_CMD_DEFINE(on_cmd_sock_readdata)
 MODEM_CMD_DEFINE(on_cmd_sock_checkdata)
 {
 	int unread = ATOI(argv[2], 0, "unread_length");
+	/* The whole line, with the two commas, counts as AT overhead. */
+	size_t rsp_len = sizeof(MDM_QIRD_RSP) - 1 + strlen(argv[0]) + strlen(argv[1]) +
+			 strlen(argv[2]) + 2;
 	//LOG_INF("Unread: %d", unread);
 	modem_cmd_handler_set_error(data, 0);
-	return on_cmd_handle_check_data(mdata.sock_fd, data, unread);
+	return on_cmd_handle_check_data(mdata.sock_fd, data, unread, rsp_len);
 }
 
 /* Handler: Data receive indication. */
@@ -498,6 +896,7 @@ MODEM_CMD_DEFINE(on_cmd_unsol_recv)
 
 	/* Data ready indication. */
 	LOG_DBG("Data Receive Indication for socket: %d", sock_fd);
+	evtrace_record(EVTRACE_SOCK_STATE, sock->id, EVTRACE_SOCK_DATA_READY);
 	modem_socket_data_ready(&mdata.socket_config, sock);
 
 	return 0;
@@ -516,6 +915,7 @@ MODEM_CMD_DEFINE(on_cmd_unsol_close)
 	}
 
 	LOG_INF("Socket Close Indication for socket: %d", sock_fd);
+	evtrace_record(EVTRACE_SOCK_STATE, sock->id, EVTRACE_SOCK_CLOSED_URC);
 
 	/* Tell the modem to close the socket. */
 	socket_close_async(sock);
@@ -526,15 +926,35 @@ MODEM_CMD_DEFINE(on_cmd_unsol_close)
 /* Handler: Modem initialization ready. */
 MODEM_CMD_DEFINE(on_cmd_unsol_rdy)
 {
-	k_sem_give(&mdata.sem_response);
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag("RDY"));
+	mdm_sem_give(&mdata.sem_response, EVTRACE_SEM_MDM_RESPONSE);
+	return 0;
+}
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PSM)
+/* Handler: +QPSMTIMER: <T3412 s>,<T3324 s>
+ * The PSM timers granted by the network, which may differ from the
+ * requested ones.
+ */
+MODEM_CMD_DEFINE(on_cmd_unsol_psmtimer)
+{
+	int tau = ATOI(argv[0], -1, "tau");
+	int active = ATOI(argv[1], -1, "active");
+
+	LOG_INF("PSM granted: TAU %d s, active %d s", tau, active);
+	if (active >= 0) {
+		mdm_pm_stats_psm_active(active);
+	}
 	return 0;
 }
+#endif
 
 #if defined(CONFIG_DNS_RESOLVER)
 /* Handler: +QIURC: "dnsgip",<hostIP> */
 // TODO(mskobov): Handle error DNS lookups!
 MODEM_CMD_DEFINE(on_cmd_dns)
 {
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag("DNS"));
 	if (argv[0][0] != '\"') {
 		// Just drop the response that doesn't have the IP.
 		return 0;
@@ -548,13 +968,114 @@ MODEM_CMD_DEFINE(on_cmd_dns)
 	/* skip beginning quote when parsing */
 	(void)net_addr_pton(result.ai_family, &argv[0][1],
 			    &((struct sockaddr_in *)&result_addr)->sin_addr);
-	k_sem_give(&mdata.sem_dns);
+	mdm_sem_give(&mdata.sem_dns, EVTRACE_SEM_MDM_DNS);
 	return 0;
 }
 #endif
 
+/* Func: socket_open
+ * Desc: Open the connect ID of the socket with AT+QIOPEN and wait for the
+ * +QIOPEN result. @p service_type is "TCP", "UDP" or "UDP SERVICE"; a
+ * UDP service ignores the remote and listens on @p local_port. A TLS
+ * socket is opened with AT+QSSLOPEN instead, which does the handshake
+ * before its +QSSLOPEN result. The socket is closed if the open fails.
+ */
+static int socket_open(struct modem_socket *sock, const char *service_type,
+		       const char *ip_str, uint16_t dst_port, uint16_t local_port)
+{
+	char buf[sizeof("AT+QSSLOPEN=#,#,#,'UDP SERVICE','###',"
+			"####.####.####.####.####.####.####.####,######,"
+			"######,0")] = {0};
+	struct mdm_cmd_start start;
+	enum mdm_cmd_class cls = MDM_CMD_CLASS_QIOPEN;
+	int ret;
+
+	/* +QIOPEN does not reliably identify which open it answers, so only
+	 * one may be outstanding at a time.
+	 */
+	k_mutex_lock(&mdata.sock_conn_lock, K_FOREVER);
+	k_sem_reset(&mdata.sem_sock_conn);
+
+	/* Per-socket usage is counted from here. */
+	(void)quectel_bg96_connect_id_usage(sock->id,
+					    &mdata.usage_at_connect[sock->id - MDM_BASE_SOCKET_NUM]);
+
+	evtrace_record(EVTRACE_SOCK_STATE, sock->id, EVTRACE_SOCK_CONNECTING);
+
+	/* Formulate the complete string. */
+	if (sock_is_tls(sock)) {
+		snprintk(buf, sizeof(buf), "AT+QSSLOPEN=%d,%d,%d,\"%s\",%d,0", 1,
+			 MDM_SSL_CTX_ID, sock->id, ip_str, dst_port);
+#if defined(CONFIG_MODEM_QUECTEL_BG96_SSL)
+		cls = MDM_CMD_CLASS_QSSLOPEN;
+#endif
+	} else {
+		snprintk(buf, sizeof(buf), "AT+QIOPEN=%d,%d,\"%s\",\"%s\",%d,%d,0", 1, sock->id,
+			 service_type, ip_str, dst_port, local_port);
+	}
+
+	/* Send out the command. It is timed through to the +QIOPEN URC. */
+	start = mdm_cmd_stats_start();
+	ret = mdm_cmd_send(MDM_CMD_CLASS_NONE, NULL, 0U, buf,
+			   &mdata.sem_response, K_SECONDS(1));
+	sock_usage_at(sock, buf, sizeof(MDM_OK_RSP) - 1 + sizeof(MDM_QIOPEN_RSP) - 1);
+	if (ret < 0) {
+		mdm_cmd_stats_record(cls, start, ret);
+		LOG_ERR("%s ret:%d", buf, ret);
+		LOG_ERR("Closing the socket!!!");
+		socket_close(sock);
+		goto exit;
+	}
+
+	/* Wait for QI+OPEN */
+	ret = mdm_sem_take(&mdata.sem_sock_conn, EVTRACE_SEM_MDM_SOCK_CONN, MDM_CMD_CONN_TIMEOUT);
+	mdm_cmd_stats_record(cls, start, ret < 0 ? ret : (mdata.sock_conn_err ? -EIO : 0));
+	if (ret < 0) {
+		LOG_ERR("Timeout waiting for socket open");
+		LOG_ERR("Closing the socket!!!");
+		socket_close(sock);
+		goto exit;
+	}
+
+	ret = mdata.sock_conn_err;
+	if (ret != 0) {
+		LOG_ERR("Closing the socket!!!");
+		socket_close(sock);
+		/* +QIOPEN reports a positive modem error code. */
+		ret = -EIO;
+		goto exit;
+	}
+
+	/* Connected successfully. */
+	sock->is_connected = true;
+	mdata.udp_service[sock->id - MDM_BASE_SOCKET_NUM] =
+		strcmp(service_type, "UDP SERVICE") == 0;
+	evtrace_record(EVTRACE_SOCK_STATE, sock->id, EVTRACE_SOCK_CONNECTED);
+
+exit:
+	k_mutex_unlock(&mdata.sock_conn_lock);
+	return ret;
+}
+
+/* Func: socket_open_udp_service
+ * Desc: Open the connect ID of an unconnected UDP socket as a UDP service
+ * on its bound port, or on one derived from the connect ID.
+ */
+static int socket_open_udp_service(struct modem_socket *sock)
+{
+	uint16_t local_port = ntohs(net_sin(&sock->src)->sin_port);
+
+	if (local_port == 0) {
+		local_port = MDM_UDP_SERVICE_PORT_BASE + sock->id;
+	}
+
+	return socket_open(sock, "UDP SERVICE", "127.0.0.1", 0, local_port);
+}
+
 /* Func: send_socket_data
  * Desc: This function will send "binary" data over the socket object.
+ * A UDP service is not bound to a remote, so @p dst_addr is given with
+ * each of its sends; it is NULL otherwise.
  */
 static ssize_t send_socket_data(struct modem_socket *sock,
 				const struct sockaddr *dst_addr,
@@ -563,9 +1084,11 @@ static ssize_t send_socket_data(struct modem_socket *sock,
 				const char *buf, size_t buf_len,
 				k_timeout_t timeout)
 {
-	int  ret;
-	char send_buf[sizeof("AT+QISEND=##,####")] = {0};
+	int  ret, written;
+	char send_buf[sizeof("AT+QISEND=##,####,\"\",#####") + NET_IPV6_ADDR_LEN] = {0};
+	char ip_str[NET_IPV6_ADDR_LEN];
 	char ctrlz = 0x1A;
+	struct mdm_cmd_start start;
 
 	if (buf_len > MDM_MAX_DATA_LENGTH) {
 		buf_len = MDM_MAX_DATA_LENGTH;
@@ -573,13 +1096,26 @@ static ssize_t send_socket_data(struct modem_socket *sock,
 
 	/* Create a buffer with the correct params. */
 	mdata.sock_written = buf_len;
-	snprintk(send_buf, sizeof(send_buf), "AT+QISEND=%d,%ld", sock->id, (long) buf_len);
+	if (dst_addr) {
+		ret = modem_context_sprint_ip_addr(dst_addr, ip_str, sizeof(ip_str));
+		if (ret != 0) {
+			return ret;
+		}
+		snprintk(send_buf, sizeof(send_buf), "AT+QISEND=%d,%ld,\"%s\",%d", sock->id,
+			 (long) buf_len, ip_str, ntohs(net_sin(dst_addr)->sin_port));
+	} else {
+		snprintk(send_buf, sizeof(send_buf),
+			 sock_is_tls(sock) ? "AT+QSSLSEND=%d,%ld" : "AT+QISEND=%d,%ld",
+			 sock->id, (long) buf_len);
+	}
 
 	/* Setup the locks correctly. */
-	k_sem_take(&mdata.cmd_handler_data.sem_tx_lock, K_FOREVER);
+	mdm_tx_lock();
 	k_sem_reset(&mdata.sem_tx_ready);
 
 	/* Send the Modem command. */
+	start = mdm_cmd_stats_start();
+	evtrace_record(EVTRACE_MDM_CMD_BEGIN, sock->id, evtrace_tag(send_buf));
 	ret = modem_cmd_send_nolock(&mctx.iface, &mctx.cmd_handler,
 				    NULL, 0U, send_buf, NULL, K_NO_WAIT);
 	if (ret < 0) {
@@ -595,7 +1131,8 @@ static ssize_t send_socket_data(struct modem_socket *sock,
 	}
 
 	/* Wait for '>' */
-	ret = k_sem_take(&mdata.sem_tx_ready, K_MSEC(5000));
+	ret = mdm_sem_take(&mdata.sem_tx_ready, EVTRACE_SEM_MDM_TX_READY, K_MSEC(5000));
+	mdm_cmd_stats_record(MDM_CMD_CLASS_QISEND_PROMPT, start, ret);
 	if (ret < 0) {
 		/* Didn't get the data prompt - Exit. */
 		LOG_DBG("Timeout waiting for tx");
@@ -607,14 +1144,17 @@ static ssize_t send_socket_data(struct modem_socket *sock,
 	mctx.iface.write(&mctx.iface, &ctrlz, 1);
 
 	/* Wait for 'SEND OK' or 'SEND FAIL' */
+	start = mdm_cmd_stats_start();
 	k_sem_reset(&mdata.sem_response);
-	ret = k_sem_take(&mdata.sem_response, timeout);
+	ret = mdm_sem_take(&mdata.sem_response, EVTRACE_SEM_MDM_RESPONSE, timeout);
 	if (ret < 0) {
 		LOG_DBG("No send response");
+		mdm_cmd_stats_record(MDM_CMD_CLASS_SEND_OK, start, ret);
 		goto exit;
 	}
 
 	ret = modem_cmd_handler_get_error(&mdata.cmd_handler_data);
+	mdm_cmd_stats_record(MDM_CMD_CLASS_SEND_OK, start, ret);
 	if (ret != 0) {
 		LOG_DBG("Failed to send data");
 	}
@@ -623,14 +1163,29 @@ exit:
 	/* unset handler commands and ignore any errors */
 	(void)modem_cmd_handler_update_cmds(&mdata.cmd_handler_data,
 					    NULL, 0U, false);
-	k_sem_give(&mdata.cmd_handler_data.sem_tx_lock);
+	/* Read the count before another sender can reuse it. */
+	written = mdata.sock_written;
+	evtrace_record(EVTRACE_MDM_CMD_END, (uint16_t)ret, written);
+	mdm_tx_unlock();
+
+	/* The command, the prompt, CTRL+Z and the result code. */
+	struct quectel_bg96_data_usage delta = {
+		.tx_at_bytes = strlen(send_buf) + 1 + 1,
+		.rx_at_bytes = sizeof(MDM_TX_PROMPT) - 1 + sizeof(MDM_SEND_OK_RSP) - 1,
+	};
+
+	if (ret >= 0) {
+		delta.tx_bytes = written;
+		delta.tx_packets = 1;
+	}
+	sock_usage_add(sock, &delta);
 
 	if (ret < 0) {
 		return ret;
 	}
 
 	/* Return the amount of data written on the socket. */
-	return mdata.sock_written;
+	return written;
 }
 
 /* Func: offload_sendto
@@ -667,10 +1222,29 @@ static ssize_t offload_sendto(void *obj, const void *buf, size_t len,
 		return -1;
 	}
 
-	/* UDP is not supported. */
 	if (sock->ip_proto == IPPROTO_UDP) {
-		errno = ENOTSUP;
-		return -1;
+		/* A datagram goes out with a single AT+QISEND. */
+		if (len > MDM_MAX_DATA_LENGTH) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		/* Without connect(), the first sendto() opens a UDP service. */
+		if (!sock->is_connected && to) {
+			ret = socket_open_udp_service(sock);
+			if (ret < 0) {
+				errno = -ret;
+				return -1;
+			}
+		}
+		if (!mdata.udp_service[sock->id - MDM_BASE_SOCKET_NUM]) {
+			/* A UDP client only sends to the address it was opened with. */
+			to = NULL;
+		} else if (!to) {
+			errno = EDESTADDRREQ;
+			return -1;
+		}
+	} else {
+		to = NULL;
 	}
 
 	if (!sock->is_connected) {
@@ -690,6 +1264,32 @@ static ssize_t offload_sendto(void *obj, const void *buf, size_t len,
 	return ret;
 }
 
+/* Func: socket_read_cmd_send
+ * Desc: Send an AT+QIRD command for the given socket. The +QIRD handlers
+ * find their socket through mdata.sock_fd, so it is set while holding the
+ * TX lock; otherwise two threads reading different sockets would see each
+ * other's data.
+ */
+static int socket_read_cmd_send(struct modem_socket *sock,
+				const struct modem_cmd *handler_cmds,
+				size_t handler_cmds_len, const char *buf)
+{
+	struct mdm_cmd_start start;
+	int ret;
+
+	mdm_tx_lock();
+	mdata.sock_fd = sock->sock_fd;
+	start = mdm_cmd_stats_start();
+	ret = modem_cmd_send_nolock(&mctx.iface, &mctx.cmd_handler,
+				    handler_cmds, handler_cmds_len, buf,
+				    &mdata.sem_response, MDM_CMD_TIMEOUT);
+	mdm_cmd_stats_record(MDM_CMD_CLASS_QIRD, start, ret);
+	mdm_tx_unlock();
+	sock_usage_at(sock, buf, sizeof(MDM_OK_RSP) - 1);
+
+	return ret;
+}
+
 /* Func: offload_recvfrom
  * Desc: This function will receive data on the socket object.
  */
@@ -698,23 +1298,33 @@ static ssize_t offload_recvfrom(void *obj, void *buf, size_t len,
 				socklen_t *fromlen)
 {
 	struct modem_socket *sock = (struct modem_socket *)obj;
-	char   sendbuf[sizeof("AT+QIRD=##,####")] = {0};
+	char   sendbuf[sizeof("AT+QSSLRECV=##,####")] = {0};
 	int    ret;
 	struct socket_read_data sock_data;
 
-	/* Modem does not tell packet size. Set dummy for receive. */
+	bool dgram = sock->type == SOCK_DGRAM;
+	bool tls = sock_is_tls(sock);
+
+	/* Modem does not tell packet size. Set dummy for receive. The query
+	 * is only answered for TCP; a datagram is read whole below, and the
+	 * SSL stack has no query, so an empty read waits for its URC.
+	 */
 	struct modem_cmd check_cmd[] = { MODEM_CMD("+QIRD: ", on_cmd_sock_checkdata, 3U, ",") };
-	snprintk(sendbuf, sizeof(sendbuf), "AT+QIRD=%d,0", sock->id);
-	ret = modem_cmd_send(&mctx.iface, &mctx.cmd_handler,
-				check_cmd, 1, sendbuf, &mdata.sem_response,
-				MDM_CMD_TIMEOUT);
-	if (ret < 0) {
-		LOG_ERR("Error reading from socket");
-		modem_socket_packet_size_update(&mdata.socket_config, sock, 0);
+	if (!dgram && !tls) {
+		snprintk(sendbuf, sizeof(sendbuf), "AT+QIRD=%d,0", sock->id);
+		ret = socket_read_cmd_send(sock, check_cmd, 1, sendbuf);
+		if (ret < 0) {
+			LOG_ERR("Error reading from socket");
+			modem_socket_packet_size_update(&mdata.socket_config, sock, 0);
+		}
 	}
 
 	/* Modem command to read the data. */
-	struct modem_cmd data_cmd[] = { MODEM_CMD("+QIRD: ", on_cmd_sock_readdata, 0U, "") };
+	struct modem_cmd qird_cmd[] = { MODEM_CMD("+QIRD: ", on_cmd_sock_readdata, 0U, "") };
+	struct modem_cmd qsslrecv_cmd[] = {
+		MODEM_CMD("+QSSLRECV: ", on_cmd_sock_readdata, 0U, "")
+	};
+	struct modem_cmd *data_cmd = tls ? qsslrecv_cmd : qird_cmd;
 
 	if (!buf || len == 0) {
 		errno = EINVAL;
@@ -726,7 +1336,15 @@ static ssize_t offload_recvfrom(void *obj, void *buf, size_t len,
 		return -1;
 	}
 
-	snprintk(sendbuf, sizeof(sendbuf), "AT+QIRD=%d,%zd", sock->id, len);
+	if (dgram) {
+		/* Reads the next datagram, up to 1500 bytes. */
+		snprintk(sendbuf, sizeof(sendbuf), "AT+QIRD=%d", sock->id);
+	} else if (tls) {
+		snprintk(sendbuf, sizeof(sendbuf), "AT+QSSLRECV=%d,%zd", sock->id,
+			 MIN(len, MDM_MAX_DATA_LENGTH));
+	} else {
+		snprintk(sendbuf, sizeof(sendbuf), "AT+QIRD=%d,%zd", sock->id, len);
+	}
 
 	/* Socket read settings */
 	(void) memset(&sock_data, 0, sizeof(sock_data));
@@ -734,13 +1352,20 @@ static ssize_t offload_recvfrom(void *obj, void *buf, size_t len,
 	sock_data.recv_buf_len = len;
 	sock_data.recv_addr    = from;
 	sock->data	       = &sock_data;
-	mdata.sock_fd	       = sock->sock_fd;
 
 	/* Tell the modem to give us data (AT+QIRD=id,data_len). */
-	ret = modem_cmd_send(&mctx.iface, &mctx.cmd_handler,
-			     data_cmd, ARRAY_SIZE(data_cmd), sendbuf, &mdata.sem_response,
-			     MDM_CMD_TIMEOUT);
+	ret = socket_read_cmd_send(sock, data_cmd, 1, sendbuf);
 	LOG_DBG("QIRD cmd complete");
+	while ((dgram || tls) && ret == 0 && sock_data.recv_read_len == 0) {
+		/* Nothing yet; wait for the next "recv" URC. */
+		if (flags & ZSOCK_MSG_DONTWAIT) {
+			errno = EAGAIN;
+			ret = -1;
+			goto exit;
+		}
+		modem_socket_wait_data(&mdata.socket_config, sock);
+		ret = socket_read_cmd_send(sock, data_cmd, 1, sendbuf);
+	}
 	if (ret < 0) {
 		// Experimental addition by IOT course instructors
 		if (flags & ZSOCK_MSG_DONTWAIT) {
@@ -751,9 +1376,7 @@ static ssize_t offload_recvfrom(void *obj, void *buf, size_t len,
 
 		LOG_DBG("modem_socket_wait_data");
 		modem_socket_wait_data(&mdata.socket_config, sock);
-		ret = modem_cmd_send(&mctx.iface, &mctx.cmd_handler,
-			     data_cmd, ARRAY_SIZE(data_cmd), sendbuf, &mdata.sem_response,
-			     MDM_CMD_TIMEOUT);
+		ret = socket_read_cmd_send(sock, data_cmd, 1, sendbuf);
 		if (ret < 0) {
 			errno = -ret;
 			ret = -1;
@@ -761,10 +1384,23 @@ static ssize_t offload_recvfrom(void *obj, void *buf, size_t len,
 		}
 	}
 
-	/* HACK: use dst address as from */
+	/* The modem only sends another "recv" URC for TLS once its buffer
+	 * has been emptied, and for UDP once all queued datagrams have been
+	 * read, so a full TLS read or any datagram leaves the socket readable
+	 * and the next read finds out whether more is buffered.
+	 */
+	if ((tls && sock_data.recv_read_len == MIN(len, MDM_MAX_DATA_LENGTH)) ||
+	    (dgram && sock_data.recv_read_len > 0)) {
+		modem_socket_packet_size_update(&mdata.socket_config, sock, 1);
+	}
+
+	/* A UDP service reports the source of each datagram; otherwise the
+	 * data came from the address the socket was connected to.
+	 */
 	if (from && fromlen) {
 		*fromlen = sizeof(sock->dst);
-		memcpy(from, &sock->dst, *fromlen);
+		memcpy(from, sock_data.has_recv_from ? &sock_data.recv_from : &sock->dst,
+		       *fromlen);
 	}
 
 	/* return length of received data */
@@ -826,8 +1462,28 @@ static int offload_ioctl(void *obj, unsigned int request, va_list args)
 	}
 }
 
+/* Func: offload_bind
+ * Desc: Keep the local address. Only the port is used, as the local port
+ * of a UDP service opened by sendto().
+ */
+static int offload_bind(void *obj, const struct sockaddr *addr,
+			socklen_t addrlen)
+{
+	struct modem_socket *sock = (struct modem_socket *)obj;
+
+	if (sock->is_connected) {
+		errno = EISCONN;
+		return -1;
+	}
+
+	memcpy(&sock->src, addr, MIN(addrlen, sizeof(sock->src)));
+	errno = 0;
+	return 0;
+}
+
 /* Func: offload_connect
- * Desc: This function will connect with a provided TCP.
+ * Desc: This function will connect with a provided TCP, or open a UDP
+ * client that sends to and receives from the provided address only.
  */
 static int offload_connect(void *obj, const struct sockaddr *addr,
 						   socklen_t addrlen)
@@ -835,10 +1491,6 @@ static int offload_connect(void *obj, const struct sockaddr *addr,
 	struct modem_socket *sock     = (struct modem_socket *) obj;
 	uint16_t	    dst_port  = 0;
 	char		    *protocol = "TCP";
-	struct modem_cmd    cmd[]     = { MODEM_CMD("+QIOPEN: ", on_cmd_atcmdinfo_sockopen, 2U, ",") };
-	char		    buf[sizeof("AT+QIOPEN=#,#,'###','###',"
-				       "####.####.####.####.####.####.####.####,######,"
-				       "0,0")] = {0};
 	int		    ret;
 	char		    ip_str[NET_IPV6_ADDR_LEN];
 
@@ -864,14 +1516,10 @@ static int offload_connect(void *obj, const struct sockaddr *addr,
 		dst_port = ntohs(net_sin(addr)->sin_port);
 	}
 
-	/* UDP is not supported. */
 	if (sock->ip_proto == IPPROTO_UDP) {
-		errno = ENOTSUP;
-		return -1;
+		protocol = "UDP";
 	}
 
-	k_sem_reset(&mdata.sem_sock_conn);
-
 	ret = modem_context_sprint_ip_addr(addr, ip_str, sizeof(ip_str));
 	if (ret != 0) {
 		LOG_ERR("Error formatting IP string %d", ret);
@@ -881,55 +1529,15 @@ static int offload_connect(void *obj, const struct sockaddr *addr,
 		return -1;
 	}
 
-	/* Formulate the complete string. */
-	snprintk(buf, sizeof(buf), "AT+QIOPEN=%d,%d,\"%s\",\"%s\",%d,0,0", 1, sock->id, protocol,
-		 ip_str, dst_port);
-
-	/* Send out the command. */
-	ret = modem_cmd_send(&mctx.iface, &mctx.cmd_handler,
-			     NULL, 0U, buf,
-			     &mdata.sem_response, K_SECONDS(1));
+	ret = socket_open(sock, protocol, ip_str, dst_port, 0);
 	if (ret < 0) {
-		LOG_ERR("%s ret:%d", buf, ret);
-		LOG_ERR("Closing the socket!!!");
-		socket_close(sock);
 		errno = -ret;
 		return -1;
 	}
 
-	/* set command handlers */
-	ret = modem_cmd_handler_update_cmds(&mdata.cmd_handler_data,
-					    cmd, ARRAY_SIZE(cmd), true);
-	if (ret < 0) {
-		goto exit;
-	}
-
-	/* Wait for QI+OPEN */
-	ret = k_sem_take(&mdata.sem_sock_conn, MDM_CMD_CONN_TIMEOUT);
-	if (ret < 0) {
-		LOG_ERR("Timeout waiting for socket open");
-		LOG_ERR("Closing the socket!!!");
-		socket_close(sock);
-		goto exit;
-	}
-
-	ret = modem_cmd_handler_get_error(&mdata.cmd_handler_data);
-	if (ret != 0) {
-		LOG_ERR("Closing the socket!!!");
-		socket_close(sock);
-		goto exit;
-	}
-
-	/* Connected successfully. */
-	sock->is_connected = true;
+	memcpy(&sock->dst, addr, MIN(addrlen, sizeof(sock->dst)));
 	errno = 0;
 	return 0;
-
-exit:
-	(void) modem_cmd_handler_update_cmds(&mdata.cmd_handler_data,
-					     NULL, 0U, false);
-	errno = -ret;
-	return -1;
 }
 
 /* Func: offload_close
@@ -963,6 +1571,12 @@ static ssize_t offload_sendmsg(void *obj, const struct msghdr *msg, int flags)
 
 	LOG_DBG("msg_iovlen:%zd flags:%d", msg->msg_iovlen, flags);
 
+	/* Each AT+QISEND is a datagram, so one cannot be gathered. */
+	if (((struct modem_socket *)obj)->type == SOCK_DGRAM && msg->msg_iovlen > 1) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
 	for (int i = 0; i < msg->msg_iovlen; i++) {
 		const char *buf = msg->msg_iov[i].iov_base;
 		size_t len	= msg->msg_iov[i].iov_len;
@@ -989,9 +1603,33 @@ static ssize_t offload_sendmsg(void *obj, const struct msghdr *msg, int flags)
 }
 
 #if defined(CONFIG_DNS_RESOLVER)
+/* Func: dns_result_copy
+ * Desc: Hand out a copy of the static result and release dns_lock.
+ */
+static int dns_result_copy(struct zsock_addrinfo **res)
+{
+	struct mdm_dns_result *copy;
+	int ret = 0;
+
+	if (k_mem_slab_alloc(&dns_results, (void **)&copy, K_NO_WAIT) != 0) {
+		LOG_ERR("No free DNS result, freeaddrinfo() missing?");
+		ret = DNS_EAI_MEMORY;
+	} else {
+		copy->ai = result;
+		copy->addr = result_addr;
+		copy->ai.ai_addr = &copy->addr;
+		copy->ai.ai_canonname = NULL;
+		*res = &copy->ai;
+	}
+	k_mutex_unlock(&mdata.dns_lock);
+	return ret;
+}
+
 /* TODO: This is a bare-bones implementation of DNS handling
  * We ignore most of the hints like ai_family, ai_protocol and ai_socktype.
  * Later, we can add additional handling if it makes sense.
+ * The +QIURC handler fills one static result, so lookups are serialized by
+ * dns_lock and each caller gets a copy of the result.
  */
 static int offload_getaddrinfo(const char *node, const char *service,
 			       const struct zsock_addrinfo *hints,
@@ -1004,6 +1642,8 @@ static int offload_getaddrinfo(const char *node, const char *service,
 	/* DNS command + 128 bytes for domain name parameter */
 	char sendbuf[sizeof("AT+QIDNSGIP=1,''\r") + 128];
 
+	k_mutex_lock(&mdata.dns_lock, K_FOREVER);
+
 	/* init result */
 	(void)memset(&result, 0, sizeof(result));
 	(void)memset(&result_addr, 0, sizeof(result_addr));
@@ -1018,6 +1658,7 @@ static int offload_getaddrinfo(const char *node, const char *service,
 	if (service) {
 		port = ATOI(service, 0U, "port");
 		if (port < 1 || port > USHRT_MAX) {
+			k_mutex_unlock(&mdata.dns_lock);
 			return DNS_EAI_SERVICE;
 		}
 	}
@@ -1033,12 +1674,12 @@ static int offload_getaddrinfo(const char *node, const char *service,
 	if (net_addr_pton(result.ai_family, node,
 			  &((struct sockaddr_in *)&result_addr)->sin_addr)
 	    == 0) {
-		*res = &result;
-		return 0;
+		return dns_result_copy(res);
 	}
 
 	/* user flagged node as numeric host, but we failed net_addr_pton */
 	if (hints && hints->ai_flags & AI_NUMERICHOST) {
+		k_mutex_unlock(&mdata.dns_lock);
 		return DNS_EAI_NONAME;
 	}
 
@@ -1046,10 +1687,10 @@ static int offload_getaddrinfo(const char *node, const char *service,
 
 
 	snprintk(sendbuf, sizeof(sendbuf), "AT+QIDNSGIP=1,\"%s\"", node);
-	ret = modem_cmd_send(&mctx.iface, &mctx.cmd_handler,
-			     &cmd, 1U, sendbuf, &mdata.sem_dns,
-			     MDM_DNS_TIMEOUT);
+	ret = mdm_cmd_send(MDM_CMD_CLASS_QIDNSGIP, &cmd, 1U, sendbuf, &mdata.sem_dns,
+			   MDM_DNS_TIMEOUT);
 	if (ret < 0) {
+		k_mutex_unlock(&mdata.dns_lock);
 		return ret;
 	}
 
@@ -1058,14 +1699,15 @@ static int offload_getaddrinfo(const char *node, const char *service,
 					 &net_sin(&result_addr)->sin_addr,
 					 sendbuf, NET_IPV4_ADDR_LEN));
 
-	*res = (struct zsock_addrinfo *)&result;
-	return 0;
+	return dns_result_copy(res);
 }
 
 static void offload_freeaddrinfo(struct zsock_addrinfo *res)
 {
-	/* using static result from offload_getaddrinfo() -- no need to free */
-	res = NULL;
+	/* The ai is the start of the mdm_dns_result. */
+	if (res != NULL) {
+		k_mem_slab_free(&dns_results, (void **)&res);
+	}
 }
 
 static const struct socket_dns_offload offload_dns_ops = {
@@ -1074,6 +1716,325 @@ static const struct socket_dns_offload offload_dns_ops = {
 };
 #endif
 
+#if defined(CONFIG_MODEM_QUECTEL_BG96_HTTP)
+/* Handler: +QHTTPGET: <err>[0], <httprspcode>[1], <content_length>[2]
+ * The status and length only follow a successful request.
+ */
+MODEM_CMD_DEFINE(on_cmd_unsol_httpget)
+{
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag("HGET"));
+	mdata.http_err = ATOI(argv[0], 0, "http_err");
+	mdata.http_rsp.status = argc > 1 ? ATOI(argv[1], 0, "http_status") : 0;
+	mdata.http_rsp.content_length = argc > 2 ? ATOI(argv[2], -1, "content_length") : -1;
+	mdm_sem_give(&mdata.sem_http, EVTRACE_SEM_MDM_HTTP);
+	return 0;
+}
+
+/* Handler: +QHTTPREADFILE: <err>[0] */
+MODEM_CMD_DEFINE(on_cmd_unsol_httpreadfile)
+{
+	evtrace_record(EVTRACE_MDM_RSP, UINT16_MAX, evtrace_tag("HRDF"));
+	mdata.http_err = ATOI(argv[0], 0, "http_err");
+	mdm_sem_give(&mdata.sem_http, EVTRACE_SEM_MDM_HTTP);
+	return 0;
+}
+
+/* Handler: +QFOPEN: <filehandle>[0] */
+MODEM_CMD_DEFINE(on_cmd_file_open)
+{
+	mdata.file_handle = ATOI(argv[0], -1, "file_handle");
+	return 0;
+}
+
+/* Handler: +QFLST: <filename>[0], <file_size>[1] */
+MODEM_CMD_DEFINE(on_cmd_file_list)
+{
+	mdata.file_size = ATOI(argv[1], -1, "file_size");
+	return 0;
+}
+
+/* Handler: CONNECT <read_length>\r\n<data>
+ * The answer to AT+QFREAD, read into the block in mdata.file_read.
+ */
+MODEM_CMD_DEFINE(on_cmd_file_readdata)
+{
+	struct file_read_data *block = mdata.file_read;
+	char header[sizeof("#####\r")];
+	size_t header_len;
+	char *header_end;
+	int read_len;
+
+	header_len = net_buf_linearize(header, sizeof(header) - 1, data->rx_buf, 0,
+				       sizeof(header) - 1);
+	header[header_len] = '\0';
+	header_end = strchr(header, '\r');
+	if (!header_end) {
+		return header_len == sizeof(header) - 1 ? -EINVAL : -EAGAIN;
+	}
+	*header_end = '\0';
+	/* The length and its CRLF. */
+	header_len = header_end - header + 2;
+
+	read_len = ATOI(header, -1, "read_length");
+	if (!block || read_len < 0 || (size_t)read_len > block->len) {
+		LOG_ERR("Unexpected AT+QFREAD length %d", read_len);
+		return -EINVAL;
+	}
+
+	if (net_buf_frags_len(data->rx_buf) < header_len + read_len) {
+		return -EAGAIN;
+	}
+
+	data->rx_buf = net_buf_skip(data->rx_buf, header_len);
+	block->read_len = net_buf_linearize(block->buf, block->len, data->rx_buf, 0, read_len);
+	data->rx_buf = net_buf_skip(data->rx_buf, read_len);
+
+	/* don't give back semaphore -- OK to follow */
+	return 0;
+}
+
+/* Func: mdm_cmd_send_connect
+ * Desc: Send a command the modem answers with CONNECT, write @p data after
+ * it and wait for the result code that ends the command. Used for
+ * AT+QHTTPURL, which takes the URL this way.
+ */
+static int mdm_cmd_send_connect(const char *cmd, const char *data, size_t len)
+{
+	struct modem_cmd connect_cmd[] = { MODEM_CMD_DIRECT("CONNECT", on_cmd_tx_ready) };
+	int ret;
+
+	mdm_tx_lock();
+	k_sem_reset(&mdata.sem_tx_ready);
+	evtrace_record(EVTRACE_MDM_CMD_BEGIN, 0, evtrace_tag(cmd));
+	ret = modem_cmd_send_nolock(&mctx.iface, &mctx.cmd_handler,
+				    NULL, 0U, cmd, NULL, K_NO_WAIT);
+	if (ret < 0) {
+		goto exit;
+	}
+
+	ret = modem_cmd_handler_update_cmds(&mdata.cmd_handler_data,
+					    connect_cmd, ARRAY_SIZE(connect_cmd), true);
+	if (ret < 0) {
+		goto exit;
+	}
+
+	ret = mdm_sem_take(&mdata.sem_tx_ready, EVTRACE_SEM_MDM_TX_READY, MDM_CMD_TIMEOUT);
+	if (ret < 0) {
+		LOG_DBG("Timeout waiting for CONNECT");
+		goto exit;
+	}
+
+	k_sem_reset(&mdata.sem_response);
+	mctx.iface.write(&mctx.iface, data, len);
+	ret = mdm_sem_take(&mdata.sem_response, EVTRACE_SEM_MDM_RESPONSE, MDM_CMD_TIMEOUT);
+	if (ret == 0) {
+		ret = modem_cmd_handler_get_error(&mdata.cmd_handler_data);
+	}
+
+exit:
+	(void)modem_cmd_handler_update_cmds(&mdata.cmd_handler_data,
+					    NULL, 0U, false);
+	evtrace_record(EVTRACE_MDM_CMD_END, (uint16_t)ret, 0);
+	mdm_tx_unlock();
+	return ret;
+}
+
+/* Func: mdm_http_wait
+ * Desc: Wait for the URC that ends an HTTP command and return its result.
+ */
+static int mdm_http_wait(const char *cmd, int timeout_s)
+{
+	int ret;
+
+	mdm_pm_hold();
+	ret = mdm_sem_take(&mdata.sem_http, EVTRACE_SEM_MDM_HTTP,
+			   K_SECONDS(timeout_s + MDM_HTTP_URC_MARGIN_SECS));
+	mdm_pm_release();
+	if (ret < 0) {
+		LOG_ERR("%s: no result", cmd);
+		return -ETIMEDOUT;
+	}
+	if (mdata.http_err != 0) {
+		/* The modem's HTTP error codes start at 701. */
+		LOG_ERR("%s: error %d", cmd, mdata.http_err);
+		return -EIO;
+	}
+	return 0;
+}
+
+int quectel_bg96_http_get(const char *url, int timeout_s,
+			  struct quectel_bg96_http_response *rsp)
+{
+	char buf[sizeof("AT+QHTTPURL=####,###")];
+	size_t url_len = strlen(url);
+	int ret;
+
+	if (url_len > MDM_HTTP_URL_LENGTH) {
+		return -ENAMETOOLONG;
+	}
+
+	snprintk(buf, sizeof(buf), "AT+QHTTPURL=%zu,%d", url_len, MDM_HTTP_URL_TIMEOUT_SECS);
+	ret = mdm_cmd_send_connect(buf, url, url_len);
+	if (ret < 0) {
+		LOG_ERR("%s ret:%d", buf, ret);
+		return ret;
+	}
+
+	k_sem_reset(&mdata.sem_http);
+	snprintk(buf, sizeof(buf), "AT+QHTTPGET=%d", timeout_s);
+	ret = mdm_cmd_send(MDM_CMD_CLASS_OTHER, NULL, 0U, buf,
+			   &mdata.sem_response, MDM_CMD_TIMEOUT);
+	if (ret < 0) {
+		LOG_ERR("%s ret:%d", buf, ret);
+		return ret;
+	}
+
+	ret = mdm_http_wait(buf, timeout_s);
+	if (ret < 0) {
+		return ret;
+	}
+
+	*rsp = mdata.http_rsp;
+	return 0;
+}
+
+int quectel_bg96_http_read_file(const char *file, int timeout_s)
+{
+	struct modem_cmd list_cmd[] = {
+		MODEM_CMD("+QFLST: ", on_cmd_file_list, 2U, ","),
+	};
+	char buf[sizeof("AT+QHTTPREADFILE=\"UFS:\",###") + MDM_FILE_NAME_LENGTH];
+	int ret;
+
+	if (strlen(file) > MDM_FILE_NAME_LENGTH) {
+		return -ENAMETOOLONG;
+	}
+
+	/* An earlier download is replaced. */
+	(void)quectel_bg96_file_delete(file);
+
+	k_sem_reset(&mdata.sem_http);
+	snprintk(buf, sizeof(buf), "AT+QHTTPREADFILE=\"UFS:%s\",%d", file, timeout_s);
+	ret = mdm_cmd_send(MDM_CMD_CLASS_OTHER, NULL, 0U, buf,
+			   &mdata.sem_response, MDM_CMD_TIMEOUT);
+	if (ret < 0) {
+		LOG_ERR("%s ret:%d", buf, ret);
+		return ret;
+	}
+
+	ret = mdm_http_wait(buf, timeout_s);
+	if (ret < 0) {
+		return ret;
+	}
+
+	mdata.file_size = -1;
+	snprintk(buf, sizeof(buf), "AT+QFLST=\"UFS:%s\"", file);
+	ret = mdm_cmd_send(MDM_CMD_CLASS_OTHER, list_cmd, ARRAY_SIZE(list_cmd), buf,
+			   &mdata.sem_response, MDM_CMD_TIMEOUT);
+	if (ret < 0 || mdata.file_size < 0) {
+		LOG_ERR("%s ret:%d", buf, ret);
+		return ret < 0 ? ret : -EIO;
+	}
+
+	return mdata.file_size;
+}
+
+/* Func: file_read_cmd_send
+ * Desc: Send an AT+QFREAD command for @p block. The handler finds the
+ * block through mdata.file_read, so it is set while holding the TX lock.
+ */
+static int file_read_cmd_send(struct file_read_data *block,
+			      const struct modem_cmd *handler_cmds,
+			      size_t handler_cmds_len, const char *buf)
+{
+	struct mdm_cmd_start start;
+	int ret;
+
+	mdm_tx_lock();
+	mdata.file_read = block;
+	start = mdm_cmd_stats_start();
+	ret = modem_cmd_send_nolock(&mctx.iface, &mctx.cmd_handler,
+				    handler_cmds, handler_cmds_len, buf,
+				    &mdata.sem_response, MDM_CMD_TIMEOUT);
+	mdm_cmd_stats_record(MDM_CMD_CLASS_QFREAD, start, ret);
+	mdata.file_read = NULL;
+	mdm_tx_unlock();
+
+	return ret;
+}
+
+int quectel_bg96_file_read(const char *file, uint8_t *buf, size_t block_len,
+			   quectel_bg96_file_cb cb, void *user_data)
+{
+	struct modem_cmd open_cmd[] = { MODEM_CMD("+QFOPEN: ", on_cmd_file_open, 1U, "") };
+	struct modem_cmd read_cmd[] = { MODEM_CMD("CONNECT ", on_cmd_file_readdata, 0U, "") };
+	char cmd[sizeof("AT+QFOPEN=\"UFS:\",2") + MDM_FILE_NAME_LENGTH];
+	struct file_read_data block;
+	int handle;
+	int total = 0;
+	int ret;
+
+	if (strlen(file) > MDM_FILE_NAME_LENGTH) {
+		return -ENAMETOOLONG;
+	}
+	block_len = MIN(block_len, MDM_FILE_READ_MAX);
+
+	/* Mode 2 opens an existing file read-only. */
+	mdata.file_handle = -1;
+	snprintk(cmd, sizeof(cmd), "AT+QFOPEN=\"UFS:%s\",2", file);
+	ret = mdm_cmd_send(MDM_CMD_CLASS_OTHER, open_cmd, ARRAY_SIZE(open_cmd), cmd,
+			   &mdata.sem_response, MDM_CMD_TIMEOUT);
+	if (ret < 0 || mdata.file_handle < 0) {
+		LOG_ERR("%s ret:%d", cmd, ret);
+		return ret < 0 ? ret : -EIO;
+	}
+	handle = mdata.file_handle;
+
+	while (true) {
+		memset(&block, 0, sizeof(block));
+		block.buf = buf;
+		block.len = block_len;
+		snprintk(cmd, sizeof(cmd), "AT+QFREAD=%d,%zu", handle, block_len);
+		ret = file_read_cmd_send(&block, read_cmd, ARRAY_SIZE(read_cmd), cmd);
+		if (ret < 0) {
+			LOG_ERR("%s ret:%d", cmd, ret);
+			break;
+		}
+		if (block.read_len == 0) {
+			/* End of the file. */
+			ret = total;
+			break;
+		}
+		total += block.read_len;
+		ret = cb(buf, block.read_len, user_data);
+		if (ret < 0) {
+			break;
+		}
+	}
+
+	snprintk(cmd, sizeof(cmd), "AT+QFCLOSE=%d", handle);
+	if (mdm_cmd_send(MDM_CMD_CLASS_OTHER, NULL, 0U, cmd,
+			 &mdata.sem_response, MDM_CMD_TIMEOUT) < 0) {
+		LOG_WRN("%s failed", cmd);
+	}
+
+	return ret;
+}
+
+int quectel_bg96_file_delete(const char *file)
+{
+	char buf[sizeof("AT+QFDEL=\"UFS:\"") + MDM_FILE_NAME_LENGTH];
+
+	if (strlen(file) > MDM_FILE_NAME_LENGTH) {
+		return -ENAMETOOLONG;
+	}
+
+	snprintk(buf, sizeof(buf), "AT+QFDEL=\"UFS:%s\"", file);
+	return mdm_cmd_send(MDM_CMD_CLASS_OTHER, NULL, 0U, buf,
+			    &mdata.sem_response, MDM_CMD_TIMEOUT);
+}
+#endif /* defined(CONFIG_MODEM_QUECTEL_BG96_HTTP) */
+
 /* Func: modem_rx
  * Desc: Thread to process all messages received from the Modem.
  */
@@ -1098,9 +2059,8 @@ static void modem_rssi_query_work(struct k_work *work)
 	int ret;
 
 	/* query modem RSSI */
-	ret = modem_cmd_send(&mctx.iface, &mctx.cmd_handler,
-			     &cmd, 1U, send_cmd, &mdata.sem_response,
-			     MDM_CMD_TIMEOUT);
+	ret = mdm_cmd_send(MDM_CMD_CLASS_OTHER, &cmd, 1U, send_cmd, &mdata.sem_response,
+			   MDM_CMD_TIMEOUT);
 	if (ret < 0) {
 		LOG_ERR("AT+CSQ ret:%d", ret);
 	}
@@ -1123,9 +2083,8 @@ static void modem_registration_query_work()
 	int ret;
 
 	/* query modem registration status */
-	ret = modem_cmd_send(&mctx.iface, &mctx.cmd_handler,
-			     &cmd, 1U, send_cmd, &mdata.sem_response,
-			     MDM_CMD_TIMEOUT);
+	ret = mdm_cmd_send(MDM_CMD_CLASS_OTHER, &cmd, 1U, send_cmd, &mdata.sem_response,
+			   MDM_CMD_TIMEOUT);
 	if (ret < 0) {
 		LOG_ERR("AT+CEREG? ret:%d", ret);
 	}
@@ -1176,7 +2135,20 @@ static const struct modem_cmd response_cmds[] = {
 
 static const struct modem_cmd unsol_cmds[] = {
 	MODEM_CMD("+QIURC: \"recv\",",	   on_cmd_unsol_recv,  1U, ""),
+	MODEM_CMD("+QIOPEN: ",		   on_cmd_atcmdinfo_sockopen, 2U, ","),
 	MODEM_CMD("+QIURC: \"closed\",",   on_cmd_unsol_close, 1U, ""),
+#if defined(CONFIG_MODEM_QUECTEL_BG96_SSL)
+	MODEM_CMD("+QSSLURC: \"recv\",",   on_cmd_unsol_recv,  1U, ""),
+	MODEM_CMD("+QSSLOPEN: ",	   on_cmd_atcmdinfo_sockopen, 2U, ","),
+	MODEM_CMD("+QSSLURC: \"closed\",", on_cmd_unsol_close, 1U, ""),
+#endif
+#if defined(CONFIG_MODEM_QUECTEL_BG96_HTTP)
+	MODEM_CMD_ARGS_MAX("+QHTTPGET: ", on_cmd_unsol_httpget, 1U, 3U, ","),
+	MODEM_CMD("+QHTTPREADFILE: ", on_cmd_unsol_httpreadfile, 1U, ""),
+#endif
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PSM)
+	MODEM_CMD("+QPSMTIMER: ", on_cmd_unsol_psmtimer, 2U, ","),
+#endif
 	//MODEM_CMD("+QIRD: ",  on_cmd_sock_checkdata, 3U, ","),
 	MODEM_CMD("RDY", on_cmd_unsol_rdy, 0U, ""),
 };
@@ -1187,7 +2159,7 @@ static const struct setup_cmd setup_cmds[] = {
     SETUP_CMD_NOHANDLE("ATE0"),
 	// Use the long response code format
     SETUP_CMD_NOHANDLE("ATV1"),
-	// TODO(mskobov): Decide on which DTR function mode to use
+	// Ignore DTR for data mode; it only gates UART sleep (AT+QSCLK)
     SETUP_CMD_NOHANDLE("AT&D0"),
 	// IOTEMBSYS: Turn off flow control
     SETUP_CMD_NOHANDLE("AT+IFC=0,0"),
@@ -1195,8 +2167,21 @@ static const struct setup_cmd setup_cmds[] = {
 	SETUP_CMD_NOHANDLE("ATH"),
     // IOTEMBSYS: Set default error message format (numeric values)
 	SETUP_CMD_NOHANDLE("AT+CMEE=1"),
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PSM)
+	/* Report the granted PSM timers; PSM is requested after registration. */
+	SETUP_CMD_NOHANDLE("AT+QCFG=\"psm/urc\",1"),
+#else
     // IOTEMBSYS: Disable power save mode
     SETUP_CMD_NOHANDLE("AT+CPSMS=0"),
+#endif
+#if defined(CONFIG_MODEM_QUECTEL_BG96_EDRX)
+	/* eDRX on LTE-M (access technology 4) with the configured cycle. */
+	SETUP_CMD_NOHANDLE("AT+CEDRXS=1,4,\"" CONFIG_MODEM_QUECTEL_BG96_EDRX_CYCLE "\""),
+#endif
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PM) && DT_INST_NODE_HAS_PROP(0, mdm_dtr_gpios)
+	/* Sleep the UART while DTR is released. */
+	SETUP_CMD_NOHANDLE("AT+QSCLK=1"),
+#endif
 
 	/* Commands to read info from the modem (things like IMEI, Model etc). */
 	SETUP_CMD("AT+CGMI", "", on_cmd_atcmdinfo_manufacturer, 0U, ""),
@@ -1222,6 +2207,31 @@ static const struct setup_cmd setup_cmds[] = {
     // Set the band configuration to any
     //SETUP_CMD_NOHANDLE("AT+QCFG=\"band\",0xf,0x400a0e189f,0xa0e189f,1"),
 
+#if defined(CONFIG_MODEM_QUECTEL_BG96_SSL)
+	/* The SSL context used by TLS sockets: TLS 1.2 only, with one suite. */
+	SETUP_CMD_NOHANDLE("AT+QSSLCFG=\"sslversion\"," STRINGIFY(MDM_SSL_CTX_ID) ",3"),
+	SETUP_CMD_NOHANDLE("AT+QSSLCFG=\"ciphersuite\"," STRINGIFY(MDM_SSL_CTX_ID) ","
+			   CONFIG_MODEM_QUECTEL_BG96_SSL_CIPHERSUITE),
+#if defined(CONFIG_MODEM_QUECTEL_BG96_SSL_VERIFY)
+	SETUP_CMD_NOHANDLE("AT+QSSLCFG=\"cacert\"," STRINGIFY(MDM_SSL_CTX_ID) ",\""
+			   CONFIG_MODEM_QUECTEL_BG96_SSL_CACERT "\""),
+	SETUP_CMD_NOHANDLE("AT+QSSLCFG=\"seclevel\"," STRINGIFY(MDM_SSL_CTX_ID) ",1"),
+#else
+	SETUP_CMD_NOHANDLE("AT+QSSLCFG=\"seclevel\"," STRINGIFY(MDM_SSL_CTX_ID) ",0"),
+#endif
+#endif /* defined(CONFIG_MODEM_QUECTEL_BG96_SSL) */
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_HTTP)
+	/* The HTTP client uses the PDP context of the sockets, and gives the
+	 * body without the response headers.
+	 */
+	SETUP_CMD_NOHANDLE("AT+QHTTPCFG=\"contextid\",1"),
+	SETUP_CMD_NOHANDLE("AT+QHTTPCFG=\"responseheader\",0"),
+#if defined(CONFIG_MODEM_QUECTEL_BG96_SSL)
+	SETUP_CMD_NOHANDLE("AT+QHTTPCFG=\"sslctxid\"," STRINGIFY(MDM_SSL_CTX_ID)),
+#endif
+#endif /* defined(CONFIG_MODEM_QUECTEL_BG96_HTTP) */
+
     // IOTEMBSYS: Go into full functionality mode
     SETUP_CMD_NOHANDLE("AT+CFUN=1,0"),
 };
@@ -1306,6 +2316,91 @@ static int modem_pdp_context_activate(void)
 	return ret;
 }
 
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PSM)
+/* A GPRS timer unit of 3GPP TS 24.008: its 3 bits and its length. */
+struct psm_timer_unit {
+	const char *bits;
+	uint32_t secs;
+};
+
+/* T3412 extended (table 10.5.163a), by increasing unit. */
+static const struct psm_timer_unit t3412_units[] = {
+	{ "011", 2 }, { "100", 30 }, { "101", 60 }, { "000", 600 },
+	{ "001", 3600 }, { "010", 36000 }, { "110", 1152000 },
+};
+
+/* T3324 (table 10.5.172), by increasing unit. */
+static const struct psm_timer_unit t3324_units[] = {
+	{ "000", 2 }, { "001", 60 }, { "010", 360 },
+};
+
+/* Func: psm_timer_encode
+ * Desc: Write @p secs as the 8 bit string of a GPRS timer in @p out, with
+ * the smallest unit that holds it in the 5 bit value, rounding up.
+ */
+static void psm_timer_encode(char out[9], uint32_t secs,
+			     const struct psm_timer_unit *units, size_t n)
+{
+	const struct psm_timer_unit *unit = &units[n - 1];
+	uint32_t value;
+
+	for (size_t i = 0; i < n; i++) {
+		if (DIV_ROUND_UP(secs, units[i].secs) <= 31) {
+			unit = &units[i];
+			break;
+		}
+	}
+
+	value = MIN(DIV_ROUND_UP(secs, unit->secs), 31);
+	memcpy(out, unit->bits, 3);
+	for (int bit = 0; bit < 5; bit++) {
+		out[3 + bit] = (value & BIT(4 - bit)) ? '1' : '0';
+	}
+	out[8] = '\0';
+}
+#endif /* defined(CONFIG_MODEM_QUECTEL_BG96_PSM) */
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PM)
+/* Func: mdm_pm_start
+ * Desc: Request PSM, and start letting the modem sleep when it is idle.
+ * Called once the modem is registered and the PDP context is up.
+ */
+static void mdm_pm_start(void)
+{
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PSM)
+	char buf[sizeof("AT+CPSMS=1,,,\"########\",\"########\"")];
+	char tau[9];
+	char active[9];
+	int ret;
+#endif
+
+	mdm_pm_stats_init();
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PSM)
+	psm_timer_encode(tau, CONFIG_MODEM_QUECTEL_BG96_PSM_TAU_S,
+			 t3412_units, ARRAY_SIZE(t3412_units));
+	psm_timer_encode(active, CONFIG_MODEM_QUECTEL_BG96_PSM_ACTIVE_S,
+			 t3324_units, ARRAY_SIZE(t3324_units));
+	snprintk(buf, sizeof(buf), "AT+CPSMS=1,,,\"%s\",\"%s\"", tau, active);
+	ret = mdm_cmd_send(MDM_CMD_CLASS_OTHER, NULL, 0U, buf,
+			   &mdata.sem_response, MDM_CMD_TIMEOUT);
+	if (ret < 0) {
+		LOG_WRN("%s ret:%d", buf, ret);
+	}
+
+	/* Until +QPSMTIMER reports the granted one. */
+	mdm_pm_stats_psm_active(CONFIG_MODEM_QUECTEL_BG96_PSM_ACTIVE_S);
+#endif
+
+	k_work_init_delayable(&mdata.pm_idle_work, mdm_pm_idle_work);
+	k_work_init(&mdata.pm_wake_work, mdm_pm_wake_work);
+	mdata.pm_started = true;
+	mdm_pm_idle_restart();
+}
+#else
+static inline void mdm_pm_start(void) {}
+#endif /* defined(CONFIG_MODEM_QUECTEL_BG96_PM) */
+
 /* Func: modem_setup
  * Desc: This function is used to setup the modem from zero. The idea
  * is that this function will be called right after the modem is
@@ -1321,7 +2416,7 @@ static int modem_setup(void)
 
 	/* Let the modem respond. */
 	LOG_INF("Waiting for modem to respond");
-	ret = k_sem_take(&mdata.sem_response, MDM_MAX_BOOT_TIME);
+	ret = mdm_sem_take(&mdata.sem_response, EVTRACE_SEM_MDM_RESPONSE, MDM_MAX_BOOT_TIME);
 	if (ret < 0) {
 		LOG_ERR("Timeout waiting for RDY");
 		goto error;
@@ -1414,7 +2509,7 @@ static const struct socket_op_vtable offload_socket_fd_op_vtable = {
 		.close	= offload_close,
 		.ioctl	= offload_ioctl,
 	},
-	.bind		= NULL,
+	.bind		= offload_bind,
 	.connect	= offload_connect,
 	.sendto		= offload_sendto,
 	.recvfrom	= offload_recvfrom,
@@ -1457,15 +2552,20 @@ static bool offload_is_supported(int family, int type, int proto)
 		return false;
 	}
 
-	if (type != SOCK_STREAM) {
-		return false;
+	if (type == SOCK_STREAM && proto == IPPROTO_TCP) {
+		return true;
 	}
 
-	if (proto != IPPROTO_TCP) {
-		return false;
+	if (IS_ENABLED(CONFIG_MODEM_QUECTEL_BG96_SSL) &&
+	    type == SOCK_STREAM && proto == IPPROTO_TLS_1_2) {
+		return true;
+	}
+
+	if (type == SOCK_DGRAM && proto == IPPROTO_UDP) {
+		return true;
 	}
 
-	return true;
+	return false;
 }
 
 static int offload_socket(int family, int type, int proto)
@@ -1487,13 +2587,20 @@ static int modem_init(const struct device *dev)
 {
 	int ret; ARG_UNUSED(dev);
 
+	bootprof_mark("modem_init");
 	k_sem_init(&mdata.sem_response,	 0, 1);
 	k_sem_init(&mdata.sem_tx_ready,	 0, 1);
 	k_sem_init(&mdata.sem_sock_conn, 0, 1);
 	k_sem_init(&mdata.sem_dns, 0, 1);
+#if defined(CONFIG_MODEM_QUECTEL_BG96_HTTP)
+	k_sem_init(&mdata.sem_http, 0, 1);
+#endif
+	k_mutex_init(&mdata.sock_conn_lock);
+	k_mutex_init(&mdata.dns_lock);
+	mdm_cmd_stats_init();
 	k_work_queue_start(&modem_workq, modem_workq_stack,
 			   K_KERNEL_STACK_SIZEOF(modem_workq_stack),
-			   K_PRIO_COOP(7), NULL);
+			   K_PRIO_COOP(7), &modem_workq_cfg);
 
 	/* socket config */
 	ret = modem_socket_init(&mdata.socket_config, &mdata.sockets[0], ARRAY_SIZE(mdata.sockets),
@@ -1589,6 +2696,9 @@ static int modem_init(const struct device *dev)
 	}
 #endif
 
+	/* The modem is awake until the power saving lets it sleep. */
+	mdm_uart_active(true);
+
 	/* modem context setup */
 	mctx.driver_data       = &mdata;
 
@@ -1603,10 +2713,16 @@ static int modem_init(const struct device *dev)
 			K_KERNEL_STACK_SIZEOF(modem_rx_stack),
 			(k_thread_entry_t) modem_rx,
 			NULL, NULL, NULL, K_PRIO_COOP(7), 0, K_NO_WAIT);
+	k_thread_name_set(&modem_rx_thread, "modem_rx");
 
 	/* Init RSSI query */
 	k_work_init_delayable(&mdata.rssi_query_work, modem_rssi_query_work);
-	return modem_setup();
+	ret = modem_setup();
+	bootprof_mark("modem_setup");
+	if (ret >= 0) {
+		mdm_pm_start();
+	}
+	return ret;
 
 error:
 	return ret;
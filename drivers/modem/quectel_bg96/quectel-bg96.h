@@ -11,6 +11,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <zephyr/drivers/gpio.h>
+#include <zephyr/pm/policy.h>
 #include <zephyr/device.h>
 #include <zephyr/init.h>
 
@@ -24,6 +25,10 @@
 #include "modem_cmd_handler.h"
 #include "modem_iface_uart.h"
 
+#include <modem/quectel_bg96.h>
+#include <evtrace/evtrace.h>
+#include <bootprof/bootprof.h>
+
 #define MDM_UART_NODE			  DT_INST_BUS(0)
 #define MDM_UART_DEV			  DEVICE_DT_GET(MDM_UART_NODE)
 #define MDM_CMD_TIMEOUT			  K_SECONDS(10)
@@ -42,6 +47,37 @@
 #define MDM_WAIT_FOR_RSSI_DELAY		  K_SECONDS(2)
 #define BUF_ALLOC_TIMEOUT		  K_SECONDS(1)
 #define MDM_MAX_BOOT_TIME		  K_SECONDS(50)
+/* Local port of a UDP service opened by sendto() on an unbound socket;
+ * the connect ID is added to it.
+ */
+#define MDM_UDP_SERVICE_PORT_BASE	  49152
+/* SSL context configured at boot and used by every TLS socket. */
+#define MDM_SSL_CTX_ID			  1
+#define MDM_HTTP_URL_LENGTH		  700
+/* Time the modem waits for the URL after CONNECT. */
+#define MDM_HTTP_URL_TIMEOUT_SECS	  10
+/* Slack on top of the modem's own timeout when waiting for an HTTP URC. */
+#define MDM_HTTP_URC_MARGIN_SECS	  10
+/* Time the modem has to answer AT when it is woken. */
+#define MDM_PM_PROBE_TIMEOUT		  K_MSEC(500)
+/* PWRKEY pulse that wakes the modem from PSM; well short of the 650 ms
+ * that turns it off, in case it was awake after all.
+ */
+#define MDM_PSM_PWRKEY_TIME		  K_MSEC(100)
+#define MDM_PSM_WAKE_PROBES		  10
+#define MDM_FILE_NAME_LENGTH		  64
+/* A whole AT+QFREAD answer is held in the receive buffers before it is
+ * copied out, so a block must fit in them with room to spare.
+ */
+#define MDM_FILE_READ_MAX		  8192
+
+/* Result code framing counted as AT overhead by the data accounting. */
+#define MDM_OK_RSP			  "\r\nOK\r\n"
+#define MDM_SEND_OK_RSP			  "\r\nSEND OK\r\n"
+#define MDM_TX_PROMPT			  "> "
+#define MDM_QIRD_RSP			  "+QIRD: \r\n"
+#define MDM_QSSLRECV_RSP		  "+QSSLRECV: \r\n"
+#define MDM_QIOPEN_RSP			  "\r\n+QIOPEN: #,#\r\n"
 
 /* Default lengths of certain things. */
 #define MDM_MANUFACTURER_LENGTH		  10
@@ -72,6 +108,13 @@ enum mdm_control_pins {
 #endif
 };
 
+/* File read callback data */
+struct file_read_data {
+	uint8_t *buf;
+	size_t	 len;
+	size_t	 read_len;
+};
+
 /* driver data */
 struct modem_data {
 	struct net_if *net_iface;
@@ -109,19 +152,137 @@ struct modem_data {
 	/* Socket from which we are currently reading data. */
 	int sock_fd;
 
+	/* Connect IDs opened as "UDP SERVICE", which are not bound to one
+	 * remote and so take its address with every AT+QISEND.
+	 */
+	bool udp_service[MDM_MAX_SOCKETS];
+
+	/* Result of the last +QIOPEN, and a lock so one open is in flight. */
+	int sock_conn_err;
+	struct k_mutex sock_conn_lock;
+
+	/* Data usage per connect ID since boot, and at the last connect. */
+	struct quectel_bg96_data_usage usage[MDM_MAX_SOCKETS];
+	struct quectel_bg96_data_usage usage_at_connect[MDM_MAX_SOCKETS];
+	struct k_spinlock usage_lock;
+
+	/* Serializes DNS lookups, see offload_getaddrinfo(). */
+	struct k_mutex dns_lock;
+
 	/* Semaphore(s) */
 	struct k_sem sem_response;
 	struct k_sem sem_tx_ready;
 	struct k_sem sem_sock_conn;
 	struct k_sem sem_dns;
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_HTTP)
+	/* Results of the HTTP and file commands, and the URC semaphore. */
+	int http_err;
+	struct quectel_bg96_http_response http_rsp;
+	int file_handle;
+	int file_size;
+	/* Block the AT+QFREAD in flight reads into. */
+	struct file_read_data *file_read;
+	struct k_sem sem_http;
+#endif
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PM)
+	/* Set once the power saving setup is done; until then the modem is
+	 * kept awake.
+	 */
+	bool pm_started;
+	/* DTR is released and the UART may sleep, or the modem be in PSM. */
+	bool pm_asleep;
+	/* Waits for a URC outside of a command, which keep the modem awake. */
+	atomic_t pm_holds;
+	struct k_work_delayable pm_idle_work;
+	struct k_work pm_wake_work;
+#endif
+};
+
+/* Command classes tracked by the latency statistics. */
+enum mdm_cmd_class {
+	/* Time spent waiting for the command handler TX lock. */
+	MDM_CMD_CLASS_TX_LOCK = 0,
+	/* AT+QIOPEN until the +QIOPEN URC. */
+	MDM_CMD_CLASS_QIOPEN,
+#if defined(CONFIG_MODEM_QUECTEL_BG96_SSL)
+	/* AT+QSSLOPEN until the +QSSLOPEN URC, so TCP connect and handshake. */
+	MDM_CMD_CLASS_QSSLOPEN,
+#endif
+	/* AT+QISEND until the '>' data prompt. */
+	MDM_CMD_CLASS_QISEND_PROMPT,
+	/* End of the data written after '>' until SEND OK/SEND FAIL. */
+	MDM_CMD_CLASS_SEND_OK,
+	MDM_CMD_CLASS_QIRD,
+	MDM_CMD_CLASS_QIDNSGIP,
+	/* AT+QFREAD of one file block, through to its OK. */
+	MDM_CMD_CLASS_QFREAD,
+	MDM_CMD_CLASS_OTHER,
+	MDM_CMD_CLASS_COUNT,
+	/* Not recorded. */
+	MDM_CMD_CLASS_NONE = MDM_CMD_CLASS_COUNT,
+};
+
+/* When a command started. Waits run up to MDM_CMD_CONN_TIMEOUT, longer
+ * than the 32-bit cycle counter takes to wrap, so the uptime is kept too.
+ */
+struct mdm_cmd_start {
+	uint32_t cycles;
+	int64_t ticks;
 };
 
+#if defined(CONFIG_MODEM_QUECTEL_BG96_CMD_STATS)
+void mdm_cmd_stats_init(void);
+/* Record a command of class @p cls that started at @p start and finished
+ * with @p ret.
+ */
+void mdm_cmd_stats_record(enum mdm_cmd_class cls, struct mdm_cmd_start start, int ret);
+
+static inline struct mdm_cmd_start mdm_cmd_stats_start(void)
+{
+	return (struct mdm_cmd_start){
+		.cycles = k_cycle_get_32(),
+		.ticks = k_uptime_ticks(),
+	};
+}
+#else
+static inline void mdm_cmd_stats_init(void) {}
+static inline void mdm_cmd_stats_record(enum mdm_cmd_class cls, struct mdm_cmd_start start,
+					int ret) {}
+static inline struct mdm_cmd_start mdm_cmd_stats_start(void)
+{
+	return (struct mdm_cmd_start){ 0 };
+}
+#endif /* defined(CONFIG_MODEM_QUECTEL_BG96_CMD_STATS) */
+
+#if defined(CONFIG_MODEM_QUECTEL_BG96_PM)
+void mdm_pm_stats_init(void);
+/* Record the modem being let sleep. */
+void mdm_pm_stats_sleep(void);
+/* Record a wake that took @p wake_ms, @p psm if it needed PWRKEY to leave
+ * PSM.
+ */
+void mdm_pm_stats_wake(uint32_t wake_ms, bool psm);
+/* Record socket data read; the first after a wake sets wake-to-first-byte. */
+void mdm_pm_stats_rx(void);
+/* Set the PSM active time: sleep longer than it is counted as PSM. 0 if
+ * PSM is off.
+ */
+void mdm_pm_stats_psm_active(uint32_t active_s);
+#else
+static inline void mdm_pm_stats_rx(void) {}
+#endif /* defined(CONFIG_MODEM_QUECTEL_BG96_PM) */
+
 /* Socket read callback data */
 struct socket_read_data {
 	char		 *recv_buf;
 	size_t		 recv_buf_len;
 	struct sockaddr	 *recv_addr;
 	uint16_t	 recv_read_len;
+	/* Source of the datagram read from a UDP service. */
+	struct sockaddr	 recv_from;
+	bool		 has_recv_from;
 };
 
 #endif /* QUECTEL_BG96_H */
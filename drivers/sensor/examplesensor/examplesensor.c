@@ -12,13 +12,7 @@
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(examplesensor, CONFIG_SENSOR_LOG_LEVEL);
 
-struct examplesensor_data {
-	int state;
-};
-
-struct examplesensor_config {
-	struct gpio_dt_spec input;
-};
+#include "examplesensor.h"
 
 static int examplesensor_sample_fetch(const struct device *dev,
 				      enum sensor_channel chan)
@@ -49,6 +43,9 @@ static int examplesensor_channel_get(const struct device *dev,
 static const struct sensor_driver_api examplesensor_api = {
 	.sample_fetch = &examplesensor_sample_fetch,
 	.channel_get = &examplesensor_channel_get,
+#if defined(CONFIG_EXAMPLESENSOR_TRIGGER)
+	.trigger_set = &examplesensor_trigger_set,
+#endif
 };
 
 static int examplesensor_init(const struct device *dev)
@@ -68,6 +65,13 @@ static int examplesensor_init(const struct device *dev)
 		return ret;
 	}
 
+#if defined(CONFIG_EXAMPLESENSOR_TRIGGER)
+	ret = examplesensor_trigger_init(dev);
+	if (ret < 0) {
+		return ret;
+	}
+#endif
+
 	return 0;
 }
 
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EXAMPLESENSOR_H
+#define EXAMPLESENSOR_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/sensor.h>
+
+#include <sensor/examplesensor.h>
+
+struct examplesensor_data {
+	int state;
+
+#if defined(CONFIG_EXAMPLESENSOR_TRIGGER)
+	const struct device *dev;
+	struct gpio_callback gpio_cb;
+	struct k_work work;
+	sensor_trigger_handler_t handler;
+	const struct sensor_trigger *trigger;
+
+	/* Filled by the GPIO interrupt, read by examplesensor_fifo_read(). */
+	struct k_spinlock lock;
+	struct examplesensor_sample fifo[CONFIG_EXAMPLESENSOR_FIFO_SIZE];
+	uint16_t head;
+	uint16_t count;
+	uint32_t dropped;
+#endif
+};
+
+struct examplesensor_config {
+	struct gpio_dt_spec input;
+};
+
+#if defined(CONFIG_EXAMPLESENSOR_TRIGGER)
+int examplesensor_trigger_init(const struct device *dev);
+
+int examplesensor_trigger_set(const struct device *dev,
+			      const struct sensor_trigger *trig,
+			      sensor_trigger_handler_t handler);
+#endif
+
+#endif /* EXAMPLESENSOR_H */
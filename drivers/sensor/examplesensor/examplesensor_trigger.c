@@ -0,0 +1,134 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Edge triggered sampling for the example sensor. The GPIO interrupt puts a
+ * timestamped sample of the input on the FIFO of the instance and submits
+ * a work item, which calls the trigger handler. The handler is called once
+ * for however many edges came before the work item ran, and drains them
+ * with examplesensor_fifo_read().
+ */
+
+#define DT_DRV_COMPAT zephyr_examplesensor
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/sensor.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_DECLARE(examplesensor, CONFIG_SENSOR_LOG_LEVEL);
+
+#include "examplesensor.h"
+
+static void examplesensor_gpio_callback(const struct device *port,
+					struct gpio_callback *cb, uint32_t pins)
+{
+	struct examplesensor_data *data =
+		CONTAINER_OF(cb, struct examplesensor_data, gpio_cb);
+	const struct examplesensor_config *config = data->dev->config;
+	struct examplesensor_sample sample = {
+		.uptime_ticks = k_uptime_ticks(),
+		.cycles = k_cycle_get_32(),
+	};
+	k_spinlock_key_t key;
+	int state;
+
+	state = gpio_pin_get_dt(&config->input);
+	if (state < 0) {
+		return;
+	}
+	sample.state = state;
+
+	key = k_spin_lock(&data->lock);
+	data->state = state;
+	if (data->count == CONFIG_EXAMPLESENSOR_FIFO_SIZE) {
+		data->dropped++;
+	} else {
+		data->fifo[(data->head + data->count) % CONFIG_EXAMPLESENSOR_FIFO_SIZE] = sample;
+		data->count++;
+	}
+	k_spin_unlock(&data->lock, key);
+
+	if (data->handler != NULL) {
+		k_work_submit(&data->work);
+	}
+}
+
+static void examplesensor_work_handler(struct k_work *work)
+{
+	struct examplesensor_data *data =
+		CONTAINER_OF(work, struct examplesensor_data, work);
+	sensor_trigger_handler_t handler = data->handler;
+
+	if (handler != NULL) {
+		handler(data->dev, data->trigger);
+	}
+}
+
+size_t examplesensor_fifo_read(const struct device *dev, struct examplesensor_sample *samples,
+			       size_t max, uint32_t *dropped)
+{
+	struct examplesensor_data *data = dev->data;
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+	size_t count = MIN(max, data->count);
+
+	for (size_t i = 0; i < count; i++) {
+		samples[i] = data->fifo[data->head];
+		data->head = (data->head + 1) % CONFIG_EXAMPLESENSOR_FIFO_SIZE;
+	}
+	data->count -= count;
+
+	if (dropped != NULL) {
+		*dropped = data->dropped;
+		data->dropped = 0;
+	}
+	k_spin_unlock(&data->lock, key);
+
+	return count;
+}
+
+int examplesensor_trigger_set(const struct device *dev,
+			      const struct sensor_trigger *trig,
+			      sensor_trigger_handler_t handler)
+{
+	struct examplesensor_data *data = dev->data;
+
+	if (trig->type != SENSOR_TRIG_DATA_READY ||
+	    (trig->chan != SENSOR_CHAN_PROX && trig->chan != SENSOR_CHAN_ALL)) {
+		return -ENOTSUP;
+	}
+
+	data->trigger = trig;
+	data->handler = handler;
+
+	return 0;
+}
+
+int examplesensor_trigger_init(const struct device *dev)
+{
+	const struct examplesensor_config *config = dev->config;
+	struct examplesensor_data *data = dev->data;
+	int ret;
+
+	data->dev = dev;
+	k_work_init(&data->work, examplesensor_work_handler);
+
+	gpio_init_callback(&data->gpio_cb, examplesensor_gpio_callback,
+			   BIT(config->input.pin));
+	ret = gpio_add_callback(config->input.port, &data->gpio_cb);
+	if (ret < 0) {
+		LOG_ERR("Could not add GPIO callback (%d)", ret);
+		return ret;
+	}
+
+	/* Sampling starts right away, so the FIFO can also be read without a
+	 * trigger handler.
+	 */
+	ret = gpio_pin_interrupt_configure_dt(&config->input, GPIO_INT_EDGE_BOTH);
+	if (ret < 0) {
+		LOG_ERR("Could not configure GPIO interrupt (%d)", ret);
+		return ret;
+	}
+
+	return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* For posix_openpt() and friends from the host C library. */
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+
+#define DT_DRV_COMPAT zephyr_native_pty_uart
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+
+#include <posix_trace.h>
+
+/* How long poll_out waits for the peer to drain the pty before retrying. */
+#define TX_RETRY_MS 10
+
+struct native_pty_uart_data {
+	const struct device *dev;
+	int fd;
+	/* A byte read ahead to tell whether the pty is readable, or -1. */
+	int peek;
+	struct k_timer irq_timer;
+	uart_irq_callback_user_data_t callback;
+	void *cb_data;
+	bool rx_irq_enabled;
+	bool tx_irq_enabled;
+};
+
+static bool pty_readable(struct native_pty_uart_data *data)
+{
+	unsigned char c;
+
+	if (data->peek >= 0) {
+		return true;
+	}
+	/* Fails with EIO while no one has the other end open. */
+	if (read(data->fd, &c, 1) == 1) {
+		data->peek = c;
+		return true;
+	}
+	return false;
+}
+
+static int native_pty_uart_poll_in(const struct device *dev, unsigned char *c)
+{
+	struct native_pty_uart_data *data = dev->data;
+
+	if (!pty_readable(data)) {
+		return -1;
+	}
+	*c = (unsigned char)data->peek;
+	data->peek = -1;
+	return 0;
+}
+
+static void native_pty_uart_poll_out(const struct device *dev, unsigned char c)
+{
+	struct native_pty_uart_data *data = dev->data;
+	struct pollfd pfd = {
+		.fd = data->fd,
+		.events = POLLOUT,
+	};
+
+	/* Behave like a UART with flow control while a peer is attached, so a
+	 * slow simulator does not lose data, but do not block forever when
+	 * there is none.
+	 */
+	while (write(data->fd, &c, 1) != 1) {
+		if (errno != EAGAIN && errno != EINTR) {
+			return;
+		}
+		if (poll(&pfd, 1, TX_RETRY_MS) > 0 && (pfd.revents & POLLHUP)) {
+			return;
+		}
+	}
+}
+
+static int native_pty_uart_fifo_fill(const struct device *dev, const uint8_t *tx_data,
+				     int size)
+{
+	struct native_pty_uart_data *data = dev->data;
+	ssize_t written = write(data->fd, tx_data, size);
+
+	return written < 0 ? 0 : (int)written;
+}
+
+static int native_pty_uart_fifo_read(const struct device *dev, uint8_t *rx_data,
+				     const int size)
+{
+	struct native_pty_uart_data *data = dev->data;
+	int count = 0;
+	ssize_t ret;
+
+	if (size <= 0) {
+		return 0;
+	}
+	if (data->peek >= 0) {
+		rx_data[count++] = (uint8_t)data->peek;
+		data->peek = -1;
+	}
+	ret = read(data->fd, &rx_data[count], size - count);
+	if (ret > 0) {
+		count += ret;
+	}
+	return count;
+}
+
+static void native_pty_uart_irq_tx_enable(const struct device *dev)
+{
+	struct native_pty_uart_data *data = dev->data;
+
+	data->tx_irq_enabled = true;
+}
+
+static void native_pty_uart_irq_tx_disable(const struct device *dev)
+{
+	struct native_pty_uart_data *data = dev->data;
+
+	data->tx_irq_enabled = false;
+}
+
+static int native_pty_uart_irq_tx_ready(const struct device *dev)
+{
+	struct native_pty_uart_data *data = dev->data;
+
+	return data->tx_irq_enabled;
+}
+
+static int native_pty_uart_irq_tx_complete(const struct device *dev)
+{
+	return 1;
+}
+
+static void native_pty_uart_irq_rx_enable(const struct device *dev)
+{
+	struct native_pty_uart_data *data = dev->data;
+
+	data->rx_irq_enabled = true;
+}
+
+static void native_pty_uart_irq_rx_disable(const struct device *dev)
+{
+	struct native_pty_uart_data *data = dev->data;
+
+	data->rx_irq_enabled = false;
+}
+
+static int native_pty_uart_irq_rx_ready(const struct device *dev)
+{
+	struct native_pty_uart_data *data = dev->data;
+
+	return data->rx_irq_enabled && pty_readable(data);
+}
+
+static int native_pty_uart_irq_is_pending(const struct device *dev)
+{
+	return native_pty_uart_irq_rx_ready(dev) || native_pty_uart_irq_tx_ready(dev);
+}
+
+static int native_pty_uart_irq_update(const struct device *dev)
+{
+	return 1;
+}
+
+static void native_pty_uart_irq_callback_set(const struct device *dev,
+					     uart_irq_callback_user_data_t cb, void *cb_data)
+{
+	struct native_pty_uart_data *data = dev->data;
+
+	data->callback = cb;
+	data->cb_data = cb_data;
+
+	/* Started here rather than at init, which is before the system clock. */
+	if (k_timer_remaining_ticks(&data->irq_timer) == 0) {
+		k_timer_start(&data->irq_timer, K_MSEC(CONFIG_UART_NATIVE_PTY_POLL_MS),
+			      K_MSEC(CONFIG_UART_NATIVE_PTY_POLL_MS));
+	}
+}
+
+/* Runs in the timer ISR, standing in for the UART interrupt. */
+static void irq_timer_expiry(struct k_timer *timer)
+{
+	struct native_pty_uart_data *data =
+		CONTAINER_OF(timer, struct native_pty_uart_data, irq_timer);
+
+	if (data->callback != NULL && native_pty_uart_irq_is_pending(data->dev)) {
+		data->callback(data->dev, data->cb_data);
+	}
+}
+
+static int native_pty_uart_init(const struct device *dev)
+{
+	struct native_pty_uart_data *data = dev->data;
+	struct termios tio;
+	const char *name;
+
+	data->dev = dev;
+	data->peek = -1;
+
+	data->fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (data->fd < 0 || grantpt(data->fd) != 0 || unlockpt(data->fd) != 0) {
+		posix_print_error_and_exit("%s: could not open a pty (%d)\n", dev->name, errno);
+		return -EIO;
+	}
+
+	/* Raw bytes both ways; AT data must not be echoed or translated. */
+	if (tcgetattr(data->fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		(void)tcsetattr(data->fd, TCSANOW, &tio);
+	}
+	(void)fcntl(data->fd, F_SETFL, fcntl(data->fd, F_GETFL) | O_NONBLOCK);
+
+	name = ptsname(data->fd);
+	posix_print_trace("%s connected to pseudotty: %s\n", dev->name, name);
+
+	k_timer_init(&data->irq_timer, irq_timer_expiry, NULL);
+	return 0;
+}
+
+static const struct uart_driver_api native_pty_uart_api = {
+	.poll_in = native_pty_uart_poll_in,
+	.poll_out = native_pty_uart_poll_out,
+	.fifo_fill = native_pty_uart_fifo_fill,
+	.fifo_read = native_pty_uart_fifo_read,
+	.irq_tx_enable = native_pty_uart_irq_tx_enable,
+	.irq_tx_disable = native_pty_uart_irq_tx_disable,
+	.irq_tx_ready = native_pty_uart_irq_tx_ready,
+	.irq_tx_complete = native_pty_uart_irq_tx_complete,
+	.irq_rx_enable = native_pty_uart_irq_rx_enable,
+	.irq_rx_disable = native_pty_uart_irq_rx_disable,
+	.irq_rx_ready = native_pty_uart_irq_rx_ready,
+	.irq_is_pending = native_pty_uart_irq_is_pending,
+	.irq_update = native_pty_uart_irq_update,
+	.irq_callback_set = native_pty_uart_irq_callback_set,
+};
+
+#define NATIVE_PTY_UART_INIT(n)							\
+	static struct native_pty_uart_data native_pty_uart_data_##n;			\
+										\
+	DEVICE_DT_INST_DEFINE(n, native_pty_uart_init, NULL,				\
+			      &native_pty_uart_data_##n, NULL, PRE_KERNEL_1,		\
+			      CONFIG_SERIAL_INIT_PRIORITY, &native_pty_uart_api);
+
+DT_INST_FOREACH_STATUS_OKAY(NATIVE_PTY_UART_INIT)
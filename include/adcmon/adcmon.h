@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EXAMPLE_APPLICATION_INCLUDE_ADCMON_ADCMON_H_
+#define EXAMPLE_APPLICATION_INCLUDE_ADCMON_ADCMON_H_
+
+/**
+ * @brief Continuous ADC monitor.
+ *
+ * Scans a set of channels of one ADC at CONFIG_ADCMON_RATE_HZ into a
+ * buffer of two halves. The ADC sequence callback hands each half to a
+ * work item as it fills, and the work item decimates every channel of it
+ * by CONFIG_ADCMON_DECIMATION with a Q15 FIR filter while the other half
+ * fills. The decimated samples of each channel are aggregated over windows
+ * of CONFIG_ADCMON_WINDOW samples, in millivolts.
+ *
+ * The last window of each channel is kept for adcmon_window_get(), passed
+ * to the window callback and, with CONFIG_ADCMON_STATS, set in the
+ * "adcmon<N>" stats group, which is sent with the status update. The time
+ * spent processing is reported per thousand samples by adcmon_load_get().
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/drivers/adc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Aggregates of one channel over a window, in millivolts. */
+struct adcmon_window {
+	int32_t min_mv;
+	int32_t max_mv;
+	int32_t mean_mv;
+	int32_t rms_mv;
+	/** Windows completed on the channel since the start, this one included. */
+	uint32_t seq;
+};
+
+/** Processing load since the start. */
+struct adcmon_load {
+	/** Conversions processed, over all channels. */
+	uint64_t samples;
+	/** Half buffers processed. */
+	uint32_t blocks;
+	/** Halves filled again before they were processed. */
+	uint32_t overruns;
+	/** Cycles spent filtering and aggregating per 1000 samples, window
+	 * callbacks included.
+	 */
+	uint32_t cycles_per_ksample;
+	/** The same in microseconds. */
+	uint32_t us_per_ksample;
+	/** Share of the CPU that takes at the configured rate, in parts per
+	 * million. Conversions are not included; they are up to the driver.
+	 */
+	uint32_t load_ppm;
+};
+
+/**
+ * @brief Called from the system work queue with each completed window.
+ *
+ * @param channel Index of the channel in the array given to adcmon_start().
+ */
+typedef void (*adcmon_window_cb_t)(size_t channel, const struct adcmon_window *window,
+				   void *user_data);
+
+#if defined(CONFIG_ADCMON)
+/**
+ * @brief Set up the channels and start sampling.
+ *
+ * The channels must be on the same ADC, have distinct channel IDs and the
+ * same resolution of at most 15 bits. @p channels must stay valid until
+ * adcmon_stop().
+ *
+ * @returns 0, -EALREADY if running, -EINVAL or -ENOTSUP for channels that
+ * cannot be sampled together, or an error of the ADC driver.
+ */
+int adcmon_start(const struct adc_dt_spec *channels, size_t count, adcmon_window_cb_t cb,
+		 void *user_data);
+
+/**
+ * @brief Stop sampling and wait for the last half to be processed.
+ *
+ * Windows in progress are dropped; the last completed ones are kept until
+ * the next start.
+ */
+int adcmon_stop(void);
+
+/**
+ * @brief Get the last completed window of a channel.
+ *
+ * @returns 0, -EINVAL for an unknown channel, or -ENODATA before the first
+ * window of the channel completed.
+ */
+int adcmon_window_get(size_t channel, struct adcmon_window *window);
+
+/**
+ * @brief Get the processing load since the start.
+ */
+void adcmon_load_get(struct adcmon_load *load);
+#else
+static inline int adcmon_start(const struct adc_dt_spec *channels, size_t count,
+			       adcmon_window_cb_t cb, void *user_data)
+{
+	return -ENOTSUP;
+}
+static inline int adcmon_stop(void)
+{
+	return -ENOTSUP;
+}
+static inline int adcmon_window_get(size_t channel, struct adcmon_window *window)
+{
+	return -ENOTSUP;
+}
+static inline void adcmon_load_get(struct adcmon_load *load)
+{
+	*load = (struct adcmon_load){ 0 };
+}
+#endif /* defined(CONFIG_ADCMON) */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXAMPLE_APPLICATION_INCLUDE_ADCMON_ADCMON_H_ */
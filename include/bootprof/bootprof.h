@@ -0,0 +1,73 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EXAMPLE_APPLICATION_INCLUDE_BOOTPROF_BOOTPROF_H_
+#define EXAMPLE_APPLICATION_INCLUDE_BOOTPROF_BOOTPROF_H_
+
+/**
+ * @brief Boot phase profiler.
+ *
+ * Records the time at which each SYS_INIT level starts, and at named
+ * milestones marked by drivers and the application, into no-init RAM. A
+ * warm reset keeps the record, so the profile of the previous boot is still
+ * there after a watchdog reset that happened before the boot completed.
+ *
+ * Times are from the system timer, which starts during PRE_KERNEL_2, so
+ * earlier marks are not meaningful and the time spent in the bootloader
+ * is not seen.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOTPROF_NAME_LEN 12
+
+struct bootprof_mark {
+	/** Time since the system timer started, in microseconds. */
+	uint32_t us;
+	/** Copied, as names in flash may move after an update. */
+	char name[BOOTPROF_NAME_LEN];
+};
+
+#if defined(CONFIG_BOOTPROF)
+/**
+ * @brief Record a boot milestone. Marks beyond CONFIG_BOOTPROF_MARKS are
+ * dropped, as are marks made after bootprof_done().
+ *
+ * @param name Truncated to BOOTPROF_NAME_LEN - 1 characters.
+ */
+void bootprof_mark(const char *name);
+
+/** @brief Record the "done" milestone; the boot is complete. */
+void bootprof_done(void);
+
+/**
+ * @brief Get the marks of this boot or of the previous one.
+ *
+ * @param previous Get the previous boot's marks instead of this boot's.
+ * @param marks Set to the marks, in the order they were made.
+ * @param complete If not NULL, set to whether the boot reached bootprof_done().
+ * @returns The number of marks, 0 if there is no record.
+ */
+size_t bootprof_get(bool previous, const struct bootprof_mark **marks, bool *complete);
+#else
+static inline void bootprof_mark(const char *name) {}
+static inline void bootprof_done(void) {}
+static inline size_t bootprof_get(bool previous, const struct bootprof_mark **marks,
+				  bool *complete)
+{
+	return 0;
+}
+#endif /* defined(CONFIG_BOOTPROF) */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXAMPLE_APPLICATION_INCLUDE_BOOTPROF_BOOTPROF_H_ */
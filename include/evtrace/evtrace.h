@@ -0,0 +1,176 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EXAMPLE_APPLICATION_INCLUDE_EVTRACE_EVTRACE_H_
+#define EXAMPLE_APPLICATION_INCLUDE_EVTRACE_EVTRACE_H_
+
+/**
+ * @brief Binary event trace ring.
+ *
+ * A fixed-size ring of timestamped events in RAM, cheap enough to leave
+ * enabled on the modem and HTTP hot paths: recording an event is an
+ * atomic increment and a 16-byte store, with no locks and no formatting.
+ * The ring is dumped with the "evtrace dump" shell command, and
+ * scripts/evtrace_to_chrome.py turns the dump into a Chrome trace.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Event IDs. The meaning of the arguments is given for each. */
+enum evtrace_id {
+	EVTRACE_NONE = 0,
+	/** AT command sent; arg1: command tag. */
+	EVTRACE_MDM_CMD_BEGIN,
+	/** AT command done; arg0: result (int16). */
+	EVTRACE_MDM_CMD_END,
+	/** Response or URC handled; arg0: socket ID or 0xffff, arg1: tag. */
+	EVTRACE_MDM_RSP,
+	/** Semaphore given; arg0: enum evtrace_sem. */
+	EVTRACE_SEM_GIVE,
+	/** Started waiting on a semaphore; arg0: enum evtrace_sem. */
+	EVTRACE_SEM_TAKE_BEGIN,
+	/** Done waiting; arg0: enum evtrace_sem, arg1: result. */
+	EVTRACE_SEM_TAKE_END,
+	/** Socket state change; arg0: socket ID, arg1: enum evtrace_sock_state. */
+	EVTRACE_SOCK_STATE,
+	/** HTTP request started; arg0: endpoint. */
+	EVTRACE_HTTP_BEGIN,
+	/** HTTP request phase reached; arg0: phase. */
+	EVTRACE_HTTP_PHASE,
+	/** HTTP request done; arg1: result. */
+	EVTRACE_HTTP_END,
+	/** HTTP payload callback; arg1: bytes sent. */
+	EVTRACE_HTTP_PAYLOAD,
+	/** HTTP response callback; arg0: final call, arg1: body bytes. */
+	EVTRACE_HTTP_RESPONSE,
+	/** First ID free for application events. */
+	EVTRACE_USER = 0x80,
+};
+
+/** Semaphores traced by EVTRACE_SEM_* events. */
+enum evtrace_sem {
+	EVTRACE_SEM_MDM_RESPONSE = 0,
+	EVTRACE_SEM_MDM_TX_READY,
+	EVTRACE_SEM_MDM_SOCK_CONN,
+	EVTRACE_SEM_MDM_DNS,
+	EVTRACE_SEM_MDM_TX_LOCK,
+	EVTRACE_SEM_MDM_HTTP,
+};
+
+enum evtrace_sock_state {
+	EVTRACE_SOCK_CONNECTING = 0,
+	EVTRACE_SOCK_CONNECTED,
+	EVTRACE_SOCK_DATA_READY,
+	EVTRACE_SOCK_CLOSED,
+	/** Closed by the remote end or the modem. */
+	EVTRACE_SOCK_CLOSED_URC,
+};
+
+/** One event, as stored in the ring and dumped. */
+struct evtrace_entry {
+	/** Low 32 bits of the hardware cycle counter. */
+	uint32_t cycles;
+	/** Recording thread, or 0 in an ISR. */
+	uint32_t thread;
+	uint32_t arg1;
+	uint16_t arg0;
+	uint8_t id;
+	/** Twice the times the ring had wrapped, odd while being written. */
+	uint8_t seq;
+};
+
+/**
+ * @brief Pack up to 4 characters of a command or response into a tag.
+ *
+ * A leading "AT" and "+" are skipped, so "AT+QISEND=0,12" becomes "QISE".
+ */
+static inline uint32_t evtrace_tag(const char *str)
+{
+	uint32_t tag = 0;
+
+	if (str == NULL) {
+		return 0;
+	}
+	if (str[0] == 'A' && str[1] == 'T') {
+		str += 2;
+	}
+	if (str[0] == '+') {
+		str++;
+	}
+	for (int i = 0; i < 4 && str[i] != '\0'; i++) {
+		tag |= (uint32_t)(uint8_t)str[i] << (8 * i);
+	}
+	return tag;
+}
+
+#if defined(CONFIG_EVTRACE)
+/**
+ * @brief Record an event. Callable from any context.
+ */
+void evtrace_record(uint8_t id, uint16_t arg0, uint32_t arg1);
+
+/**
+ * @brief Pause or resume recording.
+ */
+void evtrace_enable(bool enable);
+
+/**
+ * @brief Copy the events in the ring, oldest first.
+ *
+ * Entries being written during the copy are skipped.
+ *
+ * @param out Buffer for at most @p max entries.
+ * @param dropped If not NULL, set to the number of events recorded since
+ * the last clear that were overwritten before the copy.
+ * @returns The number of entries copied.
+ */
+size_t evtrace_copy(struct evtrace_entry *out, size_t max, uint32_t *dropped);
+
+/**
+ * @brief The seq of the entry at ring index @p idx once written.
+ *
+ * Always even; a writer sets it one higher while the entry is being
+ * written, which no completed entry can hold.
+ */
+static inline uint8_t evtrace_seq_done(uint32_t idx)
+{
+	return (uint8_t)((idx / CONFIG_EVTRACE_ENTRIES) << 1);
+}
+
+/**
+ * @brief Whether an entry read for ring index @p idx is whole and current.
+ *
+ * @param before The seq read before copying the entry.
+ * @param after The seq read after copying it.
+ */
+static inline bool evtrace_seq_valid(uint32_t idx, uint8_t before, uint8_t after)
+{
+	return before == after && before == evtrace_seq_done(idx);
+}
+
+/**
+ * @brief Discard all recorded events.
+ */
+void evtrace_clear(void);
+#else
+static inline void evtrace_record(uint8_t id, uint16_t arg0, uint32_t arg1) {}
+static inline void evtrace_enable(bool enable) {}
+static inline size_t evtrace_copy(struct evtrace_entry *out, size_t max, uint32_t *dropped)
+{
+	return 0;
+}
+static inline void evtrace_clear(void) {}
+#endif /* defined(CONFIG_EVTRACE) */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXAMPLE_APPLICATION_INCLUDE_EVTRACE_EVTRACE_H_ */
@@ -0,0 +1,199 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EXAMPLE_APPLICATION_INCLUDE_METRICAGG_METRICAGG_H_
+#define EXAMPLE_APPLICATION_INCLUDE_METRICAGG_METRICAGG_H_
+
+/**
+ * @brief Windowed metric aggregation.
+ *
+ * Samples of up to CONFIG_METRICAGG_METRICS metrics are aggregated over
+ * consecutive windows, each starting with the first sample after the end
+ * of the previous one. When a window ends, a summary with the count,
+ * minimum, maximum, mean, standard deviation and the 50th, 90th and 99th
+ * percentiles is queued. The percentiles are estimated with the P-square
+ * algorithm, five markers each, so no samples are kept.
+ *
+ * Every sample is also checked against the rules of its metric. A rule
+ * goes off when the value, or its change per second, passes the
+ * threshold, and clears once it is back past the threshold by the
+ * hysteresis; both queue an event.
+ *
+ * Summaries and events stay queued until a report carrying them is
+ * acknowledged. The notify callback is called whenever one is queued, so
+ * the app only wakes the network for those.
+ *
+ * Usage:
+ *
+ *	metricagg_init(wake_network);
+ *	metricagg_add(METRIC_SUPPLY, mv);
+ *	...
+ *	struct metricagg_cursor cursor = { 0 };
+ *	n = metricagg_summaries_get(summaries, ARRAY_SIZE(summaries), &cursor);
+ *	...send them...
+ *	metricagg_ack(&cursor);
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum metricagg_rule_type {
+	METRICAGG_RULE_NONE = 0,
+	/** The value is above the threshold. */
+	METRICAGG_RULE_ABOVE,
+	/** The value is below the threshold. */
+	METRICAGG_RULE_BELOW,
+	/** The value changes by more than the threshold per second, either way. */
+	METRICAGG_RULE_RATE,
+};
+
+struct metricagg_rule {
+	uint8_t metric;
+	/** enum metricagg_rule_type */
+	uint8_t type;
+	int32_t threshold;
+	/** How far back past the threshold the value has to go to clear. */
+	uint32_t hysteresis;
+};
+
+/** One metric over a window. */
+struct metricagg_summary {
+	uint8_t metric;
+	/** Uptime of the end of the window. */
+	int64_t end_ms;
+	uint32_t duration_ms;
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int32_t mean;
+	uint32_t stddev;
+	int32_t p50;
+	int32_t p90;
+	int32_t p99;
+};
+
+/** A rule that went off or cleared. */
+struct metricagg_event {
+	uint8_t metric;
+	/** Index of the rule in the configuration. */
+	uint8_t rule;
+	bool cleared;
+	/** The sample, or its change per second for a rate rule. */
+	int32_t value;
+	int64_t uptime_ms;
+};
+
+/** What a report carried, to drop it from the queues once delivered. */
+struct metricagg_cursor {
+	uint32_t summaries;
+	uint32_t events;
+};
+
+/** Called from the context of metricagg_add() when something is queued. */
+typedef void (*metricagg_notify_t)(void);
+
+#if defined(CONFIG_METRICAGG)
+/**
+ * @brief Set the notify callback and register the stats group.
+ */
+void metricagg_init(metricagg_notify_t notify);
+
+/**
+ * @brief Add a sample taken now.
+ */
+void metricagg_add(uint8_t metric, int32_t value);
+
+/**
+ * @brief Add a sample taken at @p uptime_ms, which must not go backwards.
+ */
+void metricagg_add_at(uint8_t metric, int32_t value, int64_t uptime_ms);
+
+/**
+ * @brief End the windows that ended by @p uptime_ms, for metrics whose
+ * samples stopped.
+ *
+ * Meant for just before a report, so the notify callback is not called.
+ */
+void metricagg_flush(int64_t uptime_ms);
+
+/**
+ * @brief Replace the window length and the rules.
+ *
+ * Open windows keep their length; the rules start out clear. Events still
+ * queued are dropped, since they refer to the old rules.
+ *
+ * @param id Reported back by metricagg_config_id(), so the backend can tell
+ * which configuration the device runs.
+ * @param window_ms 0 for CONFIG_METRICAGG_WINDOW_S.
+ * @returns 0, or -EINVAL for too many rules or a rule for an unknown
+ * metric or of an unknown type, which leaves the configuration unchanged.
+ */
+int metricagg_configure(uint32_t id, uint32_t window_ms, const struct metricagg_rule *rules,
+			size_t count);
+
+/**
+ * @brief The ID of the current configuration, 0 for the defaults.
+ */
+uint32_t metricagg_config_id(void);
+
+/**
+ * @brief Copy up to @p max queued summaries, oldest first.
+ *
+ * @param cursor Updated to cover the summaries copied.
+ * @returns The number of summaries copied.
+ */
+size_t metricagg_summaries_get(struct metricagg_summary *out, size_t max,
+			       struct metricagg_cursor *cursor);
+
+/**
+ * @brief Copy up to @p max queued events, oldest first.
+ *
+ * @param cursor Updated to cover the events copied.
+ * @returns The number of events copied.
+ */
+size_t metricagg_events_get(struct metricagg_event *out, size_t max,
+			    struct metricagg_cursor *cursor);
+
+/**
+ * @brief Drop the summaries and events covered by @p cursor.
+ */
+void metricagg_ack(const struct metricagg_cursor *cursor);
+#else
+static inline void metricagg_init(metricagg_notify_t notify) {}
+static inline void metricagg_add(uint8_t metric, int32_t value) {}
+static inline void metricagg_add_at(uint8_t metric, int32_t value, int64_t uptime_ms) {}
+static inline void metricagg_flush(int64_t uptime_ms) {}
+static inline int metricagg_configure(uint32_t id, uint32_t window_ms,
+				      const struct metricagg_rule *rules, size_t count)
+{
+	return -ENOTSUP;
+}
+static inline uint32_t metricagg_config_id(void)
+{
+	return 0;
+}
+static inline size_t metricagg_summaries_get(struct metricagg_summary *out, size_t max,
+					     struct metricagg_cursor *cursor)
+{
+	return 0;
+}
+static inline size_t metricagg_events_get(struct metricagg_event *out, size_t max,
+					  struct metricagg_cursor *cursor)
+{
+	return 0;
+}
+static inline void metricagg_ack(const struct metricagg_cursor *cursor) {}
+#endif /* defined(CONFIG_METRICAGG) */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXAMPLE_APPLICATION_INCLUDE_METRICAGG_METRICAGG_H_ */
@@ -0,0 +1,164 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Quectel BG96 driver extensions beyond the offloaded socket API.
+ */
+
+#ifndef QUECTEL_BG96_PUBLIC_H
+#define QUECTEL_BG96_PUBLIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Bytes and packets exchanged with the modem for a socket.
+ *
+ * Payload counts are the socket data written with AT+QISEND and read with
+ * AT+QIRD. AT counts are the command and response framing around that
+ * data on the UART (AT+QIOPEN, AT+QISEND, AT+QIRD, prompts and result
+ * codes). Headers added by the modem's own TCP/IP stack are not visible
+ * to the host; the packet counts can be used to estimate them. For sockets
+ * on the modem's SSL stack, the payload is the data before encryption.
+ */
+struct quectel_bg96_data_usage {
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	/* AT+QISEND transfers. */
+	uint32_t tx_packets;
+	/* AT+QIRD reads that returned data. */
+	uint32_t rx_packets;
+	uint32_t tx_at_bytes;
+	uint32_t rx_at_bytes;
+};
+
+/**
+ * @brief Get the data usage of an open socket since it was connected.
+ *
+ * @param fd Socket descriptor returned by socket().
+ * @param usage Filled in with the counters.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if @p fd is not a BG96 socket.
+ */
+int quectel_bg96_socket_usage(int fd, struct quectel_bg96_data_usage *usage);
+
+/**
+ * @brief Get the data usage of a modem connect ID since boot.
+ *
+ * @param connect_id Modem connect ID (AT+QIOPEN <connectID>).
+ * @param usage Filled in with the counters.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if @p connect_id is out of range.
+ */
+int quectel_bg96_connect_id_usage(int connect_id, struct quectel_bg96_data_usage *usage);
+
+/**
+ * @brief Result of a GET made by the modem's HTTP client.
+ */
+struct quectel_bg96_http_response {
+	/* HTTP status code. */
+	int status;
+	/* Content-Length of the body; -1 if the server sent none. */
+	int content_length;
+};
+
+/**
+ * @brief Called with each block read from a file on the modem.
+ *
+ * @returns 0 to go on, or a negative errno to stop the read with it.
+ */
+typedef int (*quectel_bg96_file_cb)(const uint8_t *data, size_t len, void *user_data);
+
+/**
+ * @brief Have the modem make a GET request for @p url.
+ *
+ * The modem resolves the host, connects and reads the response headers by
+ * itself; the body stays on the modem until
+ * quectel_bg96_http_read_file(). One request can be made at a time.
+ *
+ * @param url http:// or https:// URL.
+ * @param timeout_s Time the modem allows for the response headers.
+ * @param rsp Filled in with the status and length of the response.
+ *
+ * @retval 0 if a response came, whatever its status.
+ * @retval -ETIMEDOUT if the modem did not report a result.
+ * @retval -EIO if the modem failed the request.
+ */
+int quectel_bg96_http_get(const char *url, int timeout_s,
+			  struct quectel_bg96_http_response *rsp);
+
+/**
+ * @brief Store the body of the last response in the file @p file of the
+ * modem's UFS, replacing the file if it exists.
+ *
+ * There is no UART traffic until the body has been received, so the
+ * caller only waits on a semaphore while the modem downloads.
+ *
+ * @param timeout_s Time the modem allows for the whole body.
+ *
+ * @returns The size of the file, or a negative errno.
+ */
+int quectel_bg96_http_read_file(const char *file, int timeout_s);
+
+/**
+ * @brief Read the file @p file of the modem's UFS in blocks of up to
+ * @p block_len bytes (at most 8 KiB), calling @p cb with each block.
+ *
+ * @param buf Buffer of @p block_len bytes the blocks are read into.
+ *
+ * @returns The number of bytes read, or a negative errno, which is the
+ * one returned by @p cb if it stopped the read.
+ */
+int quectel_bg96_file_read(const char *file, uint8_t *buf, size_t block_len,
+			   quectel_bg96_file_cb cb, void *user_data);
+
+/** @brief Delete the file @p file of the modem's UFS. */
+int quectel_bg96_file_delete(const char *file);
+
+/**
+ * @brief Time the modem spent in each power state, and how long it took
+ * to wake, since boot.
+ */
+struct quectel_bg96_pm_stats {
+	/* Time with DTR held and the UART up. */
+	uint32_t awake_ms;
+	/* Time with DTR released, PSM included. */
+	uint32_t sleep_ms;
+	/* Part of the sleep past the PSM active time, when the modem is
+	 * expected to have been in PSM. An estimate: the host cannot see PSM
+	 * entry.
+	 */
+	uint32_t psm_ms;
+	uint32_t wakes;
+	/* Wakes that needed PWRKEY because the modem was in PSM. */
+	uint32_t psm_wakes;
+	/* From the wake starting until the modem answered AT. */
+	uint32_t wake_ms_last;
+	uint32_t wake_ms_max;
+	/* From the wake starting until the first socket data was read. */
+	uint32_t first_byte_ms_last;
+	uint32_t first_byte_ms_max;
+};
+
+/**
+ * @brief Start waking the modem in the background.
+ *
+ * Commands wake the modem by themselves, so this is only to overlap the
+ * wake with preparing a request. Does nothing when power saving is off or
+ * the modem is awake.
+ */
+void quectel_bg96_wake(void);
+
+/**
+ * @brief Get the power state statistics.
+ *
+ * @retval 0 on success.
+ * @retval -ENOTSUP if power saving is not enabled.
+ */
+int quectel_bg96_pm_stats(struct quectel_bg96_pm_stats *stats);
+
+#endif /* QUECTEL_BG96_PUBLIC_H */
@@ -0,0 +1,56 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Example sensor extensions beyond the sensor API.
+ */
+
+#ifndef EXAMPLESENSOR_PUBLIC_H
+#define EXAMPLESENSOR_PUBLIC_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/device.h>
+
+/**
+ * @brief The input level right after an edge.
+ */
+struct examplesensor_sample {
+	/* Uptime of the edge, in ticks. */
+	int64_t uptime_ticks;
+	/* Cycle count of the edge, for the time between close edges; it wraps
+	 * sooner than the uptime.
+	 */
+	uint32_t cycles;
+	/* Logical level of the input, 1 for active. */
+	uint8_t state;
+};
+
+#if defined(CONFIG_EXAMPLESENSOR_TRIGGER)
+/**
+ * @brief Take up to @p max samples, oldest first, off the FIFO of @p dev.
+ *
+ * @param dropped If not NULL, set to the number of edges dropped because
+ * the FIFO was full since the last read.
+ *
+ * @returns The number of samples read.
+ */
+size_t examplesensor_fifo_read(const struct device *dev, struct examplesensor_sample *samples,
+			       size_t max, uint32_t *dropped);
+#else
+static inline size_t examplesensor_fifo_read(const struct device *dev,
+					     struct examplesensor_sample *samples,
+					     size_t max, uint32_t *dropped)
+{
+	if (dropped != NULL) {
+		*dropped = 0;
+	}
+	return 0;
+}
+#endif /* defined(CONFIG_EXAMPLESENSOR_TRIGGER) */
+
+#endif /* EXAMPLESENSOR_PUBLIC_H */
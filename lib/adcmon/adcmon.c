@@ -0,0 +1,580 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/adc.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#if defined(CONFIG_ADCMON_CMSIS_DSP)
+#include <arm_math.h>
+#else
+typedef int16_t q15_t;
+#endif
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(adcmon, CONFIG_LOG_DEFAULT_LEVEL);
+
+#include <adcmon/adcmon.h>
+
+#define ADCMON_BLOCK CONFIG_ADCMON_BLOCK
+#define ADCMON_DECIMATION CONFIG_ADCMON_DECIMATION
+#define ADCMON_TAPS (2 * ADCMON_DECIMATION - 1)
+#define ADCMON_OUT_BLOCK (ADCMON_BLOCK / ADCMON_DECIMATION)
+
+BUILD_ASSERT(IS_POWER_OF_TWO(ADCMON_DECIMATION),
+	     "CONFIG_ADCMON_DECIMATION must be a power of two");
+BUILD_ASSERT(ADCMON_BLOCK % ADCMON_DECIMATION == 0,
+	     "CONFIG_ADCMON_BLOCK must be a multiple of CONFIG_ADCMON_DECIMATION");
+
+#if defined(CONFIG_ADCMON_STATS)
+STATS_SECT_START(adcmon)
+STATS_SECT_ENTRY(blocks)
+STATS_SECT_ENTRY(overruns)
+STATS_SECT_ENTRY(cyc_per_ks)
+STATS_SECT_ENTRY(us_per_ks)
+STATS_SECT_ENTRY(load_ppm)
+STATS_SECT_END;
+
+STATS_NAME_START(adcmon)
+STATS_NAME(adcmon, blocks)
+STATS_NAME(adcmon, overruns)
+STATS_NAME(adcmon, cyc_per_ks)
+STATS_NAME(adcmon, us_per_ks)
+STATS_NAME(adcmon, load_ppm)
+STATS_NAME_END(adcmon);
+
+static STATS_SECT_DECL(adcmon) adcmon_stats_;
+
+STATS_SECT_START(adcmon_chan)
+STATS_SECT_ENTRY(windows)
+STATS_SECT_ENTRY(min_mv)
+STATS_SECT_ENTRY(max_mv)
+STATS_SECT_ENTRY(mean_mv)
+STATS_SECT_ENTRY(rms_mv)
+STATS_SECT_END;
+
+STATS_NAME_START(adcmon_chan)
+STATS_NAME(adcmon_chan, windows)
+STATS_NAME(adcmon_chan, min_mv)
+STATS_NAME(adcmon_chan, max_mv)
+STATS_NAME(adcmon_chan, mean_mv)
+STATS_NAME(adcmon_chan, rms_mv)
+STATS_NAME_END(adcmon_chan);
+#endif /* defined(CONFIG_ADCMON_STATS) */
+
+struct adcmon_chan {
+	/* The last ADCMON_TAPS - 1 inputs followed by the block being
+	 * filtered, laid out as arm_fir_decimate_q15() keeps them.
+	 */
+	q15_t state[ADCMON_TAPS + ADCMON_BLOCK - 1];
+#if defined(CONFIG_ADCMON_CMSIS_DSP)
+	arm_fir_decimate_instance_q15 fir;
+#endif
+	/* Index of the channel within a scan, which is in channel ID order. */
+	uint8_t pos;
+	uint16_t vref_mv;
+
+	/* Window being aggregated, in Q15 of the reference voltage. */
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+	uint64_t sum_sq;
+	uint32_t count;
+
+	/* Last completed window, under lock_. */
+	struct adcmon_window last;
+
+#if defined(CONFIG_ADCMON_STATS)
+	STATS_SECT_DECL(adcmon_chan) stats;
+	char stats_name[sizeof("adcmon0")];
+	bool registered;
+#endif
+};
+
+/* Two cascaded moving averages of ADCMON_DECIMATION samples, in Q15. */
+static q15_t coeffs_[ADCMON_TAPS];
+
+/* Both halves, each ADCMON_BLOCK scans of all channels. */
+static int16_t buf_[2 * ADCMON_BLOCK * CONFIG_ADCMON_MAX_CHANNELS];
+/* One channel of a half, and its decimated samples. */
+static q15_t in_[ADCMON_BLOCK];
+static q15_t out_[ADCMON_OUT_BLOCK];
+
+static struct adcmon_chan chans_[CONFIG_ADCMON_MAX_CHANNELS];
+static size_t nchans_;
+/* From the ADC resolution to Q15. */
+static uint8_t shift_;
+/* Whether the filter state holds earlier inputs. */
+static bool primed_;
+static adcmon_window_cb_t cb_;
+static void *cb_data_;
+
+static struct adc_sequence_options options_;
+static struct adc_sequence sequence_;
+static const struct device *adc_;
+/* Raised when a sequence ends. */
+static struct k_poll_signal done_;
+
+/* Halves filled and not processed yet, one bit each. */
+static atomic_t filled_;
+static atomic_t stopping_;
+static atomic_t overruns_;
+static bool running_;
+static K_MUTEX_DEFINE(mutex_);
+
+/* Load accounting and the last windows. */
+static struct k_spinlock lock_;
+static uint64_t samples_;
+static uint64_t cycles_;
+static uint32_t blocks_;
+
+static void block_work_handler(struct k_work *work);
+static K_WORK_DEFINE(block_work_, block_work_handler);
+
+static void coeffs_init(void)
+{
+	/* 1, 2, .. N, .. 2, 1 over N^2, which is exact in Q15 for a power of
+	 * two N up to 64 and sums to unity gain.
+	 */
+	for (int k = 0; k < ADCMON_TAPS; k++) {
+		int h = k < ADCMON_DECIMATION ? k + 1 : ADCMON_TAPS - k;
+
+		coeffs_[k] = h * (32768 / (ADCMON_DECIMATION * ADCMON_DECIMATION));
+	}
+}
+
+static void decimate(struct adcmon_chan *chan)
+{
+#if defined(CONFIG_ADCMON_CMSIS_DSP)
+	arm_fir_decimate_q15(&chan->fir, in_, out_, ADCMON_BLOCK);
+#else
+	/* Same arithmetic as arm_fir_decimate_q15(): a 64-bit accumulator,
+	 * shifted back to Q15 and saturated.
+	 */
+	q15_t *state = chan->state;
+
+	memcpy(&state[ADCMON_TAPS - 1], in_, sizeof(in_));
+	for (int i = 0; i < ADCMON_OUT_BLOCK; i++) {
+		const q15_t *x = &state[i * ADCMON_DECIMATION];
+		int64_t acc = 0;
+
+		for (int k = 0; k < ADCMON_TAPS; k++) {
+			acc += (int32_t)x[k] * coeffs_[k];
+		}
+		out_[i] = (q15_t)CLAMP(acc >> 15, INT16_MIN, INT16_MAX);
+	}
+	memmove(state, &state[ADCMON_BLOCK], (ADCMON_TAPS - 1) * sizeof(q15_t));
+#endif
+}
+
+static uint32_t isqrt(uint32_t v)
+{
+	uint32_t bit = 1U << 30;
+	uint32_t res = 0;
+
+	while (bit > v) {
+		bit >>= 2;
+	}
+	while (bit != 0) {
+		if (v >= res + bit) {
+			v -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+	return res;
+}
+
+static int32_t q15_mv(const struct adcmon_chan *chan, int64_t q)
+{
+	return (int32_t)((q * chan->vref_mv + (1 << 14)) >> 15);
+}
+
+static void window_done(size_t idx, struct adcmon_chan *chan)
+{
+	struct adcmon_window window = {
+		.min_mv = q15_mv(chan, chan->min),
+		.max_mv = q15_mv(chan, chan->max),
+		.mean_mv = q15_mv(chan, chan->sum / chan->count),
+		.rms_mv = q15_mv(chan, isqrt((uint32_t)(chan->sum_sq / chan->count))),
+	};
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+
+	window.seq = chan->last.seq + 1;
+	chan->last = window;
+	k_spin_unlock(&lock_, key);
+	chan->count = 0;
+
+#if defined(CONFIG_ADCMON_STATS)
+	STATS_INC(chan->stats, windows);
+	STATS_SET(chan->stats, min_mv, (uint32_t)window.min_mv);
+	STATS_SET(chan->stats, max_mv, (uint32_t)window.max_mv);
+	STATS_SET(chan->stats, mean_mv, (uint32_t)window.mean_mv);
+	STATS_SET(chan->stats, rms_mv, (uint32_t)window.rms_mv);
+#endif
+
+	if (cb_ != NULL) {
+		cb_(idx, &window, cb_data_);
+	}
+}
+
+static void window_add(size_t idx, struct adcmon_chan *chan, q15_t v)
+{
+	if (chan->count == 0) {
+		chan->min = v;
+		chan->max = v;
+		chan->sum = 0;
+		chan->sum_sq = 0;
+	} else {
+		chan->min = MIN(chan->min, v);
+		chan->max = MAX(chan->max, v);
+	}
+	chan->sum += v;
+	chan->sum_sq += (uint32_t)((int32_t)v * v);
+	chan->count++;
+
+	if (chan->count == CONFIG_ADCMON_WINDOW) {
+		window_done(idx, chan);
+	}
+}
+
+static void load_get(struct adcmon_load *load)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+	uint64_t samples = samples_;
+	uint64_t cycles = cycles_;
+
+	*load = (struct adcmon_load){
+		.samples = samples,
+		.blocks = blocks_,
+		.overruns = (uint32_t)atomic_get(&overruns_),
+	};
+	k_spin_unlock(&lock_, key);
+
+	if (samples == 0) {
+		return;
+	}
+	load->cycles_per_ksample = (uint32_t)(cycles * 1000 / samples);
+	load->us_per_ksample = (uint32_t)k_cyc_to_us_floor64(cycles * 1000 / samples);
+	/* Microseconds of processing per second of sampling. */
+	load->load_ppm = (uint32_t)k_cyc_to_us_floor64(cycles * CONFIG_ADCMON_RATE_HZ *
+						       nchans_ / samples);
+}
+
+static void process_half(int half)
+{
+	const int16_t *block = &buf_[half * ADCMON_BLOCK * nchans_];
+	uint32_t start = k_cycle_get_32();
+	k_spinlock_key_t key;
+
+	for (size_t c = 0; c < nchans_; c++) {
+		struct adcmon_chan *chan = &chans_[c];
+
+		for (int s = 0; s < ADCMON_BLOCK; s++) {
+			in_[s] = block[s * nchans_ + chan->pos] << shift_;
+		}
+		/* Start from the first input rather than from zero, so the
+		 * first window has no step response in it.
+		 */
+		if (!primed_) {
+			for (int k = 0; k < ADCMON_TAPS - 1; k++) {
+				chan->state[k] = in_[0];
+			}
+		}
+		decimate(chan);
+		for (int o = 0; o < ADCMON_OUT_BLOCK; o++) {
+			window_add(c, chan, out_[o]);
+		}
+	}
+	primed_ = true;
+
+	key = k_spin_lock(&lock_);
+	cycles_ += k_cycle_get_32() - start;
+	samples_ += ADCMON_BLOCK * nchans_;
+	blocks_++;
+	k_spin_unlock(&lock_, key);
+
+#if defined(CONFIG_ADCMON_STATS)
+	struct adcmon_load load;
+
+	load_get(&load);
+	STATS_SET(adcmon_stats_, blocks, load.blocks);
+	STATS_SET(adcmon_stats_, overruns, load.overruns);
+	STATS_SET(adcmon_stats_, cyc_per_ks, load.cycles_per_ksample);
+	STATS_SET(adcmon_stats_, us_per_ks, load.us_per_ksample);
+	STATS_SET(adcmon_stats_, load_ppm, load.load_ppm);
+#endif
+}
+
+/* Runs after every scan, in the context the ADC driver completes it in. */
+static enum adc_action sampling_done(const struct device *dev,
+				     const struct adc_sequence *sequence,
+				     uint16_t sampling_index)
+{
+	if ((sampling_index + 1) % ADCMON_BLOCK == 0) {
+		int half = sampling_index / ADCMON_BLOCK;
+
+		if (atomic_test_and_set_bit(&filled_, half)) {
+			atomic_inc(&overruns_);
+		}
+		k_work_submit(&block_work_);
+	}
+	return atomic_get(&stopping_) ? ADC_ACTION_FINISH : ADC_ACTION_CONTINUE;
+}
+
+static void sequence_start(void)
+{
+	int ret;
+
+	if (atomic_get(&stopping_)) {
+		return;
+	}
+	k_poll_signal_reset(&done_);
+	ret = adc_read_async(adc_, &sequence_, &done_);
+	if (ret < 0) {
+		LOG_ERR("Starting the ADC sequence failed: %d", ret);
+		k_poll_signal_raise(&done_, ret);
+	}
+}
+
+static void block_work_handler(struct k_work *work)
+{
+	if (atomic_test_bit(&filled_, 0)) {
+		process_half(0);
+		atomic_clear_bit(&filled_, 0);
+	}
+	if (atomic_test_bit(&filled_, 1)) {
+		/* The sequence ended with the second half; the next one fills
+		 * the first half while this one is processed.
+		 */
+		sequence_start();
+		process_half(1);
+		atomic_clear_bit(&filled_, 1);
+	}
+}
+
+#if defined(CONFIG_ADCMON_STATS)
+static void stats_register(void)
+{
+	static bool registered;
+
+	if (!registered) {
+		registered = true;
+		STATS_INIT_AND_REG(adcmon_stats_, STATS_SIZE_32, "adcmon");
+	}
+	for (size_t c = 0; c < nchans_; c++) {
+		struct adcmon_chan *chan = &chans_[c];
+
+		if (chan->registered) {
+			continue;
+		}
+		chan->registered = true;
+		snprintf(chan->stats_name, sizeof(chan->stats_name), "adcmon%u", (unsigned int)c);
+		stats_init_and_reg(&chan->stats.s_hdr, STATS_SIZE_32,
+				   (sizeof(chan->stats) - sizeof(struct stats_hdr)) / STATS_SIZE_32,
+				   STATS_NAME_INIT_PARMS(adcmon_chan), chan->stats_name);
+	}
+}
+#endif
+
+static int channels_setup(const struct adc_dt_spec *channels, size_t count)
+{
+	uint32_t mask = 0;
+	int ret;
+
+	if (count == 0 || count > CONFIG_ADCMON_MAX_CHANNELS) {
+		return -EINVAL;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (channels[i].dev != channels[0].dev ||
+		    channels[i].resolution != channels[0].resolution ||
+		    (mask & BIT(channels[i].channel_id)) != 0) {
+			return -EINVAL;
+		}
+		mask |= BIT(channels[i].channel_id);
+	}
+	if (channels[0].resolution == 0 || channels[0].resolution > 15) {
+		return -ENOTSUP;
+	}
+	if (!device_is_ready(channels[0].dev)) {
+		return -ENODEV;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		const struct adc_dt_spec *spec = &channels[i];
+		struct adcmon_chan *chan = &chans_[i];
+
+		ret = adc_channel_setup_dt(spec);
+		if (ret < 0) {
+			return ret;
+		}
+
+		chan->vref_mv = spec->channel_cfg.reference == ADC_REF_INTERNAL ?
+				adc_ref_internal(spec->dev) : spec->vref_mv;
+		if (chan->vref_mv == 0) {
+			return -ENOTSUP;
+		}
+		chan->pos = __builtin_popcount(mask & (BIT(spec->channel_id) - 1));
+		chan->count = 0;
+		chan->last = (struct adcmon_window){ 0 };
+		memset(chan->state, 0, sizeof(chan->state));
+#if defined(CONFIG_ADCMON_CMSIS_DSP)
+		arm_fir_decimate_init_q15(&chan->fir, ADCMON_TAPS, ADCMON_DECIMATION, coeffs_,
+					  chan->state, ADCMON_BLOCK);
+#endif
+	}
+
+	adc_ = channels[0].dev;
+	nchans_ = count;
+	shift_ = 15 - channels[0].resolution;
+	options_ = (struct adc_sequence_options){
+		.interval_us = USEC_PER_SEC / CONFIG_ADCMON_RATE_HZ,
+		.callback = sampling_done,
+		.extra_samplings = 2 * ADCMON_BLOCK - 1,
+	};
+	sequence_ = (struct adc_sequence){
+		.options = &options_,
+		.channels = mask,
+		.buffer = buf_,
+		.buffer_size = 2 * ADCMON_BLOCK * count * sizeof(buf_[0]),
+		.resolution = channels[0].resolution,
+		.oversampling = channels[0].oversampling,
+	};
+	return 0;
+}
+
+int adcmon_start(const struct adc_dt_spec *channels, size_t count, adcmon_window_cb_t cb,
+		 void *user_data)
+{
+	k_spinlock_key_t key;
+	int ret;
+
+	k_mutex_lock(&mutex_, K_FOREVER);
+	if (running_) {
+		ret = -EALREADY;
+		goto out;
+	}
+
+	coeffs_init();
+	ret = channels_setup(channels, count);
+	if (ret < 0) {
+		goto out;
+	}
+#if defined(CONFIG_ADCMON_STATS)
+	stats_register();
+#endif
+
+	cb_ = cb;
+	cb_data_ = user_data;
+	primed_ = false;
+	atomic_clear(&filled_);
+	atomic_clear(&stopping_);
+	atomic_clear(&overruns_);
+	key = k_spin_lock(&lock_);
+	samples_ = 0;
+	cycles_ = 0;
+	blocks_ = 0;
+	k_spin_unlock(&lock_, key);
+
+	k_poll_signal_init(&done_);
+	ret = adc_read_async(adc_, &sequence_, &done_);
+	if (ret < 0) {
+		LOG_ERR("Starting the ADC sequence failed: %d", ret);
+		goto out;
+	}
+	running_ = true;
+out:
+	k_mutex_unlock(&mutex_);
+	return ret;
+}
+
+int adcmon_stop(void)
+{
+	struct k_poll_event event =
+		K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &done_);
+	struct k_work_sync sync;
+	int ret = 0;
+
+	k_mutex_lock(&mutex_, K_FOREVER);
+	if (!running_) {
+		ret = -EALREADY;
+		goto out;
+	}
+
+	/* Once the work item has seen this it starts no new sequence, and the
+	 * running one ends at its next scan.
+	 */
+	atomic_set(&stopping_, 1);
+	k_work_flush(&block_work_, &sync);
+	if (k_poll(&event, 1, K_MSEC(100 + 2 * MSEC_PER_SEC / CONFIG_ADCMON_RATE_HZ)) != 0) {
+		LOG_WRN("ADC sequence did not end");
+		ret = -ETIMEDOUT;
+	}
+	/* Process what the last sequence handed over. */
+	k_work_flush(&block_work_, &sync);
+	running_ = false;
+out:
+	k_mutex_unlock(&mutex_);
+	return ret;
+}
+
+int adcmon_window_get(size_t channel, struct adcmon_window *window)
+{
+	k_spinlock_key_t key;
+	int ret = 0;
+
+	if (channel >= nchans_) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&lock_);
+	*window = chans_[channel].last;
+	k_spin_unlock(&lock_, key);
+	if (window->seq == 0) {
+		ret = -ENODATA;
+	}
+	return ret;
+}
+
+void adcmon_load_get(struct adcmon_load *load)
+{
+	load_get(load);
+}
+
+#if defined(CONFIG_ADCMON_SHELL)
+static int cmd_adcmon(const struct shell *sh, size_t argc, char **argv)
+{
+	struct adcmon_window window;
+	struct adcmon_load load;
+
+	adcmon_load_get(&load);
+	shell_print(sh, "%u Hz, decimation %u, window %u, %s", CONFIG_ADCMON_RATE_HZ,
+		    ADCMON_DECIMATION, CONFIG_ADCMON_WINDOW, running_ ? "running" : "stopped");
+	shell_print(sh, "%-4s %8s %8s %8s %8s %8s", "ch", "windows", "min_mv", "max_mv",
+		    "mean_mv", "rms_mv");
+	for (size_t c = 0; c < nchans_; c++) {
+		if (adcmon_window_get(c, &window) < 0) {
+			shell_print(sh, "%-4u %8u", (unsigned int)c, 0);
+			continue;
+		}
+		shell_print(sh, "%-4u %8u %8d %8d %8d %8d", (unsigned int)c, window.seq,
+			    window.min_mv, window.max_mv, window.mean_mv, window.rms_mv);
+	}
+	shell_print(sh, "samples: %llu, blocks: %u, overruns: %u",
+		    (unsigned long long)load.samples, load.blocks, load.overruns);
+	shell_print(sh, "per 1000 samples: %u cycles, %u us; load: %u ppm",
+		    load.cycles_per_ksample, load.us_per_ksample, load.load_ppm);
+	return 0;
+}
+
+SHELL_CMD_REGISTER(adcmon, NULL, "Show ADC monitor windows and processing load", cmd_adcmon);
+#endif /* defined(CONFIG_ADCMON_SHELL) */
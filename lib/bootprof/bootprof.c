@@ -0,0 +1,151 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/shell/shell.h>
+#include <string.h>
+
+#include <bootprof/bootprof.h>
+
+#define BOOTPROF_MAGIC 0x424f4f54 /* "BOOT" */
+
+struct bootprof_record {
+	uint32_t magic;
+	uint32_t count;
+	uint32_t complete;
+	struct bootprof_mark marks[CONFIG_BOOTPROF_MARKS];
+	/* Over everything above; catches RAM clobbered by the bootloader. */
+	uint32_t check;
+};
+
+/* [0] is this boot, [1] the previous one. */
+static __noinit struct bootprof_record records_[2];
+
+static uint32_t record_check(const struct bootprof_record *record)
+{
+	const uint32_t *words = (const uint32_t *)record;
+	uint32_t check = 0;
+
+	for (size_t i = 0; i < offsetof(struct bootprof_record, check) / sizeof(uint32_t); i++) {
+		check = (check << 1 | check >> 31) ^ words[i];
+	}
+	return check;
+}
+
+static bool record_valid(const struct bootprof_record *record)
+{
+	return record->magic == BOOTPROF_MAGIC && record->count <= CONFIG_BOOTPROF_MARKS &&
+	       record->check == record_check(record);
+}
+
+void bootprof_mark(const char *name)
+{
+	struct bootprof_record *record = &records_[0];
+	uint32_t us = (uint32_t)MIN(k_ticks_to_us_floor64(k_uptime_ticks()), UINT32_MAX);
+	unsigned int key = irq_lock();
+
+	if (record->magic == BOOTPROF_MAGIC && !record->complete &&
+	    record->count < CONFIG_BOOTPROF_MARKS) {
+		struct bootprof_mark *mark = &record->marks[record->count++];
+
+		mark->us = us;
+		strncpy(mark->name, name, sizeof(mark->name) - 1);
+		mark->name[sizeof(mark->name) - 1] = '\0';
+		record->check = record_check(record);
+	}
+	irq_unlock(key);
+}
+
+void bootprof_done(void)
+{
+	bootprof_mark("done");
+
+	unsigned int key = irq_lock();
+
+	records_[0].complete = 1;
+	records_[0].check = record_check(&records_[0]);
+	irq_unlock(key);
+}
+
+size_t bootprof_get(bool previous, const struct bootprof_mark **marks, bool *complete)
+{
+	const struct bootprof_record *record = &records_[previous ? 1 : 0];
+
+	if (!record_valid(record)) {
+		return 0;
+	}
+	*marks = record->marks;
+	if (complete != NULL) {
+		*complete = record->complete;
+	}
+	return record->count;
+}
+
+static int bootprof_start(void)
+{
+	/* Keep the previous boot's record before starting this one. */
+	if (record_valid(&records_[0])) {
+		records_[1] = records_[0];
+	} else {
+		memset(&records_[1], 0, sizeof(records_[1]));
+	}
+
+	memset(&records_[0], 0, sizeof(records_[0]));
+	records_[0].magic = BOOTPROF_MAGIC;
+	bootprof_mark("pre_kernel1");
+	return 0;
+}
+
+static int bootprof_pre_kernel_2(void)
+{
+	bootprof_mark("pre_kernel2");
+	return 0;
+}
+
+static int bootprof_post_kernel(void)
+{
+	bootprof_mark("post_kernel");
+	return 0;
+}
+
+static int bootprof_application(void)
+{
+	bootprof_mark("application");
+	return 0;
+}
+
+SYS_INIT(bootprof_start, PRE_KERNEL_1, 0);
+SYS_INIT(bootprof_pre_kernel_2, PRE_KERNEL_2, 0);
+SYS_INIT(bootprof_post_kernel, POST_KERNEL, 0);
+SYS_INIT(bootprof_application, APPLICATION, 0);
+
+#if defined(CONFIG_BOOTPROF_SHELL)
+static void print_record(const struct shell *sh, bool previous)
+{
+	const struct bootprof_mark *marks;
+	bool complete;
+	size_t count = bootprof_get(previous, &marks, &complete);
+
+	shell_print(sh, "%s boot%s:", previous ? "previous" : "this",
+		    count == 0 ? " (no record)" : complete ? "" : " (incomplete)");
+	for (size_t i = 0; i < count; i++) {
+		uint32_t delta = i + 1 < count ? marks[i + 1].us - marks[i].us : 0;
+
+		shell_print(sh, "  %-12s %8u.%03u ms  +%u.%03u ms", marks[i].name,
+			    marks[i].us / 1000, marks[i].us % 1000, delta / 1000, delta % 1000);
+	}
+}
+
+static int cmd_bootprof(const struct shell *sh, size_t argc, char **argv)
+{
+	print_record(sh, false);
+	print_record(sh, true);
+	return 0;
+}
+
+SHELL_CMD_REGISTER(bootprof, NULL, "Show the boot phase profile of this and the previous boot",
+		   cmd_bootprof);
+#endif /* defined(CONFIG_BOOTPROF_SHELL) */
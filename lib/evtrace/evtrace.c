@@ -0,0 +1,170 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include <evtrace/evtrace.h>
+
+#define EVTRACE_MASK (CONFIG_EVTRACE_ENTRIES - 1)
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_EVTRACE_ENTRIES),
+	     "CONFIG_EVTRACE_ENTRIES must be a power of two");
+BUILD_ASSERT(sizeof(struct evtrace_entry) == 16);
+
+static struct evtrace_entry ring_[CONFIG_EVTRACE_ENTRIES];
+/* Index of the next entry to write; only ever incremented. */
+static atomic_t head_;
+/* Value of head_ at the last clear. */
+static atomic_t base_;
+static bool enabled_ = IS_ENABLED(CONFIG_EVTRACE_ENABLED_AT_BOOT);
+
+void evtrace_record(uint8_t id, uint16_t arg0, uint32_t arg1)
+{
+	struct evtrace_entry *entry;
+	uint32_t idx;
+
+	if (!enabled_) {
+		return;
+	}
+
+	idx = (uint32_t)atomic_inc(&head_);
+	entry = &ring_[idx & EVTRACE_MASK];
+
+	/* Odd, so a reader can tell it from any completed entry, seqlock
+	 * style, and from the entry of the last lap this one replaces.
+	 */
+	entry->seq = evtrace_seq_done(idx) | 1;
+	compiler_barrier();
+	entry->cycles = k_cycle_get_32();
+	entry->thread = k_is_in_isr() ? 0 : (uint32_t)(uintptr_t)k_current_get();
+	entry->arg1 = arg1;
+	entry->arg0 = arg0;
+	entry->id = id;
+	compiler_barrier();
+	entry->seq = evtrace_seq_done(idx);
+}
+
+void evtrace_enable(bool enable)
+{
+	enabled_ = enable;
+}
+
+void evtrace_clear(void)
+{
+	atomic_set(&base_, atomic_get(&head_));
+}
+
+/* Range of indices currently held by the ring. */
+static uint32_t ring_range(uint32_t *start, uint32_t *dropped)
+{
+	uint32_t head = (uint32_t)atomic_get(&head_);
+	uint32_t base = (uint32_t)atomic_get(&base_);
+	uint32_t count = MIN(head - base, CONFIG_EVTRACE_ENTRIES);
+
+	*start = head - count;
+	if (dropped != NULL) {
+		*dropped = *start - base;
+	}
+	return head;
+}
+
+static bool entry_get(uint32_t idx, struct evtrace_entry *out)
+{
+	const struct evtrace_entry *entry = &ring_[idx & EVTRACE_MASK];
+	uint8_t seq = entry->seq;
+
+	compiler_barrier();
+	*out = *entry;
+	compiler_barrier();
+	return evtrace_seq_valid(idx, seq, entry->seq) && out->id != EVTRACE_NONE;
+}
+
+size_t evtrace_copy(struct evtrace_entry *out, size_t max, uint32_t *dropped)
+{
+	uint32_t start;
+	uint32_t head = ring_range(&start, dropped);
+	size_t count = 0;
+
+	for (uint32_t idx = start; idx != head && count < max; idx++) {
+		if (entry_get(idx, &out[count])) {
+			count++;
+		}
+	}
+	return count;
+}
+
+#if defined(CONFIG_EVTRACE_SHELL)
+#if defined(CONFIG_THREAD_MONITOR) && defined(CONFIG_THREAD_NAME)
+static void dump_thread(const struct k_thread *thread, void *user_data)
+{
+	const struct shell *sh = user_data;
+	const char *name = k_thread_name_get((k_tid_t)thread);
+
+	shell_print(sh, "evtrace-thread: %08x %s", (uint32_t)(uintptr_t)thread,
+		    name != NULL ? name : "");
+}
+#endif
+
+static int cmd_evtrace_dump(const struct shell *sh, size_t argc, char **argv)
+{
+	bool was_enabled = enabled_;
+	struct evtrace_entry entry;
+	uint32_t dropped;
+	uint32_t start;
+	uint32_t head;
+
+	/* Printing is slow; don't let the ring wrap under us. */
+	enabled_ = false;
+	head = ring_range(&start, &dropped);
+
+	shell_print(sh, "evtrace: v1 hz=%u entries=%u dropped=%u",
+		    sys_clock_hw_cycles_per_sec(), head - start, dropped);
+#if defined(CONFIG_THREAD_MONITOR) && defined(CONFIG_THREAD_NAME)
+	k_thread_foreach_unlocked(dump_thread, (void *)sh);
+#endif
+	for (uint32_t idx = start; idx != head; idx++) {
+		if (!entry_get(idx, &entry)) {
+			continue;
+		}
+		shell_print(sh, "evtrace-e: %08x %08x %02x %04x %08x", entry.cycles,
+			    entry.thread, entry.id, entry.arg0, entry.arg1);
+	}
+	shell_print(sh, "evtrace: end");
+
+	enabled_ = was_enabled;
+	return 0;
+}
+
+static int cmd_evtrace_clear(const struct shell *sh, size_t argc, char **argv)
+{
+	evtrace_clear();
+	return 0;
+}
+
+static int cmd_evtrace_on(const struct shell *sh, size_t argc, char **argv)
+{
+	evtrace_enable(true);
+	return 0;
+}
+
+static int cmd_evtrace_off(const struct shell *sh, size_t argc, char **argv)
+{
+	evtrace_enable(false);
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_evtrace,
+	SHELL_CMD(dump, NULL, "Print the ring for scripts/evtrace_to_chrome.py",
+		  cmd_evtrace_dump),
+	SHELL_CMD(clear, NULL, "Discard recorded events", cmd_evtrace_clear),
+	SHELL_CMD(on, NULL, "Resume recording", cmd_evtrace_on),
+	SHELL_CMD(off, NULL, "Pause recording", cmd_evtrace_off),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(evtrace, &sub_evtrace, "Binary event trace", NULL);
+#endif /* defined(CONFIG_EVTRACE_SHELL) */
@@ -0,0 +1,522 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/sys/util.h>
+
+#include <metricagg/metricagg.h>
+
+#define METRICAGG_QUANTILES 3
+/* Markers of the P-square estimator of one quantile. */
+#define P2_MARKERS 5
+
+#if defined(CONFIG_METRICAGG_STATS)
+STATS_SECT_START(metricagg)
+STATS_SECT_ENTRY(samples)
+STATS_SECT_ENTRY(summaries)
+STATS_SECT_ENTRY(events)
+/* Summaries and events dropped from a full queue before being reported. */
+STATS_SECT_ENTRY(dropped)
+STATS_SECT_END;
+
+STATS_NAME_START(metricagg)
+STATS_NAME(metricagg, samples)
+STATS_NAME(metricagg, summaries)
+STATS_NAME(metricagg, events)
+STATS_NAME(metricagg, dropped)
+STATS_NAME_END(metricagg);
+
+static STATS_SECT_DECL(metricagg) metricagg_stats_;
+#endif /* defined(CONFIG_METRICAGG_STATS) */
+
+/* P-square estimate of one quantile (Jain and Chlamtac, 1985). The first
+ * five samples are kept sorted in the heights; from then on the markers
+ * are moved towards their desired positions as samples come in.
+ */
+struct p2 {
+	float height[P2_MARKERS];
+	float desired[P2_MARKERS];
+	int32_t pos[P2_MARKERS];
+};
+
+struct metric {
+	bool open;
+	int64_t start_ms;
+	uint32_t window_ms;
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+	/* Running mean and sum of squared deviations, after Welford. */
+	float mean;
+	float m2;
+	struct p2 quantiles[METRICAGG_QUANTILES];
+
+	/* The previous sample, for rate rules; kept across windows. */
+	bool has_last;
+	int32_t last;
+	int64_t last_ms;
+};
+
+/* Sequence numbers, from 1, of the next entry and of the last one acked.
+ * Entries after the acked one are queued.
+ */
+struct queue {
+	uint32_t next;
+	uint32_t acked;
+};
+
+static const float quantile_p_[METRICAGG_QUANTILES] = { 0.5f, 0.9f, 0.99f };
+
+static struct metric metrics_[CONFIG_METRICAGG_METRICS];
+static struct metricagg_rule rules_[CONFIG_METRICAGG_RULES];
+static bool rule_active_[CONFIG_METRICAGG_RULES];
+static size_t rule_count_;
+static uint32_t window_ms_ = CONFIG_METRICAGG_WINDOW_S * MSEC_PER_SEC;
+static uint32_t config_id_;
+
+static struct metricagg_summary summaries_[CONFIG_METRICAGG_QUEUE];
+static struct queue summary_queue_ = { .next = 1 };
+static struct metricagg_event events_[CONFIG_METRICAGG_QUEUE];
+static struct queue event_queue_ = { .next = 1 };
+
+static metricagg_notify_t notify_;
+static struct k_spinlock lock_;
+
+static uint32_t queue_push(struct queue *queue)
+{
+	if (queue->next - queue->acked > CONFIG_METRICAGG_QUEUE) {
+		queue->acked++;
+#if defined(CONFIG_METRICAGG_STATS)
+		STATS_INC(metricagg_stats_, dropped);
+#endif
+	}
+	return queue->next++ % CONFIG_METRICAGG_QUEUE;
+}
+
+static void p2_add(struct p2 *p2, float p, uint32_t n, float x)
+{
+	const float increment[P2_MARKERS] = { 0.0f, p / 2, p, (1 + p) / 2, 1.0f };
+	float *h = p2->height;
+	int32_t *pos = p2->pos;
+	int k;
+
+	/* Samples before this one. */
+	if (n < P2_MARKERS) {
+		int i = n;
+
+		for (; i > 0 && h[i - 1] > x; i--) {
+			h[i] = h[i - 1];
+		}
+		h[i] = x;
+		if (n == P2_MARKERS - 1) {
+			for (i = 0; i < P2_MARKERS; i++) {
+				pos[i] = i;
+				p2->desired[i] = 4 * increment[i];
+			}
+		}
+		return;
+	}
+
+	/* Find the cell of x, stretching the extremes if it is outside. */
+	if (x < h[0]) {
+		h[0] = x;
+		k = 0;
+	} else if (x >= h[4]) {
+		h[4] = x;
+		k = 3;
+	} else {
+		for (k = 0; k < 3 && x >= h[k + 1]; k++) {
+		}
+	}
+	for (int i = k + 1; i < P2_MARKERS; i++) {
+		pos[i]++;
+	}
+	for (int i = 0; i < P2_MARKERS; i++) {
+		p2->desired[i] += increment[i];
+	}
+
+	/* Move the middle markers by one where they are a position or more
+	 * off, along the parabola through their neighbours, or linearly if
+	 * that would pass one of them.
+	 */
+	for (int i = 1; i < P2_MARKERS - 1; i++) {
+		float d = p2->desired[i] - pos[i];
+		int s;
+		float hp;
+
+		if (!((d >= 1.0f && pos[i + 1] - pos[i] > 1) ||
+		      (d <= -1.0f && pos[i - 1] - pos[i] < -1))) {
+			continue;
+		}
+		s = d > 0 ? 1 : -1;
+		hp = h[i] + (float)s / (pos[i + 1] - pos[i - 1]) *
+			((pos[i] - pos[i - 1] + s) * (h[i + 1] - h[i]) / (pos[i + 1] - pos[i]) +
+			 (pos[i + 1] - pos[i] - s) * (h[i] - h[i - 1]) / (pos[i] - pos[i - 1]));
+		if (h[i - 1] < hp && hp < h[i + 1]) {
+			h[i] = hp;
+		} else {
+			h[i] += s * (h[i + s] - h[i]) / (pos[i + s] - pos[i]);
+		}
+		pos[i] += s;
+	}
+}
+
+static int32_t p2_get(const struct p2 *p2, float p, uint32_t n)
+{
+	if (n >= P2_MARKERS) {
+		return (int32_t)(p2->height[2] + (p2->height[2] >= 0 ? 0.5f : -0.5f));
+	}
+	/* Nearest rank of the sorted samples, the smallest one covering p. */
+	for (uint32_t rank = 1; rank < n; rank++) {
+		if (rank >= n * p) {
+			return (int32_t)p2->height[rank - 1];
+		}
+	}
+	return (int32_t)p2->height[n - 1];
+}
+
+static uint32_t isqrt64(uint64_t v)
+{
+	uint64_t bit = 1ULL << 62;
+	uint64_t res = 0;
+
+	while (bit > v) {
+		bit >>= 2;
+	}
+	while (bit != 0) {
+		if (v >= res + bit) {
+			v -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t)res;
+}
+
+static void window_close(uint8_t idx, struct metric *metric)
+{
+	struct metricagg_summary *summary = &summaries_[queue_push(&summary_queue_)];
+
+	*summary = (struct metricagg_summary){
+		.metric = idx,
+		.end_ms = metric->start_ms + metric->window_ms,
+		.duration_ms = metric->window_ms,
+		.count = metric->count,
+		.min = metric->min,
+		.max = metric->max,
+		.mean = (int32_t)(metric->sum / metric->count),
+		.stddev = isqrt64((uint64_t)(metric->m2 / metric->count + 0.5f)),
+		.p50 = p2_get(&metric->quantiles[0], quantile_p_[0], metric->count),
+		.p90 = p2_get(&metric->quantiles[1], quantile_p_[1], metric->count),
+		.p99 = p2_get(&metric->quantiles[2], quantile_p_[2], metric->count),
+	};
+	metric->open = false;
+#if defined(CONFIG_METRICAGG_STATS)
+	STATS_INC(metricagg_stats_, summaries);
+#endif
+}
+
+static void window_add(struct metric *metric, int32_t value, int64_t uptime_ms)
+{
+	float delta;
+
+	if (!metric->open) {
+		metric->open = true;
+		metric->start_ms = uptime_ms;
+		metric->window_ms = window_ms_;
+		metric->count = 0;
+		metric->min = value;
+		metric->max = value;
+		metric->sum = 0;
+		metric->mean = 0.0f;
+		metric->m2 = 0.0f;
+	}
+
+	for (int q = 0; q < METRICAGG_QUANTILES; q++) {
+		p2_add(&metric->quantiles[q], quantile_p_[q], metric->count, value);
+	}
+	metric->count++;
+	metric->min = MIN(metric->min, value);
+	metric->max = MAX(metric->max, value);
+	metric->sum += value;
+	delta = value - metric->mean;
+	metric->mean += delta / metric->count;
+	metric->m2 += delta * (value - metric->mean);
+}
+
+static void event_queue(uint8_t metric, size_t rule, bool cleared, int32_t value,
+			int64_t uptime_ms)
+{
+	events_[queue_push(&event_queue_)] = (struct metricagg_event){
+		.metric = metric,
+		.rule = rule,
+		.cleared = cleared,
+		.value = value,
+		.uptime_ms = uptime_ms,
+	};
+#if defined(CONFIG_METRICAGG_STATS)
+	STATS_INC(metricagg_stats_, events);
+#endif
+}
+
+/* Returns true if an event was queued. */
+static bool rules_check(uint8_t idx, const struct metric *metric, int32_t value,
+			int64_t uptime_ms)
+{
+	bool queued = false;
+
+	for (size_t r = 0; r < rule_count_; r++) {
+		const struct metricagg_rule *rule = &rules_[r];
+		int64_t v = value;
+		bool fire;
+		bool clear;
+
+		if (rule->metric != idx) {
+			continue;
+		}
+		switch (rule->type) {
+		case METRICAGG_RULE_ABOVE:
+			fire = v > rule->threshold;
+			clear = v <= (int64_t)rule->threshold - rule->hysteresis;
+			break;
+		case METRICAGG_RULE_BELOW:
+			fire = v < rule->threshold;
+			clear = v >= (int64_t)rule->threshold + rule->hysteresis;
+			break;
+		case METRICAGG_RULE_RATE:
+			if (!metric->has_last || uptime_ms <= metric->last_ms) {
+				continue;
+			}
+			v = ((int64_t)value - metric->last) * MSEC_PER_SEC /
+			    (uptime_ms - metric->last_ms);
+			v = CLAMP(v, INT32_MIN, INT32_MAX);
+			fire = (v < 0 ? -v : v) > rule->threshold;
+			clear = (v < 0 ? -v : v) <= (int64_t)rule->threshold - rule->hysteresis;
+			break;
+		default:
+			continue;
+		}
+
+		if (!rule_active_[r] && fire) {
+			rule_active_[r] = true;
+			event_queue(idx, r, false, (int32_t)v, uptime_ms);
+			queued = true;
+		} else if (rule_active_[r] && clear) {
+			rule_active_[r] = false;
+			event_queue(idx, r, true, (int32_t)v, uptime_ms);
+			queued = true;
+		}
+	}
+	return queued;
+}
+
+void metricagg_init(metricagg_notify_t notify)
+{
+	notify_ = notify;
+#if defined(CONFIG_METRICAGG_STATS)
+	STATS_INIT_AND_REG(metricagg_stats_, STATS_SIZE_32, "metricagg");
+#endif
+}
+
+void metricagg_add(uint8_t metric, int32_t value)
+{
+	metricagg_add_at(metric, value, k_uptime_get());
+}
+
+void metricagg_add_at(uint8_t idx, int32_t value, int64_t uptime_ms)
+{
+	struct metric *metric;
+	bool queued = false;
+	k_spinlock_key_t key;
+
+	if (idx >= ARRAY_SIZE(metrics_)) {
+		return;
+	}
+	metric = &metrics_[idx];
+
+	key = k_spin_lock(&lock_);
+	if (metric->open && uptime_ms - metric->start_ms >= metric->window_ms) {
+		window_close(idx, metric);
+		queued = true;
+	}
+	window_add(metric, value, uptime_ms);
+	queued |= rules_check(idx, metric, value, uptime_ms);
+	metric->has_last = true;
+	metric->last = value;
+	metric->last_ms = uptime_ms;
+#if defined(CONFIG_METRICAGG_STATS)
+	STATS_INC(metricagg_stats_, samples);
+#endif
+	k_spin_unlock(&lock_, key);
+
+	if (queued && notify_ != NULL) {
+		notify_();
+	}
+}
+
+void metricagg_flush(int64_t uptime_ms)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+
+	for (size_t i = 0; i < ARRAY_SIZE(metrics_); i++) {
+		struct metric *metric = &metrics_[i];
+
+		if (metric->open && uptime_ms - metric->start_ms >= metric->window_ms) {
+			window_close(i, metric);
+		}
+	}
+	k_spin_unlock(&lock_, key);
+}
+
+int metricagg_configure(uint32_t id, uint32_t window_ms, const struct metricagg_rule *rules,
+			size_t count)
+{
+	k_spinlock_key_t key;
+
+	if (count > ARRAY_SIZE(rules_)) {
+		return -EINVAL;
+	}
+	for (size_t r = 0; r < count; r++) {
+		if (rules[r].metric >= ARRAY_SIZE(metrics_) ||
+		    rules[r].type == METRICAGG_RULE_NONE || rules[r].type > METRICAGG_RULE_RATE) {
+			return -EINVAL;
+		}
+	}
+
+	key = k_spin_lock(&lock_);
+	config_id_ = id;
+	window_ms_ = window_ms != 0 ? window_ms : CONFIG_METRICAGG_WINDOW_S * MSEC_PER_SEC;
+	if (count > 0) {
+		memcpy(rules_, rules, count * sizeof(rules[0]));
+	}
+	memset(rule_active_, 0, sizeof(rule_active_));
+	rule_count_ = count;
+	/* Queued events name rules by index, which now mean other rules. */
+	event_queue_.acked = event_queue_.next - 1;
+	k_spin_unlock(&lock_, key);
+	return 0;
+}
+
+uint32_t metricagg_config_id(void)
+{
+	return config_id_;
+}
+
+size_t metricagg_summaries_get(struct metricagg_summary *out, size_t max,
+			       struct metricagg_cursor *cursor)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+	size_t count = 0;
+
+	for (uint32_t s = summary_queue_.acked + 1; s != summary_queue_.next && count < max; s++) {
+		out[count++] = summaries_[s % CONFIG_METRICAGG_QUEUE];
+		cursor->summaries = s;
+	}
+	k_spin_unlock(&lock_, key);
+	return count;
+}
+
+size_t metricagg_events_get(struct metricagg_event *out, size_t max,
+			    struct metricagg_cursor *cursor)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+	size_t count = 0;
+
+	for (uint32_t s = event_queue_.acked + 1; s != event_queue_.next && count < max; s++) {
+		out[count++] = events_[s % CONFIG_METRICAGG_QUEUE];
+		cursor->events = s;
+	}
+	k_spin_unlock(&lock_, key);
+	return count;
+}
+
+void metricagg_ack(const struct metricagg_cursor *cursor)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+
+	summary_queue_.acked = MAX(summary_queue_.acked, cursor->summaries);
+	event_queue_.acked = MAX(event_queue_.acked, cursor->events);
+	k_spin_unlock(&lock_, key);
+}
+
+#if defined(CONFIG_METRICAGG_SHELL)
+static const char *const rule_names_[] = {
+	[METRICAGG_RULE_NONE] = "none",
+	[METRICAGG_RULE_ABOVE] = "above",
+	[METRICAGG_RULE_BELOW] = "below",
+	[METRICAGG_RULE_RATE] = "rate",
+};
+
+/* What the shell prints of a metric, without the quantile markers. */
+struct metric_view {
+	bool open;
+	int64_t start_ms;
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int32_t mean;
+};
+
+static int cmd_metricagg(const struct shell *sh, size_t argc, char **argv)
+{
+	struct metric_view metrics[CONFIG_METRICAGG_METRICS];
+	struct metricagg_rule rules[CONFIG_METRICAGG_RULES];
+	bool active[CONFIG_METRICAGG_RULES];
+	uint32_t summaries, events;
+	size_t rule_count;
+	uint32_t window_ms;
+	k_spinlock_key_t key = k_spin_lock(&lock_);
+
+	for (size_t i = 0; i < ARRAY_SIZE(metrics); i++) {
+		const struct metric *m = &metrics_[i];
+
+		metrics[i] = (struct metric_view){
+			.open = m->open,
+			.start_ms = m->start_ms,
+			.count = m->count,
+			.min = m->min,
+			.max = m->max,
+			.mean = m->open ? (int32_t)(m->sum / m->count) : 0,
+		};
+	}
+	memcpy(rules, rules_, sizeof(rules));
+	memcpy(active, rule_active_, sizeof(active));
+	rule_count = rule_count_;
+	window_ms = window_ms_;
+	summaries = summary_queue_.next - 1 - summary_queue_.acked;
+	events = event_queue_.next - 1 - event_queue_.acked;
+	k_spin_unlock(&lock_, key);
+
+	shell_print(sh, "config %08x, window %u s, %u summaries and %u events queued",
+		    config_id_, window_ms / MSEC_PER_SEC, summaries, events);
+	shell_print(sh, "%-6s %8s %8s %10s %10s %10s", "metric", "samples", "age_s", "min",
+		    "max", "mean");
+	for (size_t i = 0; i < ARRAY_SIZE(metrics); i++) {
+		const struct metric_view *m = &metrics[i];
+
+		if (!m->open) {
+			continue;
+		}
+		shell_print(sh, "%-6u %8u %8u %10d %10d %10d", (unsigned int)i, m->count,
+			    (uint32_t)((k_uptime_get() - m->start_ms) / MSEC_PER_SEC), m->min,
+			    m->max, m->mean);
+	}
+	for (size_t r = 0; r < rule_count; r++) {
+		shell_print(sh, "rule %u: metric %u %s %d hysteresis %u%s", (unsigned int)r,
+			    rules[r].metric, rule_names_[rules[r].type], rules[r].threshold,
+			    rules[r].hysteresis, active[r] ? " (active)" : "");
+	}
+	return 0;
+}
+
+SHELL_CMD_REGISTER(metricagg, NULL, "Show metric windows, rules and the report queues",
+		   cmd_metricagg);
+#endif /* defined(CONFIG_METRICAGG_SHELL) */
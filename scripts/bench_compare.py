@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+
+'''bench_compare.py
+
+Checks the BENCH lines printed by tests/benchmarks/hot_paths against the
+checked-in baseline of the platform, and fails if any benchmark got slower
+by more than --tolerance, or if a benchmark has no baseline or the baseline
+has no measurement. The metric is cycles per operation where the
+platform has a cycle counter, and nanoseconds per operation on
+native_posix, where it is host time and so only comparable on one machine.
+
+  west twister -T tests/benchmarks -p qemu_cortex_m3
+  ./scripts/bench_compare.py --platform qemu_cortex_m3 \\
+      twister-out/qemu_cortex_m3/tests/benchmarks/hot_paths/benchmark.hot_paths/handler.log
+
+With --update, the measured values are written to the baseline instead, to
+be committed along with a change that is expected to move them.
+'''
+
+import argparse
+import json
+import os
+import re
+import sys
+
+BENCH_RE = re.compile(r'BENCH (\{.*\})')
+BASELINE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tests',
+                            'benchmarks', 'hot_paths', 'baselines')
+
+
+def read_results(paths):
+    results = {}
+    for path in paths:
+        with (sys.stdin if path == '-' else open(path, errors='replace')) as f:
+            for line in f:
+                m = BENCH_RE.search(line)
+                if m:
+                    result = json.loads(m.group(1))
+                    results[result['name']] = result
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[1],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('logs', nargs='+', help='console logs of the benchmark, - for stdin')
+    parser.add_argument('--platform', required=True, help='twister platform the logs are from')
+    parser.add_argument('--baseline', help='baseline file (default: baselines/<platform>.json)')
+    parser.add_argument('--tolerance', type=float, default=0.10,
+                        help='allowed slowdown as a fraction (default 0.10)')
+    parser.add_argument('--update', action='store_true', help='write the baseline')
+    args = parser.parse_args()
+
+    path = args.baseline or os.path.join(BASELINE_DIR, args.platform + '.json')
+    with open(path) as f:
+        baseline = json.load(f)
+    metric = baseline['metric']
+    results = read_results(args.logs)
+    if not results:
+        sys.exit('no BENCH lines found')
+
+    if args.update:
+        baseline['benchmarks'] = {name: r[metric] for name, r in sorted(results.items())}
+        baseline.pop('note', None)
+        with open(path, 'w') as f:
+            json.dump(baseline, f, indent=2)
+            f.write('\n')
+        print('wrote %d benchmarks to %s' % (len(results), path))
+        return
+
+    regressions = 0
+    unmatched = 0
+    for name, result in sorted(results.items()):
+        value = result[metric]
+        base = baseline['benchmarks'].get(name)
+        extra = ', %d B/s' % result['bytes_per_sec'] if result.get('bytes_per_op') else ''
+        if base is None:
+            print('%-28s %10d %s  NO BASELINE%s' % (name, value, metric, extra))
+            unmatched += 1
+            continue
+        change = (value - base) / base if base else 0.0
+        status = 'ok'
+        if change > args.tolerance:
+            status = 'REGRESSION'
+            regressions += 1
+        elif change < -args.tolerance:
+            status = 'faster; consider --update'
+        print('%-28s %10d %s  %+6.1f%% vs %d  %s%s' % (name, value, metric, change * 100, base,
+                                                       status, extra))
+    for name in sorted(set(baseline['benchmarks']) - set(results)):
+        print('%-28s missing from the logs' % name)
+        unmatched += 1
+    errors = []
+    if regressions:
+        errors.append('%d benchmark(s) regressed by more than %d%%' %
+                      (regressions, args.tolerance * 100))
+    if unmatched:
+        errors.append('%d benchmark(s) not in both %s and the logs; record it with --update' %
+                      (unmatched, path))
+    if errors:
+        sys.exit('\n'.join(errors))
+
+
+if __name__ == '__main__':
+    main()
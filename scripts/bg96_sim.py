@@ -0,0 +1,838 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+
+'''bg96_sim.py
+
+Simulated Quectel BG96 on a pseudoterminal, for running the modem driver
+on native_posix without the board. The AT dialect the driver uses is
+answered: the setup commands, +CSQ, +CEREG, +QIOPEN, +QISEND, +QIRD,
++QICLOSE and +QIDNSGIP, with the RDY, +QIURC "recv", "closed" and "dnsgip"
+URCs, and the +QSSLOPEN, +QSSLSEND, +QSSLRECV and +QSSLCLOSE of TLS
+sockets with their +QSSLURC URCs. Sockets are bridged to real TCP
+connections and UDP sockets of the host, so the driver can talk to
+scripts/local_backend.py or to the built-in echo server. "UDP" clients send
+to the address they were opened with and "UDP SERVICE" sockets to the
+address given with each +QISEND; datagrams are read one per +QIRD, with
+their source for a service. TLS sockets do the handshake on the host, like
+the modem does, without verifying the server.
+
+The modem's HTTP client is answered too: +QHTTPURL, +QHTTPGET and
++QHTTPREADFILE fetch the URL on the host into a file kept in memory, which
++QFOPEN, +QFREAD, +QFCLOSE, +QFLST and +QFDEL then work on.
+
+Power saving commands are acknowledged and AT+CPSMS is answered with the
+requested timers in +QPSMTIMER, but the modem never sleeps.
+
+Attach to a running build, or start it and attach to the pty it prints:
+
+  ./scripts/bg96_sim.py --pty /dev/pts/5
+  ./scripts/bg96_sim.py --echo-port 7777 --run build/zephyr/zephyr.exe
+
+The cellular link is modeled per direction on the socket payload only:
+
+  --latency-ms   one-way delay of every payload segment; connects and DNS
+                 lookups take a round trip
+  --bandwidth    payload rate cap in bytes per second
+  --loss         probability that a segment is lost; TCP hides the loss,
+                 so it shows up as a --rto-ms stall of the link, while a
+                 lost datagram is dropped
+  --baud         pace of the UART itself (0 = as fast as the pty goes)
+
+Events can be scripted, one per line of --script, as "<seconds> <event>
+[arg]" counted from attach:
+
+  rssi <csq>  cereg <stat>  close <connect id>  send-fail <count>
+  latency <ms>  bandwidth <B/s>  loss <p>  reboot
+
+With --run, the build's stdin can be fed from --shell, one shell command
+per line as "<seconds> <command>", to drive it without a console, e.g.
+"20 app_request backend".
+
+A summary of the traffic is printed on exit.
+'''
+
+import argparse
+import heapq
+import http.client
+import os
+import random
+import re
+import socket
+import socketserver
+import ssl
+import subprocess
+import sys
+import threading
+import time
+import tty
+import urllib.parse
+
+CTRL_Z = 0x1a
+# Largest +QIRD answer the modem gives, whatever the driver asks for.
+MAX_READ = 1500
+PTY_RE = r'^%s connected to pseudotty: (\S+)'
+
+# +QIOPEN / +QIURC error codes.
+ERR_SOCKET_IN_USE = 563
+ERR_DNS = 565
+ERR_CONNECT = 566
+# +QHTTPGET error code, and the +CME ERROR of a missing file.
+ERR_HTTP_UNKNOWN = 701
+ERR_FILE_NOT_FOUND = 405
+
+IDENTITY = {
+    'AT+CGMI': 'Quectel',
+    'AT+CGMM': 'BG96',
+    'AT+CGMR': 'BG96MAR02A07M1G',
+    'AT+CGSN': '866425030000000',
+    'AT+CIMI': '310410000000000',
+    'AT+QCCID': '+QCCID: 89014103211118510720',
+    'AT+CPIN?': '+CPIN: READY',
+    'AT+QIACT?': '+QIACT: 1,1,1,"10.0.0.2"',
+}
+
+# Setup commands that are only acknowledged.
+OK_PREFIXES = ('AT&D', 'ATH', 'ATV', 'AT+IFC', 'AT+CMEE', 'AT+CPSMS', 'AT+CFUN', 'AT+QCFG',
+               'AT+QICSGP', 'AT+QIACT', 'AT+QIDEACT', 'AT+QIDNSCFG', 'AT+CEDRXS',
+               'AT+QSSLCFG', 'AT+QHTTPCFG', 'AT+QSCLK')
+
+# GPRS timer units of 3GPP TS 24.008 in seconds, by their 3 bits, for
+# T3412 extended (periodic TAU) and T3324 (active time).
+T3412_UNITS = {'000': 600, '001': 3600, '010': 36000, '011': 2, '100': 30, '101': 60,
+               '110': 1152000}
+T3324_UNITS = {'000': 2, '001': 60, '010': 360}
+
+
+class Link:
+    '''One direction of the cellular link.'''
+
+    def __init__(self, args):
+        self.latency = args.latency_ms / 1000.0
+        self.bandwidth = args.bandwidth
+        self.loss = args.loss
+        self.rto = args.rto_ms / 1000.0
+        self.busy = 0.0
+        self.bytes = 0
+        self.losses = 0
+
+    def schedule(self, nbytes, reliable=True):
+        '''Returns when a segment has left the modem and when it arrives.
+
+        A lost datagram is not retransmitted; it arrives at None.
+        '''
+        depart = max(time.monotonic(), self.busy)
+        if self.bandwidth:
+            depart += nbytes / self.bandwidth
+        lost = self.loss and random.random() < self.loss
+        if lost:
+            self.losses += 1
+            if reliable:
+                # Everything behind the lost segment waits for the retransmit.
+                depart += self.rto
+        self.busy = depart
+        self.bytes += nbytes
+        if lost and not reliable:
+            return depart, None
+        return depart, depart + self.latency
+
+
+class Connection:
+    def __init__(self, connect_id, service_type, host, port):
+        self.id = connect_id
+        self.service_type = service_type
+        self.host = host
+        self.port = port
+        self.sock = None
+        self.unread = bytearray()
+        # (data, (ip, port)) of each datagram not read yet, for UDP.
+        self.datagrams = []
+        self.total = 0
+        self.read = 0
+        self.closed = False
+
+    @property
+    def urc(self):
+        return b'+QSSLURC' if self.service_type == 'SSL' else b'+QIURC'
+
+
+class Simulator:
+    def __init__(self, args):
+        self.args = args
+        self.fd = None
+        self.lock = threading.Lock()
+        self.events = []
+        self.seq = 0
+        self.cond = threading.Condition(self.lock)
+        self.rx = bytearray()
+        self.echo = True
+        self.send = None
+        # Length of the +QHTTPURL input still to come.
+        self.url_len = None
+        self.url = None
+        self.http_body = None
+        # UFS files by name, and the open ones by handle.
+        self.files = {}
+        self.handles = {}
+        self.send_fail = 0
+        self.rssi = args.rssi
+        self.cereg = args.cereg
+        self.conns = {}
+        self.uplink = Link(args)
+        self.downlink = Link(args)
+        self.commands = 0
+        self.started = time.monotonic()
+
+    # Output is serialized through one scheduler thread, like the UART.
+    def at(self, when, fn):
+        with self.cond:
+            heapq.heappush(self.events, (when, self.seq, fn))
+            self.seq += 1
+            self.cond.notify()
+
+    def emit(self, data, delay=None):
+        if isinstance(data, str):
+            data = ('\r\n%s\r\n' % data).encode()
+        if delay is None:
+            delay = self.args.at_latency_ms / 1000.0
+        self.at(time.monotonic() + delay, lambda: self.uart_write(data))
+
+    def uart_write(self, data):
+        os.write(self.fd, data)
+        if self.args.baud:
+            time.sleep(len(data) * 10.0 / self.args.baud)
+
+    def run_events(self):
+        while True:
+            with self.cond:
+                while not self.events or self.events[0][0] > time.monotonic():
+                    timeout = self.events[0][0] - time.monotonic() if self.events else None
+                    self.cond.wait(timeout)
+                _, _, fn = heapq.heappop(self.events)
+            try:
+                fn()
+            except OSError as e:
+                log('event failed: %s' % e)
+
+    def attach(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        log('attached to %s' % path)
+        threading.Thread(target=self.run_events, daemon=True).start()
+        threading.Thread(target=self.read_uart, daemon=True).start()
+        self.boot()
+        if self.args.script:
+            self.load_script(self.args.script)
+
+    def boot(self):
+        # The driver flushes the UART when it starts and only then powers
+        # the modem on, so RDY must not come too early.
+        self.echo = True
+        self.emit('RDY', self.args.boot_ms / 1000.0)
+
+    def read_uart(self):
+        while True:
+            try:
+                data = os.read(self.fd, 4096)
+            except OSError:
+                data = b''
+            if not data:
+                log('pty closed')
+                return
+            self.rx += data
+            self.parse()
+
+    def parse(self):
+        while True:
+            if self.send is not None:
+                conn, length, dest = self.send
+                if len(self.rx) < length + 1:
+                    return
+                data = bytes(self.rx[:length])
+                terminator = self.rx[length]
+                del self.rx[:length + 1]
+                self.send = None
+                self.on_send_data(conn, data, terminator, dest)
+                continue
+            if self.url_len is not None:
+                if len(self.rx) < self.url_len:
+                    return
+                self.url = bytes(self.rx[:self.url_len]).decode('latin-1')
+                del self.rx[:self.url_len]
+                self.url_len = None
+                self.emit('OK')
+                continue
+            end = self.rx.find(b'\r')
+            if end < 0:
+                return
+            line = self.rx[:end].decode('latin-1').strip()
+            del self.rx[:end + 1]
+            if self.rx[:1] == b'\n':
+                del self.rx[:1]
+            if line:
+                if self.echo:
+                    self.emit((line + '\r').encode(), 0)
+                self.commands += 1
+                self.on_command(line)
+
+    def on_command(self, cmd):
+        upper = cmd.upper()
+        if upper in ('AT', 'ATE0', 'ATE1'):
+            if upper != 'AT':
+                self.echo = upper == 'ATE1'
+            self.emit('OK')
+        elif upper in IDENTITY:
+            self.emit(IDENTITY[upper])
+            self.emit('OK')
+        elif upper == 'AT+CSQ':
+            self.emit('+CSQ: %d,99' % self.rssi)
+            self.emit('OK')
+        elif upper == 'AT+CEREG?':
+            self.emit('+CEREG: 0,%d' % self.cereg)
+            self.emit('OK')
+        elif upper == 'AT+CFUN=1,1':
+            self.emit('OK')
+            self.reboot()
+        elif upper.startswith('AT+QIOPEN='):
+            self.on_open(cmd)
+        elif upper.startswith('AT+QISEND='):
+            self.on_send(cmd)
+        elif upper.startswith('AT+QIRD='):
+            self.on_read(cmd)
+        elif upper.startswith('AT+QICLOSE='):
+            self.on_close(cmd)
+        elif upper.startswith('AT+QSSLOPEN='):
+            self.on_ssl_open(cmd)
+        elif upper.startswith('AT+QSSLSEND='):
+            self.on_send(cmd)
+        elif upper.startswith('AT+QSSLRECV='):
+            self.on_ssl_read(cmd)
+        elif upper.startswith('AT+QSSLCLOSE='):
+            self.on_close(cmd)
+        elif upper.startswith('AT+QIDNSGIP='):
+            self.on_dns(cmd)
+        elif upper.startswith('AT+QHTTPURL='):
+            self.on_http_url(cmd)
+        elif upper.startswith('AT+QHTTPGET'):
+            self.on_http_get(cmd)
+        elif upper.startswith('AT+QHTTPREADFILE='):
+            self.on_http_read_file(cmd)
+        elif upper.startswith(('AT+QFOPEN=', 'AT+QFREAD=', 'AT+QFCLOSE=', 'AT+QFLST=',
+                               'AT+QFDEL=')):
+            self.on_file(cmd)
+        elif upper.startswith('AT+CPSMS=1'):
+            self.on_psm(cmd)
+        elif upper.startswith(OK_PREFIXES):
+            self.emit('OK')
+        else:
+            log('unhandled: %s' % cmd)
+            self.emit('ERROR')
+
+    def on_open(self, cmd):
+        m = re.match(r'AT\+QIOPEN=\d+,(\d+),"([\w ]+)","([^"]+)",(\d+)', cmd, re.I)
+        service_type = m.group(2).upper() if m else None
+        if service_type not in ('TCP', 'UDP', 'UDP SERVICE'):
+            self.emit('ERROR')
+            return
+        connect_id, host, port = int(m.group(1)), m.group(3), int(m.group(4))
+        self.emit('OK')
+        if connect_id in self.conns:
+            self.emit('+QIOPEN: %d,%d' % (connect_id, ERR_SOCKET_IN_USE))
+            return
+        conn = Connection(connect_id, service_type, host, port)
+        self.conns[connect_id] = conn
+        if service_type == 'TCP':
+            threading.Thread(target=self.connect, args=(conn,), daemon=True).start()
+        else:
+            self.open_udp(conn)
+
+    def on_ssl_open(self, cmd):
+        m = re.match(r'AT\+QSSLOPEN=\d+,\d+,(\d+),"([^"]+)",(\d+)', cmd, re.I)
+        if not m:
+            self.emit('ERROR')
+            return
+        connect_id, host, port = int(m.group(1)), m.group(2), int(m.group(3))
+        self.emit('OK')
+        if connect_id in self.conns:
+            self.emit('+QSSLOPEN: %d,%d' % (connect_id, ERR_SOCKET_IN_USE))
+            return
+        conn = Connection(connect_id, 'SSL', host, port)
+        self.conns[connect_id] = conn
+        threading.Thread(target=self.connect, args=(conn,), daemon=True).start()
+
+    def open_udp(self, conn):
+        # The modem's local port is behind the operator's NAT, so any port
+        # of the host will do.
+        conn.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        conn.sock.bind(('0.0.0.0', 0))
+        # There is no handshake; the modem answers right away.
+        self.emit('+QIOPEN: %d,0' % conn.id, self.args.at_latency_ms / 1000.0)
+        log('connection %d: %s %s:%d' % (conn.id, conn.service_type, conn.host, conn.port))
+        threading.Thread(target=self.receive_udp, args=(conn,), daemon=True).start()
+
+    def receive_udp(self, conn):
+        while True:
+            try:
+                data, addr = conn.sock.recvfrom(65535)
+            except OSError:
+                return
+            if conn.service_type == 'UDP' and addr != (conn.host, conn.port):
+                # A UDP client only takes datagrams from its remote.
+                continue
+            with self.lock:
+                _, arrive = self.downlink.schedule(len(data), reliable=False)
+            if arrive is not None:
+                self.at(arrive, lambda data=data, addr=addr: self.deliver_datagram(conn, data,
+                                                                                  addr))
+
+    def deliver_datagram(self, conn, data, addr):
+        if conn.closed:
+            return
+        conn.datagrams.append((data, addr))
+        conn.total += len(data)
+        self.uart_write(b'\r\n+QIURC: "recv",%d\r\n' % conn.id)
+
+    def connect(self, conn):
+        started = time.monotonic()
+        tls = conn.service_type == 'SSL'
+        try:
+            conn.sock = socket.create_connection((conn.host, conn.port), timeout=10)
+            if tls:
+                context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+                context.check_hostname = False
+                context.verify_mode = ssl.CERT_NONE
+                context.maximum_version = ssl.TLSVersion.TLSv1_2
+                conn.sock = context.wrap_socket(conn.sock, server_hostname=conn.host)
+            conn.sock.settimeout(None)
+            err = 0
+        except OSError as e:
+            log('connect %s:%d failed: %s' % (conn.host, conn.port, e))
+            self.conns.pop(conn.id, None)
+            err = ERR_CONNECT
+        # The TCP handshake takes a round trip over the radio, and a full
+        # TLS 1.2 handshake two more.
+        rtt = (3 if tls else 1) * 2 * self.args.latency_ms / 1000.0
+        self.emit('%s: %d,%d' % ('+QSSLOPEN' if tls else '+QIOPEN', conn.id, err),
+                  max(0, rtt - (time.monotonic() - started)))
+        if not err:
+            log('connection %d: %s:%d' % (conn.id, conn.host, conn.port))
+            threading.Thread(target=self.receive, args=(conn,), daemon=True).start()
+
+    def receive(self, conn):
+        while True:
+            try:
+                data = conn.sock.recv(4096)
+            except OSError:
+                data = b''
+            if not data:
+                break
+            with self.lock:
+                _, arrive = self.downlink.schedule(len(data))
+            self.at(arrive, lambda data=data: self.deliver(conn, data))
+        with self.lock:
+            when = self.downlink.busy + self.downlink.latency
+        self.at(when, lambda: self.peer_closed(conn))
+
+    def deliver(self, conn, data):
+        if conn.closed:
+            return
+        conn.unread += data
+        conn.total += len(data)
+        self.uart_write(b'\r\n%s: "recv",%d\r\n' % (conn.urc, conn.id))
+
+    def peer_closed(self, conn):
+        if not conn.closed and self.conns.get(conn.id) is conn:
+            self.uart_write(b'\r\n%s: "closed",%d\r\n' % (conn.urc, conn.id))
+
+    def on_send(self, cmd):
+        m = re.match(r'AT\+Q(?:I|SSL)SEND=(\d+),(\d+)(?:,"([^"]+)",(\d+))?', cmd, re.I)
+        conn = self.conns.get(int(m.group(1))) if m else None
+        if conn is None or conn.sock is None or conn.closed:
+            self.emit('ERROR')
+            return
+        if conn.service_type == 'UDP SERVICE':
+            if not m.group(3):
+                self.emit('ERROR')
+                return
+            dest = (m.group(3), int(m.group(4)))
+        elif conn.service_type == 'UDP':
+            dest = (conn.host, conn.port)
+        else:
+            dest = None
+        self.send = (conn, int(m.group(2)), dest)
+        self.emit(b'\r\n> ')
+
+    def on_send_data(self, conn, data, terminator, dest):
+        if terminator != CTRL_Z:
+            log('connection %d: QISEND data not followed by CTRL+Z' % conn.id)
+        if self.send_fail:
+            self.send_fail -= 1
+            self.emit('SEND FAIL')
+            return
+        with self.lock:
+            depart, arrive = self.uplink.schedule(len(data), reliable=dest is None)
+        if dest is not None:
+            if arrive is not None:
+                self.at(arrive, lambda: self.forward_datagram(conn, data, dest))
+        else:
+            self.at(arrive, lambda: self.forward(conn, data))
+        # SEND OK once the data fits in the modem's send buffer.
+        backlog = 0
+        if self.args.bandwidth:
+            backlog = max(0, depart - self.args.tx_buffer / self.args.bandwidth - time.monotonic())
+        self.emit('SEND OK', max(self.args.at_latency_ms / 1000.0, backlog))
+
+    def forward(self, conn, data):
+        if not conn.closed:
+            conn.sock.sendall(data)
+
+    def forward_datagram(self, conn, data, dest):
+        if not conn.closed:
+            try:
+                conn.sock.sendto(data, dest)
+            except OSError as e:
+                log('connection %d: datagram to %s:%d dropped: %s' % (conn.id, *dest, e))
+
+    def on_read(self, cmd):
+        m = re.match(r'AT\+QIRD=(\d+)(?:,(\d+))?', cmd, re.I)
+        conn = self.conns.get(int(m.group(1))) if m else None
+        if conn is None:
+            self.emit('ERROR')
+            return
+        if conn.service_type != 'TCP':
+            self.read_datagram(conn)
+            return
+        if m.group(2) == '0':
+            self.emit('+QIRD: %d,%d,%d' % (conn.total, conn.read, len(conn.unread)))
+            self.emit('OK')
+            return
+        want = int(m.group(2)) if m.group(2) else MAX_READ
+        data = bytes(conn.unread[:min(want, MAX_READ)])
+        del conn.unread[:len(data)]
+        conn.read += len(data)
+        self.emit(b'\r\n+QIRD: %d\r\n%s\r\n\r\nOK\r\n' % (len(data), data))
+
+    def on_ssl_read(self, cmd):
+        m = re.match(r'AT\+QSSLRECV=(\d+),(\d+)', cmd, re.I)
+        conn = self.conns.get(int(m.group(1))) if m else None
+        if conn is None or conn.service_type != 'SSL':
+            self.emit('ERROR')
+            return
+        data = bytes(conn.unread[:min(int(m.group(2)), MAX_READ)])
+        del conn.unread[:len(data)]
+        conn.read += len(data)
+        if data:
+            self.emit(b'\r\n+QSSLRECV: %d\r\n%s\r\n\r\nOK\r\n' % (len(data), data))
+        else:
+            self.emit('+QSSLRECV: 0')
+            self.emit('OK')
+
+    def read_datagram(self, conn):
+        '''Answers +QIRD with the next datagram, or a length of 0.'''
+        if not conn.datagrams:
+            self.emit('+QIRD: 0')
+            self.emit('OK')
+            return
+        data, (ip, port) = conn.datagrams.pop(0)
+        data = data[:MAX_READ]
+        conn.read += len(data)
+        if conn.service_type == 'UDP SERVICE':
+            header = b'+QIRD: %d,"%s",%d' % (len(data), ip.encode(), port)
+        else:
+            header = b'+QIRD: %d' % len(data)
+        self.emit(b'\r\n%s\r\n%s\r\n\r\nOK\r\n' % (header, data))
+
+    def on_close(self, cmd):
+        m = re.match(r'AT\+Q(?:I|SSL)CLOSE=(\d+)', cmd, re.I)
+        conn = self.conns.pop(int(m.group(1)), None) if m else None
+        if conn is not None:
+            self.close(conn)
+        self.emit('OK')
+
+    def close(self, conn):
+        conn.closed = True
+        if conn.sock is not None:
+            conn.sock.close()
+
+    def on_dns(self, cmd):
+        m = re.match(r'AT\+QIDNSGIP=\d+,"([^"]+)"', cmd, re.I)
+        if not m:
+            self.emit('ERROR')
+            return
+        self.emit('OK')
+        host = m.group(1)
+        try:
+            addr = self.args.hosts.get(host) or socket.gethostbyname(host)
+        except OSError:
+            addr = None
+        rtt = 2 * self.args.latency_ms / 1000.0
+        if addr is None:
+            self.emit('+QIURC: "dnsgip",%d,0,0' % ERR_DNS, rtt)
+        else:
+            self.emit('+QIURC: "dnsgip",0,1,600', rtt)
+            self.emit('+QIURC: "dnsgip","%s"' % addr, rtt)
+
+    def on_psm(self, cmd):
+        '''Grant the requested PSM timers right away. Sleep is not modeled:
+        the pty carries no DTR or PWRKEY, so the modem stays awake.'''
+        self.emit('OK')
+        m = re.match(r'AT\+CPSMS=1,[^,]*,[^,]*,"([01]{8})","([01]{8})"', cmd, re.I)
+        if not m:
+            return
+        tau, active = m.groups()
+        if tau[:3] not in T3412_UNITS or active[:3] not in T3324_UNITS:
+            return
+        self.emit('+QPSMTIMER: %d,%d' % (T3412_UNITS[tau[:3]] * int(tau[3:], 2),
+                                         T3324_UNITS[active[:3]] * int(active[3:], 2)),
+                  2 * self.args.latency_ms / 1000.0)
+
+    def on_http_url(self, cmd):
+        m = re.match(r'AT\+QHTTPURL=(\d+)', cmd, re.I)
+        if not m:
+            self.emit('ERROR')
+            return
+        self.url_len = int(m.group(1))
+        self.emit('CONNECT')
+
+    def on_http_get(self, cmd):
+        if not self.url:
+            self.emit('ERROR')
+            return
+        self.emit('OK')
+        threading.Thread(target=self.http_get, args=(self.url,), daemon=True).start()
+
+    def http_get(self, url):
+        started = time.monotonic()
+        self.http_body = None
+        parts = urllib.parse.urlsplit(url)
+        host = parts.hostname
+        addr = self.args.hosts.get(host, host)
+        try:
+            if parts.scheme == 'https':
+                context = ssl._create_unverified_context()
+                client = http.client.HTTPSConnection(addr, parts.port or 443, timeout=10,
+                                                     context=context)
+            else:
+                client = http.client.HTTPConnection(addr, parts.port or 80, timeout=10)
+            path = parts.path + ('?' + parts.query if parts.query else '')
+            client.request('GET', path or '/', headers={'Host': host})
+            rsp = client.getresponse()
+            self.http_body = rsp.read()
+            length = rsp.getheader('Content-Length')
+            result = '0,%d' % rsp.status + (',%s' % length if length else '')
+            client.close()
+        except (OSError, http.client.HTTPException) as e:
+            log('http %s failed: %s' % (url, e))
+            result = '%d' % ERR_HTTP_UNKNOWN
+        # A DNS lookup, the TCP handshake and the request take a round trip
+        # each; the body is accounted for by +QHTTPREADFILE.
+        rtt = 3 * 2 * self.args.latency_ms / 1000.0
+        self.emit('+QHTTPGET: %s' % result, max(0, rtt - (time.monotonic() - started)))
+
+    def on_http_read_file(self, cmd):
+        m = re.match(r'AT\+QHTTPREADFILE="(?:UFS:)?([^"]+)"', cmd, re.I)
+        if not m or self.http_body is None:
+            self.emit('ERROR')
+            return
+        self.emit('OK')
+        name, body = m.group(1), self.http_body
+        self.http_body = None
+        with self.lock:
+            _, arrive = self.downlink.schedule(len(body))
+        log('http: %d bytes into %s' % (len(body), name))
+
+        def done():
+            self.files[name] = body
+            self.uart_write(b'\r\n+QHTTPREADFILE: 0\r\n')
+        self.at(arrive, done)
+
+    def on_file(self, cmd):
+        m = re.match(r'AT\+QF(OPEN|READ|CLOSE|LST|DEL)=(?:"(?:UFS:)?([^"]+)"|(\d+))(?:,(\d+))?',
+                     cmd, re.I)
+        if not m:
+            self.emit('ERROR')
+            return
+        op, name, handle, arg = m.group(1).upper(), m.group(2), m.group(3), m.group(4)
+        if op in ('OPEN', 'LST', 'DEL') and name not in self.files:
+            self.emit('+CME ERROR: %d' % ERR_FILE_NOT_FOUND)
+        elif op == 'OPEN':
+            handle = 1024 + len(self.handles)
+            while handle in self.handles:
+                handle += 1
+            self.handles[handle] = [name, 0]
+            self.emit('+QFOPEN: %d' % handle)
+            self.emit('OK')
+        elif op == 'LST':
+            self.emit('+QFLST: "UFS:%s",%d' % (name, len(self.files[name])))
+            self.emit('OK')
+        elif op == 'DEL':
+            del self.files[name]
+            self.emit('OK')
+        elif int(handle) not in self.handles:
+            self.emit('ERROR')
+        elif op == 'CLOSE':
+            del self.handles[int(handle)]
+            self.emit('OK')
+        else:
+            entry = self.handles[int(handle)]
+            data = self.files.get(entry[0], b'')[entry[1]:entry[1] + int(arg or 1024)]
+            entry[1] += len(data)
+            self.emit(b'\r\nCONNECT %d\r\n%s\r\nOK\r\n' % (len(data), data))
+
+    def reboot(self):
+        for conn in list(self.conns.values()):
+            self.close(conn)
+        self.conns.clear()
+        self.send = None
+        self.url_len = None
+        self.handles.clear()
+        self.boot()
+
+    def load_script(self, path):
+        with open(path) as f:
+            for number, line in enumerate(f, 1):
+                line = line.split('#', 1)[0].split()
+                if not line:
+                    continue
+                when, event, arg = float(line[0]), line[1], line[2] if len(line) > 2 else None
+                handler = getattr(self, 'event_' + event.replace('-', '_'), None)
+                if handler is None:
+                    sys.exit('%s:%d: unknown event %s' % (path, number, event))
+                self.at(self.started + when, lambda h=handler, a=arg: h(a))
+
+    def event_rssi(self, arg):
+        self.rssi = int(arg)
+
+    def event_cereg(self, arg):
+        self.cereg = int(arg)
+
+    def event_close(self, arg):
+        conn = self.conns.get(int(arg))
+        if conn is not None and conn.service_type == 'TCP':
+            conn.sock.close()
+
+    def event_send_fail(self, arg):
+        self.send_fail = int(arg or 1)
+
+    def event_latency(self, arg):
+        self.uplink.latency = self.downlink.latency = int(arg) / 1000.0
+
+    def event_bandwidth(self, arg):
+        self.uplink.bandwidth = self.downlink.bandwidth = int(arg)
+
+    def event_loss(self, arg):
+        self.uplink.loss = self.downlink.loss = float(arg)
+
+    def event_reboot(self, arg):
+        self.reboot()
+
+    def summary(self):
+        elapsed = time.monotonic() - self.started
+        log('%.1f s, %d commands; up %d B (%d lost), down %d B (%d lost)' %
+            (elapsed, self.commands, self.uplink.bytes, self.uplink.losses,
+             self.downlink.bytes, self.downlink.losses))
+
+
+class EchoHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        while True:
+            data = self.request.recv(4096)
+            if not data:
+                return
+            self.request.sendall(data)
+
+
+def log(msg):
+    print('bg96_sim: %s' % msg, file=sys.stderr, flush=True)
+
+
+def feed_shell(proc, path):
+    started = time.monotonic()
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            when, command = line.split(None, 1)
+            time.sleep(max(0, started + float(when) - time.monotonic()))
+            log('shell: %s' % command)
+            try:
+                proc.stdin.write(command + '\n')
+                proc.stdin.flush()
+            except OSError:
+                return
+
+
+def run(sim, args):
+    '''Runs the build, relaying its console, and attaches to its modem pty.'''
+    proc = subprocess.Popen(args.run, stdout=subprocess.PIPE, text=True, bufsize=1,
+                            stdin=subprocess.PIPE if args.shell else None)
+    if args.shell:
+        threading.Thread(target=feed_shell, args=(proc, args.shell), daemon=True).start()
+    pattern = re.compile(PTY_RE % re.escape(args.uart))
+    for line in proc.stdout:
+        sys.stdout.write(line)
+        sys.stdout.flush()
+        m = pattern.match(line)
+        if m and sim.fd is None:
+            sim.attach(m.group(1))
+    return proc.wait()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[1],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument('--pty', help='pty of a running build')
+    target.add_argument('--run', nargs=argparse.REMAINDER,
+                        help='build to run, with its arguments; must be last')
+    parser.add_argument('--uart', default='modem-uart',
+                        help='name of the modem UART node, to find its pty with --run')
+    parser.add_argument('--latency-ms', type=int, default=0, help='one-way payload delay')
+    parser.add_argument('--bandwidth', type=int, default=0,
+                        help='payload rate cap in bytes/s per direction (0 = none)')
+    parser.add_argument('--loss', type=float, default=0.0,
+                        help='probability that a payload segment is lost')
+    parser.add_argument('--rto-ms', type=int, default=1000, help='stall per lost segment')
+    parser.add_argument('--tx-buffer', type=int, default=10240,
+                        help='modem send buffer; SEND OK is held while it is full')
+    parser.add_argument('--at-latency-ms', type=int, default=2,
+                        help='delay before every AT response')
+    parser.add_argument('--baud', type=int, default=115200, help='UART rate (0 = unpaced)')
+    parser.add_argument('--boot-ms', type=int, default=2000, help='delay before RDY')
+    parser.add_argument('--rssi', type=int, default=20, help='+CSQ value')
+    parser.add_argument('--cereg', type=int, default=1, help='+CEREG status')
+    parser.add_argument('--host', action='append', default=[], metavar='NAME=ADDR',
+                        help='answer for +QIDNSGIP and the HTTP client instead of '
+                        'the host resolver')
+    parser.add_argument('--echo-port', type=int, default=0,
+                        help='also serve a TCP echo server on localhost')
+    parser.add_argument('--script', help='file of timed events')
+    parser.add_argument('--shell', help='file of timed shell commands for the --run build')
+    parser.add_argument('--seed', type=int, help='seed for --loss')
+    args = parser.parse_args()
+    args.hosts = dict(h.split('=', 1) for h in args.host)
+    random.seed(args.seed)
+
+    if args.echo_port:
+        socketserver.ThreadingTCPServer.allow_reuse_address = True
+        server = socketserver.ThreadingTCPServer(('127.0.0.1', args.echo_port), EchoHandler)
+        server.daemon_threads = True
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        log('echo server on 127.0.0.1:%d' % args.echo_port)
+
+    sim = Simulator(args)
+    status = 0
+    try:
+        if args.run:
+            status = run(sim, args)
+        else:
+            sim.attach(args.pty)
+            threading.Event().wait()
+    except KeyboardInterrupt:
+        pass
+    sim.summary()
+    sys.exit(status)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+
+'''evtrace_to_chrome.py
+
+Converts the output of the "evtrace dump" shell command into a Chrome trace
+(the JSON format read by chrome://tracing and https://ui.perfetto.dev).
+
+Capture the console while running the command, e.g. with
+"minicom -C dump.txt", then:
+
+  ./scripts/evtrace_to_chrome.py dump.txt -o trace.json
+
+Lines that are not part of the dump are ignored, so the whole console log
+can be passed in. AT commands, semaphore waits and HTTP requests are shown
+as spans on the thread that made them; responses, URCs, semaphore gives and
+socket state changes as instant events.
+'''
+
+import argparse
+import json
+import re
+import sys
+
+HEADER_RE = re.compile(r'evtrace: v1 hz=(\d+) entries=(\d+) dropped=(\d+)')
+THREAD_RE = re.compile(r'evtrace-thread: ([0-9a-f]{8}) ?(.*)$')
+ENTRY_RE = re.compile(r'evtrace-e: ([0-9a-f]{8}) ([0-9a-f]{8}) ([0-9a-f]{2}) '
+                      r'([0-9a-f]{4}) ([0-9a-f]{8})')
+
+# enum evtrace_id in include/evtrace/evtrace.h.
+MDM_CMD_BEGIN = 1
+MDM_CMD_END = 2
+MDM_RSP = 3
+SEM_GIVE = 4
+SEM_TAKE_BEGIN = 5
+SEM_TAKE_END = 6
+SOCK_STATE = 7
+HTTP_BEGIN = 8
+HTTP_PHASE = 9
+HTTP_END = 10
+HTTP_PAYLOAD = 11
+HTTP_RESPONSE = 12
+
+SEMS = ['response', 'tx_ready', 'sock_conn', 'dns', 'tx_lock', 'http']
+SOCK_STATES = ['connecting', 'connected', 'data_ready', 'closed', 'closed_urc']
+# enum req_phase in app/src/req_trace.h and RequestEndpoint in app/api/api.proto.
+PHASES = ['dns', 'socket', 'connect', 'tls', 'sent', 'first_byte', 'done']
+ENDPOINTS = ['unknown', 'generic', 'status_update', 'ota_check', 'check_in', 'ota_download',
+             'check_in_coap', 'check_in_mqtt', 'ota_download_modem']
+
+
+def lookup(names, index):
+    return names[index] if index < len(names) else str(index)
+
+
+def signed(value, bits):
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def tag_str(tag):
+    return tag.to_bytes(4, 'little').rstrip(b'\0').decode('ascii', errors='replace')
+
+
+def parse(lines):
+    '''Returns (hz, dropped, {thread: name}, [entries]) of the last dump.'''
+    hz = dropped = None
+    threads = {}
+    entries = []
+    for line in lines:
+        m = HEADER_RE.search(line)
+        if m:
+            # Only the last dump in the log is converted.
+            hz, dropped = int(m.group(1)), int(m.group(3))
+            threads, entries = {}, []
+            continue
+        m = THREAD_RE.search(line)
+        if m:
+            threads[int(m.group(1), 16)] = m.group(2).strip()
+            continue
+        m = ENTRY_RE.search(line)
+        if m and hz is not None:
+            entries.append(tuple(int(g, 16) for g in m.groups()))
+    if hz is None:
+        raise ValueError('no "evtrace: v1" header found')
+    return hz, dropped, threads, entries
+
+
+def to_chrome(hz, threads, entries):
+    events = []
+    tids = {}
+
+    def tid(thread):
+        if thread not in tids:
+            tids[thread] = len(tids) + 1
+            name = 'isr' if thread == 0 else threads.get(thread) or '%08x' % thread
+            events.append({'ph': 'M', 'name': 'thread_name', 'pid': 1, 'tid': tids[thread],
+                           'args': {'name': name}})
+        return tids[thread]
+
+    # The cycle counter is 32 bits, so unwrap it assuming no gap between
+    # consecutive events is longer than one wrap.
+    cycles = last = None
+    for raw, thread, event, arg0, arg1 in entries:
+        cycles = 0 if last is None else cycles + ((raw - last) & 0xffffffff)
+        last = raw
+        base = {'pid': 1, 'tid': tid(thread), 'ts': cycles * 1e6 / hz}
+
+        if event == MDM_CMD_BEGIN:
+            base.update(ph='B', name='AT+' + tag_str(arg1), cat='modem')
+        elif event == MDM_CMD_END:
+            base.update(ph='E', args={'result': signed(arg0, 16), 'written': arg1})
+        elif event == SEM_TAKE_BEGIN:
+            base.update(ph='B', name='wait ' + lookup(SEMS, arg0), cat='sem')
+        elif event == SEM_TAKE_END:
+            base.update(ph='E', args={'result': signed(arg1, 32)})
+        elif event == HTTP_BEGIN:
+            base.update(ph='B', name='http ' + lookup(ENDPOINTS, arg0), cat='http')
+        elif event == HTTP_END:
+            base.update(ph='E', args={'result': signed(arg1, 32)})
+        else:
+            base.update(ph='i', s='t')
+            if event == MDM_RSP:
+                base.update(name=tag_str(arg1), cat='modem')
+                if arg0 != 0xffff:
+                    base['args'] = {'socket': arg0}
+            elif event == SEM_GIVE:
+                base.update(name='give ' + lookup(SEMS, arg0), cat='sem')
+            elif event == SOCK_STATE:
+                base.update(name='socket %d %s' % (arg0, lookup(SOCK_STATES, arg1)),
+                            cat='socket')
+            elif event == HTTP_PHASE:
+                base.update(name=lookup(PHASES, arg0), cat='http', args={'us': arg1})
+            elif event == HTTP_PAYLOAD:
+                base.update(name='payload', cat='http', args={'bytes': signed(arg1, 32)})
+            elif event == HTTP_RESPONSE:
+                base.update(name='final' if arg0 else 'response', cat='http',
+                            args={'body_bytes': arg1})
+            else:
+                base.update(name='event 0x%02x' % event, args={'arg0': arg0, 'arg1': arg1})
+        events.append(base)
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[1],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('dump', nargs='?', type=argparse.FileType('r', errors='replace'),
+                        default=sys.stdin, help='console log with an evtrace dump')
+    parser.add_argument('-o', '--output', type=argparse.FileType('w'), default=sys.stdout,
+                        help='Chrome trace JSON to write')
+    args = parser.parse_args()
+
+    hz, dropped, threads, entries = parse(args.dump)
+    if dropped:
+        print('%d events were overwritten before the dump' % dropped, file=sys.stderr)
+    json.dump(to_chrome(hz, threads, entries), args.output)
+    print('%d events' % len(entries), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
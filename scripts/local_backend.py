@@ -0,0 +1,1078 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Apache-2.0
+
+'''local_backend.py
+
+Local stand-in for the backend and the firmware release bucket, used to
+benchmark the device without the real servers. Files under --root are
+served over HTTP/1.1 with support for HEAD and single "Range: bytes=a-b"
+requests, so both the single-stream and the parallel range download paths
+can be exercised.
+
+The protobuf endpoints of the backend (app/api/api.proto) are answered too:
+
+  POST /status_update   StatusUpdateRequest -> StatusUpdateResponse
+  POST /ota             OTAUpdateRequest    -> OTAUpdateResponse
+  POST /check_in        CheckInRequest      -> CheckInResponse
+
+POST /post is echoed back as JSON, like httpbin.org does, for the generic
+request of the app.
+
+The same protobuf endpoints are served over CoAP on UDP --coap-port, as
+confirmable POSTs to coap://host/check_in and so on, answered with
+piggybacked 2.04 responses. Retransmitted requests are answered from a
+cache of recent responses rather than handled twice. Each exchange is
+logged with its datagram sizes next to those of the HTTP requests, to
+compare the two transports.
+
+With --mqtt-port, it is also a minimal MQTT 3.1.1 broker standing in for
+Mosquitto and the backend behind it. Sessions that are not clean keep
+their subscriptions and unacknowledged QoS 1 messages across connections,
+and a client that misses its keepalive is disconnected. A request
+published to embsys/<device>/check_in (or status_update, ota) is answered
+on <topic>/rsp. --push-ota-after pushes the --ota-path update to
+embsys/<device>/ota that many seconds after a device subscribes, and logs
+how long the device took to acknowledge it and to start the download.
+
+With --tls-port, the HTTP endpoints are served over TLS too, with the
+--tls-cert and --tls-key given. Session IDs and tickets are both accepted,
+and every handshake is logged as full or resumed with its duration. The
+device only offers ECDHE-ECDSA on P-256, so the key has to be one:
+
+  openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes \\
+      -keyout backend.key -out backend.pem -days 365 -subj /CN=<host>
+
+An update is offered whenever --ota-path is given and the device does not
+report the download as done. --blink-ms is sent back as DeviceConfig.
+--metric-window-s and --metric-rule are sent as a MetricConfig to devices
+that do not report running it, and the metric summaries and events they
+send are logged. For an event when A0 (metric 0) goes over 2000 mV, and
+clears back under 1900 mV:
+
+  ./scripts/local_backend.py --metric-window-s 600 --metric-rule 0:above:2000:100
+
+Delta check-ins are applied to the acknowledged snapshot of their session;
+an unknown session or base is answered with a zero token to force a full
+snapshot.
+
+Cellular links are approximated by injecting latency and a bandwidth cap:
+
+  --latency-ms   delay before the response headers of every request (RTT)
+  --bandwidth    per-connection cap on the body, in bytes per second
+
+Example:
+
+  ./scripts/local_backend.py --root build/zephyr --latency-ms 600 \\
+      --bandwidth 4000
+
+Every completed request is logged with its size and duration, which gives
+the server-side view of the throughput reported by the device. Protobuf
+requests are logged with the bytes received and sent, headers included.
+'''
+
+import argparse
+import collections
+import http.server
+import json
+import os
+import random
+import re
+import socketserver
+import ssl
+import sys
+import threading
+import time
+import zlib
+
+CHUNK_SIZE = 512
+RANGE_RE = re.compile(r'bytes=(\d*)-(\d*)$')
+
+# CoAP (RFC 7252) message types, codes and options used here.
+COAP_CON, COAP_NON, COAP_ACK, COAP_RST = range(4)
+COAP_EMPTY = 0x00
+COAP_POST = 0x02
+COAP_CHANGED = 0x44
+COAP_BAD_REQUEST = 0x80
+COAP_NOT_FOUND = 0x84
+COAP_METHOD_NOT_ALLOWED = 0x85
+COAP_OPTION_URI_PATH = 11
+# Responses kept for answering retransmitted requests.
+COAP_CACHE_SIZE = 64
+
+# MQTT 3.1.1 control packet types used here.
+MQTT_CONNECT, MQTT_CONNACK, MQTT_PUBLISH, MQTT_PUBACK = 1, 2, 3, 4
+MQTT_SUBSCRIBE, MQTT_SUBACK = 8, 9
+MQTT_PINGREQ, MQTT_PINGRESP, MQTT_DISCONNECT = 12, 13, 14
+MQTT_TOPIC_ROOT = 'embsys/'
+
+# Values of the OTAState enum in api.proto.
+OTA_STATE_DOWNLOADED = 2
+OTA_STATE_PERSISTED = 3
+
+# Values of the MetricRuleType enum in api.proto.
+METRIC_RULE_TYPES = {'above': 1, 'below': 2, 'rate': 3}
+
+
+# Just enough of the protobuf wire format for the messages in api.proto.
+def pb_read_varint(data, pos):
+    value = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7f) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+
+
+def pb_decode(data):
+    '''Returns {field number: [values]}; varints as int, the rest as bytes.'''
+    fields = {}
+    pos = 0
+    while pos < len(data):
+        key, pos = pb_read_varint(data, pos)
+        wire_type = key & 7
+        if wire_type == 0:
+            value, pos = pb_read_varint(data, pos)
+        elif wire_type == 2:
+            length, pos = pb_read_varint(data, pos)
+            value = data[pos:pos + length]
+            pos += length
+        elif wire_type in (1, 5):
+            length = 8 if wire_type == 1 else 4
+            value = data[pos:pos + length]
+            pos += length
+        else:
+            raise ValueError('unsupported wire type %d' % wire_type)
+        fields.setdefault(key >> 3, []).append(value)
+    return fields
+
+
+def pb_varint(value):
+    out = bytearray()
+    value &= (1 << 64) - 1
+    while True:
+        b = value & 0x7f
+        value >>= 7
+        if value:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def pb_field_varint(number, value):
+    return pb_varint(number << 3) + pb_varint(value) if value else b''
+
+
+def pb_field_bytes(number, value):
+    if isinstance(value, str):
+        value = value.encode()
+    return pb_varint((number << 3) | 2) + pb_varint(len(value)) + value
+
+
+def pb_field_fixed32(number, value):
+    return pb_varint((number << 3) | 5) + value.to_bytes(4, 'little') if value else b''
+
+
+def pb_packed_varints(values):
+    '''Returns the ints of a repeated varint field, packed or not.'''
+    out = []
+    for value in values:
+        if isinstance(value, int):
+            out.append(value)
+            continue
+        pos = 0
+        while pos < len(value):
+            item, pos = pb_read_varint(value, pos)
+            out.append(item)
+    return out
+
+
+def pb_first(fields, number, default=None):
+    return fields.get(number, [default])[0]
+
+
+def pb_zigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def pb_int(value, bits):
+    '''Reinterprets a decoded varint as a signed intN.'''
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def coap_parse(data):
+    '''Returns (type, code, message id, token, {option: [values]}, payload).'''
+    if len(data) < 4 or data[0] >> 6 != 1:
+        raise ValueError('not a CoAP message')
+    mtype = (data[0] >> 4) & 3
+    tkl = data[0] & 0xf
+    code = data[1]
+    mid = int.from_bytes(data[2:4], 'big')
+    token = bytes(data[4:4 + tkl])
+    pos = 4 + tkl
+    options = {}
+    number = 0
+    while pos < len(data) and data[pos] != 0xff:
+        delta, length = data[pos] >> 4, data[pos] & 0xf
+        pos += 1
+        values = []
+        for nibble in (delta, length):
+            if nibble == 13:
+                values.append(data[pos] + 13)
+                pos += 1
+            elif nibble == 14:
+                values.append(int.from_bytes(data[pos:pos + 2], 'big') + 269)
+                pos += 2
+            elif nibble == 15:
+                raise ValueError('bad option')
+            else:
+                values.append(nibble)
+        number += values[0]
+        options.setdefault(number, []).append(bytes(data[pos:pos + values[1]]))
+        pos += values[1]
+    payload = bytes(data[pos + 1:]) if pos < len(data) else b''
+    return mtype, code, mid, token, options, payload
+
+
+def coap_message(mtype, code, mid, token, payload=b''):
+    head = bytes([0x40 | mtype << 4 | len(token), code]) + mid.to_bytes(2, 'big') + token
+    return head + (b'\xff' + payload if payload else b'')
+
+
+def mqtt_packet(ptype, flags, body=b''):
+    head = bytearray([ptype << 4 | flags])
+    length = len(body)
+    while True:
+        b = length & 0x7f
+        length >>= 7
+        head.append(b | 0x80 if length else b)
+        if not length:
+            return bytes(head) + body
+
+
+def mqtt_string(data, pos):
+    '''Returns (bytes, next position) of a length-prefixed string.'''
+    length = int.from_bytes(data[pos:pos + 2], 'big')
+    return bytes(data[pos + 2:pos + 2 + length]), pos + 2 + length
+
+
+def mqtt_encode_string(value):
+    if isinstance(value, str):
+        value = value.encode()
+    return len(value).to_bytes(2, 'big') + value
+
+
+def mqtt_topic_matches(topic_filter, topic):
+    parts = topic.split('/')
+    for i, level in enumerate(topic_filter.split('/')):
+        if level == '#':
+            return True
+        if i >= len(parts) or (level != '+' and level != parts[i]):
+            return False
+    return len(topic_filter.split('/')) == len(parts)
+
+
+# RequestTrace fields, in field number order from 1.
+TRACE_FIELDS = ('endpoint', 'result', 'dns_ms', 'socket_ms', 'connect_ms', 'sent_ms',
+                'first_byte_ms', 'done_ms', 'age_ms', 'tls_ms')
+
+# DataUsage fields, in field number order from 1.
+DATA_USAGE_FIELDS = ('endpoint', 'requests', 'tx_payload', 'rx_payload', 'tx_http', 'rx_http',
+                     'tx_at', 'rx_at', 'tx_packets', 'rx_packets')
+
+# MetricSummary fields, in field number order from 1, and the sint32 ones.
+SUMMARY_FIELDS = ('metric', 'age_ms', 'duration_ms', 'count', 'min', 'max', 'mean', 'stddev',
+                  'p50', 'p90', 'p99')
+SUMMARY_SIGNED = ('min', 'max', 'mean', 'p50', 'p90', 'p99')
+
+
+def metric_rule(text):
+    '''Parses --metric-rule metric:type:threshold[:hysteresis] into a MetricRule.'''
+    parts = text.split(':')
+    if len(parts) not in (3, 4) or parts[1] not in METRIC_RULE_TYPES:
+        raise argparse.ArgumentTypeError('expected metric:above|below|rate:threshold'
+                                         '[:hysteresis], got %r' % text)
+    threshold = int(parts[2])
+    rule = pb_field_varint(1, int(parts[0])) + pb_field_varint(2, METRIC_RULE_TYPES[parts[1]])
+    rule += pb_field_varint(3, (threshold << 1) ^ (threshold >> 31))
+    rule += pb_field_varint(4, int(parts[3]) if len(parts) == 4 else 0)
+    return rule
+
+
+def metric_config(window_s, rules):
+    '''Returns the id and encoded MetricConfig, or (0, b'') to leave the device default.'''
+    if not window_s and not rules:
+        return 0, b''
+    body = pb_field_varint(2, window_s) + b''.join(pb_field_bytes(3, r) for r in rules)
+    config_id = zlib.crc32(body) or 1
+    return config_id, pb_field_fixed32(1, config_id) + body
+
+
+# Field number in StatusDelta of each status value sent as a delta.
+STATUS_FIELDS = {
+    'boot_count': 1,
+    'uptime_ticks': 2,
+    'ticks': 3,
+    'button_press_count': 4,
+}
+
+
+class BackendApi:
+    '''The protobuf endpoints, shared by the HTTP and CoAP handlers.'''
+
+    def endpoints(self):
+        return {
+            '/status_update': self.handle_status_update,
+            '/ota': self.handle_ota,
+            '/check_in': self.handle_check_in,
+        }
+
+    def inject_latency(self):
+        if self.server.latency_ms:
+            time.sleep(self.server.latency_ms / 1000.0)
+
+    def ota_update_response(self, ota_state):
+        '''Encodes an OTAUpdateResponse for a device in the given state.'''
+        path = self.server.ota_path
+        do_update = bool(path) and ota_state not in (OTA_STATE_DOWNLOADED,
+                                                     OTA_STATE_PERSISTED)
+        return pb_field_varint(1, do_update) + (pb_field_bytes(2, path) if path else b'')
+
+    def status_update_response(self, status):
+        # Echo the boot count so the device can tell the ack is for it.
+        return (pb_field_bytes(1, 'ok %d' % pb_first(status, 2, 0)) +
+                pb_field_fixed32(2, self.handle_stats(status)) +
+                self.metric_config_update(status, 18))
+
+    def metric_config_update(self, request, number):
+        '''Returns the MetricConfig field of a StatusUpdateResponse, if the
+        device does not report the one configured here in field @number.'''
+        device_id = int.from_bytes(pb_first(request, number, bytes(4)), 'little')
+        if device_id == self.server.metric_config_id:
+            return b''
+        self.log_message('metrics: device runs config %08x, sending %08x', device_id,
+                         self.server.metric_config_id)
+        return pb_field_bytes(3, self.server.metric_config)
+
+    def log_metrics(self, request, summaries, events):
+        for data in request.get(summaries, []):
+            fields = pb_decode(data)
+            values = {name: pb_first(fields, num, 0)
+                      for num, name in enumerate(SUMMARY_FIELDS, 1)}
+            for name in SUMMARY_SIGNED:
+                values[name] = pb_zigzag(values[name])
+            self.log_message('summary: %s', ' '.join('%s=%d' % kv for kv in values.items()))
+        for data in request.get(events, []):
+            fields = pb_decode(data)
+            self.log_message('event: metric=%d rule=%d %s value=%d age_ms=%d',
+                             pb_first(fields, 1, 0), pb_first(fields, 2, 0),
+                             'cleared' if pb_first(fields, 3, 0) else 'raised',
+                             pb_zigzag(pb_first(fields, 4, 0)), pb_first(fields, 5, 0))
+
+    def handle_stats(self, status):
+        '''Logs the StatsReport in a status; returns the dict_id we have names for.'''
+        if 14 not in status:
+            return 0
+        report = pb_decode(status[14][0])
+        dict_id = int.from_bytes(pb_first(report, 1, bytes(4)), 'little')
+        values = pb_packed_varints(report.get(3, []))
+        with self.server.lock:
+            if 2 in report:
+                names = {}
+                for data in report[2]:
+                    entry = pb_decode(data)
+                    names[pb_first(entry, 1, 0)] = pb_first(entry, 2, b'').decode()
+                self.server.stat_dicts[dict_id] = names
+            names = self.server.stat_dicts.get(dict_id)
+        if names is None:
+            self.log_message('stats: unknown dictionary %08x, asking for names', dict_id)
+            return 0
+        self.log_message('stats: %d values, %d bytes (names %s)', len(values),
+                         len(status[14][0]), 'sent' if 2 in report else 'cached')
+        for stat_id, value in enumerate(values):
+            if value:
+                self.log_message('stat: %s=%d', names.get(stat_id, '#%d' % stat_id), value)
+        return dict_id
+
+    def log_traces(self, traces):
+        for data in traces:
+            trace = pb_decode(data)
+            values = {name: pb_first(trace, num, 0) for num, name in enumerate(TRACE_FIELDS, 1)}
+            values['result'] = pb_zigzag(values['result'])
+            self.log_message('trace: %s', ' '.join('%s=%d' % kv for kv in values.items()))
+
+    def log_data_usage(self, usage):
+        for data in usage:
+            fields = pb_decode(data)
+            values = {name: pb_first(fields, num, 0)
+                      for num, name in enumerate(DATA_USAGE_FIELDS, 1)}
+            self.log_message('usage: %s', ' '.join('%s=%d' % kv for kv in values.items()))
+
+    def log_threads(self, threads):
+        for data in threads:
+            fields = pb_decode(data)
+            name = pb_first(fields, 1, b'').decode(errors='replace')
+            permille = pb_first(fields, 2, 0)
+            self.log_message('thread: %s cpu=%d.%d%% stack=%d/%d%s', name,
+                             permille // 10, permille % 10, pb_first(fields, 3, 0),
+                             pb_first(fields, 4, 0), ' over' if pb_first(fields, 5, 0) else '')
+
+    def log_boot(self, status):
+        if 15 not in status:
+            return
+        boot = pb_decode(status[15][0])
+        for number, label in ((1, 'boot'), (2, 'incomplete previous boot')):
+            marks = [pb_decode(data) for data in boot.get(number, [])]
+            if marks:
+                self.log_message('%s: %s', label, ' '.join(
+                    '%s=%.1fms' % (pb_first(m, 1, b'').decode(), pb_first(m, 2, 0) / 1000)
+                    for m in marks))
+
+    def handle_status_update(self, request):
+        self.log_traces(request.get(11, []))
+        self.log_data_usage(request.get(12, []))
+        self.log_threads(request.get(13, []))
+        self.log_boot(request)
+        self.log_metrics(request, 16, 17)
+        return self.status_update_response(request)
+
+    def handle_ota(self, request):
+        return self.ota_update_response(pb_first(request, 2, 0))
+
+    def check_in_status(self, request):
+        '''Returns the device status and (token, ack_seq) for a check-in.'''
+        server = self.server
+        seq = pb_first(request, 4, 0)
+        if 1 in request:
+            status = pb_decode(request[1][0])
+            stats = pb_decode(pb_first(status, 10, b''))
+            state = {
+                'boot_count': pb_int(pb_first(status, 2, 0), 32),
+                'uptime_ticks': pb_int(pb_first(status, 3, 0), 64),
+                'ticks': pb_int(pb_first(stats, 1, 0), 32),
+                'button_press_count': pb_int(pb_first(stats, 2, 0), 32),
+            }
+            token = random.randint(1, 0xffffffff)
+            kept = {}
+        else:
+            token = pb_first(request, 5, 0)
+            delta = pb_decode(pb_first(request, 7, b''))
+            base_seq = pb_first(request, 6, 0)
+            with server.lock:
+                base = server.sessions.get(token, {}).get(base_seq)
+            if base is None:
+                self.log_message('check_in: unknown session %d, asking for resync', token)
+                return None, 0, 0
+            state = {name: base[name] + pb_zigzag(pb_first(delta, num, 0))
+                     for name, num in STATUS_FIELDS.items()}
+            # The device keeps using this base if the ack gets lost.
+            kept = {base_seq: base}
+        with server.lock:
+            server.sessions[token] = {**kept, seq: state}
+        self.log_message('check_in: %s', state)
+        return state, token, seq
+
+    def handle_check_in(self, request):
+        self.log_traces(request.get(8, []))
+        self.log_metrics(request, 9, 10)
+        state, token, ack_seq = self.check_in_status(request)
+        ack = pb_field_bytes(1, 'ok %d' % state['boot_count'] if state else 'resync')
+        if 1 in request:
+            status = pb_decode(request[1][0])
+            self.log_boot(status)
+            ack += pb_field_fixed32(2, self.handle_stats(status))
+        # Metrics go at the top level, so delta check-ins get the config too.
+        ack += self.metric_config_update(request, 11)
+        rsp = pb_field_bytes(1, ack)
+        rsp += pb_field_bytes(2, self.ota_update_response(pb_first(request, 2, 0)))
+        if self.server.blink_ms:
+            rsp += pb_field_bytes(3, pb_field_varint(1, self.server.blink_ms))
+        rsp += pb_field_varint(4, ack_seq)
+        rsp += pb_field_varint(5, token)
+        return rsp
+
+
+class BackendHandler(BackendApi, http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    server_version = 'embsys-local-backend'
+
+    def log_request(self, code='-', size='-'):
+        # Requests are logged with timing in send_body instead.
+        pass
+
+    def resolve(self):
+        path = os.path.normpath(self.path.split('?', 1)[0]).lstrip('/')
+        full = os.path.join(self.server.root, path)
+        if not os.path.realpath(full).startswith(os.path.realpath(self.server.root)):
+            return None
+        return full if os.path.isfile(full) else None
+
+    def parse_range(self, size):
+        header = self.headers.get('Range')
+        if header is None:
+            return None
+        m = RANGE_RE.match(header.strip())
+        if not m or (not m.group(1) and not m.group(2)):
+            return 'invalid'
+        if m.group(1):
+            start = int(m.group(1))
+            end = int(m.group(2)) if m.group(2) else size - 1
+        else:
+            start = max(size - int(m.group(2)), 0)
+            end = size - 1
+        end = min(end, size - 1)
+        if start > end:
+            return 'invalid'
+        return (start, end)
+
+    def send_body(self, f, length, started):
+        sent = 0
+        while sent < length:
+            chunk = f.read(min(CHUNK_SIZE, length - sent))
+            if not chunk:
+                break
+            self.wfile.write(chunk)
+            sent += len(chunk)
+            if self.server.bandwidth:
+                # Sleep until the cap allows the bytes sent so far.
+                ahead = sent / self.server.bandwidth - (time.monotonic() - started)
+                if ahead > 0:
+                    time.sleep(ahead)
+        elapsed = time.monotonic() - started
+        rate = sent / elapsed if elapsed > 0 else 0
+        self.log_message('%s %s %s: %d bytes in %.3f s (%.0f B/s)', self.command,
+                         self.path, self.headers.get('Range', 'full'), sent,
+                         elapsed, rate)
+
+    def serve_file(self, head_only):
+        started = time.monotonic()
+        self.inject_latency()
+
+        full = self.resolve()
+        if full is None:
+            self.send_error(404)
+            return
+
+        pushed_at = self.server.ota_pushed_at
+        if pushed_at is not None and self.path == self.server.ota_path:
+            self.server.ota_pushed_at = None
+            self.log_message('OTA push -> %s %s after %.3f s', self.command, self.path,
+                             time.monotonic() - pushed_at)
+
+        size = os.path.getsize(full)
+        byte_range = self.parse_range(size)
+        if byte_range == 'invalid':
+            self.send_response(416)
+            self.send_header('Content-Range', 'bytes */%d' % size)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return
+
+        if byte_range is None:
+            start, end = 0, size - 1
+            self.send_response(200)
+        else:
+            start, end = byte_range
+            self.send_response(206)
+            self.send_header('Content-Range', 'bytes %d-%d/%d' % (start, end, size))
+        length = end - start + 1
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Content-Length', str(length))
+        self.send_header('Accept-Ranges', 'bytes')
+        self.end_headers()
+
+        if head_only:
+            return
+        with open(full, 'rb') as f:
+            f.seek(start)
+            self.send_body(f, length, started)
+
+    def do_HEAD(self):
+        self.serve_file(head_only=True)
+
+    def do_GET(self):
+        self.serve_file(head_only=False)
+
+    def read_request_body(self):
+        '''Reads a Content-Length or chunked body; returns (body, wire bytes).'''
+        if self.headers.get('Transfer-Encoding', '').lower() == 'chunked':
+            body = b''
+            wire = 0
+            while True:
+                line = self.rfile.readline()
+                wire += len(line)
+                size = int(line.split(b';', 1)[0], 16)
+                chunk = self.rfile.read(size + 2)
+                wire += len(chunk)
+                if size == 0:
+                    return body, wire
+                body += chunk[:size]
+        length = int(self.headers.get('Content-Length', 0))
+        body = self.rfile.read(length)
+        return body, length
+
+    def do_POST(self):
+        handlers = self.endpoints()
+        started = time.monotonic()
+        # The request line and headers count towards the bytes received.
+        head_len = len(self.requestline) + 2 + len(bytes(self.headers)) + 2
+        body, body_wire = self.read_request_body()
+        self.inject_latency()
+
+        content_type = 'application/x-protobuf'
+        handler = handlers.get(self.path)
+        if self.path == '/post':
+            # Stands in for httpbin.org for the generic request.
+            rsp = json.dumps({'data': body.decode('latin-1'),
+                              'url': 'http://%s/post' % self.headers.get('Host', '')}).encode()
+            content_type = 'application/json'
+        elif handler is None:
+            self.send_error(404)
+            return
+        else:
+            try:
+                rsp = handler(pb_decode(body))
+            except (ValueError, IndexError) as e:
+                self.log_message('%s: bad request: %s', self.path, e)
+                self.send_error(400)
+                return
+
+        head = ('%s 200 OK\r\nContent-Type: %s\r\n'
+                'Content-Length: %d\r\n\r\n' % (self.protocol_version, content_type, len(rsp)))
+        self.wfile.write(head.encode() + rsp)
+        self.close_connection = True
+        self.log_message('POST %s: %d bytes in (%d body), %d bytes out (%d body) in %.3f s',
+                         self.path, head_len + body_wire, len(body),
+                         len(head) + len(rsp), len(rsp), time.monotonic() - started)
+
+
+class ServerLog:
+    '''Logs like http.server does, for the handlers that are not HTTP.'''
+
+    def log_message(self, fmt, *args):
+        sys.stderr.write('%s - - [%s] %s\n' % (self.client_address[0],
+                                               time.strftime('%d/%b/%Y %H:%M:%S'), fmt % args))
+
+
+class CoapHandler(ServerLog, BackendApi, socketserver.BaseRequestHandler):
+
+    def handle(self):
+        data, sock = self.request
+        try:
+            mtype, code, mid, token, options, payload = coap_parse(data)
+        except (ValueError, IndexError) as e:
+            self.log_message('CoAP: dropped %d bytes: %s', len(data), e)
+            return
+        if mtype not in (COAP_CON, COAP_NON):
+            return
+        if code == COAP_EMPTY:
+            # A CoAP ping is answered with a reset.
+            sock.sendto(coap_message(COAP_RST, COAP_EMPTY, mid, b''), self.client_address)
+            return
+
+        key = (self.client_address, mid)
+        with self.server.lock:
+            cached = self.server.coap_responses.get(key)
+        if cached is not None:
+            self.log_message('CoAP: retransmission of %04x, resending the response', mid)
+            sock.sendto(cached, self.client_address)
+            return
+
+        started = time.monotonic()
+        path = '/' + '/'.join(v.decode(errors='replace')
+                              for v in options.get(COAP_OPTION_URI_PATH, []))
+        self.inject_latency()
+        handler = self.endpoints().get(path)
+        body = b''
+        if code != COAP_POST:
+            rsp_code = COAP_METHOD_NOT_ALLOWED
+        elif handler is None:
+            rsp_code = COAP_NOT_FOUND
+        else:
+            try:
+                body = handler(pb_decode(payload))
+                rsp_code = COAP_CHANGED
+            except (ValueError, IndexError) as e:
+                self.log_message('CoAP %s: bad request: %s', path, e)
+                rsp_code = COAP_BAD_REQUEST
+
+        if mtype == COAP_CON:
+            rsp = coap_message(COAP_ACK, rsp_code, mid, token, body)
+        else:
+            rsp = coap_message(COAP_NON, rsp_code, random.getrandbits(16), token, body)
+        with self.server.lock:
+            cache = self.server.coap_responses
+            cache[key] = rsp
+            while len(cache) > COAP_CACHE_SIZE:
+                cache.popitem(last=False)
+        sock.sendto(rsp, self.client_address)
+        self.log_message('CoAP POST %s: %d bytes in (%d body), %d bytes out (%d body) in %.3f s',
+                         path, len(data), len(payload), len(rsp), len(body),
+                         time.monotonic() - started)
+
+
+class CoapServer(socketserver.ThreadingUDPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, args, backend):
+        super().__init__((args.host, args.coap_port), CoapHandler)
+        self.backend = backend
+        self.coap_responses = collections.OrderedDict()
+
+    def __getattr__(self, name):
+        # Sessions, settings and the lock are those of the HTTP server.
+        return getattr(self.backend, name)
+
+
+class MqttSession:
+    '''What the broker keeps of a client ID across connections.'''
+
+    def __init__(self, client_id):
+        self.client_id = client_id
+        # topic filter -> granted QoS
+        self.subscriptions = {}
+        # QoS 1 messages not acknowledged yet: packet id -> (topic, payload, queued at)
+        self.inflight = collections.OrderedDict()
+        self.next_id = 1
+        self.handler = None
+        self.lock = threading.Lock()
+
+    def qos_for(self, topic):
+        granted = [qos for f, qos in self.subscriptions.items() if mqtt_topic_matches(f, topic)]
+        return max(granted) if granted else None
+
+    def deliver(self, topic, payload):
+        '''Sends to the client if connected; QoS 1 is kept until acknowledged.'''
+        with self.lock:
+            qos = self.qos_for(topic)
+            if qos is None:
+                return
+            packet_id = 0
+            if qos:
+                packet_id = self.next_id
+                self.next_id = self.next_id % 0xffff + 1
+                self.inflight[packet_id] = (topic, payload, time.monotonic())
+            handler = self.handler
+        if handler is not None:
+            handler.send_publish(topic, payload, qos, packet_id)
+
+    def resend(self, handler):
+        with self.lock:
+            pending = list(self.inflight.items())
+        for packet_id, (topic, payload, _) in pending:
+            handler.send_publish(topic, payload, 1, packet_id, dup=True)
+
+
+class MqttHandler(ServerLog, BackendApi, socketserver.StreamRequestHandler):
+    def read_packet(self):
+        '''Returns (type, flags, body), or None when the connection ends.'''
+        head = self.rfile.read(1)
+        if not head:
+            return None
+        length = shift = 0
+        while True:
+            b = self.rfile.read(1)
+            if not b:
+                return None
+            length |= (b[0] & 0x7f) << shift
+            shift += 7
+            if not b[0] & 0x80:
+                break
+        body = self.rfile.read(length)
+        if len(body) < length:
+            return None
+        return head[0] >> 4, head[0] & 0xf, body
+
+    def send_packet(self, ptype, flags, body=b''):
+        with self.write_lock:
+            self.wfile.write(mqtt_packet(ptype, flags, body))
+
+    def send_publish(self, topic, payload, qos, packet_id, dup=False):
+        body = mqtt_encode_string(topic) + (packet_id.to_bytes(2, 'big') if qos else b'')
+        try:
+            self.send_packet(MQTT_PUBLISH, (dup << 3) | (qos << 1), body + payload)
+        except OSError:
+            # Kept in the session and resent on the next connection.
+            pass
+
+    def on_connect(self, body):
+        _, pos = mqtt_string(body, 0)
+        flags = body[pos + 1]
+        keepalive = int.from_bytes(body[pos + 2:pos + 4], 'big')
+        client_id, _ = mqtt_string(body, pos + 4)
+        client_id = client_id.decode(errors='replace')
+        clean = bool(flags & 0x02)
+
+        server = self.server
+        with server.lock:
+            session = server.mqtt_sessions.get(client_id)
+            present = session is not None and not clean
+            if not present:
+                session = MqttSession(client_id)
+                server.mqtt_sessions[client_id] = session
+        with session.lock:
+            previous, session.handler = session.handler, self
+        if previous is not None:
+            # A client reconnecting takes over its session.
+            previous.request.close()
+        self.session = session
+        if keepalive:
+            # The broker gives up after one and a half keepalives of silence.
+            self.request.settimeout(keepalive * 1.5)
+        self.send_packet(MQTT_CONNACK, 0, bytes([present, 0]))
+        self.log_message('MQTT connect %s: %s session, keepalive %d s', client_id,
+                         'resumed' if present else 'new', keepalive)
+        session.resend(self)
+
+    def on_subscribe(self, body):
+        granted = []
+        pos = 2
+        while pos < len(body):
+            topic_filter, pos = mqtt_string(body, pos)
+            qos = min(body[pos], 1)
+            pos += 1
+            with self.session.lock:
+                self.session.subscriptions[topic_filter.decode(errors='replace')] = qos
+            granted.append(qos)
+        self.send_packet(MQTT_SUBACK, 0, body[:2] + bytes(granted))
+        self.log_message('MQTT subscribe %s: %s', self.session.client_id,
+                         ' '.join(sorted(self.session.subscriptions)))
+        self.server.schedule_push(self)
+
+    def on_puback(self, body):
+        packet_id = int.from_bytes(body[:2], 'big')
+        with self.session.lock:
+            message = self.session.inflight.pop(packet_id, None)
+        if message is not None:
+            topic, payload, queued = message
+            self.log_message('MQTT %s: %d bytes delivered in %.3f s', topic, len(payload),
+                             time.monotonic() - queued)
+
+    def on_publish(self, flags, body):
+        started = time.monotonic()
+        qos = (flags >> 1) & 3
+        topic, pos = mqtt_string(body, 0)
+        topic = topic.decode(errors='replace')
+        if qos:
+            self.send_packet(MQTT_PUBACK, 0, body[pos:pos + 2])
+            pos += 2
+        payload = body[pos:]
+
+        prefix, _, name = topic.rpartition('/')
+        handler = self.endpoints().get('/' + name)
+        if not prefix.startswith(MQTT_TOPIC_ROOT) or handler is None:
+            # Anything else is only brokered.
+            self.server.mqtt_publish(topic, payload)
+            return
+        self.inject_latency()
+        try:
+            rsp = handler(pb_decode(payload))
+        except (ValueError, IndexError) as e:
+            self.log_message('MQTT %s: bad request: %s', topic, e)
+            return
+        self.server.mqtt_publish(topic + '/rsp', rsp)
+        # The fixed header is 2 bytes for these sizes.
+        self.log_message('MQTT PUBLISH %s: %d bytes in (%d body), %d bytes out (%d body) '
+                         'in %.3f s', topic, 2 + len(body), len(payload),
+                         2 + len(mqtt_encode_string(topic + '/rsp')) + 2 + len(rsp), len(rsp),
+                         time.monotonic() - started)
+
+    def handle(self):
+        self.write_lock = threading.Lock()
+        self.session = None
+        packet = self.read_packet()
+        if packet is None or packet[0] != MQTT_CONNECT:
+            return
+        self.on_connect(packet[2])
+        reason = 'closed'
+        try:
+            while True:
+                packet = self.read_packet()
+                if packet is None:
+                    break
+                ptype, flags, body = packet
+                if ptype == MQTT_PUBLISH:
+                    self.on_publish(flags, body)
+                elif ptype == MQTT_PUBACK:
+                    self.on_puback(body)
+                elif ptype == MQTT_SUBSCRIBE:
+                    self.on_subscribe(body)
+                elif ptype == MQTT_PINGREQ:
+                    self.send_packet(MQTT_PINGRESP, 0)
+                elif ptype == MQTT_DISCONNECT:
+                    reason = 'disconnected'
+                    break
+        except TimeoutError:
+            reason = 'keepalive expired'
+        except OSError as e:
+            reason = str(e)
+        with self.session.lock:
+            if self.session.handler is self:
+                self.session.handler = None
+        self.log_message('MQTT %s: %s, %d messages pending', self.session.client_id, reason,
+                         len(self.session.inflight))
+
+
+class MqttServer(socketserver.ThreadingTCPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, args, backend):
+        super().__init__((args.host, args.mqtt_port), MqttHandler)
+        self.backend = backend
+        self.push_ota_after = args.push_ota_after
+        # client ID -> MqttSession
+        self.mqtt_sessions = {}
+        self.push_scheduled = False
+
+    def __getattr__(self, name):
+        # Sessions, settings and the lock are those of the HTTP server.
+        return getattr(self.backend, name)
+
+    def mqtt_publish(self, topic, payload):
+        with self.lock:
+            sessions = list(self.mqtt_sessions.values())
+        for session in sessions:
+            session.deliver(topic, payload)
+
+    def schedule_push(self, handler):
+        '''Pushes the update once, --push-ota-after seconds after the first subscription.'''
+        if not self.push_ota_after or not self.ota_path:
+            return
+        with self.lock:
+            if self.push_scheduled:
+                return
+            self.push_scheduled = True
+        topic = MQTT_TOPIC_ROOT + handler.session.client_id.split('-', 1)[-1] + '/ota'
+        payload = handler.ota_update_response(0)
+        threading.Timer(self.push_ota_after, self.push, (topic, payload)).start()
+
+    def push(self, topic, payload):
+        sys.stderr.write('MQTT push of %s to %s\n' % (self.ota_path, topic))
+        self.backend.ota_pushed_at = time.monotonic()
+        self.mqtt_publish(topic, payload)
+
+
+class TlsHandler(BackendHandler):
+    def setup(self):
+        started = time.monotonic()
+        self.request = self.server.context.wrap_socket(self.request, server_side=True,
+                                                       do_handshake_on_connect=False)
+        self.tls_error = None
+        try:
+            self.request.do_handshake()
+        except (ssl.SSLError, OSError) as e:
+            self.tls_error = e
+        super().setup()
+        if self.tls_error:
+            self.log_message('TLS handshake failed: %s', self.tls_error)
+            return
+        self.log_message('TLS handshake: %s, %s, %.3f s',
+                         'resumed' if self.request.session_reused else 'full',
+                         self.request.cipher()[0], time.monotonic() - started)
+
+    def handle(self):
+        if not self.tls_error:
+            super().handle()
+
+
+class TlsServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, args, backend):
+        super().__init__((args.host, args.tls_port), TlsHandler)
+        self.backend = backend
+        self.context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        self.context.load_cert_chain(args.tls_cert, args.tls_key)
+
+    def __getattr__(self, name):
+        # Sessions, settings and the lock are those of the HTTP server.
+        return getattr(self.backend, name)
+
+
+class BackendServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, args):
+        super().__init__((args.host, args.port), BackendHandler)
+        self.root = args.root
+        self.latency_ms = args.latency_ms
+        self.bandwidth = args.bandwidth
+        self.ota_path = args.ota_path
+        # session token -> {seq: acknowledged status}
+        self.sessions = {}
+        # StatsReport dictionaries by dict_id: {stat id: name}.
+        self.stat_dicts = {}
+        self.lock = threading.Lock()
+        self.blink_ms = args.blink_ms
+        self.metric_config_id, self.metric_config = metric_config(args.metric_window_s,
+                                                                  args.metric_rule)
+        # When an update was last pushed over MQTT, until the device fetches it.
+        self.ota_pushed_at = None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[1],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--host', default='0.0.0.0', help='address to bind')
+    parser.add_argument('--port', type=int, default=8080, help='port to listen on')
+    parser.add_argument('--root', default='.', help='directory of firmware images')
+    parser.add_argument('--latency-ms', type=int, default=0,
+                        help='delay added before every response')
+    parser.add_argument('--bandwidth', type=int, default=0,
+                        help='per-connection body rate cap in bytes/s (0 = none)')
+    parser.add_argument('--ota-path', default='',
+                        help='image path offered to devices (default: no update)')
+    parser.add_argument('--blink-ms', type=int, default=0,
+                        help='blink interval pushed in DeviceConfig (0 = none)')
+    parser.add_argument('--metric-window-s', type=int, default=0,
+                        help='metric aggregation window sent in MetricConfig '
+                             '(0 = device default)')
+    parser.add_argument('--metric-rule', type=metric_rule, action='append', default=[],
+                        help='metric:above|below|rate:threshold[:hysteresis], sent in '
+                             'MetricConfig; may be repeated')
+    parser.add_argument('--coap-port', type=int, default=5683,
+                        help='UDP port of the CoAP endpoints (0 = none)')
+    parser.add_argument('--mqtt-port', type=int, default=0,
+                        help='port of the MQTT broker stand-in (0 = none)')
+    parser.add_argument('--push-ota-after', type=float, default=0,
+                        help='push --ota-path over MQTT this many seconds after a device '
+                             'subscribes (0 = never)')
+    parser.add_argument('--tls-port', type=int, default=0,
+                        help='port of the HTTP endpoints over TLS (0 = none)')
+    parser.add_argument('--tls-cert', default='backend.pem',
+                        help='certificate served on --tls-port, PEM')
+    parser.add_argument('--tls-key', default='backend.key',
+                        help='private key of --tls-cert, PEM')
+    args = parser.parse_args()
+
+    server = BackendServer(args)
+    print('Serving %s on %s:%d (latency %d ms, bandwidth %s)' %
+          (args.root, args.host, args.port, args.latency_ms,
+           '%d B/s' % args.bandwidth if args.bandwidth else 'unlimited'))
+    if args.coap_port:
+        coap = CoapServer(args, server)
+        threading.Thread(target=coap.serve_forever, daemon=True).start()
+        print('Serving CoAP on %s:%d' % (args.host, args.coap_port))
+    if args.mqtt_port:
+        mqtt = MqttServer(args, server)
+        threading.Thread(target=mqtt.serve_forever, daemon=True).start()
+        print('Serving MQTT on %s:%d' % (args.host, args.mqtt_port))
+    if args.tls_port:
+        tls = TlsServer(args, server)
+        threading.Thread(target=tls.serve_forever, daemon=True).start()
+        print('Serving HTTPS on %s:%d' % (args.host, args.tls_port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,281 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file benchmark hot paths of the app and the modem driver
+ *
+ * Each test times one path and prints a line of the form
+ *
+ *   BENCH {"name":"...","iters":N,"ns_per_op":N,"cycles_per_op":N,...}
+ *
+ * which scripts/bench_compare.py checks against the baselines/ of the
+ * platform. On native_posix the simulated clock does not advance while code
+ * runs, so the host clock is used and there is no cycle count.
+ */
+
+#include <string.h>
+#if defined(CONFIG_ARCH_POSIX)
+#include <time.h>
+#endif
+
+#include <zephyr/kernel.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/storage/stream_flash.h>
+#include <zephyr/ztest.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(hot_paths, LOG_LEVEL_INF);
+
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include "api/api.pb.h"
+
+#include "quectel-bg96-parse.h"
+
+/* As in app/src/main.c. */
+#define OTA_FLASH_BUF_LEN 512
+#define MAX_RECV_BUF_LEN 1024
+#define OTA_IMAGE_SIZE (32 * 1024)
+
+struct bench_clock {
+	uint64_t ns;
+	uint32_t cycles;
+};
+
+/* Keeps results alive so the timed calls are not optimized out. */
+static volatile uint32_t sink_;
+
+static StatusUpdateRequest status_;
+static uint8_t pb_buf_[1024];
+static uint8_t flash_buf_[OTA_FLASH_BUF_LEN];
+static uint8_t image_[MAX_RECV_BUF_LEN];
+
+static struct bench_clock bench_now(void)
+{
+	struct bench_clock now = {0};
+
+#if defined(CONFIG_ARCH_POSIX)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now.ns = (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#else
+	now.cycles = k_cycle_get_32();
+#endif
+	return now;
+}
+
+static struct bench_clock bench_elapsed(struct bench_clock start)
+{
+	struct bench_clock end = bench_now();
+
+	return (struct bench_clock){
+		.ns = end.ns - start.ns,
+		.cycles = end.cycles - start.cycles,
+	};
+}
+
+static void bench_report(const char *name, uint32_t iters, struct bench_clock elapsed,
+			 size_t bytes_per_op)
+{
+	uint64_t ns = IS_ENABLED(CONFIG_ARCH_POSIX) ? elapsed.ns
+						    : k_cyc_to_ns_floor64(elapsed.cycles);
+	uint32_t bytes_per_sec = ns ? (uint32_t)((uint64_t)bytes_per_op * iters * NSEC_PER_SEC / ns)
+				    : 0;
+	char cycles_field[32] = "";
+
+	if (!IS_ENABLED(CONFIG_ARCH_POSIX)) {
+		snprintk(cycles_field, sizeof(cycles_field), ",\"cycles_per_op\":%u",
+			 elapsed.cycles / iters);
+	}
+	printk("BENCH {\"name\":\"%s\",\"iters\":%u,\"ns_per_op\":%u%s,\"bytes_per_op\":%u,"
+	       "\"bytes_per_sec\":%u}\n",
+	       name, iters, (uint32_t)(ns / iters), cycles_field, (uint32_t)bytes_per_op,
+	       bytes_per_sec);
+}
+
+/* A status update with every repeated field full, as after a busy period. */
+static void fill_status(StatusUpdateRequest *status)
+{
+	memset(status, 0, sizeof(*status));
+	strcpy(status->device_id, "12345");
+	status->boot_count = 42;
+	status->uptime_ticks = 123456789;
+	status->has_app_stats = true;
+	status->app_stats.ticks = 3600;
+	status->app_stats.button_press_count = 7;
+
+	status->traces_count = ARRAY_SIZE(status->traces);
+	for (size_t i = 0; i < ARRAY_SIZE(status->traces); i++) {
+		status->traces[i] = (RequestTrace){
+			.endpoint = RequestEndpoint_REQUEST_ENDPOINT_CHECK_IN,
+			.result = i == 0 ? -116 : 0,
+			.dns_ms = 350,
+			.socket_ms = 360,
+			.connect_ms = 1250,
+			.sent_ms = 1400,
+			.first_byte_ms = 2100,
+			.done_ms = 2150,
+			.age_ms = 60000 * i,
+		};
+	}
+	status->data_usage_count = ARRAY_SIZE(status->data_usage);
+	for (size_t i = 0; i < ARRAY_SIZE(status->data_usage); i++) {
+		status->data_usage[i] = (DataUsage){
+			.endpoint = i,
+			.requests = 100 + i,
+			.tx_payload_bytes = 25000,
+			.rx_payload_bytes = 400000,
+			.tx_http_bytes = 40000,
+			.rx_http_bytes = 420000,
+			.tx_at_bytes = 9000,
+			.rx_at_bytes = 12000,
+			.tx_packets = 300,
+			.rx_packets = 900,
+		};
+	}
+	status->threads_count = ARRAY_SIZE(status->threads);
+	for (size_t i = 0; i < ARRAY_SIZE(status->threads); i++) {
+		snprintk(status->threads[i].name, sizeof(status->threads[i].name), "thread_%zu", i);
+		status->threads[i].cpu_permille = 100 - i;
+		status->threads[i].stack_used = 700 + i;
+		status->threads[i].stack_size = 2048;
+	}
+}
+
+ZTEST(hot_paths, test_pb_encode_status_update)
+{
+	const uint32_t iters = 1000;
+	struct bench_clock start;
+	size_t len = 0;
+
+	fill_status(&status_);
+	start = bench_now();
+	for (uint32_t i = 0; i < iters; i++) {
+		pb_ostream_t stream = pb_ostream_from_buffer(pb_buf_, sizeof(pb_buf_));
+
+		zassert_true(pb_encode(&stream, StatusUpdateRequest_fields, &status_),
+			     "encode failed: %s", PB_GET_ERROR(&stream));
+		len = stream.bytes_written;
+	}
+	bench_report("pb_encode_status_update", iters, bench_elapsed(start), len);
+}
+
+ZTEST(hot_paths, test_pb_decode_ota_response)
+{
+	static const char path[] = "/firmware/v1.2.3/zephyr.signed.bin";
+	const uint32_t iters = 5000;
+	OTAUpdateResponse rsp = { .do_update = true };
+	pb_ostream_t out = pb_ostream_from_buffer(pb_buf_, sizeof(pb_buf_));
+	struct bench_clock start;
+
+	strcpy(rsp.path, path);
+	zassert_true(pb_encode(&out, OTAUpdateResponse_fields, &rsp), "encode failed");
+
+	start = bench_now();
+	for (uint32_t i = 0; i < iters; i++) {
+		pb_istream_t in = pb_istream_from_buffer(pb_buf_, out.bytes_written);
+
+		memset(&rsp, 0, sizeof(rsp));
+		zassert_true(pb_decode(&in, OTAUpdateResponse_fields, &rsp), "decode failed");
+	}
+	bench_report("pb_decode_ota_response", iters, bench_elapsed(start), out.bytes_written);
+	zassert_true(rsp.do_update, "do_update lost");
+	zassert_equal(strcmp(rsp.path, path), 0, "path is %s", rsp.path);
+}
+
+ZTEST(hot_paths, test_find_len)
+{
+	/* The start of a +QIRD data response, after "+QIRD: ". */
+	static char rsp[] = "1460\r\n\x16\x03\x01";
+	const uint32_t iters = 20000;
+	struct bench_clock start = bench_now();
+
+	for (uint32_t i = 0; i < iters; i++) {
+		sink_ = find_len(rsp);
+	}
+	bench_report("find_len", iters, bench_elapsed(start), 0);
+	zassert_equal(sink_, 1460, "parsed %u", sink_);
+}
+
+ZTEST(hot_paths, test_modem_atoi)
+{
+	/* An argument of "+QIRD: <total>,<read>,<unread>". */
+	static const char arg[] = "123456";
+	const uint32_t iters = 20000;
+	struct bench_clock start = bench_now();
+
+	for (uint32_t i = 0; i < iters; i++) {
+		sink_ = modem_atoi(arg, 0, "unread_length", __func__);
+	}
+	bench_report("modem_atoi", iters, bench_elapsed(start), 0);
+	zassert_equal(sink_, 123456, "parsed %u", sink_);
+}
+
+ZTEST(hot_paths, test_hash32)
+{
+	static char imei[] = "866425030000000";
+	const uint32_t iters = 20000;
+	uint32_t expected = hash32(imei, strlen(imei));
+	struct bench_clock start = bench_now();
+
+	for (uint32_t i = 0; i < iters; i++) {
+		sink_ = hash32(imei, sizeof(imei) - 1);
+	}
+	bench_report("hash32", iters, bench_elapsed(start), sizeof(imei) - 1);
+	zassert_equal(sink_, expected, "hash changed");
+}
+
+/* The path of http_ota_response_cb(): body fragments of any length into a
+ * stream flash context over slot1. The first fragment follows the HTTP
+ * headers in the receive buffer, so it leaves the rest unaligned.
+ */
+ZTEST(hot_paths, test_ota_flash_write)
+{
+	const struct flash_area *area;
+	struct stream_flash_ctx ctx;
+	const uint32_t passes = 4;
+	struct bench_clock total = {0};
+	uint8_t check[16];
+
+	for (size_t i = 0; i < sizeof(image_); i++) {
+		image_[i] = (uint8_t)(i * 7);
+	}
+	zassert_equal(flash_area_open(FIXED_PARTITION_ID(slot1_partition), &area), 0,
+		      "no slot1_partition");
+	zassert_true(area->fa_size >= OTA_IMAGE_SIZE, "slot1 too small");
+
+	for (uint32_t pass = 0; pass < passes; pass++) {
+		struct bench_clock start, elapsed;
+		size_t written = 0;
+		size_t frag = 817;
+
+		/* The app erases the slot before the download starts. */
+		zassert_equal(flash_area_erase(area, 0, OTA_IMAGE_SIZE), 0, "erase failed");
+		zassert_equal(stream_flash_init(&ctx, flash_area_get_device(area), flash_buf_,
+						sizeof(flash_buf_), area->fa_off, area->fa_size,
+						NULL),
+			      0, "stream flash init failed");
+
+		start = bench_now();
+		while (written < OTA_IMAGE_SIZE) {
+			frag = MIN(frag, OTA_IMAGE_SIZE - written);
+			zassert_equal(stream_flash_buffered_write(&ctx, image_, frag,
+								  written + frag == OTA_IMAGE_SIZE),
+				      0, "write failed at %zu", written);
+			written += frag;
+			frag = sizeof(image_);
+		}
+		elapsed = bench_elapsed(start);
+		total.ns += elapsed.ns;
+		total.cycles += elapsed.cycles;
+	}
+	bench_report("ota_flash_write", passes, total, OTA_IMAGE_SIZE);
+
+	zassert_equal(flash_area_read(area, 817, check, sizeof(check)), 0, "read failed");
+	zassert_equal(memcmp(check, image_, sizeof(check)), 0, "second fragment corrupt");
+	flash_area_close(area);
+}
+
+ZTEST_SUITE(hot_paths, NULL, NULL, NULL, NULL, NULL);
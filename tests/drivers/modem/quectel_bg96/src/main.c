@@ -0,0 +1,118 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test quectel_bg96 driver on native_posix
+ *
+ * This suite runs the offloaded socket path of the modem driver against
+ * scripts/bg96_sim.py, and reports the throughput through it. The modem
+ * boots during init, so the simulator has to be attached from the start:
+ *
+ *   west build -b native_posix tests/drivers/modem/quectel_bg96
+ *   ./scripts/bg96_sim.py --echo-port 7777 --bandwidth 20000 \
+ *       --latency-ms 100 --run build/zephyr/zephyr.exe
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/ztest.h>
+
+#include <modem/quectel_bg96.h>
+
+/* The --echo-port of bg96_sim.py. */
+#define ECHO_PORT 7777
+#define CHUNK_SIZE 1024
+#define TOTAL_SIZE (16 * CHUNK_SIZE)
+
+static uint8_t tx_buf_[CHUNK_SIZE];
+static uint8_t rx_buf_[CHUNK_SIZE];
+
+static uint8_t pattern(size_t offset)
+{
+	return (uint8_t)(offset * 7 + offset / 251);
+}
+
+static uint32_t rate(size_t bytes, uint32_t ms)
+{
+	return ms ? (uint32_t)(bytes * 1000 / ms) : 0;
+}
+
+ZTEST(quectel_bg96, test_dns)
+{
+	struct zsock_addrinfo hints = {
+		.ai_family = AF_INET,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct zsock_addrinfo *res;
+	char addr[NET_IPV4_ADDR_LEN];
+
+	zassert_equal(getaddrinfo("localhost", "80", &hints, &res), 0, "lookup failed");
+	zassert_equal(res->ai_family, AF_INET, "expected IPv4");
+	net_addr_ntop(AF_INET, &net_sin(res->ai_addr)->sin_addr, addr, sizeof(addr));
+	zassert_equal(strcmp(addr, "127.0.0.1"), 0, "localhost is %s", addr);
+	zassert_equal(ntohs(net_sin(res->ai_addr)->sin_port), 80, "port not set");
+	freeaddrinfo(res);
+}
+
+ZTEST(quectel_bg96, test_echo_throughput)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(ECHO_PORT),
+	};
+	struct quectel_bg96_data_usage usage;
+	uint32_t start, tx_ms, rx_ms;
+	size_t sent = 0, received = 0;
+	int sock;
+
+	net_addr_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	zassert_true(sock >= 0, "socket failed: %d", errno);
+
+	start = k_uptime_get_32();
+	zassert_equal(connect(sock, (struct sockaddr *)&addr, sizeof(addr)), 0,
+		      "connect failed: %d", errno);
+	TC_PRINT("connect: %u ms\n", k_uptime_get_32() - start);
+
+	/* Upload everything first; the simulator holds the echo until it is read. */
+	start = k_uptime_get_32();
+	while (sent < TOTAL_SIZE) {
+		ssize_t ret;
+
+		for (size_t i = 0; i < sizeof(tx_buf_); i++) {
+			tx_buf_[i] = pattern(sent + i);
+		}
+		ret = send(sock, tx_buf_, MIN(sizeof(tx_buf_), TOTAL_SIZE - sent), 0);
+		zassert_true(ret > 0, "send failed: %d", errno);
+		sent += ret;
+	}
+	tx_ms = k_uptime_get_32() - start;
+
+	start = k_uptime_get_32();
+	while (received < TOTAL_SIZE) {
+		ssize_t ret = recv(sock, rx_buf_, sizeof(rx_buf_), 0);
+
+		zassert_true(ret > 0, "recv failed at %zu: %d", received, errno);
+		for (ssize_t i = 0; i < ret; i++) {
+			zassert_equal(rx_buf_[i], pattern(received + i), "corrupt at %zu",
+				      received + i);
+		}
+		received += ret;
+	}
+	rx_ms = k_uptime_get_32() - start;
+
+	zassert_equal(quectel_bg96_socket_usage(sock, &usage), 0, "no usage for socket");
+	TC_PRINT("tx: %u B in %u ms, %u B/s; %u packets, %u AT bytes\n", TOTAL_SIZE, tx_ms,
+		 rate(TOTAL_SIZE, tx_ms), usage.tx_packets, usage.tx_at_bytes);
+	TC_PRINT("rx: %u B in %u ms, %u B/s; %u packets, %u AT bytes\n", TOTAL_SIZE, rx_ms,
+		 rate(TOTAL_SIZE, rx_ms), usage.rx_packets, usage.rx_at_bytes);
+	zassert_equal(usage.tx_bytes, TOTAL_SIZE, "tx accounting");
+	zassert_equal(usage.rx_bytes, TOTAL_SIZE, "rx accounting");
+
+	zassert_equal(close(sock), 0, "close failed");
+}
+
+ZTEST_SUITE(quectel_bg96, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,136 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test examplesensor edge triggered sampling
+ *
+ * This suite drives the sensor input through the GPIO emulator and checks
+ * that every edge lands in the FIFO in order, that edges share one trigger
+ * call, and that an overflow is counted.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/ztest.h>
+
+#include <sensor/examplesensor.h>
+
+#define FIFO_SIZE CONFIG_EXAMPLESENSOR_FIFO_SIZE
+
+static const struct device *const dev = DEVICE_DT_GET(DT_NODELABEL(examplesensor));
+static const struct gpio_dt_spec input =
+	GPIO_DT_SPEC_GET(DT_NODELABEL(examplesensor), input_gpios);
+
+static struct examplesensor_sample samples[FIFO_SIZE];
+static int trigger_calls;
+
+static void set_input(int value)
+{
+	zassert_ok(gpio_emul_input_set(input.port, input.pin, value), "input not set");
+}
+
+static void on_data_ready(const struct device *sensor, const struct sensor_trigger *trig)
+{
+	trigger_calls++;
+}
+
+ZTEST(examplesensor, test_edges_in_order)
+{
+	uint32_t dropped;
+	size_t count;
+
+	for (int i = 0; i < 3; i++) {
+		set_input(1);
+		set_input(0);
+	}
+
+	count = examplesensor_fifo_read(dev, samples, ARRAY_SIZE(samples), &dropped);
+	zassert_equal(count, 6, "expected 6 samples, got %zu", count);
+	zassert_equal(dropped, 0, "nothing should be dropped");
+	for (int i = 0; i < 6; i++) {
+		zassert_equal(samples[i].state, (i % 2 == 0) ? 1 : 0, "wrong state");
+	}
+	for (int i = 1; i < 6; i++) {
+		zassert_true(samples[i].uptime_ticks >= samples[i - 1].uptime_ticks,
+			     "timestamps out of order");
+	}
+}
+
+ZTEST(examplesensor, test_batch_read)
+{
+	size_t count;
+
+	for (int i = 0; i < 2; i++) {
+		set_input(1);
+		set_input(0);
+	}
+
+	count = examplesensor_fifo_read(dev, samples, 3, NULL);
+	zassert_equal(count, 3, "read should stop at max");
+	count = examplesensor_fifo_read(dev, samples, ARRAY_SIZE(samples), NULL);
+	zassert_equal(count, 1, "the rest should be left");
+	zassert_equal(samples[0].state, 0, "wrong state of the last edge");
+}
+
+ZTEST(examplesensor, test_overflow)
+{
+	uint32_t dropped;
+	size_t count;
+
+	for (int i = 0; i < FIFO_SIZE + 5; i++) {
+		set_input((i + 1) % 2);
+	}
+
+	count = examplesensor_fifo_read(dev, samples, ARRAY_SIZE(samples), &dropped);
+	zassert_equal(count, FIFO_SIZE, "FIFO should be full");
+	zassert_equal(dropped, 5, "newest edges should be dropped");
+	zassert_equal(samples[0].state, 1, "oldest kept sample is wrong");
+
+	examplesensor_fifo_read(dev, samples, ARRAY_SIZE(samples), &dropped);
+	zassert_equal(dropped, 0, "drop count should reset on read");
+}
+
+ZTEST(examplesensor, test_trigger_coalesces)
+{
+	static const struct sensor_trigger trig = {
+		.type = SENSOR_TRIG_DATA_READY,
+		.chan = SENSOR_CHAN_PROX,
+	};
+	size_t count;
+
+	zassert_ok(sensor_trigger_set(dev, &trig, on_data_ready), "trigger not set");
+
+	/* The work queue cannot run in between, so all edges share one call. */
+	k_sched_lock();
+	for (int i = 0; i < 4; i++) {
+		set_input((i + 1) % 2);
+	}
+	k_sched_unlock();
+	k_msleep(10);
+
+	zassert_equal(trigger_calls, 1, "expected one trigger call, got %d", trigger_calls);
+	count = examplesensor_fifo_read(dev, samples, ARRAY_SIZE(samples), NULL);
+	zassert_equal(count, 4, "expected 4 samples, got %zu", count);
+
+	zassert_ok(sensor_trigger_set(dev, &trig, NULL), "trigger not cleared");
+}
+
+static void before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	set_input(0);
+	examplesensor_fifo_read(dev, samples, ARRAY_SIZE(samples), NULL);
+	trigger_calls = 0;
+}
+
+static void *setup(void)
+{
+	zassert_true(device_is_ready(dev), "sensor not ready");
+	return NULL;
+}
+
+ZTEST_SUITE(examplesensor, NULL, setup, before, NULL, NULL);
@@ -0,0 +1,237 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test adcmon library
+ *
+ * This suite feeds two channels of the ADC emulator with constant and
+ * alternating inputs, and checks the windows that come out of the
+ * decimation filter, the window callback and the load accounting.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/adc.h>
+#include <zephyr/drivers/adc/adc_emul.h>
+#include <zephyr/ztest.h>
+
+#include <adcmon/adcmon.h>
+
+#define CHANNELS 2
+/* Quantization of the 12-bit emulator with a 2.5 V reference. */
+#define TOLERANCE_MV 2
+/* Scans in one window. */
+#define WINDOW_SCANS (CONFIG_ADCMON_WINDOW * CONFIG_ADCMON_DECIMATION)
+
+#define DT_SPEC_AND_COMMA(node_id, prop, idx) ADC_DT_SPEC_GET_BY_IDX(node_id, idx),
+
+static const struct adc_dt_spec channels[CHANNELS] = {
+	DT_FOREACH_PROP_ELEM(DT_PATH(zephyr_user), io_channels, DT_SPEC_AND_COMMA)
+};
+
+/* Conversions of each channel so far, and the levels they alternate between. */
+struct input {
+	uint32_t conversions;
+	uint32_t low_mv;
+	uint32_t high_mv;
+	/* Conversions per level. */
+	uint32_t period;
+};
+
+static struct input inputs[CHANNELS];
+
+static uint32_t windows[CHANNELS];
+static uint32_t last_seq[CHANNELS];
+static bool seq_gap;
+
+static int input_value(const struct device *dev, unsigned int chan, void *data,
+		       uint32_t *result)
+{
+	struct input *input = data;
+
+	*result = (input->conversions++ / input->period) % 2 ? input->low_mv : input->high_mv;
+	return 0;
+}
+
+static void set_input(int chan, uint32_t high_mv, uint32_t low_mv, uint32_t period)
+{
+	inputs[chan] = (struct input){
+		.low_mv = low_mv,
+		.high_mv = high_mv,
+		.period = period,
+	};
+	zassert_ok(adc_emul_value_func_set(channels[chan].dev, channels[chan].channel_id,
+					   input_value, &inputs[chan]), "input not set");
+}
+
+static void on_window(size_t channel, const struct adcmon_window *window, void *user_data)
+{
+	if (window->seq != last_seq[channel] + 1) {
+		seq_gap = true;
+	}
+	last_seq[channel] = window->seq;
+	windows[channel]++;
+}
+
+/* Wait for a window of each channel from past the first @p seq. */
+static void wait_windows(uint32_t seq, struct adcmon_window *out)
+{
+	for (int i = 0; i < CHANNELS; i++) {
+		int64_t deadline = k_uptime_get() + 10 * seq * WINDOW_SCANS;
+
+		do {
+			k_msleep(WINDOW_SCANS / 4);
+			zassert_true(k_uptime_get() < deadline, "no window %u on channel %d", seq, i);
+		} while (adcmon_window_get(i, &out[i]) != 0 || out[i].seq < seq);
+	}
+}
+
+ZTEST(adcmon, test_constant)
+{
+	static const int32_t mv[CHANNELS] = { 1200, 600 };
+	struct adcmon_window window[CHANNELS];
+
+	for (int i = 0; i < CHANNELS; i++) {
+		set_input(i, mv[i], mv[i], 1);
+	}
+	zassert_ok(adcmon_start(channels, CHANNELS, NULL, NULL), "start failed");
+
+	/* The filter starts from the first input, so even the first window
+	 * is flat.
+	 */
+	wait_windows(1, window);
+	for (int i = 0; i < CHANNELS; i++) {
+		zassert_within(window[i].min_mv, mv[i], TOLERANCE_MV, "ch%d min %d", i,
+			       window[i].min_mv);
+		zassert_within(window[i].max_mv, mv[i], TOLERANCE_MV, "ch%d max %d", i,
+			       window[i].max_mv);
+		zassert_within(window[i].mean_mv, mv[i], TOLERANCE_MV, "ch%d mean %d", i,
+			       window[i].mean_mv);
+		zassert_within(window[i].rms_mv, mv[i], TOLERANCE_MV, "ch%d rms %d", i,
+			       window[i].rms_mv);
+	}
+}
+
+ZTEST(adcmon, test_nyquist_rejected)
+{
+	struct adcmon_window window[CHANNELS];
+
+	/* Every other conversion; the filter has a null at this frequency,
+	 * so nothing of it is left after decimation.
+	 */
+	set_input(0, 2000, 1000, 1);
+	set_input(1, 800, 400, 1);
+	zassert_ok(adcmon_start(channels, CHANNELS, NULL, NULL), "start failed");
+
+	/* Past the first window, which starts from a primed filter. */
+	wait_windows(2, window);
+	zassert_within(window[0].min_mv, 1500, TOLERANCE_MV, "min %d", window[0].min_mv);
+	zassert_within(window[0].max_mv, 1500, TOLERANCE_MV, "max %d", window[0].max_mv);
+	zassert_within(window[1].min_mv, 600, TOLERANCE_MV, "min %d", window[1].min_mv);
+	zassert_within(window[1].max_mv, 600, TOLERANCE_MV, "max %d", window[1].max_mv);
+}
+
+ZTEST(adcmon, test_square_wave)
+{
+	struct adcmon_window window[CHANNELS];
+
+	/* A level per window; with the filter delay every window sees an
+	 * edge, and the RMS is above the mean.
+	 */
+	set_input(0, 2000, 1000, WINDOW_SCANS);
+	set_input(1, 2000, 1000, WINDOW_SCANS);
+	zassert_ok(adcmon_start(channels, CHANNELS, NULL, NULL), "start failed");
+
+	wait_windows(3, window);
+	for (int i = 0; i < CHANNELS; i++) {
+		zassert_true(window[i].max_mv - window[i].min_mv > 500, "ch%d range %d..%d", i,
+			     window[i].min_mv, window[i].max_mv);
+		zassert_true(window[i].min_mv >= 1000 - TOLERANCE_MV, "ch%d min %d", i,
+			     window[i].min_mv);
+		zassert_true(window[i].max_mv <= 2000 + TOLERANCE_MV, "ch%d max %d", i,
+			     window[i].max_mv);
+		zassert_true(window[i].rms_mv >= window[i].mean_mv, "ch%d rms %d mean %d", i,
+			     window[i].rms_mv, window[i].mean_mv);
+	}
+}
+
+ZTEST(adcmon, test_window_callback)
+{
+	struct adcmon_window window[CHANNELS];
+
+	zassert_ok(adcmon_start(channels, CHANNELS, on_window, NULL), "start failed");
+	wait_windows(5, window);
+	zassert_ok(adcmon_stop(), "stop failed");
+
+	for (int i = 0; i < CHANNELS; i++) {
+		zassert_true(windows[i] >= 5, "ch%d: %u windows", i, windows[i]);
+		zassert_equal(last_seq[i], windows[i], "ch%d: callbacks missed", i);
+	}
+	zassert_false(seq_gap, "windows out of order");
+}
+
+ZTEST(adcmon, test_load)
+{
+	struct adcmon_window window[CHANNELS];
+	struct adcmon_load load;
+
+	zassert_ok(adcmon_start(channels, CHANNELS, NULL, NULL), "start failed");
+	wait_windows(4, window);
+	zassert_ok(adcmon_stop(), "stop failed");
+
+	adcmon_load_get(&load);
+	zassert_true(load.blocks >= 2, "%u blocks", load.blocks);
+	zassert_equal(load.samples, (uint64_t)load.blocks * CONFIG_ADCMON_BLOCK * CHANNELS,
+		      "samples not counted per block");
+	zassert_equal(load.overruns, 0, "%u overruns", load.overruns);
+
+	/* There is no cycle counter that runs with the code on native_posix,
+	 * so this is only meaningful on hardware and in QEMU.
+	 */
+	TC_PRINT("%u blocks, %u cycles and %u us per 1000 samples, load %u ppm\n", load.blocks,
+		 load.cycles_per_ksample, load.us_per_ksample, load.load_ppm);
+}
+
+ZTEST(adcmon, test_start_errors)
+{
+	struct adcmon_window window;
+
+	zassert_equal(adcmon_start(channels, 0, NULL, NULL), -EINVAL, "no channels");
+	zassert_equal(adcmon_start(channels, CONFIG_ADCMON_MAX_CHANNELS + 1, NULL, NULL),
+		      -EINVAL, "too many channels");
+	zassert_equal(adcmon_stop(), -EALREADY, "stop while stopped");
+
+	zassert_ok(adcmon_start(channels, CHANNELS, NULL, NULL), "start failed");
+	zassert_equal(adcmon_start(channels, CHANNELS, NULL, NULL), -EALREADY,
+		      "start while running");
+	zassert_equal(adcmon_window_get(CHANNELS, &window), -EINVAL, "unknown channel");
+}
+
+static void before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	for (int i = 0; i < CHANNELS; i++) {
+		set_input(i, 1000, 1000, 1);
+		windows[i] = 0;
+		last_seq[i] = 0;
+	}
+	seq_gap = false;
+}
+
+static void after(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	adcmon_stop();
+}
+
+static void *setup(void)
+{
+	for (int i = 0; i < CHANNELS; i++) {
+		zassert_true(device_is_ready(channels[i].dev), "ADC not ready");
+	}
+	return NULL;
+}
+
+ZTEST_SUITE(adcmon, NULL, setup, before, after, NULL);
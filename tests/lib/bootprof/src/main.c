@@ -0,0 +1,58 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test bootprof library
+ *
+ * This suite verifies that the init levels and milestones of the current
+ * boot are recorded in order, up to the configured number of marks.
+ */
+
+#include <string.h>
+
+#include <zephyr/ztest.h>
+
+#include <bootprof/bootprof.h>
+
+static const char *const levels[] = {
+	"pre_kernel1", "pre_kernel2", "post_kernel", "application",
+};
+
+ZTEST(bootprof, test_marks)
+{
+	const struct bootprof_mark *marks;
+	bool complete;
+	size_t count;
+
+	/* The init levels were marked before the test started. */
+	count = bootprof_get(false, &marks, &complete);
+	zassert_equal(count, ARRAY_SIZE(levels), "expected one mark per init level");
+	zassert_false(complete, "boot should not be complete yet");
+	for (size_t i = 0; i < count; i++) {
+		zassert_equal(strcmp(marks[i].name, levels[i]), 0, "mark %zu is %s", i,
+			      marks[i].name);
+		if (i > 0) {
+			zassert_true(marks[i].us >= marks[i - 1].us, "marks out of order");
+		}
+	}
+
+	bootprof_mark("a_name_that_is_too_long");
+	count = bootprof_get(false, &marks, NULL);
+	zassert_equal(strcmp(marks[count - 1].name, "a_name_that"), 0, "name not truncated");
+
+	/* Leave room for "done" only. */
+	while (count < CONFIG_BOOTPROF_MARKS - 1) {
+		bootprof_mark("fill");
+		count++;
+	}
+	bootprof_done();
+	bootprof_mark("late");
+
+	count = bootprof_get(false, &marks, &complete);
+	zassert_equal(count, CONFIG_BOOTPROF_MARKS, "expected a full record");
+	zassert_true(complete, "boot should be complete");
+	zassert_equal(strcmp(marks[count - 1].name, "done"), 0, "last mark should be done");
+}
+
+ZTEST_SUITE(bootprof, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,115 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test evtrace library
+ *
+ * This suite verifies that events are read back from the evtrace ring in
+ * order, that overwritten and cleared events are accounted for, and that
+ * entries being written are not read.
+ */
+
+#include <zephyr/ztest.h>
+
+#include <evtrace/evtrace.h>
+
+#define RING_SIZE CONFIG_EVTRACE_ENTRIES
+
+static struct evtrace_entry entries[RING_SIZE];
+
+ZTEST(evtrace, test_record_order)
+{
+	uint32_t dropped;
+	size_t count;
+
+	for (int i = 0; i < 3; i++) {
+		evtrace_record(EVTRACE_USER, i, 100 + i);
+	}
+
+	count = evtrace_copy(entries, ARRAY_SIZE(entries), &dropped);
+	zassert_equal(count, 3, "expected 3 events, got %zu", count);
+	zassert_equal(dropped, 0, "nothing should be dropped");
+	for (int i = 0; i < 3; i++) {
+		zassert_equal(entries[i].id, EVTRACE_USER, "wrong id");
+		zassert_equal(entries[i].arg0, i, "events out of order");
+		zassert_equal(entries[i].arg1, 100 + i, "wrong arg1");
+		zassert_equal(entries[i].thread, (uint32_t)(uintptr_t)k_current_get(),
+			      "wrong thread");
+	}
+	zassert_true(entries[2].cycles - entries[0].cycles < UINT32_MAX / 2,
+		     "timestamps out of order");
+}
+
+ZTEST(evtrace, test_wrap)
+{
+	uint32_t dropped;
+	size_t count;
+
+	for (int i = 0; i < RING_SIZE + 5; i++) {
+		evtrace_record(EVTRACE_USER, i, 0);
+	}
+
+	count = evtrace_copy(entries, ARRAY_SIZE(entries), &dropped);
+	zassert_equal(count, RING_SIZE, "ring should be full");
+	zassert_equal(dropped, 5, "oldest events should be dropped");
+	zassert_equal(entries[0].arg0, 5, "oldest kept event is wrong");
+	zassert_equal(entries[RING_SIZE - 1].arg0, RING_SIZE + 4, "newest event is wrong");
+}
+
+ZTEST(evtrace, test_clear_and_disable)
+{
+	evtrace_record(EVTRACE_USER, 1, 0);
+	evtrace_clear();
+	zassert_equal(evtrace_copy(entries, ARRAY_SIZE(entries), NULL), 0,
+		      "clear should discard events");
+
+	evtrace_enable(false);
+	evtrace_record(EVTRACE_USER, 2, 0);
+	evtrace_enable(true);
+	zassert_equal(evtrace_copy(entries, ARRAY_SIZE(entries), NULL), 0,
+		      "events should not be recorded while disabled");
+}
+
+ZTEST(evtrace, test_torn_entry)
+{
+	uint8_t done = evtrace_seq_done(3);
+	uint8_t busy_next_lap = evtrace_seq_done(3 + RING_SIZE) | 1;
+
+	zassert_true(evtrace_seq_valid(3, done, done), "written entry rejected");
+	zassert_false(evtrace_seq_valid(3, busy_next_lap, busy_next_lap),
+		      "entry being overwritten by the next lap accepted");
+	zassert_false(evtrace_seq_valid(3, done, busy_next_lap),
+		      "entry overwritten during the copy accepted");
+	zassert_false(evtrace_seq_valid(3 + RING_SIZE, done, done),
+		      "entry of the last lap accepted");
+	/* The seq of a lap wraps; a busy entry must never look done. */
+	for (uint32_t lap = 0; lap < 512; lap++) {
+		uint32_t idx = lap * RING_SIZE;
+
+		zassert_false(evtrace_seq_valid(idx, evtrace_seq_done(idx) | 1,
+						evtrace_seq_done(idx) | 1),
+			      "busy entry accepted at lap %u", lap);
+		zassert_false(evtrace_seq_valid(idx - RING_SIZE, evtrace_seq_done(idx) | 1,
+						evtrace_seq_done(idx) | 1),
+			      "busy entry accepted for the previous lap %u", lap);
+	}
+}
+
+ZTEST(evtrace, test_tag)
+{
+	zassert_equal(evtrace_tag("AT+QISEND=0,12"), 'Q' | 'I' << 8 | 'S' << 16 | 'E' << 24,
+		      "AT+ prefix should be skipped");
+	zassert_equal(evtrace_tag("+QIURC"), 'Q' | 'I' << 8 | 'U' << 16 | 'R' << 24,
+		      "+ prefix should be skipped");
+	zassert_equal(evtrace_tag("OK"), 'O' | 'K' << 8, "short tags are zero padded");
+	zassert_equal(evtrace_tag(NULL), 0, "NULL should give 0");
+}
+
+static void evtrace_before(void *fixture)
+{
+	evtrace_enable(true);
+	evtrace_clear();
+}
+
+ZTEST_SUITE(evtrace, NULL, NULL, evtrace_before, NULL, NULL);
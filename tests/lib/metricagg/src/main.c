@@ -0,0 +1,416 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file test metricagg library
+ *
+ * This suite feeds samples with explicit timestamps and checks the window
+ * summaries, the threshold and rate rules, the report queues, and how much
+ * uplink traffic aggregation saves over reporting every sample.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <pb_encode.h>
+#include "api/api.pb.h"
+
+#include <metricagg/metricagg.h>
+
+/* Each test starts this much later than the previous one, so the times of
+ * the samples never go backwards and windows left open are ended.
+ */
+#define TEST_SPACING_MS (1000LL * 1000 * 1000)
+
+static int64_t base_ms;
+static uint32_t notified;
+
+static struct metricagg_summary summaries[CONFIG_METRICAGG_QUEUE];
+static struct metricagg_event events[CONFIG_METRICAGG_QUEUE];
+
+static void on_notify(void)
+{
+	notified++;
+}
+
+static void add(uint8_t metric, int32_t value, int64_t ms)
+{
+	metricagg_add_at(metric, value, base_ms + ms);
+}
+
+static size_t get_summaries(void)
+{
+	struct metricagg_cursor cursor = { 0 };
+
+	return metricagg_summaries_get(summaries, ARRAY_SIZE(summaries), &cursor);
+}
+
+static size_t get_events(void)
+{
+	struct metricagg_cursor cursor = { 0 };
+
+	return metricagg_events_get(events, ARRAY_SIZE(events), &cursor);
+}
+
+ZTEST(metricagg, test_window_summary)
+{
+	zassert_ok(metricagg_configure(0, 100 * MSEC_PER_SEC, NULL, 0), "configure failed");
+
+	/* 1 to 100, out of order. */
+	for (int i = 0; i < 100; i++) {
+		add(0, (i * 37) % 100 + 1, i * MSEC_PER_SEC);
+	}
+	zassert_equal(get_summaries(), 0, "window ended early");
+	zassert_equal(notified, 0, "notified for a sample");
+
+	metricagg_flush(base_ms + 100 * MSEC_PER_SEC);
+	zassert_equal(get_summaries(), 1, "window not ended");
+	zassert_equal(summaries[0].metric, 0, "metric %u", summaries[0].metric);
+	zassert_equal(summaries[0].end_ms, base_ms + 100 * MSEC_PER_SEC, "end %lld",
+		      summaries[0].end_ms - base_ms);
+	zassert_equal(summaries[0].duration_ms, 100 * MSEC_PER_SEC, "duration %u",
+		      summaries[0].duration_ms);
+	zassert_equal(summaries[0].count, 100, "count %u", summaries[0].count);
+	zassert_equal(summaries[0].min, 1, "min %d", summaries[0].min);
+	zassert_equal(summaries[0].max, 100, "max %d", summaries[0].max);
+	zassert_equal(summaries[0].mean, 50, "mean %d", summaries[0].mean);
+	/* Exactly 28.87. */
+	zassert_within(summaries[0].stddev, 29, 1, "stddev %u", summaries[0].stddev);
+	/* Estimates, so within a few ranks. */
+	zassert_within(summaries[0].p50, 50, 3, "p50 %d", summaries[0].p50);
+	zassert_within(summaries[0].p90, 90, 3, "p90 %d", summaries[0].p90);
+	zassert_within(summaries[0].p99, 99, 3, "p99 %d", summaries[0].p99);
+}
+
+ZTEST(metricagg, test_window_boundaries)
+{
+	zassert_ok(metricagg_configure(0, 10 * MSEC_PER_SEC, NULL, 0), "configure failed");
+
+	add(1, 5, 0);
+	add(1, 7, 9999);
+	zassert_equal(get_summaries(), 0, "window ended early");
+
+	/* Ends the window, and opens the next one. */
+	add(1, -3, 10000);
+	zassert_equal(notified, 1, "%u notifications", notified);
+	zassert_equal(get_summaries(), 1, "window not ended");
+	zassert_equal(summaries[0].count, 2, "count %u", summaries[0].count);
+	zassert_equal(summaries[0].mean, 6, "mean %d", summaries[0].mean);
+	zassert_equal(summaries[0].stddev, 1, "stddev %u", summaries[0].stddev);
+	zassert_equal(summaries[0].p50, 5, "p50 %d", summaries[0].p50);
+	zassert_equal(summaries[0].p99, 7, "p99 %d", summaries[0].p99);
+
+	/* A window starts with its first sample, not where the last ended. */
+	add(1, -5, 25000);
+	zassert_equal(get_summaries(), 2, "second window not ended");
+	zassert_equal(summaries[1].end_ms, base_ms + 20000, "end %lld",
+		      summaries[1].end_ms - base_ms);
+	zassert_equal(summaries[1].min, -3, "min %d", summaries[1].min);
+	metricagg_flush(base_ms + 34999);
+	zassert_equal(get_summaries(), 2, "third window ended early");
+	metricagg_flush(base_ms + 35000);
+	zassert_equal(get_summaries(), 3, "third window not ended");
+	zassert_equal(summaries[2].end_ms, base_ms + 35000, "end %lld",
+		      summaries[2].end_ms - base_ms);
+	zassert_equal(notified, 2, "flush notified");
+}
+
+ZTEST(metricagg, test_threshold_rules)
+{
+	static const struct metricagg_rule rules[] = {
+		{ .metric = 0, .type = METRICAGG_RULE_ABOVE, .threshold = 200, .hysteresis = 10 },
+		{ .metric = 0, .type = METRICAGG_RULE_BELOW, .threshold = -50, .hysteresis = 0 },
+	};
+
+	zassert_ok(metricagg_configure(1, 0, rules, ARRAY_SIZE(rules)), "configure failed");
+
+	add(0, 100, 0);
+	add(0, 200, 1000);
+	zassert_equal(get_events(), 0, "event at the threshold");
+	add(0, 201, 2000);
+	add(0, 300, 3000);
+	/* Back under the threshold, but not by the hysteresis. */
+	add(0, 191, 4000);
+	zassert_equal(get_events(), 1, "event missing or repeated");
+	add(0, 190, 5000);
+	add(0, -51, 6000);
+	add(0, -50, 7000);
+
+	zassert_equal(get_events(), 4, "%zu events", get_events());
+	zassert_equal(notified, 4, "%u notifications", notified);
+
+	zassert_equal(events[0].rule, 0, "rule %u", events[0].rule);
+	zassert_false(events[0].cleared, "first event cleared");
+	zassert_equal(events[0].value, 201, "value %d", events[0].value);
+	zassert_equal(events[0].uptime_ms, base_ms + 2000, "time %lld",
+		      events[0].uptime_ms - base_ms);
+
+	zassert_equal(events[1].rule, 0, "rule %u", events[1].rule);
+	zassert_true(events[1].cleared, "not cleared");
+	zassert_equal(events[1].value, 190, "value %d", events[1].value);
+
+	zassert_equal(events[2].rule, 1, "rule %u", events[2].rule);
+	zassert_false(events[2].cleared, "below cleared");
+	zassert_equal(events[3].rule, 1, "rule %u", events[3].rule);
+	zassert_true(events[3].cleared, "below not cleared");
+	zassert_equal(metricagg_config_id(), 1, "config id %u", metricagg_config_id());
+}
+
+ZTEST(metricagg, test_rate_rule)
+{
+	static const struct metricagg_rule rules[] = {
+		{ .metric = 2, .type = METRICAGG_RULE_RATE, .threshold = 50, .hysteresis = 20 },
+	};
+
+	zassert_ok(metricagg_configure(2, 0, rules, ARRAY_SIZE(rules)), "configure failed");
+
+	add(2, 0, 0);
+	add(2, 40, 1000);
+	/* 100 per second, down. */
+	add(2, -10, 1500);
+	add(2, -50, 2500);
+	zassert_equal(get_events(), 1, "%zu events", get_events());
+	zassert_false(events[0].cleared, "cleared");
+	zassert_equal(events[0].value, -100, "rate %d", events[0].value);
+
+	add(2, -15, 3500);
+	zassert_equal(get_events(), 1, "cleared above the hysteresis");
+	add(2, 5, 4500);
+	zassert_equal(get_events(), 2, "not cleared");
+	zassert_true(events[1].cleared, "not cleared");
+	zassert_equal(events[1].value, 20, "rate %d", events[1].value);
+}
+
+ZTEST(metricagg, test_queue)
+{
+	struct metricagg_cursor cursor = { 0 };
+	size_t count;
+
+	zassert_ok(metricagg_configure(0, MSEC_PER_SEC, NULL, 0), "configure failed");
+
+	/* Two more windows than fit in the queue. */
+	for (int i = 0; i <= CONFIG_METRICAGG_QUEUE + 2; i++) {
+		add(3, i, i * MSEC_PER_SEC);
+	}
+	count = metricagg_summaries_get(summaries, 3, &cursor);
+	zassert_equal(count, 3, "%zu summaries", count);
+	zassert_equal(summaries[0].min, 2, "oldest not dropped: %d", summaries[0].min);
+
+	/* Until acknowledged, the same ones come back. */
+	zassert_equal(get_summaries(), CONFIG_METRICAGG_QUEUE, "%zu queued", get_summaries());
+	zassert_equal(summaries[0].min, 2, "not kept: %d", summaries[0].min);
+
+	metricagg_ack(&cursor);
+	zassert_equal(get_summaries(), CONFIG_METRICAGG_QUEUE - 3, "%zu left", get_summaries());
+	zassert_equal(summaries[0].min, 5, "wrong ones acked: %d", summaries[0].min);
+
+	/* Acknowledging again, or an older report, changes nothing. */
+	metricagg_ack(&cursor);
+	zassert_equal(get_summaries(), CONFIG_METRICAGG_QUEUE - 3, "acked twice");
+}
+
+ZTEST(metricagg, test_configure_errors)
+{
+	struct metricagg_rule rules[CONFIG_METRICAGG_RULES + 1] = { 0 };
+	struct metricagg_rule rule = { .metric = 0, .type = METRICAGG_RULE_ABOVE };
+
+	zassert_ok(metricagg_configure(7, 0, &rule, 1), "configure failed");
+
+	for (size_t i = 0; i < ARRAY_SIZE(rules); i++) {
+		rules[i] = rule;
+	}
+	zassert_equal(metricagg_configure(8, 0, rules, ARRAY_SIZE(rules)), -EINVAL,
+		      "too many rules");
+
+	rule.metric = CONFIG_METRICAGG_METRICS;
+	zassert_equal(metricagg_configure(8, 0, &rule, 1), -EINVAL, "unknown metric");
+	rule.metric = 0;
+	rule.type = METRICAGG_RULE_NONE;
+	zassert_equal(metricagg_configure(8, 0, &rule, 1), -EINVAL, "no type");
+	rule.type = METRICAGG_RULE_RATE + 1;
+	zassert_equal(metricagg_configure(8, 0, &rule, 1), -EINVAL, "unknown type");
+
+	zassert_equal(metricagg_config_id(), 7, "changed by a rejected configuration");
+}
+
+ZTEST(metricagg, test_configure_drops_events)
+{
+	static const struct metricagg_rule rules[] = {
+		{ .metric = 0, .type = METRICAGG_RULE_ABOVE, .threshold = 10 },
+	};
+	struct metricagg_cursor cursor = { 0 };
+
+	zassert_ok(metricagg_configure(3, 0, rules, ARRAY_SIZE(rules)), "configure failed");
+	add(0, 20, 0);
+	zassert_equal(metricagg_events_get(events, ARRAY_SIZE(events), &cursor), 1,
+		      "event missing");
+
+	/* The event names rule 0, which is another rule after this. */
+	zassert_ok(metricagg_configure(4, 0, NULL, 0), "configure failed");
+	zassert_equal(get_events(), 0, "%zu events kept", get_events());
+
+	/* Acknowledging a report sent before changes nothing. */
+	metricagg_ack(&cursor);
+	zassert_ok(metricagg_configure(5, 0, rules, ARRAY_SIZE(rules)), "configure failed");
+	add(0, 30, 1000);
+	zassert_equal(get_events(), 1, "%zu events", get_events());
+	zassert_equal(events[0].value, 30, "value %d", events[0].value);
+}
+
+/* The report the app would send, with what is queued or with one sample. */
+static size_t report_summaries;
+static size_t report_events;
+static int32_t raw_sample;
+
+static bool encode_summaries(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	for (size_t i = 0; i < report_summaries; i++) {
+		const struct metricagg_summary *s = &summaries[i];
+		MetricSummary entry = {
+			.metric = s->metric,
+			.duration_ms = s->duration_ms,
+			.count = s->count,
+			.min = s->min,
+			.max = s->max,
+			.mean = s->mean,
+			.stddev = s->stddev,
+			.p50 = s->p50,
+			.p90 = s->p90,
+			.p99 = s->p99,
+		};
+
+		if (!pb_encode_tag_for_field(stream, field) ||
+		    !pb_encode_submessage(stream, MetricSummary_fields, &entry)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool encode_events(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	for (size_t i = 0; i < report_events; i++) {
+		MetricEvent entry = {
+			.metric = events[i].metric,
+			.rule = events[i].rule,
+			.cleared = events[i].cleared,
+			.value = events[i].value,
+		};
+
+		if (!pb_encode_tag_for_field(stream, field) ||
+		    !pb_encode_submessage(stream, MetricEvent_fields, &entry)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* A raw sample is sent as the least it takes: an event with its value. */
+static bool encode_sample(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+	MetricEvent entry = {
+		.value = raw_sample,
+	};
+
+	return pb_encode_tag_for_field(stream, field) &&
+	       pb_encode_submessage(stream, MetricEvent_fields, &entry);
+}
+
+static size_t report_size(bool raw)
+{
+	static StatusUpdateRequest request;
+	size_t size;
+
+	request = (StatusUpdateRequest)StatusUpdateRequest_init_zero;
+	strncpy(request.device_id, "12345", sizeof(request.device_id));
+	if (raw) {
+		request.events.funcs.encode = encode_sample;
+	} else {
+		request.summaries.funcs.encode = encode_summaries;
+		request.events.funcs.encode = encode_events;
+		request.metric_config_id = metricagg_config_id();
+	}
+	zassert_true(pb_get_encoded_size(&size, StatusUpdateRequest_fields, &request),
+		     "encoding failed");
+	return size;
+}
+
+ZTEST(metricagg, test_uplink_volume)
+{
+	static const struct metricagg_rule rules[] = {
+		{ .metric = 0, .type = METRICAGG_RULE_ABOVE, .threshold = 3000, .hysteresis = 100 },
+	};
+	const int hours = 1;
+	size_t raw_bytes = 0;
+	size_t raw_reports = 0;
+	size_t agg_bytes = 0;
+	size_t agg_reports = 0;
+
+	zassert_ok(metricagg_configure(0x5eed, 15 * 60 * MSEC_PER_SEC, rules, ARRAY_SIZE(rules)),
+		   "configure failed");
+
+	/* A supply voltage sampled every second for an hour, with one dip of
+	 * ten seconds over the threshold. Every notification is a report.
+	 */
+	for (int t = 0; t < hours * 3600; t++) {
+		int32_t mv = 2800 + (t * 7919) % 101;
+		uint32_t before = notified;
+
+		if (t >= 2000 && t < 2010) {
+			mv = 3300;
+		}
+		raw_sample = mv;
+		raw_bytes += report_size(true);
+		raw_reports++;
+
+		add(0, mv, t * MSEC_PER_SEC);
+		if (notified != before) {
+			struct metricagg_cursor cursor = { 0 };
+
+			report_summaries = metricagg_summaries_get(summaries, ARRAY_SIZE(summaries),
+								   &cursor);
+			report_events = metricagg_events_get(events, ARRAY_SIZE(events), &cursor);
+			agg_bytes += report_size(false);
+			agg_reports++;
+			metricagg_ack(&cursor);
+		}
+	}
+
+	TC_PRINT("%d h at 1 Hz: %zu reports, %zu bytes per sample; %zu reports, %zu bytes "
+		 "aggregated (%zu times fewer reports, %zu times fewer bytes)\n", hours,
+		 raw_reports, raw_bytes, agg_reports, agg_bytes, raw_reports / agg_reports,
+		 raw_bytes / agg_bytes);
+
+	/* Three windows ended within the hour, and the dip raised and
+	 * cleared; the last window goes with the next report.
+	 */
+	zassert_equal(agg_reports, 5, "%zu reports", agg_reports);
+	zassert_true(agg_bytes * 100 < raw_bytes, "saved too little: %zu of %zu bytes", agg_bytes,
+		     raw_bytes);
+}
+
+static void before(void *fixture)
+{
+	struct metricagg_cursor cursor = { 0 };
+
+	ARG_UNUSED(fixture);
+
+	/* End what the last test left open and empty the queues. */
+	base_ms += TEST_SPACING_MS;
+	metricagg_flush(base_ms);
+	while (metricagg_summaries_get(summaries, ARRAY_SIZE(summaries), &cursor) +
+	       metricagg_events_get(events, ARRAY_SIZE(events), &cursor) > 0) {
+		metricagg_ack(&cursor);
+	}
+	zassert_ok(metricagg_configure(0, 0, NULL, 0), "configure failed");
+	notified = 0;
+}
+
+static void *setup(void)
+{
+	metricagg_init(on_notify);
+	return NULL;
+}
+
+ZTEST_SUITE(metricagg, NULL, setup, before, NULL, NULL);